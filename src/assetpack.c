@@ -0,0 +1,205 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * assetpack builds the asset pack wonderbar maps at startup. PLY and
+ * OBJ models are processed with the flags of the mesh registry and
+ * stored in the layout of the mesh cache, images and other files are
+ * stored as they are. The assets are named after the paths given on
+ * the command line, which must be the names wonderbar loads them with.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <glib-object.h>
+#include <glib/gstdio.h>
+
+#include "es-asset-pack.h"
+#include "es-mesh-registry.h"
+#include "mash-ply-loader.h"
+#include "mash-obj-loader.h"
+#include "mash-mesh-cache.h"
+
+typedef struct
+{
+  const char *filename;
+
+  EsAssetType type;
+  GBytes *bytes;
+  GError *error;
+} Job;
+
+static gboolean compress = FALSE;
+static int n_jobs = 0;
+
+static GOptionEntry entries[] =
+{
+  { "compress", 'z', 0, G_OPTION_ARG_NONE, &compress,
+    "Compress the assets that are worth it", NULL },
+  { "jobs", 'j', 0, G_OPTION_ARG_INT, &n_jobs,
+    "Number of models processed at the same time", "N" },
+  { NULL }
+};
+
+static gboolean
+has_suffix (const char *filename, const char *suffix)
+{
+  char *lower = g_ascii_strdown (filename, -1);
+  gboolean ret = g_str_has_suffix (lower, suffix);
+
+  g_free (lower);
+
+  return ret;
+}
+
+static void
+process_model (Job *job, GType loader_type)
+{
+  MashDataLoader *loader = g_object_new (loader_type, NULL);
+  MashDataFlags flags = ES_MESH_REGISTRY_LOAD_FLAGS & ~MASH_DATA_CACHE;
+
+  if (mash_data_loader_load (loader, flags, job->filename, &job->error))
+    {
+      job->type = ES_ASSET_MESH;
+      job->bytes =
+        mash_mesh_cache_data_to_bytes (mash_data_loader_get_mesh (loader),
+                                       flags);
+    }
+
+  g_object_unref (loader);
+}
+
+static void
+run_job (gpointer data, gpointer user_data)
+{
+  Job *job = data;
+  char *contents;
+  gsize length;
+
+  if (has_suffix (job->filename, ".ply"))
+    process_model (job, MASH_TYPE_PLY_LOADER);
+  else if (has_suffix (job->filename, ".obj"))
+    process_model (job, MASH_TYPE_OBJ_LOADER);
+  else if (g_file_get_contents (job->filename, &contents, &length,
+                                &job->error))
+    {
+      if (has_suffix (job->filename, ".jpg") ||
+          has_suffix (job->filename, ".jpeg") ||
+          has_suffix (job->filename, ".png"))
+        job->type = ES_ASSET_TEXTURE;
+      else
+        job->type = ES_ASSET_DATA;
+
+      job->bytes = g_bytes_new_take (contents, length);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  static const char *type_names[] = { "data", "mesh", "texture" };
+  GOptionContext *option_context;
+  EsAssetPackWriter *writer;
+  GThreadPool *pool;
+  GError *error = NULL;
+  GStatBuf buf;
+  Job *jobs;
+  int n_failed = 0, i;
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+  g_type_init ();
+#endif
+
+  option_context = g_option_context_new ("PACK ASSET... - build an asset pack");
+  g_option_context_add_main_entries (option_context, entries, NULL);
+
+  if (!g_option_context_parse (option_context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_option_context_free (option_context);
+
+  if (argc < 3)
+    {
+      g_printerr ("Give the name of the pack and some assets\n");
+      return 1;
+    }
+
+  if (n_jobs <= 0)
+    n_jobs = MAX (sysconf (_SC_NPROCESSORS_ONLN), 1);
+
+  jobs = g_new0 (Job, argc - 2);
+  pool = g_thread_pool_new (run_job, NULL, n_jobs, TRUE, NULL);
+
+  for (i = 2; i < argc; i++)
+    {
+      jobs[i - 2].filename = argv[i];
+      g_thread_pool_push (pool, jobs + i - 2, NULL);
+    }
+
+  /* Wait for all the jobs */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  writer = es_asset_pack_writer_new ();
+
+  for (i = 0; i < argc - 2; i++)
+    {
+      Job *job = jobs + i;
+
+      if (job->error)
+        {
+          g_printerr ("%s: %s\n", job->filename, job->error->message);
+          g_error_free (job->error);
+          n_failed++;
+          continue;
+        }
+
+      g_print ("%s: %s, %" G_GSIZE_FORMAT " bytes\n", job->filename,
+               type_names[job->type], g_bytes_get_size (job->bytes));
+
+      es_asset_pack_writer_add (writer, job->filename, job->type,
+                                job->bytes, compress);
+      g_bytes_unref (job->bytes);
+    }
+
+  g_free (jobs);
+
+  /* Don't leave a pack missing some assets behind */
+  if (n_failed == 0)
+    {
+      if (!es_asset_pack_writer_save (writer, argv[1], &error))
+        {
+          g_printerr ("%s\n", error->message);
+          g_error_free (error);
+          n_failed++;
+        }
+      else if (g_stat (argv[1], &buf) == 0)
+        g_print ("%s: %" G_GINT64_FORMAT " bytes\n",
+                 argv[1], (gint64) buf.st_size);
+    }
+
+  es_asset_pack_writer_free (writer);
+
+  return n_failed ? 1 : 0;
+}
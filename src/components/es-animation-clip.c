@@ -17,89 +17,702 @@
  * License along with this library. If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * An animation clip is made of tracks, each one driving a property of
+ * an object with a list of keyframes. The times of the keys of all the
+ * tracks of a clip and the segments going from each key to the next
+ * are stored in two arrays, each track only recording where its keys
+ * start, so that a clip is a few contiguous blocks of memory however
+ * many tracks it has.
+ *
+ * Each track remembers the key it was last sampled at. Playing forward,
+ * the next sample is at the same key or the next one, so finding it
+ * doesn't depend on the number of keys. Other jumps in time fall back
+ * to a binary search.
+ *
+ * The tracks write the values straight into the animated objects, where
+ * their properties say the values are. The flags the properties need
+ * set once changed are merged per object when the tracks are added, so
+ * that animating the x, y and z of an entity marks it dirty only once
+ * per frame.
+ */
+
+#include <string.h>
+#include <math.h>
+
 #include "es-main.h"
 #include "es-animation-clip.h"
 
 typedef struct
 {
-  FloatSetter setter;
-  void *object;
-  float start, end;
-  float (*easing) (float progress);
-} FloatAnimationData;
+  EsPropertyType type;
+  AnimationInterpolation interpolation;
+
+  /* Where the value of the property is in the animated object */
+  void *value;
+
+  /* Index of the first key in key_times, and of its segment in
+     key_values */
+  int first_key;
+  int first_segment;
+  int n_keys;
+} AnimationTrack;
 
 typedef struct
 {
-  QuaternionSetter setter;
-  void *object;
-  CoglQuaternion start, end;
-  float (*easing) (float progress);
-} QuaternionAnimationData;
+  uint32_t *flags;
+  uint32_t dirty_flags;
+} AnimationDirtyFlags;
+
+/* Finds the last key at or before @time, starting from @cursor */
+static int
+find_key (const int64_t *times,
+          int            n_keys,
+          int            cursor,
+          int64_t        time)
+{
+  int low, high;
+
+  if (time <= times[0])
+    return 0;
+
+  /* Playing forward only ever moves to the next key or so */
+  if (times[cursor] <= time)
+    {
+      if (cursor + 1 >= n_keys || time < times[cursor + 1])
+        return cursor;
+      if (cursor + 2 >= n_keys || time < times[cursor + 2])
+        return cursor + 1;
+    }
+
+  low = 0;
+  high = n_keys - 1;
+
+  while (low < high)
+    {
+      int middle = (low + high + 1) / 2;
+
+      if (times[middle] <= time)
+        low = middle;
+      else
+        high = middle - 1;
+    }
+
+  return low;
+}
 
-static float
-easing_linear (float progress)
+/* Slopes of the spline going through the keys, per micro second. Scaled
+   by the duration of a segment they are the tangents of its Hermite
+   curve */
+static void
+compute_slopes (const int64_t *times,
+                const float   *values,
+                int            n_keys,
+                int            n_components,
+                float         *slopes)
 {
-  return progress;
+  int key, i;
+
+  for (key = 0; key < n_keys; key++)
+    {
+      int previous = MAX (key - 1, 0), next = MIN (key + 1, n_keys - 1);
+      /* A single key has no slope */
+      float interval = MAX (times[next] - times[previous], 1);
+
+      for (i = 0; i < n_components; i++)
+        slopes[key * n_components + i] =
+          (values[next * n_components + i] -
+           values[previous * n_components + i]) / interval;
+    }
 }
 
+/* Number of floats per key and component of the tracks evaluated as
+   curves */
+#define CURVE_SEGMENT_SIZE 4
+
+/* The segment going from each key to the next one, for each component,
+   as the coefficients of a cubic polynomial of the position in the
+   segment, highest degree first */
 static void
-es_animation_clip_update (Component *component,
-                          int64_t    time)
+compute_curve_segments (const int64_t          *times,
+                        const float            *values,
+                        int                     n_keys,
+                        int                     n_components,
+                        AnimationInterpolation  interpolation,
+                        float                  *segments)
 {
-  AnimationClip *clip = ES_ANIMATION_CLIP (component);
-  float progress;
+  float *slopes = NULL;
+  int key, i;
+
+  if (interpolation == ANIMATION_INTERPOLATION_CUBIC)
+    {
+      slopes = g_new (float, n_keys * n_components);
+      compute_slopes (times, values, n_keys, n_components, slopes);
+    }
+
+  for (key = 0; key < n_keys; key++)
+    {
+      /* The last key goes to itself */
+      int next = MIN (key + 1, n_keys - 1);
+      float duration = times[next] - times[key];
+
+      for (i = 0; i < n_components; i++)
+        {
+          float *segment =
+            segments + (key * n_components + i) * CURVE_SEGMENT_SIZE;
+          float p0 = values[key * n_components + i];
+          float p1 = values[next * n_components + i];
+          float m0, m1;
+
+          /* A linear segment is a curve whose tangents are the segment
+             itself, and a held value one staying on the key */
+          switch (interpolation)
+            {
+            case ANIMATION_INTERPOLATION_STEP:
+              p1 = p0;
+              m0 = m1 = 0.f;
+              break;
+
+            case ANIMATION_INTERPOLATION_LINEAR:
+              m0 = m1 = p1 - p0;
+              break;
+
+            case ANIMATION_INTERPOLATION_CUBIC:
+            default:
+              m0 = slopes[key * n_components + i] * duration;
+              m1 = slopes[next * n_components + i] * duration;
+              break;
+            }
+
+          /* Hermite curve from p0 to p1 with the tangents m0 and m1 */
+          segment[0] = 2 * p0 + m0 - 2 * p1 + m1;
+          segment[1] = -3 * p0 - 2 * m0 + 3 * p1 - m1;
+          segment[2] = m0;
+          segment[3] = p0;
+        }
+    }
+
+  g_free (slopes);
+}
+
+/* Number of floats per key of the linear quaternion tracks */
+#define SLERP_SEGMENT_SIZE 10
+
+/* The rotation going from each key to the next one: both keys, the
+   angle between them and the inverse of its sine */
+static void
+compute_slerp_segments (const float *values,
+                        int          n_keys,
+                        float       *segments)
+{
+  int key, i;
+
+  for (key = 0; key < n_keys; key++)
+    {
+      const float *a = values + key * 4;
+      const float *b = values + MIN (key + 1, n_keys - 1) * 4;
+      float *segment = segments + key * SLERP_SEGMENT_SIZE;
+      float dot = 0.f;
+
+      for (i = 0; i < 4; i++)
+        {
+          segment[i] = a[i];
+          segment[4 + i] = b[i];
+          dot += a[i] * b[i];
+        }
+
+      /* The keys are in the same hemisphere. Close rotations are
+         interpolated linearly, which a sine of 0 stands for and avoids
+         dividing by a tiny sine */
+      if (dot > 0.9995f)
+        {
+          segment[8] = 0.f;
+          segment[9] = 0.f;
+        }
+      else
+        {
+          float angle = acosf (dot);
+
+          segment[8] = angle;
+          segment[9] = 1.f / sinf (angle);
+        }
+    }
+}
+
+static void
+normalize_quaternion (float *q)
+{
+  float length = sqrtf (q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
   int i;
 
-  if (!animation_clip_has_started (clip))
-    return;
+  if (length > 0.f)
+    for (i = 0; i < 4; i++)
+      q[i] /= length;
+}
+
+/*
+ * The clips being played are evaluated together, once per frame, by
+ * es_animation_clip_update_all(). When a clip starts, its tracks join
+ * the pool of the tracks of the same kind, which keeps each field of the
+ * tracks in its own array, along with the segment each track is in,
+ * one array per component and coefficient. A frame then goes through
+ * each pool in three loops, none of them looking at the kind of a
+ * track: the positions of the tracks in their segments are computed,
+ * which only goes back to the keys of the tracks moving to another
+ * segment, the segments are evaluated by loops the compiler can
+ * vectorize, and the results are stored in the animated objects.
+ *
+ * Floats, vectors and cubic or step quaternions are evaluated as cubic
+ * polynomials, computed when the tracks are added. Linear quaternions
+ * are interpolated spherically.
+ */
+
+typedef enum
+{
+  ANIMATION_POOL_FLOAT,
+  ANIMATION_POOL_VEC3,
+  ANIMATION_POOL_QUATERNION,
+  ANIMATION_POOL_SLERP,
+
+  ANIMATION_N_POOLS
+} AnimationPoolType;
+
+typedef struct
+{
+  /* Components evaluated on their own per track, and the floats of a
+     segment and of a result per component. The slerps keep the weights
+     of their keys after their results */
+  int n_lanes;
+  int n_coefficients;
+  int n_results;
+
+  int n_tracks;
+  int size;
+
+  /* Read every frame, one element per track. The times of the keys are
+     relative to the start of the clips */
+  int64_t *start_times;
+  int64_t *durations;
+  int64_t *key_times;
+  int64_t *next_key_times;
+  float *rates;
+  int *cursors;
+  float *positions;
+  void **values;
+
+  /* Rows of size elements, one per coefficient and component of the
+     current segments and per float and component of the results */
+  float *coefficients;
+  float *results;
+
+  /* Read when a track moves to another segment */
+  AnimationClip **clips;
+  const int64_t **times;
+  const float **segments;
+  int *n_keys;
+} AnimationPool;
 
-  if (time >= (clip->start_time + clip->duration))
+static AnimationPool pools[ANIMATION_N_POOLS] =
+{
+  { 1, CURVE_SEGMENT_SIZE, 1 },
+  { 3, CURVE_SEGMENT_SIZE, 1 },
+  { 4, CURVE_SEGMENT_SIZE, 1 },
+  { 1, SLERP_SEGMENT_SIZE, 4 + 2 }
+};
+
+/* Clips started and not finished yet */
+static GPtrArray *active_clips;
+
+#define POOL_ROW(pool, rows, row) ((pool)->rows + (row) * (pool)->size)
+
+static AnimationPool *
+get_pool (const AnimationTrack *track)
+{
+  switch (track->type)
     {
-      animation_clip_clear_started (clip);
-      return;
+    case ES_PROPERTY_TYPE_FLOAT:
+      return &pools[ANIMATION_POOL_FLOAT];
+
+    case ES_PROPERTY_TYPE_VEC3:
+      return &pools[ANIMATION_POOL_VEC3];
+
+    case ES_PROPERTY_TYPE_QUATERNION:
+    default:
+      if (track->interpolation == ANIMATION_INTERPOLATION_LINEAR)
+        return &pools[ANIMATION_POOL_SLERP];
+      return &pools[ANIMATION_POOL_QUATERNION];
     }
+}
+
+static float *
+resize_rows (float *rows,
+             int    n_rows,
+             int    n_elements,
+             int    old_size,
+             int    new_size)
+{
+  float *new_rows = g_new (float, n_rows * new_size);
+  int i;
+
+  for (i = 0; i < n_rows && n_elements > 0; i++)
+    memcpy (new_rows + i * new_size, rows + i * old_size,
+            n_elements * sizeof (float));
+
+  g_free (rows);
 
-  /* everything is in micro seconds */
-  progress = (time - clip->start_time) / (float) clip->duration;
+  return new_rows;
+}
+
+static void
+pool_grow (AnimationPool *pool)
+{
+  int size = MAX (pool->size * 2, 64);
+
+  pool->start_times = g_renew (int64_t, pool->start_times, size);
+  pool->durations = g_renew (int64_t, pool->durations, size);
+  pool->key_times = g_renew (int64_t, pool->key_times, size);
+  pool->next_key_times = g_renew (int64_t, pool->next_key_times, size);
+  pool->rates = g_renew (float, pool->rates, size);
+  pool->cursors = g_renew (int, pool->cursors, size);
+  pool->positions = g_renew (float, pool->positions, size);
+  pool->values = g_renew (void *, pool->values, size);
 
-  /* update floats */
-  if (clip->float_animation_data)
+  pool->coefficients = resize_rows (pool->coefficients,
+                                    pool->n_coefficients * pool->n_lanes,
+                                    pool->n_tracks, pool->size, size);
+  pool->results = resize_rows (pool->results,
+                               pool->n_results * pool->n_lanes,
+                               pool->n_tracks, pool->size, size);
+
+  pool->clips = g_renew (AnimationClip *, pool->clips, size);
+  pool->times = g_renew (const int64_t *, pool->times, size);
+  pool->segments = g_renew (const float *, pool->segments, size);
+  pool->n_keys = g_renew (int, pool->n_keys, size);
+
+  pool->size = size;
+}
+
+/* Moves @track to the segment at @time */
+static void
+pool_move_cursor (AnimationPool *pool,
+                  int            track,
+                  int64_t        time)
+{
+  const int64_t *times = pool->times[track];
+  int n_keys = pool->n_keys[track];
+  int n_coefficients = pool->n_coefficients;
+  int key = find_key (times, n_keys, pool->cursors[track], time);
+  const float *segment =
+    pool->segments[track] + key * pool->n_lanes * n_coefficients;
+  int i, j;
+
+  pool->cursors[track] = key;
+  pool->key_times[track] = times[key];
+
+  /* The last key holds its value forever */
+  if (key < n_keys - 1)
+    {
+      pool->next_key_times[track] = times[key + 1];
+      pool->rates[track] = 1.f / (times[key + 1] - times[key]);
+    }
+  else
     {
-      FloatAnimationData *data;
-      float new_value;
+      pool->next_key_times[track] = G_MAXINT64;
+      pool->rates[track] = 0.f;
+    }
+
+  for (i = 0; i < pool->n_lanes; i++)
+    for (j = 0; j < n_coefficients; j++)
+      POOL_ROW (pool, coefficients, j * pool->n_lanes + i)[track] = *segment++;
+}
 
-      for (i = 0; i < clip->float_animation_data->len; i ++)
+static void
+pool_add_track (AnimationPool        *pool,
+                AnimationClip        *clip,
+                const AnimationTrack *track)
+{
+  int i = pool->n_tracks;
+
+  if (pool->n_tracks == pool->size)
+    pool_grow (pool);
+
+  pool->start_times[i] = clip->start_time;
+  pool->durations[i] = clip->duration;
+  pool->values[i] = track->value;
+
+  /* The keys don't move while the clip is playing */
+  pool->clips[i] = clip;
+  pool->times[i] = &g_array_index (clip->key_times, int64_t,
+                                   track->first_key);
+  pool->segments[i] = &g_array_index (clip->key_values, float,
+                                      track->first_segment);
+  pool->n_keys[i] = track->n_keys;
+
+  pool->n_tracks++;
+
+  /* Sample from the start */
+  pool->cursors[i] = 0;
+  pool_move_cursor (pool, i, 0);
+}
+
+static void
+pool_move_track (AnimationPool *pool,
+                 int            from,
+                 int            to)
+{
+  int i;
+
+  pool->start_times[to] = pool->start_times[from];
+  pool->durations[to] = pool->durations[from];
+  pool->key_times[to] = pool->key_times[from];
+  pool->next_key_times[to] = pool->next_key_times[from];
+  pool->rates[to] = pool->rates[from];
+  pool->cursors[to] = pool->cursors[from];
+  pool->values[to] = pool->values[from];
+
+  for (i = 0; i < pool->n_coefficients * pool->n_lanes; i++)
+    {
+      float *row = POOL_ROW (pool, coefficients, i);
+
+      row[to] = row[from];
+    }
+
+  pool->clips[to] = pool->clips[from];
+  pool->times[to] = pool->times[from];
+  pool->segments[to] = pool->segments[from];
+  pool->n_keys[to] = pool->n_keys[from];
+}
+
+/* Removes the tracks of the clips not being played anymore */
+static void
+compact_pools (void)
+{
+  int i, j, n;
+
+  for (i = 0; i < ANIMATION_N_POOLS; i++)
+    {
+      AnimationPool *pool = &pools[i];
+
+      for (j = 0, n = 0; j < pool->n_tracks; j++)
+        if (animation_clip_has_started (pool->clips[j]))
+          {
+            if (n != j)
+              pool_move_track (pool, j, n);
+            n++;
+          }
+
+      pool->n_tracks = n;
+    }
+}
+
+static void
+update_positions (AnimationPool *pool,
+                  int64_t        time)
+{
+  const int64_t *start_times = pool->start_times;
+  const int64_t *durations = pool->durations;
+  const int64_t *key_times = pool->key_times;
+  const int64_t *next_key_times = pool->next_key_times;
+  const float *rates = pool->rates;
+  float *positions = pool->positions;
+  int i;
+
+  for (i = 0; i < pool->n_tracks; i++)
+    {
+      /* everything is in micro seconds. Leave the properties at their
+         final values */
+      int64_t clip_time = MIN (time - start_times[i], durations[i]);
+
+      /* Playing forward, a track only leaves its segment at its end, and
+         going back only happens when the clip is played again */
+      if (G_UNLIKELY (clip_time >= next_key_times[i] ||
+                      (clip_time < key_times[i] && pool->cursors[i] > 0)))
+        pool_move_cursor (pool, i, clip_time);
+
+      /* Hold the first value before the first key */
+      positions[i] = CLAMP ((clip_time - key_times[i]) * rates[i], 0.f, 1.f);
+    }
+}
+
+static void
+evaluate_curves (AnimationPool *pool)
+{
+  const float *s = pool->positions;
+  int n_lanes = pool->n_lanes;
+  int i, j;
+
+  for (j = 0; j < n_lanes; j++)
+    {
+      const float *a = POOL_ROW (pool, coefficients, j);
+      const float *b = POOL_ROW (pool, coefficients, n_lanes + j);
+      const float *c = POOL_ROW (pool, coefficients, 2 * n_lanes + j);
+      const float *d = POOL_ROW (pool, coefficients, 3 * n_lanes + j);
+      float *out = POOL_ROW (pool, results, j);
+
+      for (i = 0; i < pool->n_tracks; i++)
+        out[i] = ((a[i] * s[i] + b[i]) * s[i] + c[i]) * s[i] + d[i];
+    }
+}
+
+static void
+evaluate_slerps (AnimationPool *pool)
+{
+  const float *ts = pool->positions;
+  const float *angles = POOL_ROW (pool, coefficients, 8);
+  const float *inverse_sines = POOL_ROW (pool, coefficients, 9);
+  float *wa = POOL_ROW (pool, results, 4), *wb = POOL_ROW (pool, results, 5);
+  int i, j;
+
+  for (i = 0; i < pool->n_tracks; i++)
+    {
+      float t = ts[i];
+
+      if (inverse_sines[i] != 0.f)
         {
-          data = &g_array_index (clip->float_animation_data,
-                                 FloatAnimationData,
-                                 i);
+          wa[i] = sinf ((1.f - t) * angles[i]) * inverse_sines[i];
+          wb[i] = sinf (t * angles[i]) * inverse_sines[i];
+        }
+      else
+        {
+          wa[i] = 1.f - t;
+          wb[i] = t;
+        }
+    }
 
-          new_value = data->start +
-            (data->end - data->start) * data->easing (progress);
+  for (j = 0; j < 4; j++)
+    {
+      const float *a = POOL_ROW (pool, coefficients, j);
+      const float *b = POOL_ROW (pool, coefficients, 4 + j);
+      float *out = POOL_ROW (pool, results, j);
 
-          data->setter (data->object, new_value);
-      }
+      for (i = 0; i < pool->n_tracks; i++)
+        out[i] = wa[i] * a[i] + wb[i] * b[i];
     }
+}
+
+static void
+store_floats (AnimationPool *pool)
+{
+  const float *out = POOL_ROW (pool, results, 0);
+  int i;
 
-  /* update quaternions */
-  if (clip->quaternion_animation_data)
+  for (i = 0; i < pool->n_tracks; i++)
+    *(float *) pool->values[i] = out[i];
+}
+
+static void
+store_vec3s (AnimationPool *pool)
+{
+  const float *x = POOL_ROW (pool, results, 0);
+  const float *y = POOL_ROW (pool, results, 1);
+  const float *z = POOL_ROW (pool, results, 2);
+  int i;
+
+  for (i = 0; i < pool->n_tracks; i++)
     {
-      QuaternionAnimationData *data;
-      CoglQuaternion new_value;
+      float *value = pool->values[i];
 
-      for (i = 0; i < clip->quaternion_animation_data->len; i ++)
+      value[0] = x[i];
+      value[1] = y[i];
+      value[2] = z[i];
+    }
+}
+
+static void
+store_quaternions (AnimationPool *pool,
+                   gboolean       normalize)
+{
+  const float *w = POOL_ROW (pool, results, 0);
+  const float *x = POOL_ROW (pool, results, 1);
+  const float *y = POOL_ROW (pool, results, 2);
+  const float *z = POOL_ROW (pool, results, 3);
+  int i;
+
+  for (i = 0; i < pool->n_tracks; i++)
+    {
+      CoglQuaternion *quaternion = pool->values[i];
+      float value[4];
+
+      value[0] = w[i];
+      value[1] = x[i];
+      value[2] = y[i];
+      value[3] = z[i];
+
+      /* The components of the quaternion curves are interpolated on
+         their own, which is close enough with consecutive keys kept in
+         the same hemisphere */
+      if (normalize)
+        normalize_quaternion (value);
+
+      quaternion->w = value[0];
+      quaternion->x = value[1];
+      quaternion->y = value[2];
+      quaternion->z = value[3];
+    }
+}
+
+/*
+ * es_animation_clip_update_all:
+ * @time: The current time, in micro seconds
+ *
+ * Sets the properties animated by all the clips being played to their
+ * values at @time. This is meant to be called once per frame, before
+ * updating the entities.
+ */
+void
+es_animation_clip_update_all (int64_t time)
+{
+  gboolean finished = FALSE;
+  int i, j;
+
+  if (active_clips == NULL || active_clips->len == 0)
+    return;
+
+  for (i = 0; i < ANIMATION_N_POOLS; i++)
+    update_positions (&pools[i], time);
+
+  evaluate_curves (&pools[ANIMATION_POOL_FLOAT]);
+  store_floats (&pools[ANIMATION_POOL_FLOAT]);
+
+  evaluate_curves (&pools[ANIMATION_POOL_VEC3]);
+  store_vec3s (&pools[ANIMATION_POOL_VEC3]);
+
+  evaluate_curves (&pools[ANIMATION_POOL_QUATERNION]);
+  store_quaternions (&pools[ANIMATION_POOL_QUATERNION], TRUE);
+
+  evaluate_slerps (&pools[ANIMATION_POOL_SLERP]);
+  store_quaternions (&pools[ANIMATION_POOL_SLERP], FALSE);
+
+  for (i = 0; i < active_clips->len; i++)
+    {
+      AnimationClip *clip = g_ptr_array_index (active_clips, i);
+
+      for (j = 0; j < clip->dirty_flags->len; j++)
         {
-          data = &g_array_index (clip->quaternion_animation_data,
-                                 QuaternionAnimationData,
-                                 i);
+          AnimationDirtyFlags *dirty =
+            &g_array_index (clip->dirty_flags, AnimationDirtyFlags, j);
 
-          cogl_quaternion_slerp (&new_value,
-                                 &data->start, &data->end,
-                                 data->easing (progress));
+          *dirty->flags |= dirty->dirty_flags;
+        }
+    }
 
-          data->setter (data->object, &new_value);
+  /* Retire the clips that have reached their end */
+  for (i = 0; i < active_clips->len;)
+    {
+      AnimationClip *clip = g_ptr_array_index (active_clips, i);
+
+      if (time - clip->start_time >= clip->duration)
+        {
+          animation_clip_clear_started (clip);
+          g_ptr_array_remove_index_fast (active_clips, i);
+          finished = TRUE;
         }
+      else
+        i++;
     }
+
+  if (finished)
+    compact_pools ();
 }
 
 /*
@@ -113,8 +726,12 @@ es_animation_clip_new (int32_t duration)
 
   renderer = g_slice_new0 (AnimationClip);
   renderer->component.type = ES_COMPONENT_TYPE_ANIMATION_CLIP;
-  renderer->component.update = es_animation_clip_update;
   renderer->duration = duration * 1000;
+  renderer->tracks = g_array_new (FALSE, FALSE, sizeof (AnimationTrack));
+  renderer->key_times = g_array_new (FALSE, FALSE, sizeof (int64_t));
+  renderer->key_values = g_array_new (FALSE, FALSE, sizeof (float));
+  renderer->dirty_flags = g_array_new (FALSE, FALSE,
+                                       sizeof (AnimationDirtyFlags));
 
   return ES_COMPONENT (renderer);
 }
@@ -122,82 +739,256 @@ es_animation_clip_new (int32_t duration)
 void
 es_animation_clip_free (AnimationClip *clip)
 {
-  if (clip->float_animation_data)
-    g_array_unref (clip->float_animation_data);
+  es_animation_clip_stop (clip);
 
-  if (clip->quaternion_animation_data)
-    g_array_unref (clip->quaternion_animation_data);
+  g_array_unref (clip->tracks);
+  g_array_unref (clip->key_times);
+  g_array_unref (clip->key_values);
+  g_array_unref (clip->dirty_flags);
 
   g_slice_free (AnimationClip, clip);
 }
 
-void
-es_animation_clip_add_float (AnimationClip *clip,
-                             void          *object,
-                             FloatGetter    getter,
-                             FloatSetter    setter,
-                             float          end_value)
+static void
+add_dirty_flags (AnimationClip    *clip,
+                 void             *object,
+                 const EsProperty *property)
 {
-  FloatAnimationData data;
+  AnimationDirtyFlags dirty;
+  int i;
+
+  dirty.flags = ES_PROPERTY_GET_FLAGS (object, property);
+  dirty.dirty_flags = property->dirty_flags;
 
-  if (clip->float_animation_data == NULL)
+  for (i = 0; i < clip->dirty_flags->len; i++)
     {
-      clip->float_animation_data =
-        g_array_sized_new (FALSE, FALSE, sizeof (FloatAnimationData), 1);
+      AnimationDirtyFlags *other =
+        &g_array_index (clip->dirty_flags, AnimationDirtyFlags, i);
+
+      if (other->flags == dirty.flags)
+        {
+          other->dirty_flags |= dirty.dirty_flags;
+          return;
+        }
     }
 
-  data.object = object;
-  data.setter = setter;
-  data.start = getter (object);
-  data.end = end_value;
-  data.easing = easing_linear;
+  g_array_append_val (clip->dirty_flags, dirty);
+}
 
-  g_array_append_val (clip->float_animation_data, data);
+/* Appends a track animating @property of @object and its keys, the
+   times being given in ms. The playing tracks point to the keys, which
+   can't move until the clip is stopped */
+static void
+add_track (AnimationClip          *clip,
+           void                   *object,
+           const EsProperty       *property,
+           EsPropertyType          type,
+           AnimationInterpolation  interpolation,
+           int                     n_keys,
+           const int32_t          *times,
+           const float            *values)
+{
+  AnimationTrack track;
+  const int64_t *key_times;
+  int n_components, segment_size;
+  int i;
+
+  g_return_if_fail (!animation_clip_has_started (clip));
+  g_return_if_fail (property != NULL);
+  g_return_if_fail (property->type == type);
+  g_return_if_fail (n_keys > 0);
+
+  for (i = 1; i < n_keys; i++)
+    g_return_if_fail (times[i] > times[i - 1]);
+
+  n_components = es_property_get_size (property);
+
+  memset (&track, 0, sizeof (track));
+  track.type = type;
+  track.interpolation = interpolation;
+  track.value = ES_PROPERTY_GET_POINTER (object, property);
+  track.first_key = clip->key_times->len;
+  track.first_segment = clip->key_values->len;
+  track.n_keys = n_keys;
+
+  for (i = 0; i < n_keys; i++)
+    {
+      int64_t time = times[i] * (int64_t) 1000;
+
+      g_array_append_val (clip->key_times, time);
+    }
+  key_times = &g_array_index (clip->key_times, int64_t, track.first_key);
+
+  if (type == ES_PROPERTY_TYPE_QUATERNION &&
+      interpolation == ANIMATION_INTERPOLATION_LINEAR)
+    {
+      segment_size = SLERP_SEGMENT_SIZE;
+      g_array_set_size (clip->key_values,
+                        track.first_segment + n_keys * segment_size);
+      compute_slerp_segments (values, n_keys,
+                              &g_array_index (clip->key_values, float,
+                                              track.first_segment));
+    }
+  else
+    {
+      segment_size = n_components * CURVE_SEGMENT_SIZE;
+      g_array_set_size (clip->key_values,
+                        track.first_segment + n_keys * segment_size);
+      compute_curve_segments (key_times, values, n_keys, n_components,
+                              interpolation,
+                              &g_array_index (clip->key_values, float,
+                                              track.first_segment));
+    }
+
+  g_array_append_val (clip->tracks, track);
+
+  add_dirty_flags (clip, object, property);
 }
 
+/*
+ * es_animation_clip_add_float_track:
+ * @clip: An animation clip
+ * @object: The object to animate
+ * @property: The property of @object to animate
+ * @interpolation: How to go from a key to the next
+ * @n_keys: The number of keys
+ * @times: The time of each key, in ms from the start of the clip, in
+ *   increasing order
+ * @values: The value of each key
+ */
 void
-es_animation_clip_add_quaternion  (AnimationClip    *clip,
-                                   void             *object,
-                                   QuaternionGetter  getter,
-                                   QuaternionSetter  setter,
-                                   CoglQuaternion   *end_value)
+es_animation_clip_add_float_track (AnimationClip          *clip,
+                                   void                   *object,
+                                   const EsProperty       *property,
+                                   AnimationInterpolation  interpolation,
+                                   int                     n_keys,
+                                   const int32_t          *times,
+                                   const float            *values)
+{
+  add_track (clip, object, property, ES_PROPERTY_TYPE_FLOAT, interpolation,
+             n_keys, times, values);
+}
+
+/*
+ * es_animation_clip_add_vec3_track:
+ * @values: 3 components for each key
+ *
+ * Like es_animation_clip_add_float_track() for vectors, a position for
+ * example.
+ */
+void
+es_animation_clip_add_vec3_track (AnimationClip          *clip,
+                                  void                   *object,
+                                  const EsProperty       *property,
+                                  AnimationInterpolation  interpolation,
+                                  int                     n_keys,
+                                  const int32_t          *times,
+                                  const float            *values)
 {
-  QuaternionAnimationData data;
+  add_track (clip, object, property, ES_PROPERTY_TYPE_VEC3, interpolation,
+             n_keys, times, values);
+}
+
+/*
+ * es_animation_clip_add_quaternion_track:
+ *
+ * Like es_animation_clip_add_float_track() for rotations. Each key is
+ * flipped if needed to be in the same hemisphere as the previous one
+ * so that the rotations take the shortest path.
+ */
+void
+es_animation_clip_add_quaternion_track (AnimationClip          *clip,
+                                        void                   *object,
+                                        const EsProperty       *property,
+                                        AnimationInterpolation  interpolation,
+                                        int                     n_keys,
+                                        const int32_t          *times,
+                                        const CoglQuaternion   *values)
+{
+  float *keys;
+  int i, j;
+
+  keys = g_new (float, n_keys * 4);
+  for (i = 0; i < n_keys; i++)
+    {
+      keys[i * 4 + 0] = values[i].w;
+      keys[i * 4 + 1] = values[i].x;
+      keys[i * 4 + 2] = values[i].y;
+      keys[i * 4 + 3] = values[i].z;
+    }
 
-  if (clip->quaternion_animation_data == NULL)
+  for (i = 1; i < n_keys; i++)
     {
-      clip->quaternion_animation_data =
-        g_array_sized_new (FALSE, FALSE, sizeof (QuaternionAnimationData), 1);
+      float dot = 0.f;
+
+      for (j = 0; j < 4; j++)
+        dot += keys[(i - 1) * 4 + j] * keys[i * 4 + j];
+
+      if (dot < 0.f)
+        for (j = 0; j < 4; j++)
+          keys[i * 4 + j] = -keys[i * 4 + j];
     }
 
-  data.object = object;
-  data.setter = setter;
-  cogl_quaternion_init_from_quaternion (&data.start, getter (object));
-  cogl_quaternion_init_from_quaternion (&data.end, end_value);
-  data.easing = easing_linear;
+  add_track (clip, object, property, ES_PROPERTY_TYPE_QUATERNION,
+             interpolation, n_keys, times, keys);
 
-  g_array_append_val (clip->quaternion_animation_data, data);
+  g_free (keys);
 }
 
-static int
-has_float_animation_data (AnimationClip *clip)
+/*
+ * es_animation_clip_add_float:
+ *
+ * Animates a property from its current value to @end_value over the
+ * whole clip.
+ */
+void
+es_animation_clip_add_float (AnimationClip    *clip,
+                             void             *object,
+                             const EsProperty *property,
+                             float             end_value)
 {
-  return (clip->float_animation_data == NULL ||
-          clip->float_animation_data->len == 0);
+  int32_t times[2] = { 0, clip->duration / 1000 };
+  float values[2];
+
+  g_return_if_fail (property != NULL);
+  g_return_if_fail (property->type == ES_PROPERTY_TYPE_FLOAT);
+
+  values[0] = *(float *) ES_PROPERTY_GET_POINTER (object, property);
+  values[1] = end_value;
+
+  es_animation_clip_add_float_track (clip, object, property,
+                                     ANIMATION_INTERPOLATION_LINEAR,
+                                     2, times, values);
 }
 
-static int
-has_quaternion_animation_data (AnimationClip *clip)
+void
+es_animation_clip_add_quaternion  (AnimationClip    *clip,
+                                   void             *object,
+                                   const EsProperty *property,
+                                   CoglQuaternion   *end_value)
 {
-  return (clip->quaternion_animation_data == NULL ||
-          clip->quaternion_animation_data->len == 0);
+  int32_t times[2] = { 0, clip->duration / 1000 };
+  CoglQuaternion values[2];
+
+  g_return_if_fail (property != NULL);
+  g_return_if_fail (property->type == ES_PROPERTY_TYPE_QUATERNION);
+
+  cogl_quaternion_init_from_quaternion (&values[0],
+                                        ES_PROPERTY_GET_POINTER (object,
+                                                                 property));
+  cogl_quaternion_init_from_quaternion (&values[1], end_value);
+
+  es_animation_clip_add_quaternion_track (clip, object, property,
+                                          ANIMATION_INTERPOLATION_LINEAR,
+                                          2, times, values);
 }
 
 void
 es_animation_clip_start (AnimationClip *clip)
 {
-  if (!has_float_animation_data (clip) &&
-      !has_quaternion_animation_data (clip))
+  int i;
+
+  if (clip->tracks->len == 0)
     {
       g_warning ("Tried to start an animation clip without anything to animate");
       return;
@@ -208,5 +999,35 @@ es_animation_clip_start (AnimationClip *clip)
 
   clip->start_time = es_get_current_time ();
 
+  for (i = 0; i < clip->tracks->len; i++)
+    {
+      AnimationTrack *track = &g_array_index (clip->tracks, AnimationTrack, i);
+
+      pool_add_track (get_pool (track), clip, track);
+    }
+
+  if (G_UNLIKELY (active_clips == NULL))
+    active_clips = g_ptr_array_new ();
+  g_ptr_array_add (active_clips, clip);
+
   animation_clip_set_started (clip);
 }
+
+/*
+ * es_animation_clip_stop:
+ * @clip: An animation clip
+ *
+ * Stops playing @clip, leaving the properties it animates at their
+ * current values.
+ */
+void
+es_animation_clip_stop (AnimationClip *clip)
+{
+  if (!animation_clip_has_started (clip))
+    return;
+
+  g_ptr_array_remove_fast (active_clips, clip);
+
+  animation_clip_clear_started (clip);
+  compact_pools ();
+}
@@ -24,17 +24,15 @@
 
 #include "es-entity.h"
 
-#define FLOAT_GETTER(func) ((FloatGetter) (func))
-#define FLOAT_SETTER(func) ((FloatSetter) (func))
-
-typedef float (*FloatGetter) (void *object);
-typedef void (*FloatSetter) (void *object, float f);
-
-#define QUATERNION_GETTER(func) ((QuaternionGetter) (func))
-#define QUATERNION_SETTER(func) ((QuaternionSetter) (func))
-
-typedef CoglQuaternion * (*QuaternionGetter) (void *object);
-typedef void (*QuaternionSetter) (void *object, CoglQuaternion *quaternion);
+typedef enum
+{
+  /* Keep the value of the previous key until the next one */
+  ANIMATION_INTERPOLATION_STEP,
+  /* Straight line between the keys, spherical for quaternions */
+  ANIMATION_INTERPOLATION_LINEAR,
+  /* Catmull-Rom spline going through all the keys */
+  ANIMATION_INTERPOLATION_CUBIC
+} AnimationInterpolation;
 
 #define ES_ANIMATION_CLIP(p) ((AnimationClip *)(p))
 
@@ -69,25 +67,56 @@ struct _AnimationClip
   uint32_t flags;
   int64_t duration;   /* micro seconds */
   int64_t start_time; /* micro seconds */
-  GArray *float_animation_data;
-  GArray *quaternion_animation_data;
+
+  /* The keys of all the tracks are stored one after the other */
+  GArray *tracks;
+  GArray *key_times;  /* int64_t, micro seconds */
+  GArray *key_values; /* float, the segment to the next key: 4 per
+                         component, or the keys, angle and inverse of its
+                         sine for linear quaternions */
+
+  /* The flags to set on the animated objects, one element per object */
+  GArray *dirty_flags;
 };
 
 Component * es_animation_clip_new             (int32_t duration);
 
 void        es_animation_clip_free            (AnimationClip *clip);
 
-void        es_animation_clip_add_float       (AnimationClip *clip,
-                                               void          *object,
-                                               FloatGetter    getter,
-                                               FloatSetter    setter,
-                                               float          end_value);
+void        es_animation_clip_add_float       (AnimationClip    *clip,
+                                               void             *object,
+                                               const EsProperty *property,
+                                               float             end_value);
 void        es_animation_clip_add_quaternion  (AnimationClip    *clip,
                                                void             *object,
-                                               QuaternionGetter  getter,
-                                               QuaternionSetter  setter,
+                                               const EsProperty *property,
                                                CoglQuaternion   *end_value);
+
+void        es_animation_clip_add_float_track (AnimationClip          *clip,
+                                               void                   *object,
+                                               const EsProperty       *property,
+                                               AnimationInterpolation  interpolation,
+                                               int                     n_keys,
+                                               const int32_t          *times,
+                                               const float            *values);
+void        es_animation_clip_add_vec3_track  (AnimationClip          *clip,
+                                               void                   *object,
+                                               const EsProperty       *property,
+                                               AnimationInterpolation  interpolation,
+                                               int                     n_keys,
+                                               const int32_t          *times,
+                                               const float            *values);
+void        es_animation_clip_add_quaternion_track
+                                              (AnimationClip          *clip,
+                                               void                   *object,
+                                               const EsProperty       *property,
+                                               AnimationInterpolation  interpolation,
+                                               int                     n_keys,
+                                               const int32_t          *times,
+                                               const CoglQuaternion   *values);
 void        es_animation_clip_start           (AnimationClip *clip);
 void        es_animation_clip_stop            (AnimationClip *clip);
 
+void        es_animation_clip_update_all      (int64_t        time);
+
 #endif /* __ES_ANIMATION_CLIP_H__ */
@@ -27,6 +27,18 @@ typedef struct
   float r, g, b, a;
 } EsVertex4C4;
 
+static const EsProperty camera_properties[] =
+{
+  ES_PROPERTY_DEFINE ("fov", ES_PROPERTY_TYPE_FLOAT,
+                      Camera, fov, CAMERA_FLAG_PROJECTION_DIRTY),
+  ES_PROPERTY_DEFINE ("size", ES_PROPERTY_TYPE_FLOAT,
+                      Camera, size, CAMERA_FLAG_PROJECTION_DIRTY),
+  ES_PROPERTY_DEFINE ("z-near", ES_PROPERTY_TYPE_FLOAT,
+                      Camera, z_near, CAMERA_FLAG_PROJECTION_DIRTY),
+  ES_PROPERTY_DEFINE ("z-far", ES_PROPERTY_TYPE_FLOAT,
+                      Camera, z_far, CAMERA_FLAG_PROJECTION_DIRTY)
+};
+
 static void
 es_camera_update (Component *component,
                   int64_t    time)
@@ -285,3 +297,16 @@ es_camera_set_background_color (Camera    *camera,
 {
   camera->background_color = *color;
 }
+
+/*
+ * es_camera_find_property:
+ * @name: "fov", "size", "z-near" or "z-far"
+ *
+ * Returns: the property of the cameras named @name, or %NULL
+ */
+const EsProperty *
+es_camera_find_property (const char *name)
+{
+  return es_property_find (camera_properties,
+                           G_N_ELEMENTS (camera_properties), name);
+}
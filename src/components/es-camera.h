@@ -74,5 +74,6 @@ void              es_camera_set_size_of_view      (Camera *camera,
                                                    float   sov);
 void	          es_camera_set_background_color  (Camera    *camera,
                                                    CoglColor *color);
+const EsProperty *es_camera_find_property         (const char *name);
 
 #endif /* __ES_CAMERA_H__ */
@@ -19,6 +19,7 @@
 
 #include "es-main.h"
 #include "es-mesh-renderer.h"
+#include "es-buffer-arena.h"
 
 typedef struct
 {
@@ -26,6 +27,16 @@ typedef struct
   float n_x, n_y, n_z;  /* normal         */
 } Vertex;
 
+struct _MeshRendererLoad
+{
+  /* NULL if the renderer has been freed before the asset is ready */
+  MeshRenderer *renderer;
+  /* The pipeline can only be prepared once the data is loaded */
+  CoglPipeline *pipeline;
+  MeshRendererLoadCallback callback;
+  void *user_data;
+};
+
 /*
  *        f +--------+ e
  *         /        /|
@@ -117,42 +128,57 @@ static Vertex cube_vertices[] =
 #undef norm_top
 #undef norm_bottom
 
+/* The templates share the buffers of an arena */
+#define TEMPLATE_VERTEX_FORMAT "template:p3f,n3f"
+
 static CoglPrimitive *
-create_cube_primitive (void)
+create_template_primitive (const Vertex *vertices,
+                           int           n_vertices,
+                           size_t       *n_bytes)
 {
-  CoglAttributeBuffer *attribute_buffer;
+  EsBufferArena *arena;
+  EsBufferRange *range;
   CoglAttribute *attributes[2];
   CoglPrimitive *primitive;
-  CoglContext *context;
 
-  context = es_get_cogl_context ();
+  arena = es_buffer_arena_get_for_format (TEMPLATE_VERTEX_FORMAT);
+  range = es_buffer_arena_alloc (arena, n_vertices * sizeof (Vertex), 16);
+  cogl_buffer_set_data (range->buffer, range->offset, vertices, range->size);
 
-  attribute_buffer = cogl_attribute_buffer_new (context,
-                                                sizeof (cube_vertices),
-                                                cube_vertices);
-  attributes[0] = cogl_attribute_new (attribute_buffer,
+  attributes[0] = cogl_attribute_new (COGL_ATTRIBUTE_BUFFER (range->buffer),
                                       "cogl_position_in",
                                       sizeof (Vertex),
-                                      offsetof (Vertex, x),
+                                      range->offset + offsetof (Vertex, x),
                                       3,
                                       COGL_ATTRIBUTE_TYPE_FLOAT);
-  attributes[1] = cogl_attribute_new (attribute_buffer,
+  attributes[1] = cogl_attribute_new (COGL_ATTRIBUTE_BUFFER (range->buffer),
                                       "cogl_normal_in",
                                       sizeof (Vertex),
-                                      offsetof (Vertex, n_x),
+                                      range->offset + offsetof (Vertex, n_x),
                                       3,
                                       COGL_ATTRIBUTE_TYPE_FLOAT);
-  cogl_object_unref (attribute_buffer);
 
   primitive = cogl_primitive_new_with_attributes (COGL_VERTICES_MODE_TRIANGLES,
-                                                  G_N_ELEMENTS (cube_vertices),
+                                                  n_vertices,
                                                   attributes, 2);
   cogl_object_unref (attributes[0]);
   cogl_object_unref (attributes[1]);
 
+  es_buffer_range_free_with_object (range, primitive);
+
+  *n_bytes = range->size;
+
   return primitive;
 }
 
+static CoglPrimitive *
+create_cube_primitive (size_t *n_bytes)
+{
+  return create_template_primitive (cube_vertices,
+                                    G_N_ELEMENTS (cube_vertices),
+                                    n_bytes);
+}
+
 /*
  *        b +--------+ a
  *         /        /
@@ -186,56 +212,22 @@ static Vertex plane_vertices[] =
 #undef norm
 
 static CoglPrimitive *
-create_plane_primitive (void)
+create_plane_primitive (size_t *n_bytes)
 {
-  CoglAttributeBuffer *attribute_buffer;
-  CoglAttribute *attributes[2];
-  CoglPrimitive *primitive;
-  CoglContext *context;
-
-  context = es_get_cogl_context ();
-
-  attribute_buffer = cogl_attribute_buffer_new (context,
-                                                sizeof (plane_vertices),
-                                                plane_vertices);
-  attributes[0] = cogl_attribute_new (attribute_buffer,
-                                      "cogl_position_in",
-                                      sizeof (Vertex),
-                                      offsetof (Vertex, x),
-                                      3,
-                                      COGL_ATTRIBUTE_TYPE_FLOAT);
-  attributes[1] = cogl_attribute_new (attribute_buffer,
-                                      "cogl_normal_in",
-                                      sizeof (Vertex),
-                                      offsetof (Vertex, n_x),
-                                      3,
-                                      COGL_ATTRIBUTE_TYPE_FLOAT);
-  cogl_object_unref (attribute_buffer);
-
-  primitive = cogl_primitive_new_with_attributes (COGL_VERTICES_MODE_TRIANGLES,
-                                                  G_N_ELEMENTS (plane_vertices),
-                                                  attributes, 2);
-  cogl_object_unref (attributes[0]);
-  cogl_object_unref (attributes[1]);
-
-  return primitive;
+  return create_template_primitive (plane_vertices,
+                                    G_N_ELEMENTS (plane_vertices),
+                                    n_bytes);
 }
 
-static MashData *
-create_ply_primitive (const gchar *filename)
+static const struct
 {
-  MashData *data = mash_data_new ();
-  GError *error = NULL;
-
-  mash_data_load (data, MASH_DATA_NONE, filename, &error);
-  if (error)
-    {
-      g_critical ("could not load model %s: %s", filename, error->message);
-      return NULL;
-    }
-
-  return data;
-}
+  const char *name;
+  EsMeshTemplateFunc create;
+} templates[] =
+{
+  { "plane", create_plane_primitive },
+  { "cube", create_cube_primitive }
+};
 
 static void
 es_mesh_renderer_draw (Component *component, CoglFramebuffer *fb)
@@ -250,12 +242,8 @@ es_mesh_renderer_draw (Component *component, CoglFramebuffer *fb)
     }
   else if (renderer->mesh_data)
     {
-      CoglPrimitive *primitive;
-
-      primitive = mash_data_get_primitive (renderer->mesh_data);
-      cogl_framebuffer_draw_primitive (fb,
-                                       renderer->pipeline,
-                                       primitive);
+      /* Big meshes are made of several submeshes */
+      mash_data_render (renderer->mesh_data, fb, renderer->pipeline);
     }
 }
 
@@ -271,15 +259,110 @@ es_mesh_renderer_new (void)
   return renderer;
 }
 
+static void
+asset_ready_cb (EsMeshAsset  *asset,
+                const GError *error,
+                void         *user_data)
+{
+  MeshRendererLoad *load = user_data;
+  MeshRenderer *renderer = load->renderer;
+
+  if (renderer)
+    {
+      renderer->load = NULL;
+
+      if (error)
+        g_critical ("could not load model: %s", error->message);
+      else
+        renderer->mesh_data = es_mesh_asset_get_mesh_data (asset);
+
+      /* Now that the data is known, prepare the pipeline for it */
+      es_mesh_renderer_set_pipeline (renderer, load->pipeline);
+
+      if (load->callback)
+        load->callback (renderer, error, load->user_data);
+    }
+
+  if (load->pipeline)
+    cogl_object_unref (load->pipeline);
+  g_slice_free (MeshRendererLoad, load);
+}
+
+static gboolean
+asset_ready_idle (gpointer user_data)
+{
+  MeshRendererLoad *load = user_data;
+
+  asset_ready_cb (load->renderer ? load->renderer->asset : NULL, NULL, load);
+
+  return FALSE;
+}
+
+/* Defers the setup of the renderer until its asset is ready */
+static void
+es_mesh_renderer_wait_for_asset (MeshRenderer             *renderer,
+                                 MeshRendererLoadCallback  callback,
+                                 void                     *user_data)
+{
+  MeshRendererLoad *load;
+
+  load = g_slice_new0 (MeshRendererLoad);
+  load->renderer = renderer;
+  load->callback = callback;
+  load->user_data = user_data;
+  renderer->load = load;
+
+  if (es_mesh_asset_is_loading (renderer->asset))
+    es_mesh_asset_add_ready_callback (renderer->asset, asset_ready_cb, load);
+  else
+    g_idle_add (asset_ready_idle, load);
+}
+
 Component *
 es_mesh_renderer_new_from_file (const char   *file,
                                 CoglPipeline *pipeline)
 {
   MeshRenderer *renderer;
+  GError *error = NULL;
 
   renderer = es_mesh_renderer_new ();
-  renderer->mesh_data = create_ply_primitive (file);
-  renderer->pipeline = cogl_object_ref (pipeline);
+  renderer->asset = es_mesh_registry_get_file (file, &error);
+
+  if (renderer->asset == NULL)
+    {
+      g_critical ("could not load model %s: %s", file, error->message);
+      g_error_free (error);
+    }
+  /* Someone else is loading the same file asynchronously */
+  else if (es_mesh_asset_is_loading (renderer->asset))
+    es_mesh_renderer_wait_for_asset (renderer, NULL, NULL);
+  else
+    renderer->mesh_data = es_mesh_asset_get_mesh_data (renderer->asset);
+
+  es_mesh_renderer_set_pipeline (renderer, pipeline);
+
+  return ES_COMPONENT (renderer);
+}
+
+/*
+ * Same as es_mesh_renderer_new_from_file() but the file is loaded in
+ * the background. The renderer draws nothing until the mesh is ready,
+ * @callback is then invoked from the GLib main context. This is also
+ * the case when the mesh was already loaded.
+ */
+Component *
+es_mesh_renderer_new_from_file_async (const char               *file,
+                                      CoglPipeline             *pipeline,
+                                      MeshRendererLoadCallback  callback,
+                                      void                     *user_data)
+{
+  MeshRenderer *renderer;
+
+  renderer = es_mesh_renderer_new ();
+  renderer->asset = es_mesh_registry_get_file_async (file);
+  es_mesh_renderer_wait_for_asset (renderer, callback, user_data);
+
+  es_mesh_renderer_set_pipeline (renderer, pipeline);
 
   return ES_COMPONENT (renderer);
 }
@@ -289,16 +372,21 @@ es_mesh_renderer_new_from_template (const char   *name,
                                     CoglPipeline *pipeline)
 {
   MeshRenderer *renderer;
+  int i;
 
   renderer = es_mesh_renderer_new ();
 
-  if (g_strcmp0 (name, "plane") == 0)
-    renderer->primitive = create_plane_primitive ();
-  else if (g_strcmp0 (name, "cube") == 0)
-    renderer->primitive = create_cube_primitive ();
-  else
-    g_assert_not_reached ();
+  for (i = 0; i < G_N_ELEMENTS (templates); i++)
+    if (g_strcmp0 (name, templates[i].name) == 0)
+      {
+        renderer->asset = es_mesh_registry_get_template (name,
+                                                         templates[i].create);
+        break;
+      }
 
+  g_assert (renderer->asset != NULL);
+
+  renderer->primitive = es_mesh_asset_get_primitive (renderer->asset);
   renderer->pipeline = cogl_object_ref (pipeline);
 
   return ES_COMPONENT (renderer);
@@ -306,14 +394,15 @@ es_mesh_renderer_new_from_template (const char   *name,
 
 void es_mesh_renderer_free (MeshRenderer *renderer)
 {
+  if (renderer->load)
+    renderer->load->renderer = NULL;
+
   if (renderer->pipeline)
     cogl_object_unref (renderer->pipeline);
 
-  if (renderer->primitive)
-    cogl_object_unref (renderer->primitive);
-
-  if (renderer->mesh_data)
-    g_object_unref (renderer->mesh_data);
+  /* The primitive and the mesh data belong to the asset */
+  if (renderer->asset)
+    es_mesh_asset_unref (renderer->asset);
 
   g_slice_free (MeshRenderer, renderer);
 }
@@ -329,6 +418,26 @@ es_mesh_renderer_set_pipeline (MeshRenderer *renderer,
       renderer->pipeline = NULL;
     }
 
-  if (pipeline)
+  /* Remember the pipeline until the data is loaded */
+  if (renderer->load)
+    {
+      if (pipeline)
+        cogl_object_ref (pipeline);
+      if (renderer->load->pipeline)
+        cogl_object_unref (renderer->load->pipeline);
+      renderer->load->pipeline = pipeline;
+    }
+
+  if (pipeline == NULL)
+    return;
+
+  /* Quantized mesh data needs its own pipeline to decode the vertices,
+     the other meshes share the pipeline they are given */
+  if (renderer->mesh_data && mash_data_is_quantized (renderer->mesh_data))
+    {
+      renderer->pipeline = cogl_pipeline_copy (pipeline);
+      mash_data_prepare_pipeline (renderer->mesh_data, renderer->pipeline);
+    }
+  else
     renderer->pipeline = cogl_object_ref (pipeline);
 }
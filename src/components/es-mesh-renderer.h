@@ -25,22 +25,37 @@
 #include <cogl/cogl.h>
 
 #include "es-entity.h"
+#include "es-mesh-registry.h"
 #include "mash-data-loader.h"
 
 #define ES_MESH_RENDERER(p) ((MeshRenderer *)(p))
 
 typedef struct _MeshRenderer MeshRenderer;
+typedef struct _MeshRendererLoad MeshRendererLoad;
+
+typedef void (*MeshRendererLoadCallback) (MeshRenderer *renderer,
+                                          const GError *error,
+                                          void         *user_data);
 
 struct _MeshRenderer
 {
   Component component;
+  EsMeshAsset *asset;
+  /* Owned by the asset */
   CoglPrimitive *primitive;
   MashData *mesh_data;
   CoglPipeline *pipeline;
+  /* Set while the mesh data is loaded asynchronously */
+  MeshRendererLoad *load;
 };
 
 Component *     es_mesh_renderer_new_from_file      (const char   *file,
                                                      CoglPipeline *pipeline);
+Component *     es_mesh_renderer_new_from_file_async
+                                                    (const char   *file,
+                                                     CoglPipeline *pipeline,
+                                                     MeshRendererLoadCallback callback,
+                                                     void         *user_data);
 Component *     es_mesh_renderer_new_from_template  (const char   *name,
                                                      CoglPipeline *pipeline);
 
@@ -0,0 +1,677 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * An asset pack puts all the assets in one file so that starting up
+ * maps a single file instead of opening and seeking through many.
+ *
+ * The file starts with a header, followed by the index of the assets
+ * sorted by name, the names themselves and then the data of each
+ * asset aligned to 16 bytes. Each asset can be compressed with the
+ * LZ4 block format, in which case it is decompressed when it is looked
+ * up; the others are used straight from the mapping. Like the mesh
+ * cache, the pack is stored in the native byte order, which the header
+ * records.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "es-asset-pack.h"
+
+#define PACK_MAGIC      "ESASSETS"
+#define PACK_VERSION    1
+#define PACK_BYTE_ORDER 0x01020304
+#define PACK_ALIGN(x)   (((x) + 15) & ~(guint64) 15)
+
+/* The data of an asset is only compressed when it saves at least an
+ * eighth of its size */
+#define COMPRESS_MIN_GAIN(size) ((size) / 8)
+
+/* LZ4 block format constants */
+#define LZ4_MIN_MATCH      4
+#define LZ4_LAST_LITERALS  5
+#define LZ4_MATCH_LIMIT    12
+#define LZ4_MAX_OFFSET     65535
+#define LZ4_HASH_BITS      14
+/* Each byte of a block can expand to at most 255 bytes, when it is part
+ * of the run of length bytes of a long match */
+#define LZ4_MAX_RATIO      255
+
+typedef enum
+{
+  COMPRESSION_NONE,
+  COMPRESSION_LZ4
+} Compression;
+
+typedef struct
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint32 n_entries;
+  guint32 names_size;
+} PackHeader;
+
+typedef struct
+{
+  guint32 name_offset;
+  guint32 type;
+  guint32 compression;
+  guint32 padding;
+  guint64 offset;
+  guint64 size;
+  guint64 uncompressed_size;
+} PackEntry;
+
+struct _EsAssetPack
+{
+  GBytes *bytes;
+
+  const PackEntry *entries;
+  guint n_entries;
+  const char *names;
+};
+
+typedef struct
+{
+  char *name;
+  EsAssetType type;
+  Compression compression;
+  GBytes *bytes;
+  gsize uncompressed_size;
+} WriterEntry;
+
+struct _EsAssetPackWriter
+{
+  /* WriterEntries */
+  GPtrArray *entries;
+};
+
+static EsAssetPack *default_pack;
+
+static gboolean
+check_pack (EsAssetPack *pack,
+            gsize        names_size,
+            gsize        length)
+{
+  guint64 data_start;
+  guint i;
+
+  data_start = PACK_ALIGN (sizeof (PackHeader) +
+                           pack->n_entries * (guint64) sizeof (PackEntry));
+
+  for (i = 0; i < pack->n_entries; i++)
+    {
+      const PackEntry *entry = pack->entries + i;
+
+      /* The names must be terminated in the table and the index must be
+       * sorted for the lookups. The uncompressed size is what gets
+       * allocated so it must be possible to decompress to it */
+      if (entry->offset < data_start ||
+          entry->offset > length ||
+          entry->size > length - entry->offset ||
+          entry->compression > COMPRESSION_LZ4 ||
+          (entry->compression == COMPRESSION_NONE &&
+           entry->uncompressed_size != entry->size) ||
+          (entry->compression == COMPRESSION_LZ4 &&
+           (entry->uncompressed_size > entry->size * LZ4_MAX_RATIO ||
+            entry->uncompressed_size > G_MAXSIZE)) ||
+          entry->name_offset >= names_size ||
+          (i > 0 &&
+           strcmp (pack->names + pack->entries[i - 1].name_offset,
+                   pack->names + entry->name_offset) >= 0))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * es_asset_pack_open:
+ * @filename: The name of a file written by es_asset_pack_writer_save()
+ * @error: Return location for an error or %NULL
+ *
+ * Maps the pack. The whole file is read ahead sequentially as most of
+ * the assets will be needed at startup.
+ *
+ * Return value: The pack or %NULL if it can't be read.
+ */
+EsAssetPack *
+es_asset_pack_open (const char  *filename,
+                    GError     **error)
+{
+  const PackHeader *header;
+  EsAssetPack *pack;
+  GMappedFile *file;
+  const char *contents;
+  gsize length, names_end;
+
+  if ((file = g_mapped_file_new (filename, FALSE, error)) == NULL)
+    return NULL;
+
+  contents = g_mapped_file_get_contents (file);
+  length = g_mapped_file_get_length (file);
+  header = (const PackHeader *) contents;
+
+  if (length < sizeof (PackHeader) ||
+      memcmp (header->magic, PACK_MAGIC, sizeof (header->magic)) ||
+      header->version != PACK_VERSION ||
+      header->byte_order != PACK_BYTE_ORDER)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "%s is not an asset pack for this machine", filename);
+      g_mapped_file_unref (file);
+      return NULL;
+    }
+
+#if defined(HAVE_MADVISE) && defined(MADV_WILLNEED)
+  madvise ((void *) contents, length, MADV_WILLNEED);
+#endif
+
+  pack = g_slice_new (EsAssetPack);
+  pack->bytes = g_bytes_new_with_free_func (contents, length,
+                                            (GDestroyNotify)
+                                            g_mapped_file_unref,
+                                            file);
+  pack->entries = (const PackEntry *) (contents + sizeof (PackHeader));
+  pack->n_entries = header->n_entries;
+  pack->names = (const char *) (pack->entries + pack->n_entries);
+
+  names_end = (sizeof (PackHeader) +
+               pack->n_entries * (guint64) sizeof (PackEntry) +
+               header->names_size);
+
+  if (names_end > length ||
+      header->names_size == 0 ||
+      pack->names[header->names_size - 1] != '\0' ||
+      !check_pack (pack, header->names_size, length))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "The asset pack %s is corrupted", filename);
+      es_asset_pack_free (pack);
+      return NULL;
+    }
+
+  return pack;
+}
+
+void
+es_asset_pack_free (EsAssetPack *pack)
+{
+  if (pack == default_pack)
+    default_pack = NULL;
+
+  g_bytes_unref (pack->bytes);
+  g_slice_free (EsAssetPack, pack);
+}
+
+/* Adds the extra bytes of a length of 15 or more */
+static gboolean
+lz4_read_length (const guint8 **ip,
+                 const guint8  *src_end,
+                 gsize         *length)
+{
+  guint8 byte;
+
+  do
+    {
+      if (*ip >= src_end)
+        return FALSE;
+      byte = *(*ip)++;
+      *length += byte;
+    }
+  while (byte == 255);
+
+  return TRUE;
+}
+
+static gboolean
+lz4_decompress (const guint8 *src,
+                gsize         src_size,
+                guint8       *dst,
+                gsize         dst_size)
+{
+  const guint8 *ip = src, *src_end = src + src_size;
+  guint8 *op = dst, *dst_end = dst + dst_size;
+
+  while (ip < src_end)
+    {
+      guint token = *ip++;
+      gsize length = token >> 4, offset;
+      const guint8 *match;
+
+      if (length == 15 && !lz4_read_length (&ip, src_end, &length))
+        return FALSE;
+
+      if (length > (gsize) (src_end - ip) || length > (gsize) (dst_end - op))
+        return FALSE;
+      memcpy (op, ip, length);
+      op += length;
+      ip += length;
+
+      /* The last sequence only has literals */
+      if (ip == src_end)
+        break;
+
+      if (src_end - ip < 2)
+        return FALSE;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (gsize) (op - dst))
+        return FALSE;
+
+      length = token & 15;
+      if (length == 15 && !lz4_read_length (&ip, src_end, &length))
+        return FALSE;
+      length += LZ4_MIN_MATCH;
+
+      if (length > (gsize) (dst_end - op))
+        return FALSE;
+
+      /* The match can overlap what it produces */
+      match = op - offset;
+      while (length--)
+        *op++ = *match++;
+    }
+
+  return op == dst_end;
+}
+
+/*
+ * es_asset_pack_lookup:
+ * @pack: A pack or %NULL
+ * @name: The name the asset was added with
+ * @type: The expected type of the asset
+ *
+ * Looks an asset up with a binary search of the index. The bytes of an
+ * uncompressed asset point into the mapping of the pack and keep it
+ * alive.
+ *
+ * Return value: The data of the asset or %NULL if @pack doesn't have an
+ *   asset called @name with the type @type.
+ */
+GBytes *
+es_asset_pack_lookup (EsAssetPack *pack,
+                      const char  *name,
+                      EsAssetType  type)
+{
+  const PackEntry *entry = NULL;
+  guint low = 0, high;
+  guint8 *data;
+
+  if (pack == NULL)
+    return NULL;
+
+  high = pack->n_entries;
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+      int cmp = strcmp (name, pack->names + pack->entries[middle].name_offset);
+
+      if (cmp == 0)
+        {
+          entry = pack->entries + middle;
+          break;
+        }
+      else if (cmp < 0)
+        high = middle;
+      else
+        low = middle + 1;
+    }
+
+  if (entry == NULL || entry->type != type)
+    return NULL;
+
+  if (entry->compression == COMPRESSION_NONE)
+    return g_bytes_new_from_bytes (pack->bytes, entry->offset, entry->size);
+
+  data = g_try_malloc (entry->uncompressed_size);
+  if (data == NULL)
+    {
+      g_warning ("Not enough memory to decompress the asset %s of the pack",
+                 name);
+      return NULL;
+    }
+
+  if (!lz4_decompress ((const guint8 *) g_bytes_get_data (pack->bytes, NULL) +
+                       entry->offset, entry->size,
+                       data, entry->uncompressed_size))
+    {
+      g_warning ("The asset %s of the pack is corrupted", name);
+      g_free (data);
+      return NULL;
+    }
+
+  return g_bytes_new_take (data, entry->uncompressed_size);
+}
+
+/*
+ * es_asset_pack_set_default:
+ * @pack: A pack or %NULL
+ *
+ * Makes the loaders look the assets up in @pack before reading files.
+ * The pack isn't owned by the loaders and must be set before any load
+ * is started.
+ */
+void
+es_asset_pack_set_default (EsAssetPack *pack)
+{
+  default_pack = pack;
+}
+
+EsAssetPack *
+es_asset_pack_get_default (void)
+{
+  return default_pack;
+}
+
+EsAssetPackWriter *
+es_asset_pack_writer_new (void)
+{
+  EsAssetPackWriter *writer = g_slice_new (EsAssetPackWriter);
+
+  writer->entries = g_ptr_array_new ();
+
+  return writer;
+}
+
+static void
+writer_entry_free (WriterEntry *entry)
+{
+  g_free (entry->name);
+  g_bytes_unref (entry->bytes);
+  g_slice_free (WriterEntry, entry);
+}
+
+void
+es_asset_pack_writer_free (EsAssetPackWriter *writer)
+{
+  g_ptr_array_foreach (writer->entries, (GFunc) writer_entry_free, NULL);
+  g_ptr_array_free (writer->entries, TRUE);
+  g_slice_free (EsAssetPackWriter, writer);
+}
+
+static guint8 *
+lz4_write_length (guint8 *op,
+                  gsize   length)
+{
+  while (length >= 255)
+    {
+      *op++ = 255;
+      length -= 255;
+    }
+  *op++ = length;
+
+  return op;
+}
+
+static guint8 *
+lz4_write_sequence (guint8       *op,
+                    const guint8 *literals,
+                    gsize         n_literals,
+                    gsize         offset,
+                    gsize         match_length)
+{
+  guint8 *token = op++;
+
+  *token = MIN (n_literals, 15) << 4;
+  if (n_literals >= 15)
+    op = lz4_write_length (op, n_literals - 15);
+  memcpy (op, literals, n_literals);
+  op += n_literals;
+
+  if (match_length > 0)
+    {
+      *op++ = offset & 0xff;
+      *op++ = offset >> 8;
+
+      match_length -= LZ4_MIN_MATCH;
+      *token |= MIN (match_length, 15);
+      if (match_length >= 15)
+        op = lz4_write_length (op, match_length - 15);
+    }
+
+  return op;
+}
+
+static guint32
+lz4_read32 (const guint8 *p)
+{
+  guint32 value;
+
+  memcpy (&value, p, sizeof (value));
+
+  return value;
+}
+
+/* Greedy compression with a hash table of the last position of each
+ * 4 bytes sequence. @dst must hold @size + @size / 255 + 16 bytes */
+static gsize
+lz4_compress (const guint8 *src,
+              gsize         size,
+              guint8       *dst)
+{
+  gsize *table = g_new0 (gsize, 1 << LZ4_HASH_BITS);
+  gsize anchor = 0, ip = 0;
+  guint8 *op = dst;
+
+  /* The last match has to start LZ4_MATCH_LIMIT bytes before the end
+   * and the last LZ4_LAST_LITERALS bytes are always literals */
+  while (size >= LZ4_MATCH_LIMIT && ip <= size - LZ4_MATCH_LIMIT)
+    {
+      guint32 sequence = lz4_read32 (src + ip);
+      guint hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+      gsize candidate = table[hash];
+
+      /* The positions are stored plus one so that 0 means empty */
+      table[hash] = ip + 1;
+
+      if (candidate > 0 &&
+          ip - (candidate - 1) <= LZ4_MAX_OFFSET &&
+          lz4_read32 (src + candidate - 1) == sequence)
+        {
+          gsize match = candidate - 1;
+          gsize length = LZ4_MIN_MATCH;
+
+          while (ip + length < size - LZ4_LAST_LITERALS &&
+                 src[match + length] == src[ip + length])
+            length++;
+
+          op = lz4_write_sequence (op, src + anchor, ip - anchor,
+                                   ip - match, length);
+          ip += length;
+          anchor = ip;
+        }
+      else
+        ip++;
+    }
+
+  op = lz4_write_sequence (op, src + anchor, size - anchor, 0, 0);
+
+  g_free (table);
+
+  return op - dst;
+}
+
+/*
+ * es_asset_pack_writer_add:
+ * @writer: A writer
+ * @name: The name the asset will be looked up with
+ * @type: The type of the asset
+ * @bytes: The data of the asset
+ * @compress: Whether to try compressing the data
+ *
+ * Adds an asset to the pack. Compressed data is only kept when it is
+ * noticeably smaller, so already compressed files such as JPEG images
+ * are stored as they are.
+ */
+void
+es_asset_pack_writer_add (EsAssetPackWriter *writer,
+                          const char        *name,
+                          EsAssetType        type,
+                          GBytes            *bytes,
+                          gboolean           compress)
+{
+  WriterEntry *entry = g_slice_new (WriterEntry);
+  gsize size;
+  const guint8 *data = g_bytes_get_data (bytes, &size);
+
+  entry->name = g_strdup (name);
+  entry->type = type;
+  entry->uncompressed_size = size;
+  entry->compression = COMPRESSION_NONE;
+  entry->bytes = g_bytes_ref (bytes);
+
+  if (compress && size > 0)
+    {
+      guint8 *compressed = g_malloc (size + size / 255 + 16);
+      gsize compressed_size = lz4_compress (data, size, compressed);
+
+      if (compressed_size < size - COMPRESS_MIN_GAIN (size))
+        {
+          g_bytes_unref (entry->bytes);
+          entry->bytes = g_bytes_new_take (g_realloc (compressed,
+                                                      compressed_size),
+                                           compressed_size);
+          entry->compression = COMPRESSION_LZ4;
+        }
+      else
+        g_free (compressed);
+    }
+
+  g_ptr_array_add (writer->entries, entry);
+}
+
+static int
+compare_entries (gconstpointer a,
+                 gconstpointer b)
+{
+  const WriterEntry *entry_a = *(const WriterEntry **) a;
+  const WriterEntry *entry_b = *(const WriterEntry **) b;
+
+  return strcmp (entry_a->name, entry_b->name);
+}
+
+/*
+ * es_asset_pack_writer_save:
+ * @writer: A writer
+ * @filename: The name of the pack
+ * @error: Return location for an error or %NULL
+ *
+ * Writes all the assets added to @writer. The file is replaced
+ * atomically.
+ *
+ * Return value: %TRUE if the pack was written.
+ */
+gboolean
+es_asset_pack_writer_save (EsAssetPackWriter  *writer,
+                           const char         *filename,
+                           GError            **error)
+{
+  GPtrArray *entries = writer->entries;
+  PackHeader *header;
+  PackEntry *pack_entries;
+  GString *names;
+  guint64 offset;
+  gsize length;
+  char *contents;
+  gboolean ret;
+  guint i;
+
+  g_ptr_array_sort (entries, compare_entries);
+
+  names = g_string_new (NULL);
+  for (i = 0; i < entries->len; i++)
+    {
+      WriterEntry *entry = g_ptr_array_index (entries, i);
+
+      if (i > 0 &&
+          !strcmp (entry->name,
+                   ((WriterEntry *) g_ptr_array_index (entries, i - 1))->name))
+        {
+          g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_EXIST,
+                       "The asset %s was added twice", entry->name);
+          g_string_free (names, TRUE);
+          return FALSE;
+        }
+
+      g_string_append_len (names, entry->name, strlen (entry->name) + 1);
+    }
+  /* An empty pack still has a terminated table */
+  if (names->len == 0)
+    g_string_append_c (names, '\0');
+
+  offset = PACK_ALIGN (sizeof (PackHeader) +
+                       entries->len * (guint64) sizeof (PackEntry) +
+                       names->len);
+  length = offset;
+  for (i = 0; i < entries->len; i++)
+    {
+      WriterEntry *entry = g_ptr_array_index (entries, i);
+
+      length = PACK_ALIGN (length) + g_bytes_get_size (entry->bytes);
+    }
+
+  contents = g_malloc0 (length);
+  header = (PackHeader *) contents;
+  memcpy (header->magic, PACK_MAGIC, sizeof (header->magic));
+  header->version = PACK_VERSION;
+  header->byte_order = PACK_BYTE_ORDER;
+  header->n_entries = entries->len;
+  header->names_size = names->len;
+
+  pack_entries = (PackEntry *) (contents + sizeof (PackHeader));
+  memcpy (pack_entries + entries->len, names->str, names->len);
+
+  for (i = 0; i < entries->len; i++)
+    {
+      WriterEntry *entry = g_ptr_array_index (entries, i);
+      PackEntry *pack_entry = pack_entries + i;
+      gsize size;
+      const void *data = g_bytes_get_data (entry->bytes, &size);
+
+      pack_entry->name_offset = (i == 0 ? 0 :
+                                 pack_entries[i - 1].name_offset +
+                                 strlen (((WriterEntry *)
+                                          g_ptr_array_index (entries, i - 1))
+                                         ->name) + 1);
+      pack_entry->type = entry->type;
+      pack_entry->compression = entry->compression;
+      pack_entry->offset = PACK_ALIGN (offset);
+      pack_entry->size = size;
+      pack_entry->uncompressed_size = entry->uncompressed_size;
+
+      memcpy (contents + pack_entry->offset, data, size);
+      offset = pack_entry->offset + size;
+    }
+
+  ret = g_file_set_contents (filename, contents, length, error);
+
+  g_free (contents);
+  g_string_free (names, TRUE);
+
+  return ret;
+}
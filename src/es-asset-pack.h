@@ -0,0 +1,67 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ES_ASSET_PACK_H__
+#define __ES_ASSET_PACK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Name of the pack wonderbar opens at startup, if there is one */
+#define ES_ASSET_PACK_DEFAULT_FILENAME "wonderbar.pack"
+
+typedef enum
+{
+  /* Anything else, as it was on disk */
+  ES_ASSET_DATA,
+  /* A processed model, in the layout of the mesh cache */
+  ES_ASSET_MESH,
+  /* An image file, as it was on disk */
+  ES_ASSET_TEXTURE
+} EsAssetType;
+
+typedef struct _EsAssetPack       EsAssetPack;
+typedef struct _EsAssetPackWriter EsAssetPackWriter;
+
+EsAssetPack *       es_asset_pack_open          (const char        *filename,
+                                                 GError           **error);
+void                es_asset_pack_free          (EsAssetPack       *pack);
+
+GBytes *            es_asset_pack_lookup        (EsAssetPack       *pack,
+                                                 const char        *name,
+                                                 EsAssetType        type);
+
+void                es_asset_pack_set_default   (EsAssetPack       *pack);
+EsAssetPack *       es_asset_pack_get_default   (void);
+
+EsAssetPackWriter * es_asset_pack_writer_new    (void);
+void                es_asset_pack_writer_add    (EsAssetPackWriter *writer,
+                                                 const char        *name,
+                                                 EsAssetType        type,
+                                                 GBytes            *bytes,
+                                                 gboolean           compress);
+gboolean            es_asset_pack_writer_save   (EsAssetPackWriter *writer,
+                                                 const char        *filename,
+                                                 GError           **error);
+void                es_asset_pack_writer_free   (EsAssetPackWriter *writer);
+
+G_END_DECLS
+
+#endif /* __ES_ASSET_PACK_H__ */
@@ -0,0 +1,366 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Buffer arenas pack the vertices or the indices of many meshes into a
+ * few large buffers instead of creating a buffer object per mesh, so
+ * that meshes sharing a vertex format also share the bound buffer.
+ *
+ * An arena is a list of pages, each page being a Cogl buffer with a
+ * list of free blocks sorted by offset. Ranges are allocated first fit,
+ * starting from the oldest page so the live ranges stay packed at the
+ * front. Freed ranges are merged with their free neighbours and a page
+ * whose last range is freed is given back. The live ranges are never
+ * moved: Cogl can't copy between buffers and the data isn't kept on the
+ * CPU side.
+ */
+
+#include <string.h>
+
+#include "es-buffer-arena.h"
+#include "es-main.h"
+
+/* Number of ranges that can be tied to the lifetime of an object */
+#define MAX_RANGES_PER_OBJECT 4
+
+typedef struct
+{
+  size_t offset;
+  size_t size;
+} FreeBlock;
+
+struct _EsBufferPage
+{
+  CoglBuffer *buffer;
+  size_t size;
+  /* FreeBlocks sorted by offset */
+  GList *free_blocks;
+  unsigned int n_ranges;
+};
+
+struct _EsBufferArena
+{
+  EsBufferArenaType type;
+  /* Oldest first */
+  GList *pages;
+};
+
+static GHashTable *format_arenas;
+static EsBufferArena *index_arena;
+
+static CoglUserDataKey range_keys[MAX_RANGES_PER_OBJECT];
+
+static EsBufferArena *
+es_buffer_arena_new (EsBufferArenaType type)
+{
+  EsBufferArena *arena = g_slice_new0 (EsBufferArena);
+
+  arena->type = type;
+
+  return arena;
+}
+
+/*
+ * es_buffer_arena_get_for_format:
+ * @format: A string describing a vertex format
+ *
+ * Gets the arena of the attribute buffers holding the vertices with
+ * the layout described by @format. Only the vertices with the same
+ * layout share buffers so that drawing them doesn't need new vertex
+ * array setups.
+ */
+EsBufferArena *
+es_buffer_arena_get_for_format (const char *format)
+{
+  EsBufferArena *arena;
+
+  if (G_UNLIKELY (format_arenas == NULL))
+    format_arenas = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, NULL);
+
+  arena = g_hash_table_lookup (format_arenas, format);
+  if (arena == NULL)
+    {
+      arena = es_buffer_arena_new (ES_BUFFER_ARENA_ATTRIBUTES);
+      g_hash_table_insert (format_arenas, g_strdup (format), arena);
+    }
+
+  return arena;
+}
+
+EsBufferArena *
+es_buffer_arena_get_for_indices (void)
+{
+  if (G_UNLIKELY (index_arena == NULL))
+    index_arena = es_buffer_arena_new (ES_BUFFER_ARENA_INDICES);
+
+  return index_arena;
+}
+
+static FreeBlock *
+free_block_new (size_t offset,
+                size_t size)
+{
+  FreeBlock *block = g_slice_new (FreeBlock);
+
+  block->offset = offset;
+  block->size = size;
+
+  return block;
+}
+
+static EsBufferPage *
+es_buffer_page_new (EsBufferArena *arena,
+                    size_t         size)
+{
+  CoglContext *context = es_get_cogl_context ();
+  EsBufferPage *page;
+
+  page = g_slice_new0 (EsBufferPage);
+  page->size = size;
+  page->free_blocks = g_list_prepend (NULL, free_block_new (0, size));
+
+  if (arena->type == ES_BUFFER_ARENA_ATTRIBUTES)
+    page->buffer = COGL_BUFFER (cogl_attribute_buffer_new (context, size,
+                                                           NULL));
+  else
+    page->buffer = COGL_BUFFER (cogl_index_buffer_new (context, size));
+
+  arena->pages = g_list_append (arena->pages, page);
+
+  return page;
+}
+
+static void
+es_buffer_page_free (EsBufferArena *arena,
+                     EsBufferPage  *page)
+{
+  GList *l;
+
+  for (l = page->free_blocks; l; l = l->next)
+    g_slice_free (FreeBlock, l->data);
+  g_list_free (page->free_blocks);
+
+  cogl_object_unref (page->buffer);
+
+  arena->pages = g_list_remove (arena->pages, page);
+  g_slice_free (EsBufferPage, page);
+}
+
+static gboolean
+es_buffer_page_alloc (EsBufferPage *page,
+                      size_t        size,
+                      size_t        alignment,
+                      size_t       *offset)
+{
+  GList *l;
+
+  for (l = page->free_blocks; l; l = l->next)
+    {
+      FreeBlock *block = l->data;
+      size_t aligned, end;
+
+      aligned = (block->offset + alignment - 1) / alignment * alignment;
+      end = block->offset + block->size;
+
+      if (aligned + size > end)
+        continue;
+
+      if (aligned > block->offset)
+        {
+          /* Keep the padding free */
+          block->size = aligned - block->offset;
+          if (aligned + size < end)
+            page->free_blocks =
+              g_list_insert_before (page->free_blocks, l->next,
+                                    free_block_new (aligned + size,
+                                                    end - aligned - size));
+        }
+      else if (aligned + size < end)
+        {
+          block->offset += size;
+          block->size -= size;
+        }
+      else
+        {
+          page->free_blocks = g_list_delete_link (page->free_blocks, l);
+          g_slice_free (FreeBlock, block);
+        }
+
+      *offset = aligned;
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+es_buffer_page_release (EsBufferPage *page,
+                        size_t        offset,
+                        size_t        size)
+{
+  GList *l, *prev = NULL;
+  FreeBlock *block = NULL;
+
+  for (l = page->free_blocks; l; prev = l, l = l->next)
+    if (((FreeBlock *) l->data)->offset > offset)
+      break;
+
+  if (prev)
+    block = prev->data;
+
+  /* Merge with the previous block if they touch */
+  if (block && block->offset + block->size == offset)
+    {
+      block->size += size;
+    }
+  else
+    {
+      page->free_blocks = g_list_insert_before (page->free_blocks, l,
+                                                free_block_new (offset, size));
+      prev = l ? l->prev : g_list_last (page->free_blocks);
+      block = prev->data;
+    }
+
+  /* And with the next one */
+  if (l && block->offset + block->size == ((FreeBlock *) l->data)->offset)
+    {
+      FreeBlock *next = l->data;
+
+      block->size += next->size;
+      page->free_blocks = g_list_delete_link (page->free_blocks, l);
+      g_slice_free (FreeBlock, next);
+    }
+}
+
+/*
+ * es_buffer_arena_alloc:
+ * @arena: An #EsBufferArena
+ * @size: The size of the range
+ * @alignment: The alignment of the offset of the range
+ *
+ * Allocates a range of @size bytes. The buffer of the range is shared
+ * with other ranges so it must only be written with
+ * cogl_buffer_set_data() at the offset of the range.
+ *
+ * Return value: A new #EsBufferRange
+ */
+EsBufferRange *
+es_buffer_arena_alloc (EsBufferArena *arena,
+                       size_t         size,
+                       size_t         alignment)
+{
+  EsBufferRange *range;
+  EsBufferPage *page = NULL;
+  size_t offset = 0;
+  GList *l;
+
+  alignment = MAX (alignment, 1);
+
+  for (l = arena->pages; l; l = l->next)
+    if (es_buffer_page_alloc (l->data, size, alignment, &offset))
+      {
+        page = l->data;
+        break;
+      }
+
+  if (page == NULL)
+    {
+      page = es_buffer_page_new (arena, MAX (size, ES_BUFFER_ARENA_PAGE_SIZE));
+      es_buffer_page_alloc (page, size, alignment, &offset);
+    }
+
+  page->n_ranges++;
+
+  range = g_slice_new (EsBufferRange);
+  range->arena = arena;
+  range->page = page;
+  range->buffer = page->buffer;
+  range->offset = offset;
+  range->size = size;
+
+  return range;
+}
+
+void
+es_buffer_range_free (EsBufferRange *range)
+{
+  EsBufferPage *page = range->page;
+
+  es_buffer_page_release (page, range->offset, range->size);
+
+  /* Give the empty pages back */
+  if (--page->n_ranges == 0)
+    es_buffer_page_free (range->arena, page);
+
+  g_slice_free (EsBufferRange, range);
+}
+
+static void
+range_destroy_cb (void *user_data)
+{
+  es_buffer_range_free (user_data);
+}
+
+/*
+ * es_buffer_range_free_with_object:
+ * @range: An #EsBufferRange
+ * @object: A #CoglObject
+ *
+ * Frees @range when @object is destroyed, typically the primitive
+ * drawing from the range.
+ */
+void
+es_buffer_range_free_with_object (EsBufferRange *range,
+                                  void          *object)
+{
+  int i;
+
+  for (i = 0; i < MAX_RANGES_PER_OBJECT; i++)
+    if (cogl_object_get_user_data (object, &range_keys[i]) == NULL)
+      {
+        cogl_object_set_user_data (object, &range_keys[i],
+                                   range, range_destroy_cb);
+        return;
+      }
+
+  g_warn_if_reached ();
+}
+
+void
+es_buffer_arena_get_stats (EsBufferArena      *arena,
+                           EsBufferArenaStats *stats)
+{
+  GList *l, *b;
+
+  memset (stats, 0, sizeof (*stats));
+
+  for (l = arena->pages; l; l = l->next)
+    {
+      EsBufferPage *page = l->data;
+
+      stats->n_pages++;
+      stats->n_ranges += page->n_ranges;
+      stats->allocated_bytes += page->size;
+      stats->used_bytes += page->size;
+
+      for (b = page->free_blocks; b; b = b->next)
+        stats->used_bytes -= ((FreeBlock *) b->data)->size;
+    }
+}
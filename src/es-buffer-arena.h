@@ -0,0 +1,78 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ES_BUFFER_ARENA_H__
+#define __ES_BUFFER_ARENA_H__
+
+#include <glib.h>
+
+#include <cogl/cogl.h>
+
+G_BEGIN_DECLS
+
+/* Size of the buffers the arenas sub-allocate from. Larger requests
+ * get a buffer of their own */
+#define ES_BUFFER_ARENA_PAGE_SIZE (4 * 1024 * 1024)
+
+typedef enum
+{
+  ES_BUFFER_ARENA_ATTRIBUTES,
+  ES_BUFFER_ARENA_INDICES
+} EsBufferArenaType;
+
+typedef struct _EsBufferArena EsBufferArena;
+typedef struct _EsBufferPage  EsBufferPage;
+
+typedef struct
+{
+  EsBufferArena *arena;
+  EsBufferPage *page;
+
+  /* A CoglAttributeBuffer or a CoglIndexBuffer depending on the type
+   * of the arena */
+  CoglBuffer *buffer;
+  size_t offset;
+  size_t size;
+} EsBufferRange;
+
+typedef struct
+{
+  unsigned int n_pages;
+  unsigned int n_ranges;
+  size_t allocated_bytes;
+  size_t used_bytes;
+} EsBufferArenaStats;
+
+EsBufferArena * es_buffer_arena_get_for_format  (const char        *format);
+EsBufferArena * es_buffer_arena_get_for_indices (void);
+
+EsBufferRange * es_buffer_arena_alloc           (EsBufferArena     *arena,
+                                                 size_t             size,
+                                                 size_t             alignment);
+void            es_buffer_range_free            (EsBufferRange     *range);
+void            es_buffer_range_free_with_object
+                                                (EsBufferRange     *range,
+                                                 void              *object);
+
+void            es_buffer_arena_get_stats       (EsBufferArena     *arena,
+                                                 EsBufferArenaStats *stats);
+
+G_END_DECLS
+
+#endif /* __ES_BUFFER_ARENA_H__ */
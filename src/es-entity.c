@@ -20,6 +20,20 @@
 #include "components/es-mesh-renderer.h"
 #include "es-entity.h"
 
+static const EsProperty entity_properties[] =
+{
+  ES_PROPERTY_DEFINE ("x", ES_PROPERTY_TYPE_FLOAT,
+                      Entity, position.x, ENTITY_FLAG_DIRTY),
+  ES_PROPERTY_DEFINE ("y", ES_PROPERTY_TYPE_FLOAT,
+                      Entity, position.y, ENTITY_FLAG_DIRTY),
+  ES_PROPERTY_DEFINE ("z", ES_PROPERTY_TYPE_FLOAT,
+                      Entity, position.z, ENTITY_FLAG_DIRTY),
+  ES_PROPERTY_DEFINE ("position", ES_PROPERTY_TYPE_VEC3,
+                      Entity, position, ENTITY_FLAG_DIRTY),
+  ES_PROPERTY_DEFINE ("rotation", ES_PROPERTY_TYPE_QUATERNION,
+                      Entity, rotation, ENTITY_FLAG_DIRTY)
+};
+
 void es_entity_init (Entity *entity)
 {
   entity->position.x = 0.0f;
@@ -115,6 +129,19 @@ es_entity_get_transform (Entity *entity)
   return &entity->transform;
 }
 
+/*
+ * es_entity_find_property:
+ * @name: "x", "y", "z", "position" or "rotation"
+ *
+ * Returns: the property of the entities named @name, or %NULL
+ */
+const EsProperty *
+es_entity_find_property (const char *name)
+{
+  return es_property_find (entity_properties,
+                           G_N_ELEMENTS (entity_properties), name);
+}
+
 void
 es_entity_add_component (Entity    *entity,
                          Component *component)
@@ -24,6 +24,8 @@
 
 #include <cogl/cogl.h>
 
+#include "es-property.h"
+
 #define ES_COMPONENT(p) ((Component *)(p))
 
 typedef struct _component Component;
@@ -113,6 +115,8 @@ void                    es_entity_rotate_y_axis (Entity *entity,
 void                    es_entity_rotate_z_axis (Entity *entity,
                                                  float   z_angle);
 
+const EsProperty *      es_entity_find_property (const char *name);
+
 CoglPipeline *          es_entity_get_pipeline  (Entity *entity);
 Component *             es_entity_get_component (Entity        *entity,
                                                  ComponentType  type);
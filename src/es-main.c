@@ -25,6 +25,9 @@
 
 #include "es-entity.h"
 #include "es-components.h"
+#include "es-upload-queue.h"
+#include "es-asset-pack.h"
+#include "es-texture-registry.h"
 
 #ifndef COGL_VERSION_CHECK
 #define COGL_VERSION_CHECK(a,b,c) (FALSE)
@@ -33,6 +36,10 @@
 #define USER_ENTITY 2
 #define N_ENTITIES  4
 
+/* How often to check for the asynchronous loads to complete, in
+   micro seconds */
+#define LOAD_POLL_INTERVAL 16000
+
 typedef struct
 {
   CoglFramebuffer *fb;
@@ -52,7 +59,7 @@ typedef struct
   CoglPipeline *shadow_map_tex;
 
   /* debug */
-  CoglTexture *uv_debug;
+  EsTextureAsset *uv_debug;
 } Cube;
 
 static Cube cube;
@@ -170,6 +177,9 @@ draw (Cube *cube)
 
   time = es_get_current_time ();
 
+  /* all the animations are evaluated in one go */
+  es_animation_clip_update_all (time);
+
   for (i = 0; i < N_ENTITIES; i++)
     {
       Entity *entity = &cube->entities[i];
@@ -500,6 +510,20 @@ main (int argc, char **argv)
 
   memset (&cube, 0, sizeof(Cube));
 
+  /* All the assets come from the pack when there is one */
+  if (g_file_test (ES_ASSET_PACK_DEFAULT_FILENAME, G_FILE_TEST_EXISTS))
+    {
+      EsAssetPack *pack = es_asset_pack_open (ES_ASSET_PACK_DEFAULT_FILENAME,
+                                              &error);
+
+      if (pack == NULL)
+        {
+          g_warning ("Could not open the asset pack: %s", error->message);
+          g_clear_error (&error);
+        }
+      es_asset_pack_set_default (pack);
+    }
+
   /*
    * Setup SDL/Cogl
    */
@@ -535,14 +559,12 @@ main (int argc, char **argv)
   /* timer for the world time */
   timer = g_timer_new ();
 
-  /* load the debug uv grid */
-  cube.uv_debug = cogl_texture_new_from_file ("uvgrid.jpg",
-                                              COGL_TEXTURE_NO_ATLAS |
-                                              COGL_TEXTURE_NO_SLICING,
-                                              COGL_PIXEL_FORMAT_ANY,
-                                              &error);
-  if (error)
-    g_warning ("Could not load uv debug texture: %s", error->message);
+  /* the debug uv grid is only decoded if something uses it */
+  cube.uv_debug = es_texture_registry_get_file ("uvgrid.jpg",
+                                                ES_TEXTURE_LOAD_COMPACT,
+                                                COGL_TEXTURE_NO_ATLAS |
+                                                COGL_TEXTURE_NO_SLICING,
+                                                COGL_PIXEL_FORMAT_ANY);
 
   /*
    * Setup shadow mapping
@@ -578,7 +600,9 @@ main (int argc, char **argv)
   /* Hook the shadow sampling */
   root_pipeline = create_diffuse_specular_material ();
   cogl_pipeline_set_layer_texture (root_pipeline, 7, cube.shadow_map);
-  /* cogl_pipeline_set_layer_texture (root_pipeline, 7, cube.uv_debug); */
+  /* cogl_pipeline_set_layer_texture (root_pipeline, 7,
+                                      es_texture_asset_get_texture
+                                      (cube.uv_debug)); */
 
   cogl_pipeline_set_layer_wrap_mode_s (root_pipeline,
                                        7,
@@ -683,8 +707,7 @@ main (int argc, char **argv)
   component = es_animation_clip_new (2000);
   es_animation_clip_add_float (ES_ANIMATION_CLIP (component),
                                &cube.entities[USER_ENTITY + 1],
-                               FLOAT_GETTER (es_entity_get_x),
-                               FLOAT_SETTER (es_entity_set_x),
+                               es_entity_find_property ("x"),
                                5.0f);
   es_animation_clip_start (ES_ANIMATION_CLIP (component));
 
@@ -703,8 +726,7 @@ main (int argc, char **argv)
     component = es_animation_clip_new (5000);
     es_animation_clip_add_quaternion (ES_ANIMATION_CLIP (component),
                                       &cube.entities[USER_ENTITY + 1],
-                                      QUATERNION_GETTER (es_entity_get_rotation),
-                                      QUATERNION_SETTER (es_entity_set_rotation),
+                                      es_entity_find_property ("rotation"),
                                       &end_rotation);
 
     es_animation_clip_start (ES_ANIMATION_CLIP (component));
@@ -744,12 +766,34 @@ main (int argc, char **argv)
          fds */
       g_assert (n_poll_fds == 0);
 
+      /* The asynchronous loads complete in the GLib main context which
+         can't wake up SDL, so poll it while some are pending. This
+         also keeps the frames coming while the upload queue drains */
+      if ((mash_data_get_n_pending_loads () > 0 ||
+           es_texture_registry_get_n_pending_loads () > 0) &&
+          (timeout == -1 || timeout > LOAD_POLL_INTERVAL))
+        timeout = LOAD_POLL_INTERVAL;
+      if (g_main_context_pending (NULL))
+        timeout = 0;
+
       if (wait_event_with_timeout (&cube, &event, timeout))
         do
           handle_event (&cube, &event);
         while (SDL_PollEvent (&event));
 
       cogl_poll_dispatch (context, poll_fds, n_poll_fds);
+
+      /* Hand the meshes and the textures that have finished loading
+         to the upload queue, then upload a frame worth of data and
+         show it */
+      if (g_main_context_pending (NULL) || !es_upload_queue_is_empty ())
+        {
+          while (g_main_context_iteration (NULL, FALSE));
+
+          es_upload_queue_dispatch ();
+
+          draw (&cube);
+        }
     }
 
   return EXIT_SUCCESS;
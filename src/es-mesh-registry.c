@@ -0,0 +1,393 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The mesh registry makes sure each mesh is only loaded and uploaded
+ * once, however many components use it. Assets are keyed by file name
+ * or template name and are unloaded when their last reference goes
+ * away.
+ */
+
+#include "es-mesh-registry.h"
+#include "es-main.h"
+#include "es-asset-pack.h"
+#include "es-buffer-arena.h"
+#include "es-upload-queue.h"
+
+struct _EsMeshAsset
+{
+  int ref_count;
+  char *key;
+
+  /* A template has a primitive, a file has mesh data */
+  CoglPrimitive *primitive;
+  MashData *mesh_data;
+  size_t n_bytes;
+
+  /* Callbacks waiting for an asynchronous load */
+  gboolean loading;
+  GSList *waiters;
+};
+
+typedef struct
+{
+  EsMeshAssetReadyFunc ready;
+  void *user_data;
+} Waiter;
+
+/* Assets currently registered. The table doesn't own them */
+static GHashTable *assets;
+static size_t resident_bytes;
+
+static GBytes *
+lookup_packed_mesh (const char *filename)
+{
+  return es_asset_pack_lookup (es_asset_pack_get_default (),
+                               filename, ES_ASSET_MESH);
+}
+
+static CoglBuffer *
+alloc_arena_buffer (MashDataBufferType type,
+                    const char        *format,
+                    gsize              size,
+                    gsize              alignment,
+                    gsize             *offset,
+                    gpointer          *range)
+{
+  EsBufferArena *arena;
+  EsBufferRange *arena_range;
+
+  if (type == MASH_DATA_BUFFER_INDICES)
+    arena = es_buffer_arena_get_for_indices ();
+  else
+    arena = es_buffer_arena_get_for_format (format);
+
+  arena_range = es_buffer_arena_alloc (arena, size, alignment);
+
+  *offset = arena_range->offset;
+  *range = arena_range;
+
+  return arena_range->buffer;
+}
+
+static void
+free_arena_buffer_with_object (gpointer range,
+                               gpointer object)
+{
+  es_buffer_range_free_with_object (range, object);
+}
+
+static void
+queue_buffer_upload (CoglBuffer             *buffer,
+                     gsize                   offset,
+                     gconstpointer           data,
+                     gsize                   size,
+                     MashDataUploadDoneFunc  done,
+                     gpointer                user_data)
+{
+  es_upload_queue_add_buffer (buffer, offset, data, size, done, user_data);
+}
+
+/* The meshes are taken from the asset pack when it has them, share the
+ * buffer arenas and are uploaded by the upload queue */
+static void
+set_mash_backend (void)
+{
+  MashDataBackend backend;
+
+  backend.context = es_get_cogl_context ();
+  backend.lookup_mesh = lookup_packed_mesh;
+  backend.alloc_buffer = alloc_arena_buffer;
+  backend.free_buffer_with_object = free_arena_buffer_with_object;
+  backend.upload_buffer = queue_buffer_upload;
+
+  mash_data_set_backend (&backend);
+}
+
+static EsMeshAsset *
+lookup_asset (const char *key)
+{
+  EsMeshAsset *asset;
+
+  if (G_UNLIKELY (assets == NULL))
+    {
+      assets = g_hash_table_new (g_str_hash, g_str_equal);
+      set_mash_backend ();
+    }
+
+  asset = g_hash_table_lookup (assets, key);
+  if (asset)
+    es_mesh_asset_ref (asset);
+
+  return asset;
+}
+
+static EsMeshAsset *
+register_asset (const char *key)
+{
+  EsMeshAsset *asset;
+
+  asset = g_slice_new0 (EsMeshAsset);
+  asset->ref_count = 1;
+  asset->key = g_strdup (key);
+
+  g_hash_table_insert (assets, asset->key, asset);
+
+  return asset;
+}
+
+static void
+unregister_asset (EsMeshAsset *asset)
+{
+  /* A failed load may have been replaced by a new attempt */
+  if (g_hash_table_lookup (assets, asset->key) == asset)
+    g_hash_table_remove (assets, asset->key);
+}
+
+static void
+account_asset (EsMeshAsset *asset,
+               size_t       n_bytes)
+{
+  asset->n_bytes = n_bytes;
+  resident_bytes += n_bytes;
+}
+
+EsMeshAsset *
+es_mesh_asset_ref (EsMeshAsset *asset)
+{
+  asset->ref_count++;
+
+  return asset;
+}
+
+void
+es_mesh_asset_unref (EsMeshAsset *asset)
+{
+  if (--asset->ref_count > 0)
+    return;
+
+  unregister_asset (asset);
+
+  resident_bytes -= asset->n_bytes;
+
+  if (asset->primitive)
+    cogl_object_unref (asset->primitive);
+  if (asset->mesh_data)
+    g_object_unref (asset->mesh_data);
+
+  g_free (asset->key);
+  g_slice_free (EsMeshAsset, asset);
+}
+
+/*
+ * es_mesh_registry_get_file:
+ * @filename: The file to load
+ * @error: Return location for an error or %NULL
+ *
+ * Gets a new reference on the asset of @filename, loading it if it is
+ * not registered yet. The returned asset may still be loading if it was
+ * requested with es_mesh_registry_get_file_async() first.
+ *
+ * Return value: The asset or %NULL if the load failed
+ */
+EsMeshAsset *
+es_mesh_registry_get_file (const char  *filename,
+                           GError     **error)
+{
+  EsMeshAsset *asset;
+  char *key;
+
+  key = g_strconcat ("file:", filename, NULL);
+  asset = lookup_asset (key);
+
+  if (asset == NULL)
+    {
+      asset = register_asset (key);
+      asset->mesh_data = mash_data_new ();
+
+      if (!mash_data_load (asset->mesh_data, ES_MESH_REGISTRY_LOAD_FLAGS,
+                           filename, error))
+        {
+          es_mesh_asset_unref (asset);
+          asset = NULL;
+        }
+      else
+        account_asset (asset, mash_data_get_memory_size (asset->mesh_data));
+    }
+
+  g_free (key);
+
+  return asset;
+}
+
+static void
+asset_loaded_cb (MashData     *data,
+                 const GError *error,
+                 gpointer      user_data)
+{
+  EsMeshAsset *asset = user_data;
+  GSList *waiters, *l;
+
+  asset->loading = FALSE;
+
+  if (error)
+    {
+      /* Let the next request try again */
+      unregister_asset (asset);
+      g_object_unref (asset->mesh_data);
+      asset->mesh_data = NULL;
+    }
+  else
+    account_asset (asset, mash_data_get_memory_size (data));
+
+  /* The callbacks can add new waiters or release the asset */
+  waiters = g_slist_reverse (asset->waiters);
+  asset->waiters = NULL;
+
+  for (l = waiters; l; l = l->next)
+    {
+      Waiter *waiter = l->data;
+
+      waiter->ready (asset, error, waiter->user_data);
+      g_slice_free (Waiter, waiter);
+    }
+  g_slist_free (waiters);
+
+  /* Drop the reference held by the load */
+  es_mesh_asset_unref (asset);
+}
+
+/*
+ * es_mesh_registry_get_file_async:
+ * @filename: The file to load
+ *
+ * Gets a new reference on the asset of @filename, starting to load it
+ * in the background if it is not registered yet. Use
+ * es_mesh_asset_add_ready_callback() to know when a loading asset is
+ * ready.
+ *
+ * Return value: The asset
+ */
+EsMeshAsset *
+es_mesh_registry_get_file_async (const char *filename)
+{
+  EsMeshAsset *asset;
+  char *key;
+
+  key = g_strconcat ("file:", filename, NULL);
+  asset = lookup_asset (key);
+
+  if (asset == NULL)
+    {
+      asset = register_asset (key);
+      asset->mesh_data = mash_data_new ();
+      asset->loading = TRUE;
+
+      mash_data_load_async (asset->mesh_data, ES_MESH_REGISTRY_LOAD_FLAGS,
+                            filename, asset_loaded_cb,
+                            es_mesh_asset_ref (asset));
+    }
+
+  g_free (key);
+
+  return asset;
+}
+
+/*
+ * es_mesh_registry_get_template:
+ * @name: The name of the template
+ * @create: Function building the primitive of the template
+ *
+ * Gets a new reference on the asset of the template @name, calling
+ * @create if it is not registered yet.
+ *
+ * Return value: The asset
+ */
+EsMeshAsset *
+es_mesh_registry_get_template (const char         *name,
+                               EsMeshTemplateFunc  create)
+{
+  EsMeshAsset *asset;
+  size_t n_bytes;
+  char *key;
+
+  key = g_strconcat ("template:", name, NULL);
+  asset = lookup_asset (key);
+
+  if (asset == NULL)
+    {
+      asset = register_asset (key);
+      asset->primitive = create (&n_bytes);
+      account_asset (asset, n_bytes);
+    }
+
+  g_free (key);
+
+  return asset;
+}
+
+void
+es_mesh_registry_get_stats (EsMeshRegistryStats *stats)
+{
+  stats->n_assets = assets ? g_hash_table_size (assets) : 0;
+  stats->n_bytes = resident_bytes;
+}
+
+gboolean
+es_mesh_asset_is_loading (EsMeshAsset *asset)
+{
+  return asset->loading;
+}
+
+/*
+ * es_mesh_asset_add_ready_callback:
+ * @asset: A loading asset
+ * @ready: Function to call once the asset is loaded
+ * @user_data: Data to pass to @ready
+ *
+ * @ready is called once the load of @asset finishes, successfully or
+ * not.
+ */
+void
+es_mesh_asset_add_ready_callback (EsMeshAsset          *asset,
+                                  EsMeshAssetReadyFunc  ready,
+                                  void                 *user_data)
+{
+  Waiter *waiter;
+
+  g_return_if_fail (asset->loading);
+
+  waiter = g_slice_new (Waiter);
+  waiter->ready = ready;
+  waiter->user_data = user_data;
+
+  asset->waiters = g_slist_prepend (asset->waiters, waiter);
+}
+
+CoglPrimitive *
+es_mesh_asset_get_primitive (EsMeshAsset *asset)
+{
+  return asset->primitive;
+}
+
+MashData *
+es_mesh_asset_get_mesh_data (EsMeshAsset *asset)
+{
+  return asset->mesh_data;
+}
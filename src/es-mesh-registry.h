@@ -0,0 +1,74 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ES_MESH_REGISTRY_H__
+#define __ES_MESH_REGISTRY_H__
+
+#include <glib.h>
+
+#include <cogl/cogl.h>
+
+#include "mash-data.h"
+
+G_BEGIN_DECLS
+
+/* Flags used to load the meshes of the registry */
+#define ES_MESH_REGISTRY_LOAD_FLAGS (MASH_DATA_WELD | MASH_DATA_OPTIMIZE | \
+                                     MASH_DATA_QUANTIZE | MASH_DATA_CACHE | \
+                                     MASH_DATA_GENERATE_NORMALS |           \
+                                     MASH_DATA_CREASE_NORMALS)
+
+typedef struct _EsMeshAsset EsMeshAsset;
+
+typedef void (*EsMeshAssetReadyFunc) (EsMeshAsset  *asset,
+                                      const GError *error,
+                                      void         *user_data);
+
+/* Builds the primitive of a template and returns the size of its data
+ * in @n_bytes */
+typedef CoglPrimitive * (*EsMeshTemplateFunc) (size_t *n_bytes);
+
+typedef struct
+{
+  unsigned int n_assets;
+  size_t n_bytes;
+} EsMeshRegistryStats;
+
+EsMeshAsset *   es_mesh_registry_get_file           (const char   *filename,
+                                                     GError      **error);
+EsMeshAsset *   es_mesh_registry_get_file_async     (const char   *filename);
+EsMeshAsset *   es_mesh_registry_get_template       (const char   *name,
+                                                     EsMeshTemplateFunc create);
+
+void            es_mesh_registry_get_stats          (EsMeshRegistryStats *stats);
+
+EsMeshAsset *   es_mesh_asset_ref                   (EsMeshAsset  *asset);
+void            es_mesh_asset_unref                 (EsMeshAsset  *asset);
+
+gboolean        es_mesh_asset_is_loading            (EsMeshAsset  *asset);
+void            es_mesh_asset_add_ready_callback    (EsMeshAsset  *asset,
+                                                     EsMeshAssetReadyFunc ready,
+                                                     void         *user_data);
+
+CoglPrimitive * es_mesh_asset_get_primitive         (EsMeshAsset  *asset);
+MashData *      es_mesh_asset_get_mesh_data         (EsMeshAsset  *asset);
+
+G_END_DECLS
+
+#endif /* __ES_MESH_REGISTRY_H__ */
@@ -0,0 +1,61 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "es-property.h"
+
+/*
+ * es_property_find:
+ * @properties: The properties of a type of object
+ * @n_properties: The number of properties
+ * @name: The name of the property to look for
+ *
+ * Returns: the property named @name, or %NULL if there is none
+ */
+const EsProperty *
+es_property_find (const EsProperty *properties,
+                  int               n_properties,
+                  const char       *name)
+{
+  int i;
+
+  for (i = 0; i < n_properties; i++)
+    if (strcmp (properties[i].name, name) == 0)
+      return &properties[i];
+
+  return NULL;
+}
+
+/* The number of floats making the value of @property */
+int
+es_property_get_size (const EsProperty *property)
+{
+  switch (property->type)
+    {
+    case ES_PROPERTY_TYPE_FLOAT:
+      return 1;
+    case ES_PROPERTY_TYPE_VEC3:
+      return 3;
+    case ES_PROPERTY_TYPE_QUATERNION:
+      return 4;
+    }
+
+  g_return_val_if_reached (0);
+}
@@ -0,0 +1,79 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A property describes a field of an entity or of a component that can
+ * be written to directly, by the animations for instance, instead of
+ * going through a setter. It records where the value lives in the
+ * object and which of the object's flags to set once it has changed,
+ * so that a writer changing several properties of the same object
+ * marks it only once.
+ */
+
+#ifndef __ES_PROPERTY_H__
+#define __ES_PROPERTY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  ES_PROPERTY_TYPE_FLOAT,
+  ES_PROPERTY_TYPE_VEC3,        /* 3 floats */
+  ES_PROPERTY_TYPE_QUATERNION   /* CoglQuaternion */
+} EsPropertyType;
+
+typedef struct
+{
+  const char *name;
+  EsPropertyType type;
+
+  /* Offset of the value in the object */
+  size_t offset;
+
+  /* Offset of the uint32_t flags of the object, and the flags to set
+     there when the value changes */
+  size_t flags_offset;
+  uint32_t dirty_flags;
+} EsProperty;
+
+/* Describes @member of @object_type, which has a flags member */
+#define ES_PROPERTY_DEFINE(name, type, object_type, member, dirty_flags) \
+  { name, type, offsetof (object_type, member),                          \
+    offsetof (object_type, flags), dirty_flags }
+
+#define ES_PROPERTY_GET_POINTER(object, property)                        \
+  ((void *) ((char *) (object) + (property)->offset))
+
+#define ES_PROPERTY_GET_FLAGS(object, property)                          \
+  ((uint32_t *) ((char *) (object) + (property)->flags_offset))
+
+const EsProperty *  es_property_find      (const EsProperty *properties,
+                                           int               n_properties,
+                                           const char       *name);
+
+int                 es_property_get_size  (const EsProperty *property);
+
+G_END_DECLS
+
+#endif /* __ES_PROPERTY_H__ */
@@ -0,0 +1,346 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The texture cache stores images converted to 16 bits per pixel so
+ * that the next loads can map them and upload them as they are,
+ * without decoding the image file. Opaque images are stored as RGB 565
+ * and the others as premultiplied RGBA 4444, both dithered with an
+ * ordered 4x4 matrix to hide the banding. That halves the memory the
+ * textures take on the GPU, where 24 bits textures are usually padded
+ * to 32 bits.
+ *
+ * A cache file is made of a header followed by the rows of pixels,
+ * aligned to 16 bytes. The files live in the user cache directory and
+ * are named after a checksum of the contents of the image file, so an
+ * image that changes gets a new cache file, and the same image shipped
+ * under several names or in the asset pack shares one. The data is
+ * stored in the native byte order and the header records it.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <glib/gstdio.h>
+
+#include "es-texture-cache.h"
+#include "es-texture.h"
+
+#define ES_TEXTURE_CACHE_MAGIC      "ESTEXTUR"
+#define ES_TEXTURE_CACHE_VERSION    1
+#define ES_TEXTURE_CACHE_BYTE_ORDER 0x01020304
+#define ES_TEXTURE_CACHE_ALIGN(x)   (((x) + 15) & ~(guint64) 15)
+
+typedef struct
+{
+  char magic[8];
+  guint32 version;
+  guint32 byte_order;
+
+  guint32 format;
+  guint32 width;
+  guint32 height;
+  guint32 rowstride;
+  guint64 pixels_offset;
+} EsTextureCacheHeader;
+
+struct _EsTextureCache
+{
+  GBytes *bytes;
+  EsTextureCacheImage image;
+};
+
+/* Thresholds of the ordered dithering */
+static const guint8 dither_matrix[4][4] =
+  {
+    { 0, 8, 2, 10 },
+    { 12, 4, 14, 6 },
+    { 3, 11, 1, 9 },
+    { 15, 7, 13, 5 }
+  };
+
+static char *
+get_path (const char *checksum)
+{
+  char *basename, *path;
+
+  basename = g_strconcat (checksum, ".texture", NULL);
+  path = g_build_filename (g_get_user_cache_dir (), "wonderbar", "textures",
+                           basename, NULL);
+  g_free (basename);
+
+  return path;
+}
+
+/*
+ * es_texture_cache_get_checksum:
+ * @source: The contents of an image file
+ *
+ * Return value: The key of the cache file of @source.
+ */
+char *
+es_texture_cache_get_checksum (GBytes *source)
+{
+  const guchar *data;
+  gsize size;
+
+  data = g_bytes_get_data (source, &size);
+
+  return g_compute_checksum_for_data (G_CHECKSUM_SHA1, data, size);
+}
+
+static gboolean
+check_header (const EsTextureCacheHeader *header,
+              gsize                       length)
+{
+  if (memcmp (header->magic, ES_TEXTURE_CACHE_MAGIC, sizeof (header->magic)) ||
+      header->version != ES_TEXTURE_CACHE_VERSION ||
+      header->byte_order != ES_TEXTURE_CACHE_BYTE_ORDER ||
+      (header->format != COGL_PIXEL_FORMAT_RGB_565 &&
+       header->format != COGL_PIXEL_FORMAT_RGBA_4444_PRE))
+    return FALSE;
+
+  /* Don't trust the sizes of a truncated or corrupted file */
+  if (header->width == 0 || header->height == 0 ||
+      header->width > G_MAXINT / 2 || header->height > G_MAXINT ||
+      header->rowstride < header->width * 2 ||
+      header->pixels_offset < sizeof (EsTextureCacheHeader) ||
+      header->pixels_offset +
+      (guint64) header->rowstride * header->height > length)
+    return FALSE;
+
+  return TRUE;
+}
+
+/*
+ * es_texture_cache_open:
+ * @checksum: The checksum of an image file
+ *
+ * Maps the cache file of the image with @checksum if there is one.
+ *
+ * Return value: The cache or %NULL if there is no valid cache file.
+ */
+EsTextureCache *
+es_texture_cache_open (const char *checksum)
+{
+  const EsTextureCacheHeader *header;
+  EsTextureCache *cache;
+  GMappedFile *file;
+  const char *contents;
+  gsize length;
+  char *path;
+
+  path = get_path (checksum);
+  file = g_mapped_file_new (path, FALSE, NULL);
+  g_free (path);
+
+  if (file == NULL)
+    return NULL;
+
+  contents = g_mapped_file_get_contents (file);
+  length = g_mapped_file_get_length (file);
+  header = (const EsTextureCacheHeader *) contents;
+
+  if (length < sizeof (EsTextureCacheHeader) ||
+      !check_header (header, length))
+    {
+      g_mapped_file_unref (file);
+      return NULL;
+    }
+
+  cache = g_slice_new (EsTextureCache);
+  cache->bytes = g_bytes_new_with_free_func (contents, length,
+                                             (GDestroyNotify)
+                                             g_mapped_file_unref,
+                                             file);
+  cache->image.width = header->width;
+  cache->image.height = header->height;
+  cache->image.format = header->format;
+  cache->image.rowstride = header->rowstride;
+  cache->image.pixels = (const uint8_t *) contents + header->pixels_offset;
+
+  return cache;
+}
+
+const EsTextureCacheImage *
+es_texture_cache_get_image (EsTextureCache *cache)
+{
+  return &cache->image;
+}
+
+void
+es_texture_cache_close (EsTextureCache *cache)
+{
+  g_bytes_unref (cache->bytes);
+  g_slice_free (EsTextureCache, cache);
+}
+
+/*
+ * es_texture_cache_save:
+ * @checksum: The checksum of an image file
+ * @image: The image converted by es_texture_cache_encode()
+ * @error: Return location for an error or %NULL
+ *
+ * Writes the cache file of the image with @checksum. The file is
+ * replaced atomically so concurrent loads never see a partial file.
+ *
+ * Return value: %TRUE if the cache was written.
+ */
+gboolean
+es_texture_cache_save (const char                 *checksum,
+                       const EsTextureCacheImage  *image,
+                       GError                    **error)
+{
+  EsTextureCacheHeader *header;
+  char *path, *dirname, *contents;
+  gsize pixels_size, length;
+  gboolean ret;
+
+  pixels_size = (gsize) image->rowstride * image->height;
+  length = ES_TEXTURE_CACHE_ALIGN (sizeof (*header)) + pixels_size;
+
+  contents = g_malloc0 (length);
+  header = (EsTextureCacheHeader *) contents;
+
+  memcpy (header->magic, ES_TEXTURE_CACHE_MAGIC, sizeof (header->magic));
+  header->version = ES_TEXTURE_CACHE_VERSION;
+  header->byte_order = ES_TEXTURE_CACHE_BYTE_ORDER;
+  header->format = image->format;
+  header->width = image->width;
+  header->height = image->height;
+  header->rowstride = image->rowstride;
+  header->pixels_offset = ES_TEXTURE_CACHE_ALIGN (sizeof (*header));
+
+  memcpy (contents + header->pixels_offset, image->pixels, pixels_size);
+
+  path = get_path (checksum);
+  dirname = g_path_get_dirname (path);
+
+  if (g_mkdir_with_parents (dirname, 0755) == -1)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Could not create the cache directory %s", dirname);
+      ret = FALSE;
+    }
+  else
+    ret = g_file_set_contents (path, contents, length, error);
+
+  g_free (dirname);
+  g_free (path);
+  g_free (contents);
+
+  return ret;
+}
+
+/* Reduces @value to @max levels, with the dithering threshold @d
+   deciding whether it is rounded up or down */
+#define QUANTIZE(value, max, d) \
+  (((value) * (max) * 16 + (d) * 255) / (255 * 16))
+
+static void
+encode_rgb_565 (const guint8 *src,
+                guint16      *dst,
+                int           width,
+                int           n_channels,
+                const guint8 *dither)
+{
+  int x;
+
+  for (x = 0; x < width; x++, src += n_channels)
+    {
+      unsigned int d = dither[x & 3];
+
+      dst[x] = ((QUANTIZE (src[0], 31, d) << 11) |
+                (QUANTIZE (src[1], 63, d) << 5) |
+                QUANTIZE (src[2], 31, d));
+    }
+}
+
+/* The pixels have to be premultiplied already. Using the same threshold
+   for all the components keeps the colors below the alpha */
+static void
+encode_rgba_4444 (const guint8 *src,
+                  guint16      *dst,
+                  int           width,
+                  const guint8 *dither)
+{
+  int x;
+
+  for (x = 0; x < width; x++, src += 4)
+    {
+      unsigned int d = dither[x & 3];
+
+      dst[x] = ((QUANTIZE (src[0], 15, d) << 12) |
+                (QUANTIZE (src[1], 15, d) << 8) |
+                (QUANTIZE (src[2], 15, d) << 4) |
+                QUANTIZE (src[3], 15, d));
+    }
+}
+
+/*
+ * es_texture_cache_encode:
+ * @pixbuf: A decoded image
+ * @image: Return location for the converted image
+ *
+ * Converts @pixbuf to the format of the cache. The alpha of @pixbuf is
+ * premultiplied in place. This doesn't use Cogl and can be called from
+ * any thread.
+ *
+ * Return value: The pixels of @image, to free with g_free().
+ */
+uint8_t *
+es_texture_cache_encode (GdkPixbuf           *pixbuf,
+                         EsTextureCacheImage *image)
+{
+  int src_rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  int n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gboolean has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+  const guint8 *src;
+  uint8_t *pixels;
+  int y;
+
+  if (has_alpha)
+    es_texture_premultiply (pixbuf);
+
+  image->width = gdk_pixbuf_get_width (pixbuf);
+  image->height = gdk_pixbuf_get_height (pixbuf);
+  image->format = (has_alpha ?
+                   COGL_PIXEL_FORMAT_RGBA_4444_PRE :
+                   COGL_PIXEL_FORMAT_RGB_565);
+  /* Keep the rows aligned on 4 bytes, the default of GL */
+  image->rowstride = (image->width * 2 + 3) & ~3;
+
+  pixels = g_malloc ((gsize) image->rowstride * image->height);
+  src = gdk_pixbuf_get_pixels (pixbuf);
+
+  for (y = 0; y < image->height; y++, src += src_rowstride)
+    {
+      guint16 *dst = (guint16 *) (pixels + (gsize) y * image->rowstride);
+
+      if (has_alpha)
+        encode_rgba_4444 (src, dst, image->width, dither_matrix[y & 3]);
+      else
+        encode_rgb_565 (src, dst, image->width, n_channels,
+                        dither_matrix[y & 3]);
+    }
+
+  image->pixels = pixels;
+
+  return pixels;
+}
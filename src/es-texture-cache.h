@@ -0,0 +1,62 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ES_TEXTURE_CACHE_H__
+#define __ES_TEXTURE_CACHE_H__
+
+#include <stdint.h>
+
+#include <glib.h>
+
+#include <cogl/cogl.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EsTextureCache EsTextureCache;
+
+/*
+ * EsTextureCacheImage:
+ *
+ * Pixels ready to be uploaded as they are.
+ */
+typedef struct
+{
+  int width, height;
+  CoglPixelFormat format;
+  int rowstride;
+  const uint8_t *pixels;
+} EsTextureCacheImage;
+
+char                      *es_texture_cache_get_checksum (GBytes *source);
+
+EsTextureCache            *es_texture_cache_open         (const char *checksum);
+const EsTextureCacheImage *es_texture_cache_get_image    (EsTextureCache *cache);
+void                       es_texture_cache_close        (EsTextureCache *cache);
+
+gboolean                   es_texture_cache_save         (const char *checksum,
+                                                          const EsTextureCacheImage *image,
+                                                          GError **error);
+
+uint8_t                   *es_texture_cache_encode       (GdkPixbuf *pixbuf,
+                                                          EsTextureCacheImage *image);
+
+G_END_DECLS
+
+#endif /* __ES_TEXTURE_CACHE_H__ */
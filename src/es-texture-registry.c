@@ -0,0 +1,507 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The texture registry makes sure each image is only decoded and
+ * uploaded once, and never from the frame loop. Getting an asset
+ * doesn't load anything: the image is decoded by a worker thread the
+ * first time the texture is asked for, and its rows are then uploaded
+ * by the upload queue over as many frames as needed. The texture is
+ * only handed out once it is complete.
+ *
+ * Cogl can only upload the base level of a texture so the mipmaps
+ * can't be prepared by the workers. They are generated by the GPU the
+ * first time the texture is drawn with a mipmap filter, which happens
+ * once since the texture isn't drawn before it is complete. The
+ * workers do the rest of the CPU work, premultiplying the alpha in
+ * particular, so that the pixels are uploaded without conversion.
+ *
+ * Textures loaded with %ES_TEXTURE_LOAD_COMPACT are converted to 16
+ * bits per pixel by the workers and kept in the texture cache, so that
+ * the next runs map them instead of decoding the image.
+ */
+
+#include "es-texture-registry.h"
+#include "es-texture.h"
+#include "es-texture-cache.h"
+#include "es-upload-queue.h"
+
+/* Number of threads decoding images in the background */
+#define ES_TEXTURE_REGISTRY_LOAD_THREADS 2
+
+typedef enum
+{
+  ASSET_STATE_UNLOADED,
+  ASSET_STATE_LOADING,
+  ASSET_STATE_LOADED,
+  ASSET_STATE_FAILED
+} AssetState;
+
+struct _EsTextureAsset
+{
+  int ref_count;
+  char *key;
+
+  char *filename;
+  EsTextureLoadFlags load_flags;
+  CoglTextureFlags flags;
+  CoglPixelFormat internal_format;
+
+  AssetState state;
+  CoglTexture *texture;
+  size_t n_bytes;
+
+  /* Callbacks waiting for the load */
+  GSList *waiters;
+};
+
+typedef struct
+{
+  EsTextureAssetReadyFunc ready;
+  void *user_data;
+} Waiter;
+
+typedef struct
+{
+  EsTextureAsset *asset;
+  /* Main context the load completes in */
+  GMainContext *context;
+
+  /* Result of the worker. The pixels of @image belong to one of
+     @pixbuf, @cache or @encoded */
+  EsTextureCacheImage image;
+  GdkPixbuf *pixbuf;
+  EsTextureCache *cache;
+  uint8_t *encoded;
+  GError *error;
+
+  /* Texture being uploaded by the upload queue */
+  CoglTexture *texture;
+} Load;
+
+/* Assets currently registered. The table doesn't own them */
+static GHashTable *assets;
+static size_t resident_bytes;
+static volatile gint n_pending_loads = 0;
+
+static EsTextureAsset *
+lookup_asset (const char *key)
+{
+  EsTextureAsset *asset;
+
+  if (G_UNLIKELY (assets == NULL))
+    assets = g_hash_table_new (g_str_hash, g_str_equal);
+
+  asset = g_hash_table_lookup (assets, key);
+  if (asset)
+    es_texture_asset_ref (asset);
+
+  return asset;
+}
+
+static void
+unregister_asset (EsTextureAsset *asset)
+{
+  /* A failed load may have been replaced by a new attempt */
+  if (g_hash_table_lookup (assets, asset->key) == asset)
+    g_hash_table_remove (assets, asset->key);
+}
+
+EsTextureAsset *
+es_texture_asset_ref (EsTextureAsset *asset)
+{
+  asset->ref_count++;
+
+  return asset;
+}
+
+void
+es_texture_asset_unref (EsTextureAsset *asset)
+{
+  if (--asset->ref_count > 0)
+    return;
+
+  unregister_asset (asset);
+
+  if (asset->texture)
+    {
+      resident_bytes -= asset->n_bytes;
+      cogl_object_unref (asset->texture);
+    }
+
+  g_free (asset->filename);
+  g_free (asset->key);
+  g_slice_free (EsTextureAsset, asset);
+}
+
+/*
+ * es_texture_registry_get_file:
+ * @filename: The image to load
+ * @load_flags: How to load the image
+ * @flags: Flags of the texture
+ * @internal_format: The format of the texture, usually
+ *   %COGL_PIXEL_FORMAT_ANY. It is ignored with %ES_TEXTURE_LOAD_COMPACT
+ *
+ * Gets a new reference on the asset of @filename, registering it if it
+ * isn't yet. Nothing is loaded until the texture is used, see
+ * es_texture_asset_get_texture().
+ *
+ * Return value: The asset
+ */
+EsTextureAsset *
+es_texture_registry_get_file (const char         *filename,
+                              EsTextureLoadFlags  load_flags,
+                              CoglTextureFlags    flags,
+                              CoglPixelFormat     internal_format)
+{
+  EsTextureAsset *asset;
+  char *key;
+
+  key = g_strdup_printf ("file:%s:%x:%x:%x", filename, load_flags, flags,
+                         internal_format);
+  asset = lookup_asset (key);
+
+  if (asset == NULL)
+    {
+      asset = g_slice_new0 (EsTextureAsset);
+      asset->ref_count = 1;
+      asset->key = key;
+      asset->filename = g_strdup (filename);
+      asset->load_flags = load_flags;
+      asset->flags = flags;
+      asset->internal_format = internal_format;
+
+      g_hash_table_insert (assets, asset->key, asset);
+    }
+  else
+    g_free (key);
+
+  return asset;
+}
+
+/*
+ * es_texture_registry_get_n_pending_loads:
+ *
+ * Returns the number of textures being decoded or uploaded. Like for
+ * mash_data_get_n_pending_loads(), the main context needs to be
+ * iterated for them to complete.
+ *
+ * Return value: The number of pending loads
+ */
+guint
+es_texture_registry_get_n_pending_loads (void)
+{
+  return g_atomic_int_get (&n_pending_loads);
+}
+
+void
+es_texture_registry_get_stats (EsTextureRegistryStats *stats)
+{
+  stats->n_assets = assets ? g_hash_table_size (assets) : 0;
+  stats->n_bytes = resident_bytes;
+}
+
+static void
+finish_load (Load *load)
+{
+  EsTextureAsset *asset = load->asset;
+  GSList *waiters, *l;
+
+  g_atomic_int_add (&n_pending_loads, -1);
+
+  if (load->error)
+    {
+      g_warning ("Could not load %s: %s", asset->filename,
+                 load->error->message);
+
+      /* Let the next request try again, this asset stays empty */
+      asset->state = ASSET_STATE_FAILED;
+      unregister_asset (asset);
+    }
+  else
+    {
+      asset->state = ASSET_STATE_LOADED;
+      asset->texture = load->texture;
+      asset->n_bytes = (size_t) load->image.rowstride * load->image.height;
+      resident_bytes += asset->n_bytes;
+    }
+
+  /* The callbacks can release the asset */
+  waiters = g_slist_reverse (asset->waiters);
+  asset->waiters = NULL;
+
+  for (l = waiters; l; l = l->next)
+    {
+      Waiter *waiter = l->data;
+
+      waiter->ready (asset, load->error, waiter->user_data);
+      g_slice_free (Waiter, waiter);
+    }
+  g_slist_free (waiters);
+
+  if (load->pixbuf)
+    g_object_unref (load->pixbuf);
+  if (load->cache)
+    es_texture_cache_close (load->cache);
+  g_free (load->encoded);
+  if (load->error)
+    g_error_free (load->error);
+  g_main_context_unref (load->context);
+  g_slice_free (Load, load);
+
+  /* Drop the reference held by the load */
+  es_texture_asset_unref (asset);
+}
+
+static void
+upload_done (void *user_data)
+{
+  finish_load (user_data);
+}
+
+static gboolean
+complete_load (gpointer user_data)
+{
+  Load *load = user_data;
+  EsTextureAsset *asset = load->asset;
+  CoglPixelFormat internal_format = asset->internal_format;
+
+  if (load->error)
+    {
+      finish_load (load);
+      return FALSE;
+    }
+
+  /* Store the pixels as they were prepared so that Cogl doesn't have
+     to convert them */
+  if (internal_format == COGL_PIXEL_FORMAT_ANY ||
+      (asset->load_flags & ES_TEXTURE_LOAD_COMPACT))
+    internal_format = load->image.format;
+
+  load->texture = cogl_texture_new_with_size (load->image.width,
+                                              load->image.height,
+                                              asset->flags,
+                                              internal_format);
+
+  if (load->texture == NULL)
+    {
+      g_set_error (&load->error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                   "Could not create a texture for %s", asset->filename);
+      finish_load (load);
+      return FALSE;
+    }
+
+  es_upload_queue_add_texture (load->texture,
+                               load->image.width,
+                               load->image.height,
+                               load->image.format,
+                               load->image.rowstride,
+                               load->image.pixels,
+                               upload_done,
+                               load);
+
+  return FALSE;
+}
+
+/* Uses the pixels of the decoded image as they are, only
+   premultiplying the alpha */
+static void
+use_pixbuf (Load *load)
+{
+  GdkPixbuf *pixbuf = load->pixbuf;
+
+  if (gdk_pixbuf_get_has_alpha (pixbuf))
+    {
+      es_texture_premultiply (pixbuf);
+      load->image.format = COGL_PIXEL_FORMAT_RGBA_8888_PRE;
+    }
+  else
+    load->image.format = COGL_PIXEL_FORMAT_RGB_888;
+
+  load->image.width = gdk_pixbuf_get_width (pixbuf);
+  load->image.height = gdk_pixbuf_get_height (pixbuf);
+  load->image.rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  load->image.pixels = gdk_pixbuf_get_pixels (pixbuf);
+}
+
+/* Converts the decoded image to 16 bits per pixel and caches the
+   result for the next runs */
+static void
+encode_pixbuf (Load       *load,
+               const char *checksum)
+{
+  GError *cache_error = NULL;
+
+  load->encoded = es_texture_cache_encode (load->pixbuf, &load->image);
+
+  g_object_unref (load->pixbuf);
+  load->pixbuf = NULL;
+
+  if (!es_texture_cache_save (checksum, &load->image, &cache_error))
+    {
+      g_warning ("Could not cache %s: %s",
+                 load->asset->filename, cache_error->message);
+      g_clear_error (&cache_error);
+    }
+}
+
+/* Gets the pixels of the image, without using Cogl */
+static void
+read_image (Load *load)
+{
+  EsTextureAsset *asset = load->asset;
+  char *checksum = NULL;
+  GBytes *source;
+
+  source = es_texture_read_file (asset->filename, &load->error);
+  if (source == NULL)
+    return;
+
+  if (asset->load_flags & ES_TEXTURE_LOAD_COMPACT)
+    {
+      checksum = es_texture_cache_get_checksum (source);
+      load->cache = es_texture_cache_open (checksum);
+    }
+
+  if (load->cache)
+    load->image = *es_texture_cache_get_image (load->cache);
+  else if ((load->pixbuf = es_texture_decode_bytes (source, &load->error)))
+    {
+      if (checksum)
+        encode_pixbuf (load, checksum);
+      else
+        use_pixbuf (load);
+    }
+
+  g_free (checksum);
+  g_bytes_unref (source);
+}
+
+static void
+load_thread (gpointer thread_data,
+             gpointer pool_data)
+{
+  Load *load = thread_data;
+  GSource *source;
+
+  read_image (load);
+
+  /* Hand the pixels over to the main context for the upload */
+  source = g_idle_source_new ();
+  g_source_set_callback (source, complete_load, load, NULL);
+  g_source_attach (source, load->context);
+  g_source_unref (source);
+}
+
+static GThreadPool *
+get_load_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *new_pool;
+
+      new_pool = g_thread_pool_new (load_thread, NULL,
+                                    ES_TEXTURE_REGISTRY_LOAD_THREADS,
+                                    FALSE, NULL);
+      g_once_init_leave (&pool, (gsize) new_pool);
+    }
+
+  return (GThreadPool *) pool;
+}
+
+/*
+ * es_texture_asset_load:
+ * @asset: A texture asset
+ *
+ * Starts loading @asset in the background if it isn't loaded or
+ * loading yet. The load completes from the thread-default main context
+ * of the caller, which needs to be iterated, and
+ * es_upload_queue_dispatch() then uploads the texture.
+ */
+void
+es_texture_asset_load (EsTextureAsset *asset)
+{
+  Load *load;
+
+  if (asset->state != ASSET_STATE_UNLOADED)
+    return;
+
+  asset->state = ASSET_STATE_LOADING;
+
+  load = g_slice_new0 (Load);
+  load->asset = es_texture_asset_ref (asset);
+  load->context = g_main_context_ref_thread_default ();
+
+  g_atomic_int_inc (&n_pending_loads);
+
+  g_thread_pool_push (get_load_pool (), load, NULL);
+}
+
+gboolean
+es_texture_asset_is_loading (EsTextureAsset *asset)
+{
+  return asset->state == ASSET_STATE_LOADING;
+}
+
+/*
+ * es_texture_asset_add_ready_callback:
+ * @asset: A texture asset that isn't loaded yet
+ * @ready: Function to call once the asset is loaded
+ * @user_data: Data to pass to @ready
+ *
+ * Starts loading @asset if needed. @ready is called once the load
+ * finishes, successfully or not.
+ */
+void
+es_texture_asset_add_ready_callback (EsTextureAsset          *asset,
+                                     EsTextureAssetReadyFunc  ready,
+                                     void                    *user_data)
+{
+  Waiter *waiter;
+
+  g_return_if_fail (asset->state == ASSET_STATE_UNLOADED ||
+                    asset->state == ASSET_STATE_LOADING);
+
+  waiter = g_slice_new (Waiter);
+  waiter->ready = ready;
+  waiter->user_data = user_data;
+
+  asset->waiters = g_slist_prepend (asset->waiters, waiter);
+
+  es_texture_asset_load (asset);
+}
+
+/*
+ * es_texture_asset_get_texture:
+ * @asset: A texture asset
+ *
+ * Gets the texture of @asset, starting to load it the first time.
+ *
+ * Return value: The texture or %NULL while it is loading or if the load
+ *   failed
+ */
+CoglTexture *
+es_texture_asset_get_texture (EsTextureAsset *asset)
+{
+  es_texture_asset_load (asset);
+
+  return asset->texture;
+}
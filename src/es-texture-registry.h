@@ -0,0 +1,69 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ES_TEXTURE_REGISTRY_H__
+#define __ES_TEXTURE_REGISTRY_H__
+
+#include <glib.h>
+
+#include <cogl/cogl.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  /* Store the texture with 16 bits per pixel and cache the converted
+     pixels */
+  ES_TEXTURE_LOAD_COMPACT = 1 << 0
+} EsTextureLoadFlags;
+
+typedef struct _EsTextureAsset EsTextureAsset;
+
+typedef void (*EsTextureAssetReadyFunc) (EsTextureAsset *asset,
+                                         const GError   *error,
+                                         void           *user_data);
+
+typedef struct
+{
+  unsigned int n_assets;
+  size_t n_bytes;
+} EsTextureRegistryStats;
+
+EsTextureAsset * es_texture_registry_get_file      (const char         *filename,
+                                                    EsTextureLoadFlags  load_flags,
+                                                    CoglTextureFlags    flags,
+                                                    CoglPixelFormat     internal_format);
+
+guint            es_texture_registry_get_n_pending_loads (void);
+void             es_texture_registry_get_stats     (EsTextureRegistryStats *stats);
+
+EsTextureAsset * es_texture_asset_ref              (EsTextureAsset   *asset);
+void             es_texture_asset_unref            (EsTextureAsset   *asset);
+
+void             es_texture_asset_load             (EsTextureAsset   *asset);
+gboolean         es_texture_asset_is_loading       (EsTextureAsset   *asset);
+void             es_texture_asset_add_ready_callback (EsTextureAsset *asset,
+                                                      EsTextureAssetReadyFunc ready,
+                                                      void           *user_data);
+
+CoglTexture *    es_texture_asset_get_texture      (EsTextureAsset   *asset);
+
+G_END_DECLS
+
+#endif /* __ES_TEXTURE_REGISTRY_H__ */
@@ -0,0 +1,166 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "es-texture.h"
+#include "es-asset-pack.h"
+
+/*
+ * es_texture_read_file:
+ * @filename: The name of an image file
+ * @error: Return location for an error or %NULL
+ *
+ * Gets the encoded image called @filename from the default asset pack,
+ * or maps the file itself when the pack doesn't have it.
+ *
+ * Return value: The contents of the image file or %NULL on error.
+ */
+GBytes *
+es_texture_read_file (const char  *filename,
+                      GError     **error)
+{
+  GMappedFile *file;
+  GBytes *bytes;
+
+  bytes = es_asset_pack_lookup (es_asset_pack_get_default (),
+                                filename, ES_ASSET_TEXTURE);
+  if (bytes)
+    return bytes;
+
+  if ((file = g_mapped_file_new (filename, FALSE, error)) == NULL)
+    return NULL;
+
+  return g_bytes_new_with_free_func (g_mapped_file_get_contents (file),
+                                     g_mapped_file_get_length (file),
+                                     (GDestroyNotify) g_mapped_file_unref,
+                                     file);
+}
+
+/*
+ * es_texture_decode_bytes:
+ * @bytes: The contents of an image file
+ * @error: Return location for an error or %NULL
+ *
+ * Decodes an image with gdk-pixbuf, as Cogl can only decode files.
+ * Unlike the functions creating textures, this doesn't use Cogl and can
+ * be called from any thread.
+ *
+ * Return value: The image or %NULL on error.
+ */
+GdkPixbuf *
+es_texture_decode_bytes (GBytes  *bytes,
+                         GError **error)
+{
+  GdkPixbufLoader *loader = gdk_pixbuf_loader_new ();
+  GdkPixbuf *pixbuf = NULL;
+  const guchar *data;
+  gsize size;
+
+  data = g_bytes_get_data (bytes, &size);
+
+  if (!gdk_pixbuf_loader_write (loader, data, size, error))
+    gdk_pixbuf_loader_close (loader, NULL);
+  else if (gdk_pixbuf_loader_close (loader, error))
+    pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (loader));
+
+  g_object_unref (loader);
+
+  return pixbuf;
+}
+
+/*
+ * es_texture_premultiply:
+ * @pixbuf: An image with an alpha channel
+ *
+ * Premultiplies the colors of @pixbuf by its alpha in place, as Cogl
+ * does when creating a texture from non premultiplied pixels.
+ */
+void
+es_texture_premultiply (GdkPixbuf *pixbuf)
+{
+  int width = gdk_pixbuf_get_width (pixbuf);
+  int height = gdk_pixbuf_get_height (pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  guchar *row = gdk_pixbuf_get_pixels (pixbuf);
+  int x, y;
+
+  for (y = 0; y < height; y++, row += rowstride)
+    {
+      guchar *p = row;
+
+      for (x = 0; x < width; x++, p += 4)
+        {
+          unsigned int alpha = p[3], i, t;
+
+          for (i = 0; i < 3; i++)
+            {
+              t = p[i] * alpha + 128;
+              p[i] = ((t >> 8) + t) >> 8;
+            }
+        }
+    }
+}
+
+/*
+ * es_texture_new_from_file:
+ * @filename: The name of an image file
+ * @flags: Flags of the texture
+ * @internal_format: The format of the texture, usually
+ *   %COGL_PIXEL_FORMAT_ANY
+ * @error: Return location for an error or %NULL
+ *
+ * Loads the image called @filename from the default asset pack, or from
+ * the file itself when the pack doesn't have it.
+ *
+ * Return value: The texture or %NULL on error.
+ */
+CoglTexture *
+es_texture_new_from_file (const char        *filename,
+                          CoglTextureFlags   flags,
+                          CoglPixelFormat    internal_format,
+                          GError           **error)
+{
+  CoglTexture *texture;
+  GdkPixbuf *pixbuf;
+  GBytes *bytes;
+
+  bytes = es_asset_pack_lookup (es_asset_pack_get_default (),
+                                filename, ES_ASSET_TEXTURE);
+  if (bytes == NULL)
+    return cogl_texture_new_from_file (filename, flags, internal_format,
+                                       error);
+
+  pixbuf = es_texture_decode_bytes (bytes, error);
+  g_bytes_unref (bytes);
+
+  if (pixbuf == NULL)
+    return NULL;
+
+  texture = cogl_texture_new_from_data (gdk_pixbuf_get_width (pixbuf),
+                                        gdk_pixbuf_get_height (pixbuf),
+                                        flags,
+                                        gdk_pixbuf_get_has_alpha (pixbuf) ?
+                                        COGL_PIXEL_FORMAT_RGBA_8888 :
+                                        COGL_PIXEL_FORMAT_RGB_888,
+                                        internal_format,
+                                        gdk_pixbuf_get_rowstride (pixbuf),
+                                        gdk_pixbuf_get_pixels (pixbuf));
+  g_object_unref (pixbuf);
+
+  return texture;
+}
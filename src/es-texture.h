@@ -0,0 +1,43 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ES_TEXTURE_H__
+#define __ES_TEXTURE_H__
+
+#include <glib.h>
+
+#include <cogl/cogl.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+CoglTexture * es_texture_new_from_file (const char        *filename,
+                                        CoglTextureFlags   flags,
+                                        CoglPixelFormat    internal_format,
+                                        GError           **error);
+
+GBytes *      es_texture_read_file     (const char        *filename,
+                                        GError           **error);
+GdkPixbuf *   es_texture_decode_bytes  (GBytes            *bytes,
+                                        GError           **error);
+void          es_texture_premultiply   (GdkPixbuf         *pixbuf);
+
+G_END_DECLS
+
+#endif /* __ES_TEXTURE_H__ */
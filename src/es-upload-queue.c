@@ -0,0 +1,258 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Uploading all the data of freshly loaded assets at once makes the
+ * frame that does it miss its deadline. The upload queue spreads the
+ * uploads over several frames: es_upload_queue_dispatch() is called
+ * once per frame and only uploads up to a number of bytes or for up to
+ * a given time, splitting the large buffers and textures in ranges.
+ *
+ * The data given to the queue has to stay valid until the done
+ * callback of the upload is invoked.
+ */
+
+#include <string.h>
+
+#include "es-upload-queue.h"
+
+typedef enum
+{
+  UPLOAD_BUFFER,
+  UPLOAD_TEXTURE
+} UploadType;
+
+typedef struct
+{
+  UploadType type;
+
+  CoglObject *object;
+  const uint8_t *data;
+  size_t size;
+  /* How much has already been uploaded */
+  size_t uploaded;
+
+  /* UPLOAD_BUFFER */
+  size_t offset;
+
+  /* UPLOAD_TEXTURE */
+  int width, height;
+  CoglPixelFormat format;
+  int rowstride;
+
+  EsUploadDoneFunc done;
+  void *user_data;
+} Upload;
+
+static GQueue upload_queue = G_QUEUE_INIT;
+static size_t pending_bytes;
+static size_t max_bytes = ES_UPLOAD_QUEUE_DEFAULT_MAX_BYTES;
+static int64_t max_time = ES_UPLOAD_QUEUE_DEFAULT_MAX_TIME;
+static EsUploadQueueStats last_stats;
+
+/*
+ * es_upload_queue_set_budget:
+ * @bytes: Maximum number of bytes uploaded per frame
+ * @time: Maximum time spent uploading per frame, in micro seconds
+ *
+ * At least one range is uploaded per frame, whatever the budget, so
+ * that the queue always makes progress.
+ */
+void
+es_upload_queue_set_budget (size_t  bytes,
+                            int64_t time)
+{
+  max_bytes = bytes;
+  max_time = time;
+}
+
+static void
+push_upload (Upload *upload)
+{
+  g_queue_push_tail (&upload_queue, upload);
+  pending_bytes += upload->size;
+}
+
+void
+es_upload_queue_add_buffer (CoglBuffer       *buffer,
+                            size_t            offset,
+                            const void       *data,
+                            size_t            size,
+                            EsUploadDoneFunc  done,
+                            void             *user_data)
+{
+  Upload *upload;
+
+  upload = g_slice_new0 (Upload);
+  upload->type = UPLOAD_BUFFER;
+  upload->object = cogl_object_ref (buffer);
+  upload->data = data;
+  upload->size = size;
+  upload->offset = offset;
+  upload->done = done;
+  upload->user_data = user_data;
+
+  push_upload (upload);
+}
+
+void
+es_upload_queue_add_texture (CoglTexture      *texture,
+                             int               width,
+                             int               height,
+                             CoglPixelFormat   format,
+                             int               rowstride,
+                             const uint8_t    *data,
+                             EsUploadDoneFunc  done,
+                             void             *user_data)
+{
+  Upload *upload;
+
+  upload = g_slice_new0 (Upload);
+  upload->type = UPLOAD_TEXTURE;
+  upload->object = cogl_object_ref (texture);
+  upload->data = data;
+  upload->size = (size_t) rowstride * height;
+  upload->width = width;
+  upload->height = height;
+  upload->format = format;
+  upload->rowstride = rowstride;
+  upload->done = done;
+  upload->user_data = user_data;
+
+  push_upload (upload);
+}
+
+gboolean
+es_upload_queue_is_empty (void)
+{
+  return g_queue_is_empty (&upload_queue);
+}
+
+/* Uploads the next range of @upload of at most @budget bytes and
+ * returns its size */
+static size_t
+upload_range (Upload *upload,
+              size_t  budget)
+{
+  size_t size = MIN (upload->size - upload->uploaded, budget);
+
+  if (upload->type == UPLOAD_BUFFER)
+    {
+      cogl_buffer_set_data (COGL_BUFFER (upload->object),
+                            upload->offset + upload->uploaded,
+                            upload->data + upload->uploaded,
+                            size);
+    }
+  else
+    {
+      int first_row = upload->uploaded / upload->rowstride;
+      int n_rows;
+
+      /* Textures are uploaded by bands of whole rows */
+      n_rows = MAX (size / upload->rowstride, 1);
+      n_rows = MIN (n_rows, upload->height - first_row);
+      size = (size_t) n_rows * upload->rowstride;
+
+      cogl_texture_set_region (COGL_TEXTURE (upload->object),
+                               0, 0,
+                               0, first_row,
+                               upload->width, n_rows,
+                               upload->width, n_rows,
+                               upload->format,
+                               upload->rowstride,
+                               upload->data + upload->uploaded);
+    }
+
+  upload->uploaded += size;
+
+  return size;
+}
+
+/*
+ * es_upload_queue_dispatch:
+ *
+ * Uploads the queued data within the budget of a frame. This is meant
+ * to be called once per frame, before drawing.
+ */
+void
+es_upload_queue_dispatch (void)
+{
+  EsUploadQueueStats stats;
+  int64_t start;
+
+  memset (&stats, 0, sizeof (stats));
+  start = g_get_monotonic_time ();
+
+  while (!g_queue_is_empty (&upload_queue))
+    {
+      Upload *upload = g_queue_peek_head (&upload_queue);
+      size_t budget;
+
+      /* Always upload something so that the queue is drained even with
+         a tiny budget */
+      if (stats.n_chunks > 0 &&
+          (stats.bytes >= max_bytes ||
+           g_get_monotonic_time () - start >= max_time))
+        break;
+
+      budget = ES_UPLOAD_QUEUE_CHUNK_SIZE;
+      if (stats.bytes < max_bytes)
+        budget = MIN (budget, max_bytes - stats.bytes);
+
+      stats.bytes += upload_range (upload, budget);
+      stats.n_chunks++;
+
+      if (upload->uploaded >= upload->size)
+        {
+          g_queue_pop_head (&upload_queue);
+          pending_bytes -= upload->size;
+          stats.n_completed++;
+
+          if (upload->done)
+            upload->done (upload->user_data);
+
+          cogl_object_unref (upload->object);
+          g_slice_free (Upload, upload);
+        }
+    }
+
+  stats.time = g_get_monotonic_time () - start;
+
+  last_stats = stats;
+}
+
+/*
+ * es_upload_queue_get_stats:
+ * @stats: Return location for the statistics
+ *
+ * Gets what the last call to es_upload_queue_dispatch() did and what
+ * is left in the queue.
+ */
+void
+es_upload_queue_get_stats (EsUploadQueueStats *stats)
+{
+  Upload *head;
+
+  *stats = last_stats;
+
+  /* Account for the ranges of the current upload already done */
+  head = g_queue_peek_head (&upload_queue);
+  stats->pending_bytes = pending_bytes - (head ? head->uploaded : 0);
+  stats->n_pending = g_queue_get_length (&upload_queue);
+}
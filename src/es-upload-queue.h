@@ -0,0 +1,80 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ES_UPLOAD_QUEUE_H__
+#define __ES_UPLOAD_QUEUE_H__
+
+#include <stdint.h>
+
+#include <glib.h>
+
+#include <cogl/cogl.h>
+
+G_BEGIN_DECLS
+
+/* Default budget of a frame */
+#define ES_UPLOAD_QUEUE_DEFAULT_MAX_BYTES (4 * 1024 * 1024)
+#define ES_UPLOAD_QUEUE_DEFAULT_MAX_TIME  4000 /* micro seconds */
+
+/* Large uploads are split in ranges of at most this size */
+#define ES_UPLOAD_QUEUE_CHUNK_SIZE        (256 * 1024)
+
+typedef void (*EsUploadDoneFunc) (void *user_data);
+
+typedef struct
+{
+  /* During the last dispatch */
+  size_t bytes;
+  int64_t time; /* micro seconds */
+  unsigned int n_chunks;
+  unsigned int n_completed;
+
+  /* Still in the queue */
+  size_t pending_bytes;
+  unsigned int n_pending;
+} EsUploadQueueStats;
+
+void      es_upload_queue_set_budget  (size_t max_bytes,
+                                       int64_t max_time);
+
+void      es_upload_queue_add_buffer  (CoglBuffer       *buffer,
+                                       size_t            offset,
+                                       const void       *data,
+                                       size_t            size,
+                                       EsUploadDoneFunc  done,
+                                       void             *user_data);
+
+void      es_upload_queue_add_texture (CoglTexture      *texture,
+                                       int               width,
+                                       int               height,
+                                       CoglPixelFormat   format,
+                                       int               rowstride,
+                                       const uint8_t    *data,
+                                       EsUploadDoneFunc  done,
+                                       void             *user_data);
+
+gboolean  es_upload_queue_is_empty    (void);
+
+void      es_upload_queue_dispatch    (void);
+
+void      es_upload_queue_get_stats   (EsUploadQueueStats *stats);
+
+G_END_DECLS
+
+#endif /* __ES_UPLOAD_QUEUE_H__ */
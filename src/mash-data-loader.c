@@ -38,19 +38,94 @@ G_DEFINE_ABSTRACT_TYPE (MashDataLoader, mash_data_loader, G_TYPE_OBJECT);
   (G_TYPE_INSTANCE_GET_PRIVATE ((obj), MASH_TYPE_DATA_LOADER,  \
                                 MashDataLoaderPrivate))
 
-/* reserved for future use */
 struct _MashDataLoaderPrivate
 {
+  GMainContext *upload_context;
 };
 
+static void
+mash_data_loader_finalize (GObject *object)
+{
+  MashDataLoader *self = (MashDataLoader *) object;
+
+  if (self->priv->upload_context)
+    g_main_context_unref (self->priv->upload_context);
+
+  G_OBJECT_CLASS (mash_data_loader_parent_class)->finalize (object);
+}
+
 static void
 mash_data_loader_class_init (MashDataLoaderClass *klass)
 {
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->finalize = mash_data_loader_finalize;
+
+  g_type_class_add_private (klass, sizeof (MashDataLoaderPrivate));
 }
 
 static void
 mash_data_loader_init (MashDataLoader *self)
 {
+  self->priv = MASH_DATA_LOADER_GET_PRIVATE (self);
+}
+
+/**
+ * mash_data_loader_set_upload_context:
+ * @data_loader: The #MashDataLoader instance
+ * @context: A #GMainContext or %NULL
+ *
+ * Sets the main context of the thread owning the Cogl context, from
+ * which the data streamed with %MASH_DATA_STREAM is uploaded while it
+ * is loaded. %NULL, the default, means that the loader runs in that
+ * thread and uploads the data itself.
+ * This function is not usually called by applications.
+ */
+void
+mash_data_loader_set_upload_context (MashDataLoader *data_loader,
+                                     GMainContext *context)
+{
+  MashDataLoaderPrivate *priv;
+
+  g_return_if_fail (MASH_IS_DATA_LOADER (data_loader));
+
+  priv = data_loader->priv;
+
+  if (context)
+    g_main_context_ref (context);
+  if (priv->upload_context)
+    g_main_context_unref (priv->upload_context);
+
+  priv->upload_context = context;
+}
+
+GMainContext *
+mash_data_loader_get_upload_context (MashDataLoader *data_loader)
+{
+  g_return_val_if_fail (MASH_IS_DATA_LOADER (data_loader), NULL);
+
+  return data_loader->priv->upload_context;
+}
+
+/**
+ * mash_data_loader_get_debug:
+ *
+ * Tells whether the loaders should report what they did to the data
+ * and how fast they parsed it, which is enabled by setting the
+ * MASH_DEBUG environment variable.
+ * This function is not usually called by applications.
+ *
+ * Return value: %TRUE if the loaders report their work.
+ */
+gboolean
+mash_data_loader_get_debug (void)
+{
+  static gsize debug = 0;
+
+  if (g_once_init_enter (&debug))
+    g_once_init_leave (&debug, g_getenv ("MASH_DEBUG") ? 2 : 1);
+
+  return debug == 2;
 }
 
 /**
@@ -94,3 +169,64 @@ mash_data_loader_get_data (MashDataLoader *data_loader,
 
   MASH_DATA_LOADER_GET_CLASS (data_loader)->get_data (data_loader, loader_data);
 }
+
+/**
+ * mash_data_loader_get_mesh:
+ * @data_loader: The #MashDataLoader instance
+ *
+ * Obtains the loaded data before it is uploaded, after calling
+ * mash_data_loader_load(). The data belongs to the loader and is valid
+ * until the next load or until mash_data_loader_get_data() is called.
+ * This function is not usually called by applications.
+ *
+ * Return value: The loaded data or %NULL if the loader doesn't support
+ *   it.
+ */
+const MashMeshCacheData *
+mash_data_loader_get_mesh (MashDataLoader *data_loader)
+{
+  MashDataLoaderClass *klass;
+
+  g_return_val_if_fail (MASH_IS_DATA_LOADER (data_loader), NULL);
+
+  klass = MASH_DATA_LOADER_GET_CLASS (data_loader);
+
+  if (klass->get_mesh == NULL)
+    return NULL;
+
+  return klass->get_mesh (data_loader);
+}
+
+/**
+ * mash_data_loader_upload_queued:
+ * @data_loader: The #MashDataLoader instance
+ * @done: Function called once the data is uploaded
+ * @user_data: Data to pass to @done
+ *
+ * Hands the loaded data to the @upload_buffer function of the backend,
+ * after calling mash_data_loader_load(). mash_data_loader_get_data()
+ * must not be called until @done is called. This has to be called from
+ * the thread owning the Cogl context and is not usually called by
+ * applications.
+ *
+ * Return value: %FALSE if the loader doesn't support it, in which case
+ *   @done is never called.
+ */
+gboolean
+mash_data_loader_upload_queued (MashDataLoader *data_loader,
+                                MashDataUploadDoneFunc done,
+                                gpointer user_data)
+{
+  MashDataLoaderClass *klass;
+
+  g_return_val_if_fail (MASH_IS_DATA_LOADER (data_loader), FALSE);
+
+  klass = MASH_DATA_LOADER_GET_CLASS (data_loader);
+
+  if (klass->upload_queued == NULL)
+    return FALSE;
+
+  klass->upload_queued (data_loader, done, user_data);
+
+  return TRUE;
+}
@@ -26,7 +26,7 @@
 G_BEGIN_DECLS
 
 #define MASH_TYPE_DATA_LOADER                   \
-  (mash_data_get_type())
+  (mash_data_loader_get_type())
 #define MASH_DATA_LOADER(obj)                           \
   (G_TYPE_CHECK_INSTANCE_CAST ((obj),                   \
                                MASH_TYPE_DATA_LOADER,   \
@@ -50,11 +50,18 @@ typedef struct _MashDataLoader        MashDataLoader;
 typedef struct _MashDataLoaderClass   MashDataLoaderClass;
 typedef struct _MashDataLoaderPrivate MashDataLoaderPrivate;
 typedef struct _MashDataLoaderData    MashDataLoaderData;
+typedef struct _MashMeshCacheData     MashMeshCacheData;
 
 /**
  * MashDataLoaderClass:
- * @load: Virtual used for loading the model from the file
- * @get_data: Virtual used to get the loaded data
+ * @load: Virtual used for loading the model from the file. It may be
+ *   called from a worker thread so it must not use Cogl
+ * @get_data: Virtual used to get the loaded data. It is called from the
+ *   thread owning the Cogl context and is where the data is uploaded
+ * @get_mesh: Virtual used to get the loaded data before it is uploaded,
+ *   so that the caller can upload it itself instead of calling get_data
+ * @upload_queued: Virtual used by the loaders that don't have a get_mesh
+ *   to hand the loaded data to the backend before get_data is called
  */
 struct _MashDataLoaderClass
 {
@@ -68,6 +75,10 @@ struct _MashDataLoaderClass
                      GError **error);
   void (* get_data) (MashDataLoader *data_loader,
                      MashDataLoaderData *loader_data);
+  const MashMeshCacheData *(* get_mesh) (MashDataLoader *data_loader);
+  void (* upload_queued) (MashDataLoader *data_loader,
+                          MashDataUploadDoneFunc done,
+                          gpointer user_data);
 };
 
 /**
@@ -83,6 +94,46 @@ struct _MashDataLoader
   MashDataLoaderPrivate *priv;
 };
 
+/**
+ * MashDataQuantizedAttributes:
+ * @MASH_DATA_QUANTIZED_NONE: The attributes are floats
+ * @MASH_DATA_QUANTIZED_POSITION: cogl_position_in holds 16 bits
+ *   normalized values relative to the bounding box of the data
+ * @MASH_DATA_QUANTIZED_NORMAL: cogl_normal_in holds the 2 components of
+ *   an octahedron encoded normal as normalized shorts
+ * @MASH_DATA_QUANTIZED_TEX_COORD: cogl_tex_coord0_in holds 16 bits
+ *   normalized values relative to the bounding rectangle of the texture
+ *   coordinates
+ *
+ * Attributes that have been packed when loading with %MASH_DATA_QUANTIZE
+ * and have to be decoded in the vertex shader.
+ */
+typedef enum
+  {
+    MASH_DATA_QUANTIZED_NONE = 0,
+    MASH_DATA_QUANTIZED_POSITION = 1,
+    MASH_DATA_QUANTIZED_NORMAL = 2,
+    MASH_DATA_QUANTIZED_TEX_COORD = 4
+  } MashDataQuantizedAttributes;
+
+/**
+ * MashDataQuantization:
+ * @attributes: The quantized attributes
+ * @position_scale: Scale to apply to the normalized positions
+ * @position_offset: Offset to add to the scaled positions
+ * @tex_coord_scale: Scale to apply to the normalized texture coordinates
+ * @tex_coord_offset: Offset to add to the scaled texture coordinates
+ *
+ * Describes how to decode the attributes of a quantized primitive.
+ */
+typedef struct _MashDataQuantization
+{
+  MashDataQuantizedAttributes attributes;
+
+  float position_scale[3], position_offset[3];
+  float tex_coord_scale[2], tex_coord_offset[2];
+} MashDataQuantization;
+
 /**
  * MashDataLoaderData:
  *
@@ -90,10 +141,20 @@ struct _MashDataLoader
  */
 struct _MashDataLoaderData
 {
-  CoglPrimitive *primitive;
+  /* One CoglPrimitive per submesh */
+  GPtrArray *primitives;
 
   /* Bounding cuboid of the data */
   CoglVertexP3 min_vertex, max_vertex;
+
+  /* How to decode the vertices when loaded with MASH_DATA_QUANTIZE */
+  MashDataQuantization quantization;
+
+  /* Size of the vertices and indices of the primitive in bytes */
+  gsize n_bytes;
+
+  /* Whether the normals were computed by MASH_DATA_GENERATE_NORMALS */
+  gboolean generated_normals;
 };
 
 GType mash_data_loader_get_type (void) G_GNUC_CONST;
@@ -106,6 +167,18 @@ gboolean mash_data_loader_load (MashDataLoader *self,
 void mash_data_loader_get_data (MashDataLoader *self,
                                 MashDataLoaderData *loader_data);
 
+const MashMeshCacheData *mash_data_loader_get_mesh (MashDataLoader *self);
+
+gboolean mash_data_loader_upload_queued (MashDataLoader *self,
+                                         MashDataUploadDoneFunc done,
+                                         gpointer user_data);
+
+void mash_data_loader_set_upload_context (MashDataLoader *self,
+                                          GMainContext *context);
+GMainContext *mash_data_loader_get_upload_context (MashDataLoader *self);
+
+gboolean mash_data_loader_get_debug (void);
+
 G_END_DECLS
 
 #endif /* __MASH_DATA_LOADER_H__ */
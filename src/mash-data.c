@@ -37,11 +37,16 @@
 #endif
 
 #include <glib-object.h>
+#include <glib/gstdio.h>
 #include <string.h>
+#include <errno.h>
 #include <cogl/cogl.h>
 
 #include "mash-data.h"
 #include "mash-ply-loader.h"
+#include "mash-obj-loader.h"
+#include "mash-glb-loader.h"
+#include "mash-mesh-cache.h"
 
 static void mash_data_finalize (GObject *object);
 
@@ -77,11 +82,14 @@ mash_data_free_vbos (MashData *self)
 {
   MashDataPrivate *priv = self->priv;
 
-  if (priv->loaded_data.primitive)
+  if (priv->loaded_data.primitives)
     {
-      cogl_object_unref (priv->loaded_data.primitive);
-      priv->loaded_data.primitive = NULL;
+      g_ptr_array_unref (priv->loaded_data.primitives);
+      priv->loaded_data.primitives = NULL;
     }
+
+  priv->loaded_data.n_bytes = 0;
+  priv->loaded_data.generated_normals = FALSE;
 }
 
 static void
@@ -111,6 +119,221 @@ mash_data_new (void)
   return self;
 }
 
+/* Number of threads reading and processing models in the background */
+#define MASH_DATA_LOAD_THREADS 4
+
+typedef struct _MashDataAsyncLoad MashDataAsyncLoad;
+
+struct _MashDataAsyncLoad
+{
+  MashData *data;
+  MashDataFlags flags;
+  gchar *filename;
+  MashDataLoadCallback callback;
+  gpointer user_data;
+  /* Main context the callback is invoked from */
+  GMainContext *context;
+
+  /* Results of mash_data_read() */
+  MashMeshCache *cache;
+  MashDataLoader *loader;
+  GError *error;
+
+  /* Data being uploaded by the backend */
+  const MashMeshCacheData *mesh;
+  GPtrArray *primitives;
+};
+
+static volatile gint mash_data_n_pending_loads = 0;
+
+static MashDataBackend mash_data_backend;
+
+/**
+ * mash_data_set_backend:
+ * @backend: The functions getting the meshes to the GPU or %NULL for
+ *   the defaults
+ *
+ * Sets how the models are looked up before reading their file and how
+ * their data is uploaded. @backend is copied. This has to be called
+ * before any model is loaded, it can't be changed once loads are
+ * running.
+ */
+void
+mash_data_set_backend (const MashDataBackend *backend)
+{
+  if (backend)
+    mash_data_backend = *backend;
+  else
+    memset (&mash_data_backend, 0, sizeof (mash_data_backend));
+}
+
+/**
+ * mash_data_get_backend:
+ *
+ * Return value: The backend set with mash_data_set_backend(). Its
+ *   functions may be %NULL.
+ */
+const MashDataBackend *
+mash_data_get_backend (void)
+{
+  return &mash_data_backend;
+}
+
+/* Picks the loader from the first bytes of the file so that a file
+   with a misleading name isn't given to the wrong parser. OBJ files
+   have no magic so they are still recognised by their extension. PLY
+   files must start with "ply\n" as rply rejects any other line ending.
+   @loader is left to NULL when the format is unknown */
+static gboolean
+mash_data_sniff_format (const gchar *filename,
+                        MashDataLoader **loader,
+                        GError **error)
+{
+  gchar magic[4];
+  gsize got;
+  FILE *file;
+
+  if ((file = g_fopen (filename, "rb")) == NULL)
+    {
+      gint saved_errno = errno;
+      gchar *display_name = g_filename_display_name (filename);
+
+      g_set_error (error, MASH_DATA_ERROR,
+                   MASH_DATA_ERROR_UNKNOWN,
+                   "Failed to open %s: %s",
+                   display_name, g_strerror (saved_errno));
+      g_free (display_name);
+
+      return FALSE;
+    }
+
+  got = fread (magic, 1, sizeof (magic), file);
+  fclose (file);
+
+  if (got == sizeof (magic) && !memcmp (magic, "glTF", 4))
+    *loader = g_object_new (MASH_TYPE_GLB_LOADER, NULL);
+  else if (got == sizeof (magic) && !memcmp (magic, "ply\n", 4))
+    *loader = g_object_new (MASH_TYPE_PLY_LOADER, NULL);
+  else if (g_str_has_suffix (filename, ".obj"))
+    *loader = g_object_new (MASH_TYPE_OBJ_LOADER, NULL);
+
+  return TRUE;
+}
+
+/* Gets the model from the backend, usually from an asset pack. It is
+   only used if it was processed with the same flags */
+static MashMeshCache *
+mash_data_open_packed (const gchar *filename,
+                       MashDataFlags flags)
+{
+  MashMeshCache *cache;
+  GBytes *bytes;
+
+  if (mash_data_backend.lookup_mesh == NULL)
+    return NULL;
+
+  bytes = mash_data_backend.lookup_mesh (filename);
+  if (bytes == NULL)
+    return NULL;
+
+  cache = mash_mesh_cache_new_from_bytes (bytes, flags);
+  g_bytes_unref (bytes);
+
+  return cache;
+}
+
+/* Reads and processes the model without using Cogl so that it can
+   run in any thread. On success either @cache or @loader is set with
+   data ready to be uploaded by mash_data_upload(). Streamed data is
+   uploaded from @upload_context while it is read, or directly if it is
+   NULL */
+static gboolean
+mash_data_read (MashDataFlags flags,
+                const gchar *filename,
+                GMainContext *upload_context,
+                MashMeshCache **cache,
+                MashDataLoader **loader,
+                GError **error)
+{
+  gchar *display_name;
+  gboolean ret;
+
+  *cache = NULL;
+  *loader = NULL;
+
+  /* Models from the backend were processed when they were stored */
+  if ((*cache = mash_data_open_packed (filename, flags)) != NULL)
+    return TRUE;
+
+  /* A streamed model is never whole in memory to be cached */
+  if ((flags & MASH_DATA_CACHE) && !(flags & MASH_DATA_STREAM) &&
+      (*cache = mash_mesh_cache_open (filename, flags)) != NULL)
+    return TRUE;
+
+  if (!mash_data_sniff_format (filename, loader, error))
+    return FALSE;
+
+  if (*loader != NULL)
+    {
+      mash_data_loader_set_upload_context (*loader, upload_context);
+
+      ret = mash_data_loader_load (*loader, flags, filename, error);
+
+      if (!ret)
+        {
+          g_object_unref (*loader);
+          *loader = NULL;
+        }
+    }
+  else
+    {
+      /* Unknown file format */
+
+      display_name = g_filename_display_name (filename);
+      g_set_error (error, MASH_DATA_ERROR,
+                   MASH_DATA_ERROR_UNKNOWN_FORMAT,
+                   "Unknown format for file %s",
+                   display_name);
+      g_free (display_name);
+      ret = FALSE;
+    }
+
+  return ret;
+}
+
+/* Creates the primitives from the result of mash_data_read(). This has
+   to be called from the thread owning the Cogl context. It consumes
+   @cache and @loader */
+static void
+mash_data_upload (MashData *self,
+                  MashMeshCache *cache,
+                  MashDataLoader *loader)
+{
+  MashDataPrivate *priv = self->priv;
+
+  /* Get rid of the old VBOs (if any) */
+  mash_data_free_vbos (self);
+
+  if (cache)
+    {
+      const MashMeshCacheData *data = mash_mesh_cache_get_data (cache);
+
+      priv->loaded_data.primitives = mash_mesh_cache_create_primitives (data);
+      priv->loaded_data.min_vertex = data->min_vertex;
+      priv->loaded_data.max_vertex = data->max_vertex;
+      priv->loaded_data.quantization = data->quantization;
+      priv->loaded_data.n_bytes = mash_mesh_cache_data_get_size (data);
+      priv->loaded_data.generated_normals = data->generated_normals;
+
+      mash_mesh_cache_close (cache);
+    }
+  else
+    {
+      mash_data_loader_get_data (loader, &priv->loaded_data);
+      g_object_unref (loader);
+    }
+}
+
 /**
  * mash_data_load:
  * @self: The #MashData instance
@@ -119,9 +342,13 @@ mash_data_new (void)
  * @error: Return location for an error or %NULL
  *
  * Loads the data from the file called @filename into @self. The
- * model can then be rendered using mash_data_render(). If
- * there is an error loading the file it will return %FALSE and @error
- * will be set to a GError instance.
+ * format of the file is recognised from its first bytes for PLY and
+ * binary glTF 2.0 files, and from the ".obj" extension for Wavefront
+ * OBJ files, which have no magic. A model returned by the @lookup_mesh
+ * function of the backend, processed with the same @flags, is used
+ * instead of the file. The model can then be rendered using
+ * mash_data_render(). If there is an error loading the file it will
+ * return %FALSE and @error will be set to a GError instance.
  *
  * Return value: %TRUE if the load succeeded or %FALSE otherwise.
  */
@@ -131,56 +358,200 @@ mash_data_load (MashData *self,
                 const gchar *filename,
                 GError **error)
 {
-  MashDataPrivate *priv;
+  MashMeshCache *cache;
   MashDataLoader *loader;
-  gchar *display_name;
-  gboolean ret;
 
   g_return_val_if_fail (MASH_IS_DATA (self), FALSE);
 
-  priv = self->priv;
+  if (!mash_data_read (flags, filename, NULL, &cache, &loader, error))
+    return FALSE;
+
+  mash_data_upload (self, cache, loader);
+
+  return TRUE;
+}
 
-  loader = NULL;
-  display_name = g_filename_display_name (filename);
+static void
+mash_data_finish_load (MashDataAsyncLoad *load)
+{
+  g_atomic_int_add (&mash_data_n_pending_loads, -1);
 
-  if (g_str_has_suffix (filename, ".ply"))
-    loader = g_object_new (MASH_TYPE_PLY_LOADER, NULL);
+  if (load->callback)
+    load->callback (load->data, load->error, load->user_data);
+
+  if (load->error)
+    g_error_free (load->error);
+  g_main_context_unref (load->context);
+  g_free (load->filename);
+  g_object_unref (load->data);
+  g_slice_free (MashDataAsyncLoad, load);
+}
 
-  if (loader != NULL)
+static void
+mash_data_upload_done (void *user_data)
+{
+  MashDataAsyncLoad *load = user_data;
+  MashDataPrivate *priv = load->data->priv;
+
+  /* Get rid of the old VBOs (if any) */
+  mash_data_free_vbos (load->data);
+
+  /* A loader without a mesh uploaded its own primitives */
+  if (load->mesh == NULL)
+    mash_data_loader_get_data (load->loader, &priv->loaded_data);
+  else
     {
-      if (!mash_data_loader_load (loader, flags, filename, error))
-        ret = FALSE;
-      else
-        {
-          /* Get rid of the old VBOs (if any) */
-          mash_data_free_vbos (self);
+      priv->loaded_data.primitives = load->primitives;
+      priv->loaded_data.min_vertex = load->mesh->min_vertex;
+      priv->loaded_data.max_vertex = load->mesh->max_vertex;
+      priv->loaded_data.quantization = load->mesh->quantization;
+      priv->loaded_data.n_bytes = mash_mesh_cache_data_get_size (load->mesh);
+      priv->loaded_data.generated_normals = load->mesh->generated_normals;
+    }
 
-          mash_data_loader_get_data (loader, &priv->loaded_data);
-          ret = TRUE;
-        }
+  /* The mesh belongs to one of those */
+  if (load->cache)
+    mash_mesh_cache_close (load->cache);
+  if (load->loader)
+    g_object_unref (load->loader);
+
+  mash_data_finish_load (load);
+}
+
+static gboolean
+mash_data_complete_load (gpointer user_data)
+{
+  MashDataAsyncLoad *load = user_data;
+
+  if (load->error)
+    {
+      mash_data_finish_load (load);
+      return FALSE;
     }
+
+  if (load->cache)
+    load->mesh = mash_mesh_cache_get_data (load->cache);
   else
+    load->mesh = mash_data_loader_get_mesh (load->loader);
+
+  /* Spread the upload over several frames when possible */
+  if (load->mesh)
+    load->primitives =
+      mash_mesh_cache_create_primitives_queued (load->mesh,
+                                                mash_data_upload_done,
+                                                load);
+  else if (load->loader == NULL ||
+           !mash_data_loader_upload_queued (load->loader,
+                                            mash_data_upload_done, load))
     {
-      /* Unknown file format */
+      mash_data_upload (load->data, load->cache, load->loader);
+      mash_data_finish_load (load);
+    }
 
-      g_set_error (error, MASH_DATA_ERROR,
-                   MASH_DATA_ERROR_UNKNOWN_FORMAT,
-                   "Unknown format for file %s",
-                   display_name);
-      ret = FALSE;
+  return FALSE;
+}
+
+static void
+mash_data_load_thread (gpointer thread_data,
+                       gpointer pool_data)
+{
+  MashDataAsyncLoad *load = thread_data;
+  GSource *source;
+
+  mash_data_read (load->flags, load->filename, load->context,
+                  &load->cache, &load->loader, &load->error);
+
+  /* Hand the data over to the main context for the upload */
+  source = g_idle_source_new ();
+  g_source_set_callback (source, mash_data_complete_load, load, NULL);
+  g_source_attach (source, load->context);
+  g_source_unref (source);
+}
+
+static GThreadPool *
+mash_data_get_load_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *new_pool;
+
+      new_pool = g_thread_pool_new (mash_data_load_thread, NULL,
+                                    MASH_DATA_LOAD_THREADS, FALSE, NULL);
+      g_once_init_leave (&pool, (gsize) new_pool);
     }
 
-  g_free (display_name);
-  if (loader)
-    g_object_unref (loader);
+  return (GThreadPool *) pool;
+}
 
-  return ret;
+/**
+ * mash_data_load_async:
+ * @self: The #MashData instance
+ * @flags: Flags used to specify load-time modifications to the data
+ * @filename: The name of a file to load
+ * @callback: Function to call once the load is finished or %NULL
+ * @user_data: Data to pass to @callback
+ *
+ * Loads the data from the file called @filename into @self without
+ * blocking. The file is read and processed in a worker thread. Once
+ * that is done the data is handed to the @upload_buffer function of the
+ * backend from the thread-default main context of the caller, which
+ * needs to be iterated, and @callback is invoked once all of it is
+ * uploaded. Until then @self keeps its previous data, if any. With
+ * %MASH_DATA_STREAM the data is handed over as it is read, the worker
+ * thread waiting for the uploads when it is ahead.
+ *
+ * @self is kept alive until @callback has been invoked.
+ */
+void
+mash_data_load_async (MashData *self,
+                      MashDataFlags flags,
+                      const gchar *filename,
+                      MashDataLoadCallback callback,
+                      gpointer user_data)
+{
+  MashDataAsyncLoad *load;
+
+  g_return_if_fail (MASH_IS_DATA (self));
+
+  load = g_slice_new0 (MashDataAsyncLoad);
+  load->data = g_object_ref (self);
+  load->flags = flags;
+  load->filename = g_strdup (filename);
+  load->callback = callback;
+  load->user_data = user_data;
+  load->context = g_main_context_ref_thread_default ();
+
+  g_atomic_int_inc (&mash_data_n_pending_loads);
+
+  g_thread_pool_push (mash_data_get_load_pool (), load, NULL);
+}
+
+/**
+ * mash_data_get_n_pending_loads:
+ *
+ * Returns the number of loads started with mash_data_load_async()
+ * that haven't completed yet. Applications that don't run a GLib main
+ * loop can use this to know whether they need to keep iterating the
+ * main context.
+ *
+ * Return value: The number of pending asynchronous loads
+ */
+guint
+mash_data_get_n_pending_loads (void)
+{
+  return g_atomic_int_get (&mash_data_n_pending_loads);
 }
 
 /**
  * mash_data_get_primitive:
  * @self: A #MashData instance
  *
+ * Gets the primitive drawing the model. A model with too many vertices
+ * for 16 bits indices is split in several submeshes and this only
+ * returns the first one, use mash_data_render() to draw all of them.
+ *
  * Returns: A #CoglPrimitive
  */
 CoglPrimitive *
@@ -193,7 +564,59 @@ mash_data_get_primitive (MashData *self)
   priv = self->priv;
 
   /* Silently fail if we didn't load any data */
-  return priv->loaded_data.primitive;
+  if (priv->loaded_data.primitives == NULL)
+    return NULL;
+
+  return g_ptr_array_index (priv->loaded_data.primitives, 0);
+}
+
+/**
+ * mash_data_get_n_submeshes:
+ * @self: A #MashData instance
+ *
+ * Gets the number of submeshes the model was split in when it was
+ * loaded, each drawn with its own primitive.
+ *
+ * Return value: The number of submeshes, 0 if nothing is loaded
+ */
+guint
+mash_data_get_n_submeshes (MashData *self)
+{
+  MashDataPrivate *priv = self->priv;
+
+  if (priv->loaded_data.primitives == NULL)
+    return 0;
+
+  return priv->loaded_data.primitives->len;
+}
+
+/**
+ * mash_data_render:
+ * @self: A #MashData instance
+ * @framebuffer: The #CoglFramebuffer to draw to
+ * @pipeline: The #CoglPipeline to draw with
+ *
+ * Draws all the submeshes of the model.
+ */
+void
+mash_data_render (MashData *self,
+                  CoglFramebuffer *framebuffer,
+                  CoglPipeline *pipeline)
+{
+  GPtrArray *primitives;
+  guint i;
+
+  g_return_if_fail (MASH_IS_DATA (self));
+
+  primitives = self->priv->loaded_data.primitives;
+
+  /* Silently fail if we didn't load any data */
+  if (primitives == NULL)
+    return;
+
+  for (i = 0; i < primitives->len; i++)
+    cogl_framebuffer_draw_primitive (framebuffer, pipeline,
+                                     g_ptr_array_index (primitives, i));
 }
 
 /**
@@ -220,6 +643,200 @@ mash_data_get_extents (MashData *self,
   *max_vertex = priv->loaded_data.max_vertex;
 }
 
+/**
+ * mash_data_get_memory_size:
+ * @self: A #MashData instance
+ *
+ * Gets the size of the vertices and the indices that have been
+ * uploaded for @self.
+ *
+ * Return value: The size of the data in bytes
+ */
+gsize
+mash_data_get_memory_size (MashData *self)
+{
+  MashDataPrivate *priv = self->priv;
+
+  return priv->loaded_data.n_bytes;
+}
+
+/**
+ * mash_data_has_generated_normals:
+ * @self: A #MashData instance
+ *
+ * Tells whether the model had no normals and they were generated
+ * because it was loaded with %MASH_DATA_GENERATE_NORMALS.
+ *
+ * Return value: %TRUE if the normals were generated
+ */
+gboolean
+mash_data_has_generated_normals (MashData *self)
+{
+  MashDataPrivate *priv = self->priv;
+
+  return priv->loaded_data.generated_normals;
+}
+
+/**
+ * mash_data_is_quantized:
+ * @self: A #MashData instance
+ *
+ * Tells whether some attributes of the model were quantized because it
+ * was loaded with %MASH_DATA_QUANTIZE, in which case the pipeline used
+ * to draw it has to be set up with mash_data_prepare_pipeline().
+ *
+ * Return value: %TRUE if the data is quantized
+ */
+gboolean
+mash_data_is_quantized (MashData *self)
+{
+  MashDataPrivate *priv = self->priv;
+
+  return priv->loaded_data.quantization.attributes != 0;
+}
+
+/* The quantized attributes are decoded at the top of the vertex shader
+ * into globals that then replace the original attributes for the rest
+ * of the shader, including the snippets of the application, by
+ * redefining the name of the attribute. The functions are declared
+ * before the #define so that they still read the real attribute.
+ */
+static const char mash_data_position_declarations[] =
+  "uniform vec3 mash_position_scale, mash_position_offset;\n"
+  "vec4 mash_position;\n"
+  "vec4 mash_decode_position ()\n"
+  "{\n"
+  "  return vec4 (cogl_position_in.xyz * mash_position_scale +\n"
+  "               mash_position_offset, 1.0);\n"
+  "}\n"
+  "#define cogl_position_in mash_position\n";
+
+static const char mash_data_normal_declarations[] =
+  "vec3 mash_normal;\n"
+  "vec3 mash_decode_normal ()\n"
+  "{\n"
+  "  vec2 e = cogl_normal_in.xy;\n"
+  "  vec3 n = vec3 (e, 1.0 - abs (e.x) - abs (e.y));\n"
+  "  if (n.z < 0.0)\n"
+  "    n.xy = (1.0 - abs (n.yx)) *\n"
+  "           vec2 (n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+  "  return normalize (n);\n"
+  "}\n"
+  "#define cogl_normal_in mash_normal\n";
+
+static const char mash_data_tex_coord_declarations[] =
+  "uniform vec2 mash_tex_coord_scale, mash_tex_coord_offset;\n"
+  "vec4 mash_tex_coord0;\n"
+  "vec4 mash_decode_tex_coord0 ()\n"
+  "{\n"
+  "  return vec4 (cogl_tex_coord0_in.st * mash_tex_coord_scale +\n"
+  "               mash_tex_coord_offset, 0.0, 1.0);\n"
+  "}\n"
+  "#define cogl_tex_coord0_in mash_tex_coord0\n";
+
+static CoglSnippet *
+mash_data_get_decode_snippet (MashDataQuantizedAttributes attribute)
+{
+  /* The snippets are shared so that Cogl can share the programs between
+     all the pipelines drawing quantized data */
+  static CoglSnippet *snippets[3];
+  const char *declarations, *pre;
+  int index;
+
+  switch (attribute)
+    {
+    case MASH_DATA_QUANTIZED_POSITION:
+      index = 0;
+      declarations = mash_data_position_declarations;
+      pre = "mash_position = mash_decode_position ();\n";
+      break;
+    case MASH_DATA_QUANTIZED_NORMAL:
+      index = 1;
+      declarations = mash_data_normal_declarations;
+      pre = "mash_normal = mash_decode_normal ();\n";
+      break;
+    case MASH_DATA_QUANTIZED_TEX_COORD:
+      index = 2;
+      declarations = mash_data_tex_coord_declarations;
+      pre = "mash_tex_coord0 = mash_decode_tex_coord0 ();\n";
+      break;
+    default:
+      g_assert_not_reached ();
+      return NULL;
+    }
+
+  if (G_UNLIKELY (snippets[index] == NULL))
+    {
+      snippets[index] = cogl_snippet_new (COGL_SNIPPET_HOOK_VERTEX,
+                                          declarations,
+                                          NULL);
+      cogl_snippet_set_pre (snippets[index], pre);
+    }
+
+  return snippets[index];
+}
+
+/**
+ * mash_data_prepare_pipeline:
+ * @self: A #MashData instance
+ * @pipeline: The #CoglPipeline that will be used to draw @self
+ *
+ * Adds to @pipeline the snippets and uniforms needed to draw the
+ * primitive of @self. This is only required when the data has been
+ * loaded with %MASH_DATA_QUANTIZE, it does nothing otherwise. As the
+ * uniforms depend on the data, @pipeline should not be shared with
+ * other #MashData instances.
+ *
+ * The snippets replace cogl_position_in, cogl_normal_in and
+ * cogl_tex_coord0_in by their decoded values so vertex snippets added
+ * to @pipeline before this call can keep using them.
+ */
+void
+mash_data_prepare_pipeline (MashData *self,
+                            CoglPipeline *pipeline)
+{
+  MashDataQuantization *quantization;
+  int location;
+
+  g_return_if_fail (MASH_IS_DATA (self));
+
+  quantization = &self->priv->loaded_data.quantization;
+
+  if ((quantization->attributes & MASH_DATA_QUANTIZED_POSITION))
+    {
+      cogl_pipeline_add_snippet (pipeline,
+        mash_data_get_decode_snippet (MASH_DATA_QUANTIZED_POSITION));
+
+      location = cogl_pipeline_get_uniform_location (pipeline,
+                                                     "mash_position_scale");
+      cogl_pipeline_set_uniform_float (pipeline, location, 3, 1,
+                                       quantization->position_scale);
+      location = cogl_pipeline_get_uniform_location (pipeline,
+                                                     "mash_position_offset");
+      cogl_pipeline_set_uniform_float (pipeline, location, 3, 1,
+                                       quantization->position_offset);
+    }
+
+  if ((quantization->attributes & MASH_DATA_QUANTIZED_NORMAL))
+    cogl_pipeline_add_snippet (pipeline,
+      mash_data_get_decode_snippet (MASH_DATA_QUANTIZED_NORMAL));
+
+  if ((quantization->attributes & MASH_DATA_QUANTIZED_TEX_COORD))
+    {
+      cogl_pipeline_add_snippet (pipeline,
+        mash_data_get_decode_snippet (MASH_DATA_QUANTIZED_TEX_COORD));
+
+      location = cogl_pipeline_get_uniform_location (pipeline,
+                                                     "mash_tex_coord_scale");
+      cogl_pipeline_set_uniform_float (pipeline, location, 2, 1,
+                                       quantization->tex_coord_scale);
+      location = cogl_pipeline_get_uniform_location (pipeline,
+                                                     "mash_tex_coord_offset");
+      cogl_pipeline_set_uniform_float (pipeline, location, 2, 1,
+                                       quantization->tex_coord_offset);
+    }
+}
+
 GQuark
 mash_data_error_quark (void)
 {
@@ -20,6 +20,7 @@
 #define __MASH_DATA_H__
 
 #include <glib-object.h>
+#include <cogl/cogl.h>
 
 G_BEGIN_DECLS
 
@@ -109,6 +110,23 @@ typedef enum
  * @MASH_DATA_NEGATE_X: Negate the X axis
  * @MASH_DATA_NEGATE_Y: Negate the Y axis
  * @MASH_DATA_NEGATE_Z: Negate the Z axis
+ * @MASH_DATA_OPTIMIZE: Reorder the triangles and the vertices for the
+ *   post-transform vertex cache, overdraw and vertex fetch
+ * @MASH_DATA_WELD: Merge the vertices that are bitwise identical
+ * @MASH_DATA_WELD_EPSILON: Merge the vertices whose float properties are
+ *   equal once snapped to a small grid and whose colors are identical
+ * @MASH_DATA_QUANTIZE: Pack the vertices in a compact format that is
+ *   decoded in the vertex shader
+ * @MASH_DATA_CACHE: Keep the processed data in the user cache directory
+ *   and reuse it on the next loads
+ * @MASH_DATA_GENERATE_NORMALS: Compute smooth normals when the file
+ *   doesn't have any
+ * @MASH_DATA_CREASE_NORMALS: When generating normals, split the vertices
+ *   where the faces meet at a sharp angle
+ * @MASH_DATA_AREA_WEIGHTED_NORMALS: When generating normals, weight the
+ *   faces around a vertex by their area instead of their angle
+ * @MASH_DATA_STREAM: Upload the data while the file is read instead of
+ *   building the whole mesh in memory first
  *
  * Flags used for modifying the data as it is loaded. These can be
  * passed to mash_data_load().
@@ -128,6 +146,58 @@ typedef enum
  *
  * To avoid these issues when exporting from Blender it is common to
  * pass the %MASH_DATA_NEGATE_Y flag.
+ *
+ * %MASH_DATA_OPTIMIZE does not change what is drawn, only the order in
+ * which the triangles are submitted. The cache statistics of each
+ * optimized mesh are reported with g_debug() when the MASH_DEBUG
+ * environment variable is set.
+ *
+ * Flat shaded meshes are usually exported with a copy of each vertex
+ * per face. %MASH_DATA_WELD and %MASH_DATA_WELD_EPSILON shrink the
+ * vertex buffer by merging the copies that ended up identical, which
+ * can also allow the model to use smaller indices.
+ *
+ * %MASH_DATA_QUANTIZE roughly halves the size of the vertex buffer:
+ * positions are stored as 16 bits values relative to the bounding box,
+ * normals are octahedron encoded into two 16 bits values, texture
+ * coordinates are stored as 16 bits values relative to their bounding
+ * rectangle and colors as normalized bytes. The pipeline used to draw
+ * the primitive then needs to be set up with
+ * mash_data_prepare_pipeline().
+ *
+ * With %MASH_DATA_CACHE the data is written to a file once it has
+ * been processed with the other flags. The next loads of the same
+ * file with the same flags map that file and upload it directly,
+ * skipping the parsing and the processing. The cache is ignored
+ * whenever the size or the contents of the model change.
+ *
+ * Lighting needs normals, which some exporters leave out. With
+ * %MASH_DATA_GENERATE_NORMALS the normal of each vertex is the average
+ * of the normals of the faces around it, weighted by the angle of each
+ * face at the vertex. The faces have to be in counter-clockwise order
+ * once the negate flags are applied. Combine it with %MASH_DATA_WELD as
+ * flat shaded meshes need their vertices merged first to be smoothed.
+ * %MASH_DATA_CREASE_NORMALS keeps the edges where the faces meet at
+ * more than 60 degrees sharp by giving each side its own vertices.
+ * mash_data_has_generated_normals() tells whether the normals of a
+ * model had to be generated.
+ *
+ * Models can be bigger than the memory. With %MASH_DATA_STREAM the
+ * vertices and the indices go to the GPU through a few fixed size
+ * buffers as they are read, so the memory used doesn't depend on the
+ * size of the file. As the mesh is never whole in memory it can't be
+ * processed: %MASH_DATA_OPTIMIZE, the weld flags, %MASH_DATA_QUANTIZE,
+ * %MASH_DATA_CACHE and the normal flags are ignored, and a model with
+ * more than 65,536 vertices needs GL_UNSIGNED_INT indices instead of
+ * being split. This is only supported for PLY files.
+ *
+ * Only the geometry of OBJ files is loaded, the materials are ignored.
+ * %MASH_DATA_QUANTIZE and %MASH_DATA_STREAM have no effect on them.
+ *
+ * The parts of the binary chunk of a binary glTF 2.0 file used by the
+ * accessors are uploaded as is, so none of the flags have an effect on
+ * them. The primitives of all the
+ * meshes are loaded without the transformations of the scene nodes.
  */
 /* The flip flags must be in sequential order */
 typedef enum
@@ -135,9 +205,101 @@ typedef enum
     MASH_DATA_NONE = 0,
     MASH_DATA_NEGATE_X = 1,
     MASH_DATA_NEGATE_Y = 2,
-    MASH_DATA_NEGATE_Z = 4
+    MASH_DATA_NEGATE_Z = 4,
+    MASH_DATA_OPTIMIZE = 8,
+    MASH_DATA_WELD = 16,
+    MASH_DATA_WELD_EPSILON = 32,
+    MASH_DATA_QUANTIZE = 64,
+    MASH_DATA_CACHE = 128,
+    MASH_DATA_GENERATE_NORMALS = 256,
+    MASH_DATA_CREASE_NORMALS = 512,
+    MASH_DATA_AREA_WEIGHTED_NORMALS = 1024,
+    MASH_DATA_STREAM = 2048
   } MashDataFlags;
 
+/**
+ * MashDataLoadCallback:
+ * @data: The #MashData that was loaded
+ * @error: The error if the load failed or %NULL
+ * @user_data: The data passed to mash_data_load_async()
+ *
+ * The type of the function invoked when mash_data_load_async()
+ * finishes.
+ */
+typedef void (* MashDataLoadCallback) (MashData *data,
+                                       const GError *error,
+                                       gpointer user_data);
+
+/**
+ * MashDataUploadDoneFunc:
+ * @user_data: The data passed along with the upload
+ *
+ * The type of the function invoked once a range of a buffer has been
+ * uploaded.
+ */
+typedef void (* MashDataUploadDoneFunc) (gpointer user_data);
+
+/**
+ * MashDataBufferType:
+ * @MASH_DATA_BUFFER_ATTRIBUTES: A #CoglAttributeBuffer
+ * @MASH_DATA_BUFFER_INDICES: A #CoglIndexBuffer
+ *
+ * The type of buffer asked to the @alloc_buffer function of a
+ * #MashDataBackend.
+ */
+typedef enum
+  {
+    MASH_DATA_BUFFER_ATTRIBUTES,
+    MASH_DATA_BUFFER_INDICES
+  } MashDataBufferType;
+
+/**
+ * MashDataBackend:
+ * @context: The #CoglContext the buffers are created in
+ * @lookup_mesh: Returns the data of a model already processed in the
+ *   layout of the mesh cache, or %NULL to read the file. It is called
+ *   from the loading threads
+ * @alloc_buffer: Returns a buffer of type @type with @size bytes
+ *   available from the returned @offset, which is a multiple of
+ *   @alignment. @format describes the layout of the vertices of
+ *   attribute buffers, the ranges of buffers with the same format can
+ *   be packed together. The buffer belongs to the returned @range
+ * @free_buffer_with_object: Frees @range once @object is destroyed
+ * @upload_buffer: Copies @size bytes of @data to @buffer at @offset,
+ *   at any later time, and invokes @done once it is done. @data stays
+ *   valid until then
+ *
+ * How the meshes get to the GPU. Any function left %NULL gets a default
+ * that allocates a new buffer for each range and uploads it directly
+ * with cogl_buffer_set_data().
+ */
+typedef struct _MashDataBackend
+{
+  CoglContext *context;
+
+  GBytes *(* lookup_mesh) (const gchar *filename);
+
+  CoglBuffer *(* alloc_buffer) (MashDataBufferType type,
+                                const gchar *format,
+                                gsize size,
+                                gsize alignment,
+                                gsize *offset,
+                                gpointer *range);
+  void (* free_buffer_with_object) (gpointer range,
+                                    gpointer object);
+
+  void (* upload_buffer) (CoglBuffer *buffer,
+                          gsize offset,
+                          gconstpointer data,
+                          gsize size,
+                          MashDataUploadDoneFunc done,
+                          gpointer user_data);
+} MashDataBackend;
+
+void mash_data_set_backend (const MashDataBackend *backend);
+
+const MashDataBackend *mash_data_get_backend (void);
+
 GType mash_data_get_type (void) G_GNUC_CONST;
 
 MashData *mash_data_new (void);
@@ -147,14 +309,37 @@ gboolean mash_data_load (MashData *self,
                          const gchar *filename,
                          GError **error);
 
+void mash_data_load_async (MashData *self,
+                           MashDataFlags flags,
+                           const gchar *filename,
+                           MashDataLoadCallback callback,
+                           gpointer user_data);
+
+guint mash_data_get_n_pending_loads (void);
+
 CoglPrimitive * mash_data_get_primitive (MashData *self);
 
+guint mash_data_get_n_submeshes (MashData *self);
+
+void mash_data_render (MashData *self,
+                       CoglFramebuffer *framebuffer,
+                       CoglPipeline *pipeline);
+
 GQuark mash_data_error_quark (void);
 
 void mash_data_get_extents (MashData *self,
                             CoglVertexP3 *min_vertex,
                             CoglVertexP3 *max_vertex);
 
+gsize mash_data_get_memory_size (MashData *self);
+
+gboolean mash_data_has_generated_normals (MashData *self);
+
+gboolean mash_data_is_quantized (MashData *self);
+
+void mash_data_prepare_pipeline (MashData *self,
+                                 CoglPipeline *pipeline);
+
 G_END_DECLS
 
 #endif /* __MASH_DATA_H__ */
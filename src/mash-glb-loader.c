@@ -0,0 +1,1128 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Loader for binary glTF 2.0 files. The binary chunk of a GLB file
+ * already holds the vertices and the indices in a layout the GPU can
+ * use, so nothing is decoded: the file is mapped, the JSON chunk is
+ * only read to describe where the attributes and the indices of each
+ * primitive are, and the binary chunk is uploaded as is into one
+ * attribute buffer and one index buffer that all the primitives share.
+ *
+ * The primitives of all the meshes are loaded, ignoring the scene and
+ * the transformations of its nodes, and the materials are ignored.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib-object.h>
+#include <string.h>
+#include <cogl/cogl.h>
+
+#include "mash-glb-loader.h"
+#include "mash-json.h"
+#include "mash-mesh-cache.h"
+
+static void mash_glb_loader_finalize (GObject *object);
+static gboolean mash_glb_loader_load (MashDataLoader *data_loader,
+                                      MashDataFlags flags,
+                                      const gchar *filename,
+                                      GError **error);
+static void mash_glb_loader_get_data (MashDataLoader *data_loader,
+                                      MashDataLoaderData *loader_data);
+static void mash_glb_loader_upload_queued (MashDataLoader *data_loader,
+                                           MashDataUploadDoneFunc done,
+                                           gpointer user_data);
+
+G_DEFINE_TYPE (MashGlbLoader, mash_glb_loader, MASH_TYPE_DATA_LOADER);
+
+#define MASH_GLB_LOADER_GET_PRIVATE(obj)                      \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), MASH_TYPE_GLB_LOADER,  \
+                                MashGlbLoaderPrivate))
+
+#define MASH_GLB_LOADER_MAGIC           0x46546c67 /* "glTF" */
+#define MASH_GLB_LOADER_CHUNK_JSON      0x4e4f534a /* "JSON" */
+#define MASH_GLB_LOADER_CHUNK_BIN       0x004e4942 /* "BIN\0" */
+
+#define MASH_GLB_LOADER_MAX_ATTRIBUTES  4
+
+/* Largest byteStride allowed by the spec */
+#define MASH_GLB_LOADER_MAX_STRIDE      252
+
+/* The primitives of a file have different vertex layouts so the glTF
+   models share the buffers of their own format */
+#define MASH_GLB_LOADER_FORMAT          "glTF"
+
+/* Values of componentType in the accessors */
+#define MASH_GLB_LOADER_BYTE            5120
+#define MASH_GLB_LOADER_UNSIGNED_BYTE   5121
+#define MASH_GLB_LOADER_SHORT           5122
+#define MASH_GLB_LOADER_UNSIGNED_SHORT  5123
+#define MASH_GLB_LOADER_UNSIGNED_INT    5125
+#define MASH_GLB_LOADER_FLOAT           5126
+
+static const struct
+{
+  const gchar *semantic;
+  const gchar *name;
+}
+mash_glb_loader_attributes[MASH_GLB_LOADER_MAX_ATTRIBUTES] =
+{
+  { "POSITION", "cogl_position_in" },
+  { "NORMAL", "cogl_normal_in" },
+  { "TEXCOORD_0", "cogl_tex_coord0_in" },
+  { "COLOR_0", "cogl_color_in" }
+};
+
+/* glTF primitive modes, in the order of their values */
+static const CoglVerticesMode
+mash_glb_loader_modes[] =
+{
+  COGL_VERTICES_MODE_POINTS,
+  COGL_VERTICES_MODE_LINES,
+  COGL_VERTICES_MODE_LINE_LOOP,
+  COGL_VERTICES_MODE_LINE_STRIP,
+  COGL_VERTICES_MODE_TRIANGLES,
+  COGL_VERTICES_MODE_TRIANGLE_STRIP,
+  COGL_VERTICES_MODE_TRIANGLE_FAN
+};
+
+/* An accessor resolved against its buffer view */
+typedef struct
+{
+  /* From the start of the binary chunk */
+  gsize offset;
+  gsize size;
+  guint stride;
+  gint component_type;
+  gint n_components;
+  gint count;
+  gboolean normalized;
+} MashGlbLoaderAccessor;
+
+typedef struct
+{
+  const gchar *name;
+  gsize offset;
+  guint stride;
+  gint n_components;
+  CoglAttributeType type;
+  gboolean normalized;
+} MashGlbLoaderAttribute;
+
+typedef struct
+{
+  CoglVerticesMode mode;
+  gint n_vertices;
+
+  MashGlbLoaderAttribute attributes[MASH_GLB_LOADER_MAX_ATTRIBUTES];
+  gint n_attributes;
+
+  /* n_indices is 0 when the primitive isn't indexed */
+  gsize indices_offset;
+  CoglIndicesType indices_type;
+  gint n_indices;
+} MashGlbLoaderPrimitive;
+
+/* A range of the binary chunk that is uploaded */
+typedef struct
+{
+  gsize offset;
+  gsize size;
+  /* Where it goes in the buffer */
+  gsize buffer_offset;
+} MashGlbLoaderRange;
+
+typedef struct
+{
+  GError *error;
+  const gchar *display_name;
+
+  MashJsonNode *root;
+  const guint8 *bin;
+  gsize bin_size;
+} MashGlbLoaderData;
+
+struct _MashGlbLoaderPrivate
+{
+  /* One primitive per glTF primitive */
+  GPtrArray *primitives;
+
+  /* The mapping is kept until get_data() uploads the binary chunk */
+  GMappedFile *file;
+  const guint8 *bin;
+
+  /* MashGlbLoaderPrimitives, with offsets relative to the buffers */
+  GArray *parts;
+
+  /* MashGlbLoaderRanges of the binary chunk holding the vertices and
+     the indices, and the size of the buffers they are packed in */
+  GArray *vertex_ranges, *index_ranges;
+  gsize vertex_size, index_size;
+
+  /* Bounding cuboid of the data */
+  CoglVertexP3 min_vertex, max_vertex;
+
+  gsize n_bytes;
+};
+
+static void
+mash_glb_loader_class_init (MashGlbLoaderClass *klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  MashDataLoaderClass *data_loader_class = (MashDataLoaderClass *) klass;
+
+  gobject_class->finalize = mash_glb_loader_finalize;
+
+  data_loader_class->load = mash_glb_loader_load;
+  data_loader_class->get_data = mash_glb_loader_get_data;
+  data_loader_class->upload_queued = mash_glb_loader_upload_queued;
+
+  g_type_class_add_private (klass, sizeof (MashGlbLoaderPrivate));
+}
+
+static void
+mash_glb_loader_init (MashGlbLoader *self)
+{
+  self->priv = MASH_GLB_LOADER_GET_PRIVATE (self);
+}
+
+static void
+mash_glb_loader_free_data (MashGlbLoader *self)
+{
+  MashGlbLoaderPrivate *priv = self->priv;
+
+  if (priv->file)
+    {
+      g_mapped_file_unref (priv->file);
+      priv->file = NULL;
+      priv->bin = NULL;
+    }
+
+  if (priv->parts)
+    {
+      g_array_free (priv->parts, TRUE);
+      priv->parts = NULL;
+    }
+
+  if (priv->vertex_ranges)
+    {
+      g_array_free (priv->vertex_ranges, TRUE);
+      g_array_free (priv->index_ranges, TRUE);
+      priv->vertex_ranges = NULL;
+      priv->index_ranges = NULL;
+    }
+}
+
+static void
+mash_glb_loader_free_primitive (MashGlbLoader *self)
+{
+  MashGlbLoaderPrivate *priv = self->priv;
+
+  if (priv->primitives)
+    {
+      g_ptr_array_unref (priv->primitives);
+      priv->primitives = NULL;
+    }
+
+  mash_glb_loader_free_data (self);
+}
+
+static void
+mash_glb_loader_finalize (GObject *object)
+{
+  MashGlbLoader *self = (MashGlbLoader *) object;
+
+  mash_glb_loader_free_primitive (self);
+
+  G_OBJECT_CLASS (mash_glb_loader_parent_class)->finalize (object);
+}
+
+static guint32
+mash_glb_loader_read_uint32 (const guint8 *p)
+{
+  guint32 value;
+
+  memcpy (&value, p, sizeof (value));
+
+  return GUINT32_FROM_LE (value);
+}
+
+static gboolean
+mash_glb_loader_set_invalid (MashGlbLoaderData *data,
+                             const gchar *what)
+{
+  if (data->error == NULL)
+    g_set_error (&data->error, MASH_DATA_ERROR,
+                 MASH_DATA_ERROR_INVALID,
+                 "Invalid %s in glTF file %s",
+                 what, data->display_name);
+
+  return FALSE;
+}
+
+static gboolean
+mash_glb_loader_set_unsupported (MashGlbLoaderData *data,
+                                 const gchar *what)
+{
+  if (data->error == NULL)
+    g_set_error (&data->error, MASH_DATA_ERROR,
+                 MASH_DATA_ERROR_UNSUPPORTED,
+                 "glTF file %s uses %s, which is not supported",
+                 data->display_name, what);
+
+  return FALSE;
+}
+
+/* Finds the JSON and the binary chunks */
+static gboolean
+mash_glb_loader_read_chunks (MashGlbLoaderData *data,
+                             const guint8 *contents,
+                             gsize size)
+{
+  const guint8 *json = NULL;
+  gsize json_size = 0, offset, length;
+
+  if (size < 12 ||
+      mash_glb_loader_read_uint32 (contents) != MASH_GLB_LOADER_MAGIC)
+    return mash_glb_loader_set_invalid (data, "header");
+
+  if (mash_glb_loader_read_uint32 (contents + 4) != 2)
+    return mash_glb_loader_set_unsupported (data, "a version other than 2");
+
+  length = mash_glb_loader_read_uint32 (contents + 8);
+  if (length > size)
+    return mash_glb_loader_set_invalid (data, "length");
+
+  for (offset = 12; offset + 8 <= length; )
+    {
+      gsize chunk_size = mash_glb_loader_read_uint32 (contents + offset);
+      guint32 chunk_type = mash_glb_loader_read_uint32 (contents + offset + 4);
+
+      offset += 8;
+      if (chunk_size > length - offset)
+        return mash_glb_loader_set_invalid (data, "chunk");
+
+      /* The first chunk has to be the JSON one, the binary one can
+         follow. Unknown chunks are skipped */
+      if (json == NULL)
+        {
+          if (chunk_type != MASH_GLB_LOADER_CHUNK_JSON)
+            return mash_glb_loader_set_invalid (data, "chunk");
+          json = contents + offset;
+          json_size = chunk_size;
+        }
+      else if (data->bin == NULL && chunk_type == MASH_GLB_LOADER_CHUNK_BIN)
+        {
+          data->bin = contents + offset;
+          data->bin_size = chunk_size;
+        }
+
+      /* The chunks are padded to 4 bytes */
+      offset += (chunk_size + 3) & ~(gsize) 3;
+    }
+
+  if (json == NULL)
+    return mash_glb_loader_set_invalid (data, "chunk");
+
+  data->root = mash_json_parse ((const gchar *) json, json_size,
+                                &data->error);
+
+  return data->root != NULL;
+}
+
+static gint
+mash_glb_loader_get_component_size (gint component_type)
+{
+  switch (component_type)
+    {
+    case MASH_GLB_LOADER_BYTE:
+    case MASH_GLB_LOADER_UNSIGNED_BYTE:
+      return 1;
+    case MASH_GLB_LOADER_SHORT:
+    case MASH_GLB_LOADER_UNSIGNED_SHORT:
+      return 2;
+    case MASH_GLB_LOADER_UNSIGNED_INT:
+    case MASH_GLB_LOADER_FLOAT:
+      return 4;
+    }
+
+  return 0;
+}
+
+static gint
+mash_glb_loader_get_n_components (const gchar *type)
+{
+  if (type == NULL)
+    return 0;
+  if (!strcmp (type, "SCALAR"))
+    return 1;
+  if (!strcmp (type, "VEC2"))
+    return 2;
+  if (!strcmp (type, "VEC3"))
+    return 3;
+  if (!strcmp (type, "VEC4"))
+    return 4;
+
+  return 0;
+}
+
+/* Gets the index of an object in one of the top level arrays, such as
+   the accessor of an attribute */
+static MashJsonNode *
+mash_glb_loader_get_indexed (MashGlbLoaderData *data,
+                             const gchar *array,
+                             const MashJsonNode *index)
+{
+  if (index == NULL || index->type != MASH_JSON_NUMBER || index->number < 0)
+    return NULL;
+
+  return mash_json_node_get_element (mash_json_node_get_member (data->root,
+                                                                array),
+                                     (guint) index->number);
+}
+
+/* Gets a member that has to be an integer between 0 and @max. JSON
+   numbers are doubles so they can be negative, fractional or huge */
+static gboolean
+mash_glb_loader_get_size (const MashJsonNode *node,
+                          const gchar *name,
+                          gsize default_value,
+                          gsize max,
+                          gsize *value)
+{
+  gdouble number = mash_json_node_get_number (node, name, default_value);
+
+  if (!(number >= 0 && number <= max) || number != (gdouble) (gsize) number)
+    return FALSE;
+
+  *value = number;
+
+  return TRUE;
+}
+
+static gboolean
+mash_glb_loader_get_accessor (MashGlbLoaderData *data,
+                              const MashJsonNode *index,
+                              MashGlbLoaderAccessor *accessor)
+{
+  MashJsonNode *node, *view, *buffer;
+  gsize component_type, count, stride;
+  gsize view_offset, view_size, offset, element_size;
+  guint64 size;
+  gint component_size;
+
+  if ((node = mash_glb_loader_get_indexed (data, "accessors", index)) == NULL)
+    return mash_glb_loader_set_invalid (data, "accessor");
+
+  if (mash_json_node_get_member (node, "sparse"))
+    return mash_glb_loader_set_unsupported (data, "sparse accessors");
+
+  /* An accessor without a view is all zeros */
+  if ((view = mash_glb_loader_get_indexed (data, "bufferViews",
+                                           mash_json_node_get_member
+                                           (node, "bufferView"))) == NULL)
+    return mash_glb_loader_set_unsupported (data,
+                                            "accessors without buffer views");
+
+  /* Only the binary chunk of the file can be used */
+  buffer = mash_glb_loader_get_indexed (data, "buffers",
+                                        mash_json_node_get_member (view,
+                                                                   "buffer"));
+  if (buffer == NULL || mash_json_node_get_number (view, "buffer", 0) != 0 ||
+      mash_json_node_get_string (buffer, "uri") || data->bin == NULL)
+    return mash_glb_loader_set_unsupported (data, "external buffers");
+
+  accessor->n_components =
+    mash_glb_loader_get_n_components (mash_json_node_get_string (node,
+                                                                 "type"));
+  accessor->normalized =
+    mash_json_node_get_member (node, "normalized") &&
+    mash_json_node_get_member (node, "normalized")->boolean;
+
+  if (!mash_glb_loader_get_size (node, "componentType", 0, G_MAXINT,
+                                 &component_type) ||
+      !mash_glb_loader_get_size (node, "count", 0, G_MAXINT, &count) ||
+      !mash_glb_loader_get_size (node, "byteOffset", 0, data->bin_size,
+                                 &offset) ||
+      !mash_glb_loader_get_size (view, "byteOffset", 0, data->bin_size,
+                                 &view_offset) ||
+      !mash_glb_loader_get_size (view, "byteLength", 0, data->bin_size,
+                                 &view_size))
+    return mash_glb_loader_set_invalid (data, "accessor");
+
+  accessor->component_type = component_type;
+  accessor->count = count;
+
+  component_size =
+    mash_glb_loader_get_component_size (accessor->component_type);
+  if (component_size == 0 || accessor->n_components == 0 ||
+      accessor->count <= 0)
+    return mash_glb_loader_set_invalid (data, "accessor");
+
+  element_size = component_size * accessor->n_components;
+
+  if (!mash_glb_loader_get_size (view, "byteStride", element_size,
+                                 MASH_GLB_LOADER_MAX_STRIDE, &stride) ||
+      stride < element_size)
+    return mash_glb_loader_set_invalid (data, "accessor");
+
+  size = (guint64) (count - 1) * stride + element_size;
+
+  /* The data must be inside the view, which must be inside the chunk */
+  if (view_size > data->bin_size - view_offset ||
+      offset > view_size ||
+      size > view_size - offset)
+    return mash_glb_loader_set_invalid (data, "accessor");
+
+  accessor->stride = stride;
+  accessor->offset = view_offset + offset;
+  accessor->size = size;
+
+  return TRUE;
+}
+
+static void
+mash_glb_loader_add_range (GArray *ranges,
+                           gsize offset,
+                           gsize size)
+{
+  MashGlbLoaderRange range;
+
+  range.offset = offset;
+  range.size = size;
+  range.buffer_offset = 0;
+
+  g_array_append_val (ranges, range);
+}
+
+static gint
+mash_glb_loader_compare_ranges (gconstpointer a,
+                                gconstpointer b)
+{
+  const MashGlbLoaderRange *range_a = a, *range_b = b;
+
+  if (range_a->offset != range_b->offset)
+    return range_a->offset < range_b->offset ? -1 : 1;
+
+  return 0;
+}
+
+/* Merges the overlapping ranges, such as the attributes of interleaved
+   vertices, and packs them one after the other in a buffer. Each range
+   keeps its offset modulo 4 so the data stays aligned. Returns the size
+   of the buffer */
+static gsize
+mash_glb_loader_pack_ranges (GArray *ranges)
+{
+  MashGlbLoaderRange *range = (MashGlbLoaderRange *) ranges->data;
+  gsize buffer_size = 0;
+  guint i, n_merged = 0;
+
+  g_array_sort (ranges, mash_glb_loader_compare_ranges);
+
+  for (i = 0; i < ranges->len; i++)
+    {
+      if (n_merged > 0 &&
+          range[i].offset <= (range[n_merged - 1].offset +
+                              range[n_merged - 1].size))
+        {
+          MashGlbLoaderRange *last = range + n_merged - 1;
+
+          last->size = MAX (last->size,
+                            range[i].offset + range[i].size - last->offset);
+        }
+      else
+        range[n_merged++] = range[i];
+    }
+
+  g_array_set_size (ranges, n_merged);
+
+  for (i = 0; i < n_merged; i++)
+    {
+      range[i].buffer_offset = (((buffer_size + 3) & ~(gsize) 3) +
+                                (range[i].offset & 3));
+      buffer_size = range[i].buffer_offset + range[i].size;
+    }
+
+  return buffer_size;
+}
+
+/* Converts an offset in the binary chunk to an offset in the buffer of
+   its packed ranges */
+static gsize
+mash_glb_loader_get_buffer_offset (GArray *ranges,
+                                   gsize offset)
+{
+  const MashGlbLoaderRange *range = (MashGlbLoaderRange *) ranges->data;
+  guint low = 0, high = ranges->len;
+
+  /* Finds the last range starting at or before the offset */
+  while (high - low > 1)
+    {
+      guint middle = low + (high - low) / 2;
+
+      if (range[middle].offset <= offset)
+        low = middle;
+      else
+        high = middle;
+    }
+
+  return range[low].buffer_offset + (offset - range[low].offset);
+}
+
+/* Grows the bounding box with the bounds of a position accessor. They
+   are required by the spec so the positions don't need to be read */
+static gboolean
+mash_glb_loader_add_bounds (MashGlbLoaderData *data,
+                            MashGlbLoaderPrivate *priv,
+                            const MashJsonNode *index)
+{
+  MashJsonNode *node = mash_glb_loader_get_indexed (data, "accessors", index);
+  MashJsonNode *min = mash_json_node_get_member (node, "min");
+  MashJsonNode *max = mash_json_node_get_member (node, "max");
+  gint i;
+
+  if (mash_json_node_get_length (min) < 3 ||
+      mash_json_node_get_length (max) < 3)
+    return mash_glb_loader_set_invalid (data, "position accessor");
+
+  for (i = 0; i < 3; i++)
+    {
+      gfloat *min_value = &priv->min_vertex.x + i;
+      gfloat *max_value = &priv->max_vertex.x + i;
+
+      *min_value = MIN (*min_value,
+                        mash_json_node_get_element (min, i)->number);
+      *max_value = MAX (*max_value,
+                        mash_json_node_get_element (max, i)->number);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+mash_glb_loader_add_attribute (MashGlbLoaderData *data,
+                               MashGlbLoaderPrivate *priv,
+                               MashGlbLoaderPrimitive *part,
+                               const gchar *name,
+                               const MashJsonNode *index)
+{
+  MashGlbLoaderAttribute *attribute = part->attributes + part->n_attributes;
+  MashGlbLoaderAccessor accessor;
+
+  if (!mash_glb_loader_get_accessor (data, index, &accessor))
+    return FALSE;
+
+  switch (accessor.component_type)
+    {
+    case MASH_GLB_LOADER_BYTE:
+      attribute->type = COGL_ATTRIBUTE_TYPE_BYTE;
+      break;
+    case MASH_GLB_LOADER_UNSIGNED_BYTE:
+      attribute->type = COGL_ATTRIBUTE_TYPE_UNSIGNED_BYTE;
+      break;
+    case MASH_GLB_LOADER_SHORT:
+      attribute->type = COGL_ATTRIBUTE_TYPE_SHORT;
+      break;
+    case MASH_GLB_LOADER_UNSIGNED_SHORT:
+      attribute->type = COGL_ATTRIBUTE_TYPE_UNSIGNED_SHORT;
+      break;
+    case MASH_GLB_LOADER_FLOAT:
+      attribute->type = COGL_ATTRIBUTE_TYPE_FLOAT;
+      break;
+    default:
+      return mash_glb_loader_set_invalid (data, "attribute");
+    }
+
+  /* All the attributes of a primitive have the same count */
+  if (part->n_attributes == 0)
+    part->n_vertices = accessor.count;
+  else if (accessor.count != part->n_vertices)
+    return mash_glb_loader_set_invalid (data, "attribute");
+
+  attribute->name = name;
+  attribute->offset = accessor.offset;
+  attribute->stride = accessor.stride;
+  attribute->n_components = accessor.n_components;
+  attribute->normalized = accessor.normalized;
+  part->n_attributes++;
+
+  mash_glb_loader_add_range (priv->vertex_ranges,
+                             accessor.offset, accessor.size);
+
+  return TRUE;
+}
+
+/* The indices go straight to the GPU so they are checked like the ones
+   of the other formats */
+static gboolean
+mash_glb_loader_check_indices (MashGlbLoaderData *data,
+                               const MashGlbLoaderAccessor *accessor,
+                               gint n_vertices)
+{
+  const guint8 *p = data->bin + accessor->offset;
+  guint32 index, max_index = 0;
+  gint i;
+
+  for (i = 0; i < accessor->count; i++)
+    {
+      switch (accessor->component_type)
+        {
+        case MASH_GLB_LOADER_UNSIGNED_BYTE:
+          index = p[i];
+          break;
+        case MASH_GLB_LOADER_UNSIGNED_SHORT:
+          {
+            guint16 value;
+
+            memcpy (&value, p + i * sizeof (guint16), sizeof (value));
+            index = GUINT16_FROM_LE (value);
+          }
+          break;
+        default:
+          index = mash_glb_loader_read_uint32 (p + i * sizeof (guint32));
+          break;
+        }
+
+      max_index = MAX (max_index, index);
+    }
+
+  if (max_index >= (guint32) n_vertices)
+    {
+      if (data->error == NULL)
+        g_set_error (&data->error, MASH_DATA_ERROR,
+                     MASH_DATA_ERROR_INVALID,
+                     "Primitive references vertex %u but there are only "
+                     "%i vertices in glTF file %s",
+                     max_index, n_vertices, data->display_name);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+mash_glb_loader_add_indices (MashGlbLoaderData *data,
+                             MashGlbLoaderPrivate *priv,
+                             MashGlbLoaderPrimitive *part,
+                             const MashJsonNode *index)
+{
+  MashGlbLoaderAccessor accessor;
+
+  if (!mash_glb_loader_get_accessor (data, index, &accessor))
+    return FALSE;
+
+  switch (accessor.component_type)
+    {
+    case MASH_GLB_LOADER_UNSIGNED_BYTE:
+      part->indices_type = COGL_INDICES_TYPE_UNSIGNED_BYTE;
+      break;
+    case MASH_GLB_LOADER_UNSIGNED_SHORT:
+      part->indices_type = COGL_INDICES_TYPE_UNSIGNED_SHORT;
+      break;
+    case MASH_GLB_LOADER_UNSIGNED_INT:
+      part->indices_type = COGL_INDICES_TYPE_UNSIGNED_INT;
+      break;
+    default:
+      return mash_glb_loader_set_invalid (data, "indices");
+    }
+
+  /* Cogl reads the indices tightly packed */
+  if (accessor.n_components != 1 ||
+      accessor.stride != mash_glb_loader_get_component_size
+      (accessor.component_type))
+    return mash_glb_loader_set_invalid (data, "indices");
+
+  if (!mash_glb_loader_check_indices (data, &accessor, part->n_vertices))
+    return FALSE;
+
+  part->indices_offset = accessor.offset;
+  part->n_indices = accessor.count;
+
+  mash_glb_loader_add_range (priv->index_ranges,
+                             accessor.offset, accessor.size);
+
+  return TRUE;
+}
+
+static gboolean
+mash_glb_loader_add_primitive (MashGlbLoaderData *data,
+                               MashGlbLoaderPrivate *priv,
+                               const MashJsonNode *primitive)
+{
+  MashJsonNode *attributes = mash_json_node_get_member (primitive,
+                                                        "attributes");
+  MashGlbLoaderPrimitive part;
+  gdouble mode;
+  gint i;
+
+  memset (&part, 0, sizeof (part));
+
+  mode = mash_json_node_get_number (primitive, "mode", 4);
+  if (mode < 0 || mode >= G_N_ELEMENTS (mash_glb_loader_modes))
+    return mash_glb_loader_set_invalid (data, "primitive mode");
+  part.mode = mash_glb_loader_modes[(gint) mode];
+
+  if (mash_json_node_get_member (attributes, "POSITION") == NULL)
+    return mash_glb_loader_set_invalid (data, "primitive");
+
+  /* Other attributes, such as the skinning ones, are ignored */
+  for (i = 0; i < G_N_ELEMENTS (mash_glb_loader_attributes); i++)
+    {
+      MashJsonNode *index =
+        mash_json_node_get_member (attributes,
+                                   mash_glb_loader_attributes[i].semantic);
+
+      if (index &&
+          !mash_glb_loader_add_attribute (data, priv, &part,
+                                          mash_glb_loader_attributes[i].name,
+                                          index))
+        return FALSE;
+    }
+
+  if (!mash_glb_loader_add_bounds (data, priv,
+                                   mash_json_node_get_member (attributes,
+                                                              "POSITION")))
+    return FALSE;
+
+  if (mash_json_node_get_member (primitive, "indices") &&
+      !mash_glb_loader_add_indices (data, priv, &part,
+                                    mash_json_node_get_member (primitive,
+                                                               "indices")))
+    return FALSE;
+
+  g_array_append_val (priv->parts, part);
+
+  return TRUE;
+}
+
+static gboolean
+mash_glb_loader_read_meshes (MashGlbLoaderData *data,
+                             MashGlbLoaderPrivate *priv)
+{
+  MashJsonNode *meshes = mash_json_node_get_member (data->root, "meshes");
+  MashJsonNode *required = mash_json_node_get_member (data->root,
+                                                      "extensionsRequired");
+  guint i, j;
+
+  /* Extensions such as the mesh compression ones change how the data
+     is stored */
+  if (mash_json_node_get_length (required) > 0)
+    return mash_glb_loader_set_unsupported
+      (data, mash_json_node_get_element (required, 0)->type ==
+       MASH_JSON_STRING ?
+       mash_json_node_get_element (required, 0)->string : "extensions");
+
+  for (i = 0; i < mash_json_node_get_length (meshes); i++)
+    {
+      MashJsonNode *primitives =
+        mash_json_node_get_member (mash_json_node_get_element (meshes, i),
+                                   "primitives");
+
+      for (j = 0; j < mash_json_node_get_length (primitives); j++)
+        if (!mash_glb_loader_add_primitive (data, priv,
+                                            mash_json_node_get_element
+                                            (primitives, j)))
+          return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+mash_glb_loader_load (MashDataLoader *data_loader,
+                      MashDataFlags flags,
+                      const gchar *filename,
+                      GError **error)
+{
+  MashGlbLoader *self = MASH_GLB_LOADER (data_loader);
+  MashGlbLoaderPrivate *priv = self->priv;
+  MashGlbLoaderData data;
+  GMappedFile *file;
+  gchar *display_name;
+  gboolean ret = FALSE;
+
+  /* Get rid of the old primitive (if any) */
+  mash_glb_loader_free_primitive (self);
+
+  memset (&data, 0, sizeof (data));
+  display_name = g_filename_display_name (filename);
+  data.display_name = display_name;
+
+  priv->parts = g_array_new (FALSE, FALSE, sizeof (MashGlbLoaderPrimitive));
+  priv->vertex_ranges = g_array_new (FALSE, FALSE,
+                                     sizeof (MashGlbLoaderRange));
+  priv->index_ranges = g_array_new (FALSE, FALSE,
+                                    sizeof (MashGlbLoaderRange));
+  priv->min_vertex.x = G_MAXFLOAT;
+  priv->min_vertex.y = G_MAXFLOAT;
+  priv->min_vertex.z = G_MAXFLOAT;
+  priv->max_vertex.x = -G_MAXFLOAT;
+  priv->max_vertex.y = -G_MAXFLOAT;
+  priv->max_vertex.z = -G_MAXFLOAT;
+
+  if ((file = g_mapped_file_new (filename, FALSE, &data.error)))
+    {
+      if (mash_glb_loader_read_chunks (&data,
+                                       (const guint8 *)
+                                       g_mapped_file_get_contents (file),
+                                       g_mapped_file_get_length (file)) &&
+          mash_glb_loader_read_meshes (&data, priv))
+        {
+          if (priv->parts->len == 0)
+            g_set_error (&data.error, MASH_DATA_ERROR,
+                         MASH_DATA_ERROR_INVALID,
+                         "No meshes found in %s",
+                         display_name);
+        }
+
+      mash_json_node_free (data.root);
+    }
+
+  if (data.error)
+    {
+      g_propagate_error (error, data.error);
+      if (file)
+        g_mapped_file_unref (file);
+      mash_glb_loader_free_data (self);
+    }
+  else
+    {
+      guint i;
+
+      /* Only the bytes used by the accessors are uploaded */
+      priv->vertex_size = mash_glb_loader_pack_ranges (priv->vertex_ranges);
+      priv->index_size = mash_glb_loader_pack_ranges (priv->index_ranges);
+
+      /* Make the offsets relative to the buffers they are packed in */
+      for (i = 0; i < priv->parts->len; i++)
+        {
+          MashGlbLoaderPrimitive *part =
+            &g_array_index (priv->parts, MashGlbLoaderPrimitive, i);
+          gint j;
+
+          for (j = 0; j < part->n_attributes; j++)
+            part->attributes[j].offset =
+              mash_glb_loader_get_buffer_offset (priv->vertex_ranges,
+                                                 part->attributes[j].offset);
+          if (part->n_indices > 0)
+            part->indices_offset =
+              mash_glb_loader_get_buffer_offset (priv->index_ranges,
+                                                 part->indices_offset);
+        }
+
+      priv->file = file;
+      priv->bin = data.bin;
+      priv->n_bytes = priv->vertex_size + priv->index_size;
+      ret = TRUE;
+    }
+
+  g_free (display_name);
+
+  return ret;
+}
+
+typedef struct
+{
+  guint n_pending;
+  MashDataUploadDoneFunc done;
+  gpointer user_data;
+} MashGlbLoaderUpload;
+
+static void
+mash_glb_loader_upload_done (gpointer user_data)
+{
+  MashGlbLoaderUpload *upload = user_data;
+
+  if (--upload->n_pending == 0)
+    {
+      upload->done (upload->user_data);
+      g_slice_free (MashGlbLoaderUpload, upload);
+    }
+}
+
+/* Copies the ranges of the binary chunk to @buffer, directly when
+   @upload is NULL */
+static void
+mash_glb_loader_upload_ranges (MashGlbLoader *self,
+                               GArray *ranges,
+                               CoglBuffer *buffer,
+                               gsize buffer_offset,
+                               MashGlbLoaderUpload *upload)
+{
+  MashGlbLoaderPrivate *priv = self->priv;
+  guint i;
+
+  for (i = 0; i < ranges->len; i++)
+    {
+      const MashGlbLoaderRange *range =
+        &g_array_index (ranges, MashGlbLoaderRange, i);
+
+      if (upload)
+        mash_mesh_cache_upload_buffer (buffer,
+                                       buffer_offset + range->buffer_offset,
+                                       priv->bin + range->offset,
+                                       range->size,
+                                       mash_glb_loader_upload_done, upload);
+      else
+        cogl_buffer_set_data (buffer, buffer_offset + range->buffer_offset,
+                              priv->bin + range->offset, range->size);
+    }
+}
+
+/* Creates the primitives in buffers from the backend. The data goes
+   straight from the mapping to the buffers, which is done before
+   returning when @done is NULL */
+static void
+mash_glb_loader_create_primitives (MashGlbLoader *self,
+                                   MashDataUploadDoneFunc done,
+                                   gpointer user_data)
+{
+  MashGlbLoaderPrivate *priv = self->priv;
+  MashGlbLoaderUpload *upload = NULL;
+  CoglBuffer *vertex_buffer, *index_buffer = NULL;
+  gpointer vertex_range, index_range = NULL;
+  gsize vertex_offset, index_offset = 0;
+  guint i;
+
+  vertex_buffer =
+    mash_mesh_cache_alloc_buffer (MASH_DATA_BUFFER_ATTRIBUTES,
+                                  MASH_GLB_LOADER_FORMAT,
+                                  priv->vertex_size, 4,
+                                  &vertex_offset, &vertex_range);
+
+  if (priv->index_size > 0)
+    index_buffer =
+      mash_mesh_cache_alloc_buffer (MASH_DATA_BUFFER_INDICES, NULL,
+                                    priv->index_size, 4,
+                                    &index_offset, &index_range);
+
+  priv->primitives = g_ptr_array_new_with_free_func (cogl_object_unref);
+
+  for (i = 0; i < priv->parts->len; i++)
+    {
+      const MashGlbLoaderPrimitive *part =
+        &g_array_index (priv->parts, MashGlbLoaderPrimitive, i);
+      CoglAttribute *attributes[MASH_GLB_LOADER_MAX_ATTRIBUTES];
+      CoglPrimitive *primitive;
+      gint j;
+
+      for (j = 0; j < part->n_attributes; j++)
+        {
+          const MashGlbLoaderAttribute *attribute = part->attributes + j;
+
+          attributes[j] =
+            cogl_attribute_new (COGL_ATTRIBUTE_BUFFER (vertex_buffer),
+                                attribute->name,
+                                attribute->stride,
+                                vertex_offset + attribute->offset,
+                                attribute->n_components,
+                                attribute->type);
+          if (attribute->normalized)
+            cogl_attribute_set_normalized (attributes[j], TRUE);
+        }
+
+      primitive = cogl_primitive_new_with_attributes (part->mode,
+                                                      part->n_vertices,
+                                                      attributes,
+                                                      part->n_attributes);
+
+      if (part->n_indices > 0)
+        {
+          CoglIndices *indices =
+            cogl_indices_new_for_buffer (part->indices_type,
+                                         COGL_INDEX_BUFFER (index_buffer),
+                                         index_offset +
+                                         part->indices_offset);
+
+          cogl_primitive_set_indices (primitive, indices, part->n_indices);
+          cogl_object_unref (indices);
+        }
+
+      for (j = 0; j < part->n_attributes; j++)
+        cogl_object_unref (attributes[j]);
+
+      g_ptr_array_add (priv->primitives, primitive);
+    }
+
+  /* The ranges are freed with the first primitive, the primitives of a
+     model being kept together */
+  mash_mesh_cache_free_buffer_with_object (vertex_range,
+                                           g_ptr_array_index
+                                           (priv->primitives, 0));
+  if (index_range)
+    mash_mesh_cache_free_buffer_with_object (index_range,
+                                             g_ptr_array_index
+                                             (priv->primitives, 0));
+
+  /* @done can free the loader so it is only called once all the ranges
+     are handed over, even if the backend uploads them immediately */
+  if (done)
+    {
+      upload = g_slice_new (MashGlbLoaderUpload);
+      upload->n_pending = (priv->vertex_ranges->len +
+                           priv->index_ranges->len + 1);
+      upload->done = done;
+      upload->user_data = user_data;
+    }
+
+  mash_glb_loader_upload_ranges (self, priv->vertex_ranges,
+                                 vertex_buffer, vertex_offset, upload);
+  if (index_buffer)
+    mash_glb_loader_upload_ranges (self, priv->index_ranges,
+                                   index_buffer, index_offset, upload);
+
+  if (upload)
+    mash_glb_loader_upload_done (upload);
+}
+
+static void
+mash_glb_loader_upload_queued (MashDataLoader *data_loader,
+                               MashDataUploadDoneFunc done,
+                               gpointer user_data)
+{
+  MashGlbLoader *self = MASH_GLB_LOADER (data_loader);
+
+  /* The mapping is kept until get_data() is called from @done */
+  mash_glb_loader_create_primitives (self, done, user_data);
+}
+
+static void
+mash_glb_loader_get_data (MashDataLoader *data_loader,
+                          MashDataLoaderData *loader_data)
+{
+  MashGlbLoader *self = MASH_GLB_LOADER (data_loader);
+  MashGlbLoaderPrivate *priv = self->priv;
+
+  /* Upload the data on the first call, from the thread owning the
+     Cogl context, unless upload_queued() already did */
+  if (priv->primitives == NULL)
+    mash_glb_loader_create_primitives (self, NULL, NULL);
+  mash_glb_loader_free_data (self);
+
+  loader_data->primitives = g_ptr_array_ref (priv->primitives);
+
+  loader_data->min_vertex = priv->min_vertex;
+  loader_data->max_vertex = priv->max_vertex;
+  memset (&loader_data->quantization, 0, sizeof (loader_data->quantization));
+  loader_data->n_bytes = priv->n_bytes;
+  loader_data->generated_normals = FALSE;
+}
@@ -0,0 +1,502 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A small JSON parser building a tree of the whole document, enough
+ * for the manifests of the model formats. The text doesn't have to be
+ * nul terminated so that it can be parsed straight from a mapped file.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "mash-json.h"
+#include "mash-data.h"
+
+/* Deepest nesting accepted, to bound the recursion */
+#define MASH_JSON_MAX_DEPTH 64
+
+typedef struct
+{
+  const gchar *start, *p, *end;
+  gint depth;
+  GError **error;
+} MashJsonParser;
+
+static MashJsonNode *mash_json_parse_value (MashJsonParser *parser);
+
+static gboolean
+mash_json_set_error (MashJsonParser *parser,
+                     const gchar *message)
+{
+  g_set_error (parser->error, MASH_DATA_ERROR,
+               MASH_DATA_ERROR_INVALID,
+               "Invalid JSON at offset %" G_GSIZE_FORMAT ": %s",
+               (gsize) (parser->p - parser->start), message);
+
+  return FALSE;
+}
+
+static void
+mash_json_skip_space (MashJsonParser *parser)
+{
+  while (parser->p < parser->end &&
+         (*parser->p == ' ' || *parser->p == '\t' ||
+          *parser->p == '\n' || *parser->p == '\r'))
+    parser->p++;
+}
+
+static MashJsonNode *
+mash_json_node_new (MashJsonType type)
+{
+  MashJsonNode *node = g_slice_new0 (MashJsonNode);
+
+  node->type = type;
+
+  return node;
+}
+
+void
+mash_json_node_free (MashJsonNode *node)
+{
+  if (node == NULL)
+    return;
+
+  if (node->children)
+    g_ptr_array_free (node->children, TRUE);
+  g_free (node->string);
+  g_free (node->name);
+
+  g_slice_free (MashJsonNode, node);
+}
+
+static void
+mash_json_node_free_cb (gpointer node)
+{
+  mash_json_node_free (node);
+}
+
+static gboolean
+mash_json_parse_literal (MashJsonParser *parser,
+                         const gchar *literal)
+{
+  gsize length = strlen (literal);
+
+  if (parser->end - parser->p < length ||
+      memcmp (parser->p, literal, length))
+    return mash_json_set_error (parser, "unexpected character");
+
+  parser->p += length;
+
+  return TRUE;
+}
+
+static gint
+mash_json_parse_hex (MashJsonParser *parser)
+{
+  gint value = 0, i;
+
+  if (parser->end - parser->p < 4)
+    return -1;
+
+  for (i = 0; i < 4; i++)
+    {
+      gint digit = g_ascii_xdigit_value (*parser->p++);
+
+      if (digit < 0)
+        return -1;
+      value = value * 16 + digit;
+    }
+
+  return value;
+}
+
+static gboolean
+mash_json_parse_escape (MashJsonParser *parser,
+                        GString *string)
+{
+  gint c;
+
+  switch (*parser->p++)
+    {
+    case '"': g_string_append_c (string, '"'); return TRUE;
+    case '\\': g_string_append_c (string, '\\'); return TRUE;
+    case '/': g_string_append_c (string, '/'); return TRUE;
+    case 'b': g_string_append_c (string, '\b'); return TRUE;
+    case 'f': g_string_append_c (string, '\f'); return TRUE;
+    case 'n': g_string_append_c (string, '\n'); return TRUE;
+    case 'r': g_string_append_c (string, '\r'); return TRUE;
+    case 't': g_string_append_c (string, '\t'); return TRUE;
+    case 'u':
+      break;
+    default:
+      return mash_json_set_error (parser, "invalid escape");
+    }
+
+  c = mash_json_parse_hex (parser);
+
+  /* Characters outside of the BMP are written as a pair of
+     surrogates */
+  if (c >= 0xd800 && c < 0xdc00 &&
+      parser->end - parser->p >= 6 &&
+      parser->p[0] == '\\' && parser->p[1] == 'u')
+    {
+      gint low;
+
+      parser->p += 2;
+      low = mash_json_parse_hex (parser);
+      if (low >= 0xdc00 && low < 0xe000)
+        c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+      else
+        c = -1;
+    }
+
+  if (c < 0)
+    return mash_json_set_error (parser, "invalid escape");
+
+  g_string_append_unichar (string, c);
+
+  return TRUE;
+}
+
+/* Parses a string, the opening quote having been checked */
+static gchar *
+mash_json_parse_string (MashJsonParser *parser)
+{
+  GString *string = g_string_new (NULL);
+
+  parser->p++;
+
+  while (TRUE)
+    {
+      const gchar *run = parser->p;
+
+      /* Copy the characters that don't need escaping in one go */
+      while (parser->p < parser->end &&
+             *parser->p != '"' && *parser->p != '\\' &&
+             (guchar) *parser->p >= 0x20)
+        parser->p++;
+      g_string_append_len (string, run, parser->p - run);
+
+      if (parser->p >= parser->end || (guchar) *parser->p < 0x20)
+        {
+          mash_json_set_error (parser, "unterminated string");
+          break;
+        }
+
+      if (*parser->p++ == '"')
+        return g_string_free (string, FALSE);
+
+      if (parser->p >= parser->end)
+        {
+          mash_json_set_error (parser, "unterminated string");
+          break;
+        }
+
+      if (!mash_json_parse_escape (parser, string))
+        break;
+    }
+
+  g_string_free (string, TRUE);
+
+  return NULL;
+}
+
+static gboolean
+mash_json_parse_number (MashJsonParser *parser,
+                        gdouble *number)
+{
+  const gchar *start = parser->p;
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar *end;
+
+  while (parser->p < parser->end &&
+         (g_ascii_isdigit (*parser->p) || *parser->p == '-' ||
+          *parser->p == '+' || *parser->p == '.' ||
+          *parser->p == 'e' || *parser->p == 'E'))
+    parser->p++;
+
+  /* The text isn't nul terminated so the number is copied out for
+     g_ascii_strtod() */
+  if (parser->p == start || parser->p - start >= sizeof (buf))
+    return mash_json_set_error (parser, "invalid number");
+
+  memcpy (buf, start, parser->p - start);
+  buf[parser->p - start] = '\0';
+
+  *number = g_ascii_strtod (buf, &end);
+  if (*end != '\0')
+    return mash_json_set_error (parser, "invalid number");
+
+  return TRUE;
+}
+
+/* Parses the elements of an array or the members of an object, the
+   opening bracket having been checked */
+static gboolean
+mash_json_parse_children (MashJsonParser *parser,
+                          MashJsonNode *node,
+                          gchar close)
+{
+  node->children = g_ptr_array_new_with_free_func (mash_json_node_free_cb);
+
+  parser->p++;
+  mash_json_skip_space (parser);
+  if (parser->p < parser->end && *parser->p == close)
+    {
+      parser->p++;
+      return TRUE;
+    }
+
+  while (TRUE)
+    {
+      MashJsonNode *child;
+      gchar *name = NULL;
+
+      if (node->type == MASH_JSON_OBJECT)
+        {
+          mash_json_skip_space (parser);
+          if (parser->p >= parser->end || *parser->p != '"')
+            return mash_json_set_error (parser, "expected a member name");
+          if ((name = mash_json_parse_string (parser)) == NULL)
+            return FALSE;
+
+          mash_json_skip_space (parser);
+          if (parser->p >= parser->end || *parser->p != ':')
+            {
+              g_free (name);
+              return mash_json_set_error (parser, "expected ':'");
+            }
+          parser->p++;
+        }
+
+      if ((child = mash_json_parse_value (parser)) == NULL)
+        {
+          g_free (name);
+          return FALSE;
+        }
+      child->name = name;
+      g_ptr_array_add (node->children, child);
+
+      mash_json_skip_space (parser);
+      if (parser->p >= parser->end)
+        return mash_json_set_error (parser, "unexpected end");
+      if (*parser->p == close)
+        {
+          parser->p++;
+          return TRUE;
+        }
+      if (*parser->p++ != ',')
+        return mash_json_set_error (parser, "expected ','");
+    }
+}
+
+static MashJsonNode *
+mash_json_parse_value (MashJsonParser *parser)
+{
+  MashJsonNode *node = NULL;
+  gboolean ok = FALSE;
+
+  mash_json_skip_space (parser);
+
+  if (parser->p >= parser->end)
+    {
+      mash_json_set_error (parser, "unexpected end");
+      return NULL;
+    }
+
+  switch (*parser->p)
+    {
+    case '{':
+    case '[':
+      if (parser->depth >= MASH_JSON_MAX_DEPTH)
+        {
+          mash_json_set_error (parser, "too deeply nested");
+          return NULL;
+        }
+      node = mash_json_node_new (*parser->p == '{' ?
+                                 MASH_JSON_OBJECT : MASH_JSON_ARRAY);
+      parser->depth++;
+      ok = mash_json_parse_children (parser, node,
+                                     *parser->p == '{' ? '}' : ']');
+      parser->depth--;
+      break;
+
+    case '"':
+      node = mash_json_node_new (MASH_JSON_STRING);
+      ok = (node->string = mash_json_parse_string (parser)) != NULL;
+      break;
+
+    case 't':
+    case 'f':
+      node = mash_json_node_new (MASH_JSON_BOOLEAN);
+      node->boolean = *parser->p == 't';
+      ok = mash_json_parse_literal (parser,
+                                    node->boolean ? "true" : "false");
+      break;
+
+    case 'n':
+      node = mash_json_node_new (MASH_JSON_NULL);
+      ok = mash_json_parse_literal (parser, "null");
+      break;
+
+    default:
+      node = mash_json_node_new (MASH_JSON_NUMBER);
+      ok = mash_json_parse_number (parser, &node->number);
+      break;
+    }
+
+  if (!ok)
+    {
+      mash_json_node_free (node);
+      return NULL;
+    }
+
+  return node;
+}
+
+/*
+ * mash_json_parse:
+ * @text: The JSON document
+ * @length: The length of @text in bytes
+ * @error: Return location for an error or %NULL
+ *
+ * Parses a whole JSON document.
+ *
+ * Return value: The root of the document, to free with
+ *   mash_json_node_free(), or %NULL if the document isn't valid.
+ */
+MashJsonNode *
+mash_json_parse (const gchar *text,
+                 gsize length,
+                 GError **error)
+{
+  MashJsonParser parser;
+  MashJsonNode *root;
+
+  parser.start = parser.p = text;
+  parser.end = text + length;
+  parser.depth = 0;
+  parser.error = error;
+
+  if ((root = mash_json_parse_value (&parser)) == NULL)
+    return NULL;
+
+  /* Trailing nuls are used as padding */
+  mash_json_skip_space (&parser);
+  while (parser.p < parser.end && *parser.p == '\0')
+    parser.p++;
+
+  if (parser.p < parser.end)
+    {
+      mash_json_set_error (&parser, "trailing data");
+      mash_json_node_free (root);
+      return NULL;
+    }
+
+  return root;
+}
+
+/*
+ * mash_json_node_get_member:
+ * @node: A #MashJsonNode
+ * @name: The name of a member
+ *
+ * Return value: The member called @name if @node is an object which
+ *   has one, %NULL otherwise.
+ */
+MashJsonNode *
+mash_json_node_get_member (const MashJsonNode *node,
+                           const gchar *name)
+{
+  guint i;
+
+  if (node == NULL || node->type != MASH_JSON_OBJECT)
+    return NULL;
+
+  for (i = 0; i < node->children->len; i++)
+    {
+      MashJsonNode *child = g_ptr_array_index (node->children, i);
+
+      if (!strcmp (child->name, name))
+        return child;
+    }
+
+  return NULL;
+}
+
+/*
+ * mash_json_node_get_element:
+ * @node: A #MashJsonNode
+ * @index: The index of an element
+ *
+ * Return value: The element at @index if @node is an array long
+ *   enough, %NULL otherwise.
+ */
+MashJsonNode *
+mash_json_node_get_element (const MashJsonNode *node,
+                            guint index)
+{
+  if (node == NULL || node->type != MASH_JSON_ARRAY ||
+      index >= node->children->len)
+    return NULL;
+
+  return g_ptr_array_index (node->children, index);
+}
+
+/* Returns the number of elements of an array, 0 for anything else */
+guint
+mash_json_node_get_length (const MashJsonNode *node)
+{
+  if (node == NULL || node->type != MASH_JSON_ARRAY)
+    return 0;
+
+  return node->children->len;
+}
+
+/* Returns the number in the member @name of an object, or
+   @default_value if it doesn't have one */
+gdouble
+mash_json_node_get_number (const MashJsonNode *node,
+                           const gchar *name,
+                           gdouble default_value)
+{
+  MashJsonNode *member = mash_json_node_get_member (node, name);
+
+  if (member == NULL || member->type != MASH_JSON_NUMBER)
+    return default_value;
+
+  return member->number;
+}
+
+/* Returns the string in the member @name of an object or %NULL */
+const gchar *
+mash_json_node_get_string (const MashJsonNode *node,
+                           const gchar *name)
+{
+  MashJsonNode *member = mash_json_node_get_member (node, name);
+
+  if (member == NULL || member->type != MASH_JSON_STRING)
+    return NULL;
+
+  return member->string;
+}
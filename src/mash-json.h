@@ -0,0 +1,80 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MASH_JSON_H__
+#define __MASH_JSON_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  MASH_JSON_NULL,
+  MASH_JSON_BOOLEAN,
+  MASH_JSON_NUMBER,
+  MASH_JSON_STRING,
+  MASH_JSON_ARRAY,
+  MASH_JSON_OBJECT
+} MashJsonType;
+
+typedef struct _MashJsonNode MashJsonNode;
+
+/**
+ * MashJsonNode:
+ * @type: The type of the value
+ * @name: The name of the member when the node is in an object
+ * @boolean: The value of a %MASH_JSON_BOOLEAN
+ * @number: The value of a %MASH_JSON_NUMBER
+ * @string: The value of a %MASH_JSON_STRING
+ * @children: The elements of a %MASH_JSON_ARRAY or the members of a
+ *   %MASH_JSON_OBJECT, in the order of the document
+ *
+ * A value of a parsed JSON document.
+ */
+struct _MashJsonNode
+{
+  MashJsonType type;
+  gchar *name;
+
+  gboolean boolean;
+  gdouble number;
+  gchar *string;
+  GPtrArray *children;
+};
+
+MashJsonNode *mash_json_parse             (const gchar *text,
+                                           gsize length,
+                                           GError **error);
+void          mash_json_node_free         (MashJsonNode *node);
+
+MashJsonNode *mash_json_node_get_member   (const MashJsonNode *node,
+                                           const gchar *name);
+MashJsonNode *mash_json_node_get_element  (const MashJsonNode *node,
+                                           guint index);
+guint         mash_json_node_get_length   (const MashJsonNode *node);
+
+gdouble       mash_json_node_get_number   (const MashJsonNode *node,
+                                           const gchar *name,
+                                           gdouble default_value);
+const gchar  *mash_json_node_get_string   (const MashJsonNode *node,
+                                           const gchar *name);
+
+G_END_DECLS
+
+#endif /* __MASH_JSON_H__ */
@@ -0,0 +1,903 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The mesh cache stores the final vertex and index data of a model,
+ * once it has been parsed, welded, optimized and quantized, so that
+ * the next loads can map it and upload it as it is.
+ *
+ * A cache file is made of a header followed by the vertices, the
+ * indices and the table of submeshes, all aligned to 16 bytes. The
+ * files live in the user cache directory and are named after a
+ * checksum of the absolute path of the model and of the load flags.
+ * The header records the size and a hash of the contents of the model
+ * so that stale files are ignored and then overwritten by the next
+ * save. The data is stored in the native byte order and the header
+ * records it. Asset packs store the same layout, without a model to
+ * compare with.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <errno.h>
+#include <cogl/cogl.h>
+
+#include "mash-mesh-cache.h"
+
+#define MASH_MESH_CACHE_MAGIC      "MASHMESH"
+#define MASH_MESH_CACHE_BYTE_ORDER 0x01020304
+#define MASH_MESH_CACHE_ALIGN(x)   (((x) + 15) & ~(guint64) 15)
+
+typedef struct _MashMeshCacheHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint32 flags;
+
+  guint32 n_vertices;
+  guint32 stride;
+  guint32 n_indices;
+  guint32 indices_type;
+  guint32 n_attributes;
+
+  /* Model the cache was generated from */
+  guint64 source_size;
+  guint64 source_hash;
+
+  guint64 vertices_offset;
+  guint64 indices_offset;
+  guint64 submeshes_offset;
+  guint32 n_submeshes;
+
+  gfloat min_vertex[3];
+  gfloat max_vertex[3];
+
+  guint32 quantized_attributes;
+  gfloat position_scale[3], position_offset[3];
+  gfloat tex_coord_scale[2], tex_coord_offset[2];
+
+  guint32 generated_normals;
+
+  MashMeshCacheAttribute attributes[MASH_MESH_CACHE_MAX_ATTRIBUTES];
+} MashMeshCacheHeader;
+
+struct _MashMeshCache
+{
+  GBytes *bytes;
+  MashMeshCacheData data;
+};
+
+/* The cache flag doesn't change the data */
+#define MASH_MESH_CACHE_KEY_FLAGS(flags) ((flags) & ~MASH_DATA_CACHE)
+
+static gchar *
+mash_mesh_cache_get_path (const gchar *filename,
+                          MashDataFlags flags)
+{
+  gchar *absolute_filename, *key, *checksum, *basename, *path;
+
+  if (g_path_is_absolute (filename))
+    absolute_filename = g_strdup (filename);
+  else
+    {
+      gchar *cwd = g_get_current_dir ();
+
+      absolute_filename = g_build_filename (cwd, filename, NULL);
+      g_free (cwd);
+    }
+
+  key = g_strdup_printf ("%s:%x", absolute_filename,
+                         MASH_MESH_CACHE_KEY_FLAGS (flags));
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  basename = g_strconcat (checksum, ".mesh", NULL);
+  path = g_build_filename (g_get_user_cache_dir (), "wonderbar", "meshes",
+                           basename, NULL);
+
+  g_free (basename);
+  g_free (checksum);
+  g_free (key);
+  g_free (absolute_filename);
+
+  return path;
+}
+
+/* 64 bits FNV-1a taking 8 bytes at a time. It is only meant to notice
+   that a model has changed and runs at about the speed of the memory,
+   so the model is read much faster than it would be parsed */
+static guint64
+mash_mesh_cache_hash (const guint8 *data,
+                      gsize length)
+{
+  guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  guint64 word;
+  gsize i;
+
+  for (i = 0; i + sizeof (word) <= length; i += sizeof (word))
+    {
+      memcpy (&word, data + i, sizeof (word));
+      hash = (hash ^ word) * G_GUINT64_CONSTANT (0x100000001b3);
+    }
+
+  for (; i < length; i++)
+    hash = (hash ^ data[i]) * G_GUINT64_CONSTANT (0x100000001b3);
+
+  return hash;
+}
+
+static gboolean
+mash_mesh_cache_hash_file (const gchar *filename,
+                           guint64 *hash)
+{
+  GMappedFile *file;
+
+  if ((file = g_mapped_file_new (filename, FALSE, NULL)) == NULL)
+    return FALSE;
+
+  *hash = mash_mesh_cache_hash ((const guint8 *)
+                                g_mapped_file_get_contents (file),
+                                g_mapped_file_get_length (file));
+  g_mapped_file_unref (file);
+
+  return TRUE;
+}
+
+static guint
+mash_mesh_cache_get_index_size (CoglIndicesType indices_type)
+{
+  switch (indices_type)
+    {
+    case COGL_INDICES_TYPE_UNSIGNED_BYTE:
+      return 1;
+    case COGL_INDICES_TYPE_UNSIGNED_SHORT:
+      return 2;
+    case COGL_INDICES_TYPE_UNSIGNED_INT:
+      return 4;
+    }
+
+  return 0;
+}
+
+static guint
+mash_mesh_cache_get_attribute_type_size (CoglAttributeType type)
+{
+  switch (type)
+    {
+    case COGL_ATTRIBUTE_TYPE_BYTE:
+    case COGL_ATTRIBUTE_TYPE_UNSIGNED_BYTE:
+      return 1;
+    case COGL_ATTRIBUTE_TYPE_SHORT:
+    case COGL_ATTRIBUTE_TYPE_UNSIGNED_SHORT:
+      return 2;
+    case COGL_ATTRIBUTE_TYPE_FLOAT:
+      return 4;
+    }
+
+  return 0;
+}
+
+static gboolean
+mash_mesh_cache_check_header (const MashMeshCacheHeader *header,
+                              gsize length,
+                              MashDataFlags flags,
+                              const GStatBuf *source)
+{
+  const MashMeshSubmesh *submeshes;
+  guint index_size, type_size;
+  guint i;
+
+  if (memcmp (header->magic, MASH_MESH_CACHE_MAGIC, sizeof (header->magic)) ||
+      header->version != MASH_MESH_CACHE_VERSION ||
+      header->byte_order != MASH_MESH_CACHE_BYTE_ORDER ||
+      header->flags != MASH_MESH_CACHE_KEY_FLAGS (flags))
+    return FALSE;
+
+  /* The model has changed since the cache was written. The hash of
+     its contents is only checked once the rest of the file is known
+     to be valid. Data coming from an asset pack has no model to
+     compare with */
+  if (source && header->source_size != (guint64) source->st_size)
+    return FALSE;
+
+  /* Don't trust the sizes of a truncated or corrupted file. Each
+     section is compared to the space left before the next one so that
+     huge values can't wrap around */
+  index_size = mash_mesh_cache_get_index_size (header->indices_type);
+  if (index_size == 0 ||
+      header->n_attributes > MASH_MESH_CACHE_MAX_ATTRIBUTES ||
+      ((header->vertices_offset | header->indices_offset |
+        header->submeshes_offset) & 15) ||
+      header->vertices_offset < sizeof (MashMeshCacheHeader) ||
+      header->indices_offset < header->vertices_offset ||
+      header->submeshes_offset < header->indices_offset ||
+      header->submeshes_offset > length ||
+      (guint64) header->n_vertices * header->stride >
+      header->indices_offset - header->vertices_offset ||
+      (guint64) header->n_indices * index_size >
+      header->submeshes_offset - header->indices_offset ||
+      (guint64) header->n_submeshes * sizeof (MashMeshSubmesh) >
+      length - header->submeshes_offset)
+    return FALSE;
+
+  /* The attributes are handed to Cogl as they are */
+  for (i = 0; i < header->n_attributes; i++)
+    {
+      const MashMeshCacheAttribute *attribute = header->attributes + i;
+
+      type_size = mash_mesh_cache_get_attribute_type_size (attribute->type);
+
+      if (type_size == 0 ||
+          attribute->n_components < 1 ||
+          attribute->n_components > 4 ||
+          attribute->offset > header->stride ||
+          attribute->n_components * type_size >
+          header->stride - attribute->offset ||
+          attribute->name[sizeof (attribute->name) - 1])
+        return FALSE;
+    }
+
+  submeshes = (const MashMeshSubmesh *) ((const gchar *) header +
+                                         header->submeshes_offset);
+  for (i = 0; i < header->n_submeshes; i++)
+    if ((guint64) submeshes[i].first_vertex + submeshes[i].n_vertices >
+        header->n_vertices ||
+        (guint64) submeshes[i].first_index + submeshes[i].n_indices >
+        header->n_indices)
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Takes a reference on @bytes if they hold valid data */
+static MashMeshCache *
+mash_mesh_cache_new (GBytes *bytes,
+                     MashDataFlags flags,
+                     const GStatBuf *source)
+{
+  const MashMeshCacheHeader *header;
+  MashMeshCacheData *data;
+  MashMeshCache *cache;
+  const gchar *contents;
+  gsize length;
+
+  contents = g_bytes_get_data (bytes, &length);
+  header = (const MashMeshCacheHeader *) contents;
+
+  if (length < sizeof (MashMeshCacheHeader) ||
+      !mash_mesh_cache_check_header (header, length, flags, source))
+    return NULL;
+
+  cache = g_slice_new (MashMeshCache);
+  cache->bytes = g_bytes_ref (bytes);
+
+  data = &cache->data;
+  data->vertices = (const guint8 *) contents + header->vertices_offset;
+  data->n_vertices = header->n_vertices;
+  data->stride = header->stride;
+  data->indices = (const guint8 *) contents + header->indices_offset;
+  data->indices_type = header->indices_type;
+  data->n_indices = header->n_indices;
+  data->submeshes = (const MashMeshSubmesh *) (contents +
+                                               header->submeshes_offset);
+  data->n_submeshes = header->n_submeshes;
+  memcpy (data->attributes, header->attributes, sizeof (data->attributes));
+  data->n_attributes = header->n_attributes;
+  data->min_vertex.x = header->min_vertex[0];
+  data->min_vertex.y = header->min_vertex[1];
+  data->min_vertex.z = header->min_vertex[2];
+  data->max_vertex.x = header->max_vertex[0];
+  data->max_vertex.y = header->max_vertex[1];
+  data->max_vertex.z = header->max_vertex[2];
+  data->quantization.attributes = header->quantized_attributes;
+  memcpy (data->quantization.position_scale, header->position_scale,
+          sizeof (header->position_scale));
+  memcpy (data->quantization.position_offset, header->position_offset,
+          sizeof (header->position_offset));
+  memcpy (data->quantization.tex_coord_scale, header->tex_coord_scale,
+          sizeof (header->tex_coord_scale));
+  memcpy (data->quantization.tex_coord_offset, header->tex_coord_offset,
+          sizeof (header->tex_coord_offset));
+  data->generated_normals = header->generated_normals;
+
+  return cache;
+}
+
+/*
+ * mash_mesh_cache_open:
+ * @filename: The name of the model file
+ * @flags: The flags the model is loaded with
+ *
+ * Maps the cache file of @filename loaded with @flags if there is an
+ * up to date one.
+ *
+ * Return value: The cache or %NULL if there is no valid cache file.
+ */
+MashMeshCache *
+mash_mesh_cache_open (const gchar *filename,
+                      MashDataFlags flags)
+{
+  MashMeshCache *cache;
+  GMappedFile *file;
+  GStatBuf source;
+  GBytes *bytes;
+  gchar *path;
+
+  if (g_stat (filename, &source) == -1)
+    return NULL;
+
+  path = mash_mesh_cache_get_path (filename, flags);
+  file = g_mapped_file_new (path, FALSE, NULL);
+  g_free (path);
+
+  if (file == NULL)
+    return NULL;
+
+  bytes = g_bytes_new_with_free_func (g_mapped_file_get_contents (file),
+                                      g_mapped_file_get_length (file),
+                                      (GDestroyNotify) g_mapped_file_unref,
+                                      file);
+  cache = mash_mesh_cache_new (bytes, flags, &source);
+  g_bytes_unref (bytes);
+
+  /* The size of the model matches, check its contents as well */
+  if (cache)
+    {
+      const MashMeshCacheHeader *header = g_bytes_get_data (cache->bytes,
+                                                            NULL);
+      guint64 hash;
+
+      if (!mash_mesh_cache_hash_file (filename, &hash) ||
+          hash != header->source_hash)
+        {
+          mash_mesh_cache_close (cache);
+          cache = NULL;
+        }
+    }
+
+  return cache;
+}
+
+/*
+ * mash_mesh_cache_new_from_bytes:
+ * @bytes: Data written by mash_mesh_cache_data_to_bytes()
+ * @flags: The flags the model is loaded with
+ *
+ * Uses @bytes as the cache of a model, for example when they come from
+ * an asset pack. They are kept alive as long as the cache.
+ *
+ * Return value: The cache or %NULL if @bytes are not valid for @flags.
+ */
+MashMeshCache *
+mash_mesh_cache_new_from_bytes (GBytes *bytes,
+                                MashDataFlags flags)
+{
+  return mash_mesh_cache_new (bytes, flags, NULL);
+}
+
+const MashMeshCacheData *
+mash_mesh_cache_get_data (MashMeshCache *cache)
+{
+  return &cache->data;
+}
+
+void
+mash_mesh_cache_close (MashMeshCache *cache)
+{
+  g_bytes_unref (cache->bytes);
+  g_slice_free (MashMeshCache, cache);
+}
+
+/* Lays @data out as a cache file. @source is the model it comes from,
+   if any, and @source_hash the hash of its contents */
+static gchar *
+mash_mesh_cache_serialize (const MashMeshCacheData *data,
+                           MashDataFlags flags,
+                           const GStatBuf *source,
+                           guint64 source_hash,
+                           gsize *length_out)
+{
+  MashMeshCacheHeader *header;
+  gsize vertices_size, indices_size, submeshes_size, length;
+  guint64 vertices_offset, indices_offset, submeshes_offset;
+  gchar *contents;
+
+  vertices_size = data->n_vertices * data->stride;
+  indices_size = (data->n_indices *
+                  mash_mesh_cache_get_index_size (data->indices_type));
+  submeshes_size = data->n_submeshes * sizeof (MashMeshSubmesh);
+
+  vertices_offset = MASH_MESH_CACHE_ALIGN (sizeof (*header));
+  indices_offset = MASH_MESH_CACHE_ALIGN (vertices_offset + vertices_size);
+  submeshes_offset = MASH_MESH_CACHE_ALIGN (indices_offset + indices_size);
+  length = submeshes_offset + submeshes_size;
+
+  contents = g_malloc0 (length);
+  header = (MashMeshCacheHeader *) contents;
+
+  memcpy (header->magic, MASH_MESH_CACHE_MAGIC, sizeof (header->magic));
+  header->version = MASH_MESH_CACHE_VERSION;
+  header->byte_order = MASH_MESH_CACHE_BYTE_ORDER;
+  header->flags = MASH_MESH_CACHE_KEY_FLAGS (flags);
+  header->n_vertices = data->n_vertices;
+  header->stride = data->stride;
+  header->n_indices = data->n_indices;
+  header->indices_type = data->indices_type;
+  header->n_attributes = data->n_attributes;
+  if (source)
+    {
+      header->source_size = source->st_size;
+      header->source_hash = source_hash;
+    }
+  header->vertices_offset = vertices_offset;
+  header->indices_offset = indices_offset;
+  header->submeshes_offset = submeshes_offset;
+  header->n_submeshes = data->n_submeshes;
+  header->min_vertex[0] = data->min_vertex.x;
+  header->min_vertex[1] = data->min_vertex.y;
+  header->min_vertex[2] = data->min_vertex.z;
+  header->max_vertex[0] = data->max_vertex.x;
+  header->max_vertex[1] = data->max_vertex.y;
+  header->max_vertex[2] = data->max_vertex.z;
+  header->quantized_attributes = data->quantization.attributes;
+  memcpy (header->position_scale, data->quantization.position_scale,
+          sizeof (header->position_scale));
+  memcpy (header->position_offset, data->quantization.position_offset,
+          sizeof (header->position_offset));
+  memcpy (header->tex_coord_scale, data->quantization.tex_coord_scale,
+          sizeof (header->tex_coord_scale));
+  memcpy (header->tex_coord_offset, data->quantization.tex_coord_offset,
+          sizeof (header->tex_coord_offset));
+  header->generated_normals = data->generated_normals;
+  memcpy (header->attributes, data->attributes, sizeof (header->attributes));
+
+  memcpy (contents + header->vertices_offset, data->vertices, vertices_size);
+  memcpy (contents + header->indices_offset, data->indices, indices_size);
+  if (submeshes_size > 0)
+    memcpy (contents + header->submeshes_offset, data->submeshes,
+            submeshes_size);
+
+  *length_out = length;
+
+  return contents;
+}
+
+/*
+ * mash_mesh_cache_save:
+ * @filename: The name of the model file
+ * @flags: The flags the model was loaded with
+ * @data: The final data of the model
+ * @error: Return location for an error or %NULL
+ *
+ * Writes the cache file of @filename loaded with @flags. The file is
+ * replaced atomically so concurrent loads never see a partial file.
+ *
+ * Return value: %TRUE if the cache was written.
+ */
+gboolean
+mash_mesh_cache_save (const gchar *filename,
+                      MashDataFlags flags,
+                      const MashMeshCacheData *data,
+                      GError **error)
+{
+  GStatBuf source;
+  gchar *path, *dirname, *contents;
+  guint64 source_hash;
+  gsize length;
+  gboolean ret;
+
+  if (g_stat (filename, &source) == -1)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Could not stat %s", filename);
+      return FALSE;
+    }
+
+  if (!mash_mesh_cache_hash_file (filename, &source_hash))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                   "Could not read %s", filename);
+      return FALSE;
+    }
+
+  contents = mash_mesh_cache_serialize (data, flags, &source, source_hash,
+                                        &length);
+
+  path = mash_mesh_cache_get_path (filename, flags);
+  dirname = g_path_get_dirname (path);
+
+  if (g_mkdir_with_parents (dirname, 0755) == -1)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Could not create the cache directory %s", dirname);
+      ret = FALSE;
+    }
+  else
+    ret = g_file_set_contents (path, contents, length, error);
+
+  g_free (dirname);
+  g_free (path);
+  g_free (contents);
+
+  return ret;
+}
+
+/*
+ * mash_mesh_cache_data_to_bytes:
+ * @data: The final data of a model
+ * @flags: The flags the model was loaded with
+ *
+ * Lays @data out as a cache that isn't tied to the model file, to be
+ * stored in an asset pack and read back with
+ * mash_mesh_cache_new_from_bytes().
+ *
+ * Return value: The serialized data.
+ */
+GBytes *
+mash_mesh_cache_data_to_bytes (const MashMeshCacheData *data,
+                               MashDataFlags flags)
+{
+  gchar *contents;
+  gsize length;
+
+  contents = mash_mesh_cache_serialize (data, flags, NULL, 0, &length);
+
+  return g_bytes_new_take (contents, length);
+}
+
+/*
+ * mash_mesh_cache_data_get_size:
+ * @data: The data of a mesh
+ *
+ * Return value: The size of the vertices and the indices of @data
+ */
+gsize
+mash_mesh_cache_data_get_size (const MashMeshCacheData *data)
+{
+  return ((gsize) data->n_vertices * data->stride +
+          (gsize) data->n_indices *
+          mash_mesh_cache_get_index_size (data->indices_type));
+}
+
+/*
+ * mash_mesh_cache_alloc_buffer:
+ * @type: The type of the buffer
+ * @format: The layout of the vertices, for attribute buffers
+ * @size: The number of bytes needed
+ * @alignment: The alignment of the range
+ * @offset: Return location for the start of the range in the buffer
+ * @range: Return location for the range, to free it
+ *
+ * Gets a range of a buffer from the backend. Without an @alloc_buffer
+ * function the range is a new buffer of its own.
+ *
+ * Return value: The buffer, owned by @range
+ */
+CoglBuffer *
+mash_mesh_cache_alloc_buffer (MashDataBufferType type,
+                              const gchar *format,
+                              gsize size,
+                              gsize alignment,
+                              gsize *offset,
+                              gpointer *range)
+{
+  const MashDataBackend *backend = mash_data_get_backend ();
+  CoglBuffer *buffer;
+
+  if (backend->alloc_buffer)
+    return backend->alloc_buffer (type, format, size, alignment,
+                                  offset, range);
+
+  if (type == MASH_DATA_BUFFER_INDICES)
+    buffer = COGL_BUFFER (cogl_index_buffer_new (backend->context, size));
+  else
+    buffer = COGL_BUFFER (cogl_attribute_buffer_new (backend->context,
+                                                     size, NULL));
+
+  *offset = 0;
+  *range = buffer;
+
+  return buffer;
+}
+
+/*
+ * mash_mesh_cache_free_buffer_with_object:
+ * @range: A range returned by mash_mesh_cache_alloc_buffer()
+ * @object: A #CoglObject using the range
+ *
+ * Frees @range once @object is destroyed.
+ */
+void
+mash_mesh_cache_free_buffer_with_object (gpointer range,
+                                         gpointer object)
+{
+  const MashDataBackend *backend = mash_data_get_backend ();
+
+  /* A buffer of its own is kept alive by the objects using it */
+  if (backend->free_buffer_with_object)
+    backend->free_buffer_with_object (range, object);
+  else
+    cogl_object_unref (range);
+}
+
+/*
+ * mash_mesh_cache_upload_buffer:
+ * @buffer: The buffer to upload to
+ * @offset: Where to upload in @buffer
+ * @data: The data to upload
+ * @size: The number of bytes of @data
+ * @done: Function called once @data is uploaded
+ * @user_data: Data to pass to @done
+ *
+ * Hands @data to the backend. Without an @upload_buffer function it is
+ * uploaded directly and @done is called before returning.
+ */
+void
+mash_mesh_cache_upload_buffer (CoglBuffer *buffer,
+                               gsize offset,
+                               gconstpointer data,
+                               gsize size,
+                               MashDataUploadDoneFunc done,
+                               gpointer user_data)
+{
+  const MashDataBackend *backend = mash_data_get_backend ();
+
+  if (backend->upload_buffer)
+    backend->upload_buffer (buffer, offset, data, size, done, user_data);
+  else
+    {
+      cogl_buffer_set_data (buffer, offset, data, size);
+      done (user_data);
+    }
+}
+
+/* Meshes with the same vertex layout can share their buffers */
+static gchar *
+mash_mesh_cache_get_format (const MashMeshCacheData *data)
+{
+  GString *format;
+  guint i;
+
+  format = g_string_new (NULL);
+  g_string_append_printf (format, "%u", data->stride);
+
+  for (i = 0; i < data->n_attributes; i++)
+    {
+      const MashMeshCacheAttribute *attribute = data->attributes + i;
+
+      g_string_append_printf (format, ":%s,%u,%u,%u,%u",
+                              attribute->name,
+                              attribute->offset,
+                              attribute->n_components,
+                              attribute->type,
+                              attribute->normalized);
+    }
+
+  return g_string_free (format, FALSE);
+}
+
+typedef struct
+{
+  CoglBuffer *buffer;
+  gsize offset;
+  gsize size;
+} MashMeshCacheRange;
+
+static CoglPrimitive *
+mash_mesh_cache_create_submesh_primitive (const MashMeshCacheData *data,
+                                          const MashMeshSubmesh *submesh,
+                                          const MashMeshCacheRange *vertices,
+                                          const MashMeshCacheRange *indices)
+{
+  CoglAttribute *attributes[MASH_MESH_CACHE_MAX_ATTRIBUTES];
+  CoglPrimitive *primitive;
+  CoglIndices *submesh_indices;
+  gsize vertex_offset, index_offset;
+  guint i;
+
+  vertex_offset = (vertices->offset +
+                   (gsize) submesh->first_vertex * data->stride);
+  index_offset = (indices->offset +
+                  (gsize) submesh->first_index *
+                  mash_mesh_cache_get_index_size (data->indices_type));
+
+  for (i = 0; i < data->n_attributes; i++)
+    {
+      const MashMeshCacheAttribute *attribute = data->attributes + i;
+
+      attributes[i] =
+        cogl_attribute_new (COGL_ATTRIBUTE_BUFFER (vertices->buffer),
+                            attribute->name,
+                            data->stride,
+                            vertex_offset + attribute->offset,
+                            attribute->n_components,
+                            attribute->type);
+      if (attribute->normalized)
+        cogl_attribute_set_normalized (attributes[i], TRUE);
+    }
+
+  primitive =
+    cogl_primitive_new_with_attributes (COGL_VERTICES_MODE_TRIANGLES,
+                                        submesh->n_vertices,
+                                        attributes, data->n_attributes);
+  for (i = 0; i < data->n_attributes; i++)
+    cogl_object_unref (attributes[i]);
+
+  submesh_indices =
+    cogl_indices_new_for_buffer (data->indices_type,
+                                 COGL_INDEX_BUFFER (indices->buffer),
+                                 index_offset);
+  cogl_primitive_set_indices (primitive, submesh_indices,
+                              submesh->n_indices);
+  cogl_object_unref (submesh_indices);
+
+  return primitive;
+}
+
+/* Allocates the ranges of the vertices and the indices of @data and
+   describes each submesh in a new primitive. The ranges are freed with
+   the first primitive, the primitives of a mesh being kept together */
+static GPtrArray *
+mash_mesh_cache_create_primitives_in_ranges (const MashMeshCacheData *data,
+                                             MashMeshCacheRange *vertices,
+                                             MashMeshCacheRange *indices)
+{
+  MashMeshSubmesh whole_mesh;
+  const MashMeshSubmesh *submeshes = data->submeshes;
+  guint n_submeshes = data->n_submeshes;
+  GPtrArray *primitives;
+  gpointer vertex_range, index_range;
+  gchar *format;
+  guint index_size;
+  guint i;
+
+  index_size = mash_mesh_cache_get_index_size (data->indices_type);
+
+  format = mash_mesh_cache_get_format (data);
+  vertices->size = (gsize) data->n_vertices * data->stride;
+  vertices->buffer =
+    mash_mesh_cache_alloc_buffer (MASH_DATA_BUFFER_ATTRIBUTES, format,
+                                  vertices->size, 16,
+                                  &vertices->offset, &vertex_range);
+  g_free (format);
+
+  indices->size = (gsize) data->n_indices * index_size;
+  indices->buffer =
+    mash_mesh_cache_alloc_buffer (MASH_DATA_BUFFER_INDICES, NULL,
+                                  indices->size, index_size,
+                                  &indices->offset, &index_range);
+
+  /* A mesh that wasn't split is a single submesh */
+  if (n_submeshes == 0)
+    {
+      whole_mesh.first_vertex = 0;
+      whole_mesh.n_vertices = data->n_vertices;
+      whole_mesh.first_index = 0;
+      whole_mesh.n_indices = data->n_indices;
+      submeshes = &whole_mesh;
+      n_submeshes = 1;
+    }
+
+  primitives = g_ptr_array_new_with_free_func (cogl_object_unref);
+
+  for (i = 0; i < n_submeshes; i++)
+    g_ptr_array_add (primitives,
+                     mash_mesh_cache_create_submesh_primitive (data,
+                                                               submeshes + i,
+                                                               vertices,
+                                                               indices));
+
+  mash_mesh_cache_free_buffer_with_object (vertex_range,
+                                           g_ptr_array_index (primitives, 0));
+  mash_mesh_cache_free_buffer_with_object (index_range,
+                                           g_ptr_array_index (primitives, 0));
+
+  return primitives;
+}
+
+/*
+ * mash_mesh_cache_create_primitives:
+ * @data: The data of a mesh
+ *
+ * Uploads @data and describes it in new primitives, one per submesh.
+ * The data doesn't need to outlive the call.
+ *
+ * Return value: A new #GPtrArray of #CoglPrimitive
+ */
+GPtrArray *
+mash_mesh_cache_create_primitives (const MashMeshCacheData *data)
+{
+  MashMeshCacheRange vertices, indices;
+  GPtrArray *primitives;
+
+  primitives = mash_mesh_cache_create_primitives_in_ranges (data,
+                                                            &vertices,
+                                                            &indices);
+
+  cogl_buffer_set_data (vertices.buffer, vertices.offset,
+                        data->vertices, vertices.size);
+  cogl_buffer_set_data (indices.buffer, indices.offset,
+                        data->indices, indices.size);
+
+  return primitives;
+}
+
+typedef struct
+{
+  gint n_pending;
+  MashDataUploadDoneFunc done;
+  gpointer user_data;
+} MashMeshCacheUpload;
+
+static void
+mash_mesh_cache_upload_done (gpointer user_data)
+{
+  MashMeshCacheUpload *upload = user_data;
+
+  if (--upload->n_pending == 0)
+    {
+      upload->done (upload->user_data);
+      g_slice_free (MashMeshCacheUpload, upload);
+    }
+}
+
+/*
+ * mash_mesh_cache_create_primitives_queued:
+ * @data: The data of a mesh
+ * @done: Function called once the data is uploaded
+ * @user_data: Data to pass to @done
+ *
+ * Same as mash_mesh_cache_create_primitives() but the vertices and the
+ * indices are handed to the @upload_buffer function of the backend,
+ * which can spread them over as many frames as needed. @data has to
+ * stay valid and the primitives must not be drawn until @done is
+ * called.
+ *
+ * Return value: A new #GPtrArray of #CoglPrimitive
+ */
+GPtrArray *
+mash_mesh_cache_create_primitives_queued (const MashMeshCacheData *data,
+                                          MashDataUploadDoneFunc done,
+                                          gpointer user_data)
+{
+  MashMeshCacheRange vertices, indices;
+  MashMeshCacheUpload *upload;
+  GPtrArray *primitives;
+
+  primitives = mash_mesh_cache_create_primitives_in_ranges (data,
+                                                            &vertices,
+                                                            &indices);
+
+  upload = g_slice_new (MashMeshCacheUpload);
+  upload->n_pending = 2;
+  upload->done = done;
+  upload->user_data = user_data;
+
+  mash_mesh_cache_upload_buffer (vertices.buffer, vertices.offset,
+                                 data->vertices, vertices.size,
+                                 mash_mesh_cache_upload_done, upload);
+  mash_mesh_cache_upload_buffer (indices.buffer, indices.offset,
+                                 data->indices, indices.size,
+                                 mash_mesh_cache_upload_done, upload);
+
+  return primitives;
+}
@@ -0,0 +1,141 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MASH_MESH_CACHE_H__
+#define __MASH_MESH_CACHE_H__
+
+#include <glib.h>
+#include <cogl/cogl.h>
+
+#include "mash-data.h"
+#include "mash-data-loader.h"
+#include "mash-mesh-optimizer.h"
+
+G_BEGIN_DECLS
+
+/* Bump this whenever the layout of the cache files or the processing
+   done by the loaders changes */
+#define MASH_MESH_CACHE_VERSION 4
+
+#define MASH_MESH_CACHE_MAX_ATTRIBUTES 4
+
+/**
+ * MashMeshCacheAttribute:
+ * @name: Name of the attribute, eg. "cogl_position_in"
+ * @offset: Offset of the attribute in a vertex
+ * @n_components: Number of components of the attribute
+ * @type: The #CoglAttributeType of the components
+ * @normalized: Whether the components are normalized
+ *
+ * Describes an attribute of the interleaved vertices of a mesh.
+ */
+typedef struct _MashMeshCacheAttribute
+{
+  gchar name[32];
+  guint32 offset;
+  guint32 n_components;
+  guint32 type;
+  guint32 normalized;
+} MashMeshCacheAttribute;
+
+/**
+ * MashMeshCacheData:
+ * @vertices: The interleaved vertices
+ * @n_vertices: The number of vertices
+ * @stride: The size of a vertex in bytes
+ * @indices: The indices of the triangles
+ * @indices_type: The type of @indices
+ * @n_indices: The number of indices
+ * @submeshes: The submeshes the mesh is split in or %NULL
+ * @n_submeshes: The number of submeshes, 0 when the mesh is drawn whole
+ * @attributes: Layout of a vertex
+ * @n_attributes: The number of attributes
+ * @min_vertex: The minimum corner of the bounding box
+ * @max_vertex: The maximum corner of the bounding box
+ * @quantization: How to decode the vertices
+ * @generated_normals: Whether the normals were generated by the loader
+ *
+ * The final data of a mesh, as it is uploaded to the GPU.
+ */
+struct _MashMeshCacheData
+{
+  const guint8 *vertices;
+  guint n_vertices;
+  guint stride;
+
+  const guint8 *indices;
+  CoglIndicesType indices_type;
+  guint n_indices;
+
+  const MashMeshSubmesh *submeshes;
+  guint n_submeshes;
+
+  MashMeshCacheAttribute attributes[MASH_MESH_CACHE_MAX_ATTRIBUTES];
+  guint n_attributes;
+
+  CoglVertexP3 min_vertex, max_vertex;
+
+  MashDataQuantization quantization;
+
+  gboolean generated_normals;
+};
+
+typedef struct _MashMeshCache MashMeshCache;
+
+MashMeshCache           *mash_mesh_cache_open             (const gchar *filename,
+                                                           MashDataFlags flags);
+MashMeshCache           *mash_mesh_cache_new_from_bytes   (GBytes *bytes,
+                                                           MashDataFlags flags);
+const MashMeshCacheData *mash_mesh_cache_get_data         (MashMeshCache *cache);
+void                     mash_mesh_cache_close            (MashMeshCache *cache);
+
+gboolean                 mash_mesh_cache_save             (const gchar *filename,
+                                                           MashDataFlags flags,
+                                                           const MashMeshCacheData *data,
+                                                           GError **error);
+
+GBytes                  *mash_mesh_cache_data_to_bytes    (const MashMeshCacheData *data,
+                                                           MashDataFlags flags);
+gsize                    mash_mesh_cache_data_get_size    (const MashMeshCacheData *data);
+
+CoglBuffer              *mash_mesh_cache_alloc_buffer     (MashDataBufferType type,
+                                                           const gchar *format,
+                                                           gsize size,
+                                                           gsize alignment,
+                                                           gsize *offset,
+                                                           gpointer *range);
+void                     mash_mesh_cache_free_buffer_with_object
+                                                          (gpointer range,
+                                                           gpointer object);
+void                     mash_mesh_cache_upload_buffer    (CoglBuffer *buffer,
+                                                           gsize offset,
+                                                           gconstpointer data,
+                                                           gsize size,
+                                                           MashDataUploadDoneFunc done,
+                                                           gpointer user_data);
+
+GPtrArray               *mash_mesh_cache_create_primitives
+                                                          (const MashMeshCacheData *data);
+GPtrArray               *mash_mesh_cache_create_primitives_queued
+                                                          (const MashMeshCacheData *data,
+                                                           MashDataUploadDoneFunc done,
+                                                           gpointer user_data);
+
+G_END_DECLS
+
+#endif /* __MASH_MESH_CACHE_H__ */
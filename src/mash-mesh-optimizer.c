@@ -0,0 +1,1644 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Index and vertex buffer reordering passes run on a mesh once it has
+ * been loaded and before it is handed to Cogl:
+ *
+ *  - vertex cache optimization, using Tom Forsyth's "Linear-Speed Vertex
+ *    Cache Optimisation" greedy algorithm,
+ *  - overdraw optimization, splitting the cache optimized triangle list
+ *    into clusters and sorting them front to back from the outside of the
+ *    mesh (Sander, Nehab, Barczak, "Fast Triangle Reordering for Vertex
+ *    Locality and Reduced Overdraw"),
+ *  - vertex fetch optimization, renumbering the vertices in the order
+ *    they are first referenced by the index buffer,
+ *  - vertex welding, merging the identical vertices that exporters emit
+ *    for each face of flat shaded meshes,
+ *  - smooth normal generation for the meshes exported without normals,
+ *    splitting the vertices at the creases,
+ *  - splitting of the meshes with too many vertices for 16 bits indices
+ *    into spatially coherent submeshes.
+ *
+ * All the passes work on 32 bits indices, the loaders pack them down to
+ * the final CoglIndicesType afterwards.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mash-mesh-optimizer.h"
+#include "mash-parallel.h"
+
+/* Size of the LRU cache modelled by the Forsyth scoring function. It's
+   deliberately bigger than the FIFO we use for the statistics, the
+   ordering it produces degrades gracefully on smaller caches */
+#define FORSYTH_CACHE_SIZE      32
+#define FORSYTH_MAX_VALENCE     32
+#define FORSYTH_CACHE_DECAY     1.5f
+#define FORSYTH_LAST_TRI_SCORE  0.75f
+#define FORSYTH_VALENCE_SCALE   2.0f
+#define FORSYTH_VALENCE_POWER   0.5f
+
+#define NO_CACHE_POSITION       (-1)
+#define NO_TRIANGLE             (-1)
+#define NO_REMAP                G_MAXUINT32
+
+/*
+ * Statistics
+ */
+
+/* Simulates a FIFO cache of @cache_size entries. Returns the number of
+   vertices of the triangle that had to be transformed */
+static guint
+update_fifo_cache (const guint32 *triangle,
+                   guint32       *timestamps,
+                   guint32       *timestamp,
+                   guint          cache_size)
+{
+  guint i, misses = 0;
+
+  for (i = 0; i < 3; i++)
+    {
+      guint32 v = triangle[i];
+
+      if (timestamps[v] == 0 || *timestamp - timestamps[v] >= cache_size)
+        {
+          timestamps[v] = ++(*timestamp);
+          misses++;
+        }
+    }
+
+  return misses;
+}
+
+/**
+ * mash_mesh_optimizer_analyze_vertex_cache:
+ * @indices: A triangle list
+ * @n_indices: Number of indices in @indices
+ * @n_vertices: Number of vertices in the vertex buffer
+ * @cache_size: Number of entries of the simulated FIFO cache
+ * @stats: Return location for the statistics
+ *
+ * Simulates the post-transform vertex cache of the GPU on @indices and
+ * fills @stats with the resulting ACMR and ATVR.
+ */
+void
+mash_mesh_optimizer_analyze_vertex_cache (const guint32        *indices,
+                                          guint                 n_indices,
+                                          guint                 n_vertices,
+                                          guint                 cache_size,
+                                          MashVertexCacheStats *stats)
+{
+  guint32 *timestamps, timestamp = 0;
+  guint i;
+
+  memset (stats, 0, sizeof (MashVertexCacheStats));
+
+  if (n_indices < 3 || n_vertices == 0)
+    return;
+
+  timestamps = g_new0 (guint32, n_vertices);
+
+  for (i = 0; i + 2 < n_indices; i += 3)
+    stats->n_transformed += update_fifo_cache (indices + i,
+                                               timestamps,
+                                               &timestamp,
+                                               cache_size);
+
+  /* Every vertex that has been transformed at least once has a non 0
+     timestamp */
+  for (i = 0; i < n_vertices; i++)
+    if (timestamps[i])
+      stats->n_vertices++;
+
+  stats->n_triangles = n_indices / 3;
+  stats->acmr = (gfloat) stats->n_transformed / stats->n_triangles;
+  stats->atvr = (gfloat) stats->n_transformed / stats->n_vertices;
+
+  g_free (timestamps);
+}
+
+/*
+ * Vertex cache optimization
+ */
+
+typedef struct
+{
+  gfloat cache_scores[FORSYTH_CACHE_SIZE];
+  gfloat valence_scores[FORSYTH_MAX_VALENCE + 1];
+} ForsythScoreTables;
+
+static void
+forsyth_score_tables_init (ForsythScoreTables *tables)
+{
+  int i;
+
+  for (i = 0; i < FORSYTH_CACHE_SIZE; i++)
+    {
+      if (i < 3)
+        {
+          /* The vertices of the last triangle have a fixed score so that
+             we don't favour continuing a strip in one direction */
+          tables->cache_scores[i] = FORSYTH_LAST_TRI_SCORE;
+        }
+      else
+        {
+          gfloat scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+
+          tables->cache_scores[i] = powf (1.0f - (i - 3) * scaler,
+                                          FORSYTH_CACHE_DECAY);
+        }
+    }
+
+  tables->valence_scores[0] = 0.f;
+  for (i = 1; i <= FORSYTH_MAX_VALENCE; i++)
+    {
+      /* Boost vertices with few triangles left so that we get rid of the
+         lone triangles instead of leaving them behind */
+      tables->valence_scores[i] =
+        FORSYTH_VALENCE_SCALE * powf (i, -FORSYTH_VALENCE_POWER);
+    }
+}
+
+static gfloat
+forsyth_vertex_score (const ForsythScoreTables *tables,
+                      gint                      cache_position,
+                      guint                     remaining)
+{
+  gfloat score = 0.f;
+
+  /* No triangle needs that vertex anymore */
+  if (remaining == 0)
+    return -1.f;
+
+  if (cache_position >= 0)
+    score = tables->cache_scores[cache_position];
+
+  return score + tables->valence_scores[MIN (remaining, FORSYTH_MAX_VALENCE)];
+}
+
+/**
+ * mash_mesh_optimizer_optimize_vertex_cache:
+ * @indices: A triangle list, reordered in place
+ * @n_indices: Number of indices in @indices
+ * @n_vertices: Number of vertices in the vertex buffer. All indices
+ *   must be smaller than this.
+ *
+ * Reorders the triangles of @indices to maximise the hits in the
+ * post-transform vertex cache of the GPU. The vertices are not touched.
+ */
+void
+mash_mesh_optimizer_optimize_vertex_cache (guint32 *indices,
+                                           guint    n_indices,
+                                           guint    n_vertices)
+{
+  ForsythScoreTables tables;
+  guint n_triangles = n_indices / 3;
+  guint *remaining, *adjacency_offsets, *adjacency;
+  gint *cache_positions;
+  gfloat *vertex_scores, *triangle_scores;
+  gboolean *emitted;
+  guint32 *output;
+  guint32 cache[FORSYTH_CACHE_SIZE + 3], new_cache[FORSYTH_CACHE_SIZE + 3];
+  guint cache_len = 0;
+  guint input_cursor = 0;
+  gint best_triangle = NO_TRIANGLE;
+  gfloat best_score = -G_MAXFLOAT;
+  guint i, t;
+
+  if (n_triangles < 2 || n_vertices == 0)
+    return;
+
+  forsyth_score_tables_init (&tables);
+
+  remaining = g_new0 (guint, n_vertices);
+  adjacency_offsets = g_new (guint, n_vertices + 1);
+  adjacency = g_new (guint, n_triangles * 3);
+  cache_positions = g_new (gint, n_vertices);
+  vertex_scores = g_new (gfloat, n_vertices);
+  triangle_scores = g_new (gfloat, n_triangles);
+  emitted = g_new0 (gboolean, n_triangles);
+  output = g_new (guint32, n_triangles * 3);
+
+  /* Build the vertex -> triangles adjacency lists */
+  for (i = 0; i < n_triangles * 3; i++)
+    remaining[indices[i]]++;
+
+  adjacency_offsets[0] = 0;
+  for (i = 0; i < n_vertices; i++)
+    adjacency_offsets[i + 1] = adjacency_offsets[i] + remaining[i];
+
+  memset (remaining, 0, n_vertices * sizeof (guint));
+  for (i = 0; i < n_triangles * 3; i++)
+    {
+      guint32 v = indices[i];
+
+      adjacency[adjacency_offsets[v] + remaining[v]++] = i / 3;
+    }
+
+  /* Initial scores, nothing is in the cache yet */
+  for (i = 0; i < n_vertices; i++)
+    {
+      cache_positions[i] = NO_CACHE_POSITION;
+      vertex_scores[i] = forsyth_vertex_score (&tables,
+                                               NO_CACHE_POSITION,
+                                               remaining[i]);
+    }
+
+  for (t = 0; t < n_triangles; t++)
+    {
+      const guint32 *tri = indices + t * 3;
+
+      triangle_scores[t] = vertex_scores[tri[0]] +
+                           vertex_scores[tri[1]] +
+                           vertex_scores[tri[2]];
+
+      if (triangle_scores[t] > best_score)
+        {
+          best_score = triangle_scores[t];
+          best_triangle = t;
+        }
+    }
+
+  for (t = 0; t < n_triangles; t++)
+    {
+      const guint32 *tri;
+      guint new_cache_len = 0;
+
+      /* None of the triangles touching the cache are left, restart from
+         the first triangle not yet emitted */
+      if (best_triangle == NO_TRIANGLE)
+        {
+          while (emitted[input_cursor])
+            input_cursor++;
+
+          best_triangle = input_cursor;
+        }
+
+      tri = indices + best_triangle * 3;
+      memcpy (output + t * 3, tri, 3 * sizeof (guint32));
+      emitted[best_triangle] = TRUE;
+
+      /* Remove the triangle from the adjacency lists of its vertices */
+      for (i = 0; i < 3; i++)
+        {
+          guint32 v = tri[i];
+          guint *list = adjacency + adjacency_offsets[v];
+          guint j;
+
+          for (j = 0; j < remaining[v]; j++)
+            if (list[j] == best_triangle)
+              {
+                list[j] = list[remaining[v] - 1];
+                remaining[v]--;
+                break;
+              }
+        }
+
+      /* Push the vertices of the triangle at the front of the LRU cache */
+      for (i = 0; i < 3; i++)
+        {
+          if ((i == 1 && tri[1] == tri[0]) ||
+              (i == 2 && (tri[2] == tri[0] || tri[2] == tri[1])))
+            continue;
+
+          new_cache[new_cache_len++] = tri[i];
+        }
+
+      for (i = 0; i < cache_len; i++)
+        {
+          guint32 v = cache[i];
+
+          if (v != tri[0] && v != tri[1] && v != tri[2])
+            new_cache[new_cache_len++] = v;
+        }
+
+      /* Vertices that fell out of the cache */
+      for (i = FORSYTH_CACHE_SIZE; i < new_cache_len; i++)
+        cache_positions[new_cache[i]] = NO_CACHE_POSITION;
+
+      cache_len = MIN (new_cache_len, FORSYTH_CACHE_SIZE);
+      for (i = 0; i < cache_len; i++)
+        {
+          cache[i] = new_cache[i];
+          cache_positions[cache[i]] = i;
+        }
+
+      /* Update the scores of everything that moved, and look for the best
+         triangle among the ones touching the cache */
+      best_triangle = NO_TRIANGLE;
+      best_score = -G_MAXFLOAT;
+
+      for (i = 0; i < new_cache_len; i++)
+        {
+          guint32 v = new_cache[i];
+          guint *list = adjacency + adjacency_offsets[v];
+          gfloat score, delta;
+          guint j;
+
+          score = forsyth_vertex_score (&tables,
+                                        cache_positions[v],
+                                        remaining[v]);
+          delta = score - vertex_scores[v];
+          vertex_scores[v] = score;
+
+          for (j = 0; j < remaining[v]; j++)
+            {
+              guint other = list[j];
+
+              triangle_scores[other] += delta;
+
+              if (i < cache_len && triangle_scores[other] > best_score)
+                {
+                  best_score = triangle_scores[other];
+                  best_triangle = other;
+                }
+            }
+        }
+    }
+
+  memcpy (indices, output, n_triangles * 3 * sizeof (guint32));
+
+  g_free (remaining);
+  g_free (adjacency_offsets);
+  g_free (adjacency);
+  g_free (cache_positions);
+  g_free (vertex_scores);
+  g_free (triangle_scores);
+  g_free (emitted);
+  g_free (output);
+}
+
+/*
+ * Overdraw optimization
+ */
+
+typedef struct
+{
+  guint first, last; /* triangle range [first, last) */
+  gfloat sort_key;
+} Cluster;
+
+static void
+read_position (const guint8 *vertices,
+               guint         stride,
+               guint         position_offset,
+               guint32       index,
+               gfloat        position[3])
+{
+  memcpy (position,
+          vertices + (gsize) index * stride + position_offset,
+          3 * sizeof (gfloat));
+}
+
+static gint
+compare_clusters (gconstpointer a,
+                  gconstpointer b)
+{
+  const Cluster *ca = a, *cb = b;
+
+  /* Descending order, the most "outside" clusters are drawn first */
+  if (ca->sort_key > cb->sort_key)
+    return -1;
+  if (ca->sort_key < cb->sort_key)
+    return 1;
+
+  /* Keep the sort stable */
+  return ca->first < cb->first ? -1 : 1;
+}
+
+static GArray *
+generate_clusters (const guint32 *indices,
+                   guint          n_triangles,
+                   guint          n_vertices,
+                   gfloat         threshold)
+{
+  GArray *hard_boundaries, *clusters;
+  guint32 *timestamps, timestamp = 0;
+  guint t, i;
+
+  timestamps = g_new0 (guint32, n_vertices);
+  hard_boundaries = g_array_new (FALSE, FALSE, sizeof (guint));
+  clusters = g_array_new (FALSE, FALSE, sizeof (Cluster));
+
+  /* Hard boundaries are the triangles where the cache got flushed, ie.
+     the vertex cache optimizer could not find any neighbour */
+  for (t = 0; t < n_triangles; t++)
+    if (update_fifo_cache (indices + t * 3, timestamps, &timestamp,
+                           MASH_MESH_OPTIMIZER_CACHE_SIZE) == 3)
+      g_array_append_val (hard_boundaries, t);
+
+  if (hard_boundaries->len == 0 || g_array_index (hard_boundaries, guint, 0))
+    {
+      guint zero = 0;
+      g_array_prepend_vals (hard_boundaries, &zero, 1);
+    }
+
+  /* Soft boundaries split the hard clusters further as long as the local
+     ACMR does not degrade more than @threshold times the cluster's one */
+  for (i = 0; i < hard_boundaries->len; i++)
+    {
+      guint first = g_array_index (hard_boundaries, guint, i);
+      guint last = (i + 1 < hard_boundaries->len) ?
+        g_array_index (hard_boundaries, guint, i + 1) : n_triangles;
+      guint cluster_misses = 0, misses = 0, triangles = 0;
+      gfloat cluster_threshold;
+      Cluster cluster;
+
+      timestamp += MASH_MESH_OPTIMIZER_CACHE_SIZE + 1;
+      for (t = first; t < last; t++)
+        cluster_misses += update_fifo_cache (indices + t * 3,
+                                             timestamps,
+                                             &timestamp,
+                                             MASH_MESH_OPTIMIZER_CACHE_SIZE);
+
+      cluster_threshold = threshold * cluster_misses / (gfloat) (last - first);
+
+      cluster.first = first;
+      timestamp += MASH_MESH_OPTIMIZER_CACHE_SIZE + 1;
+
+      for (t = first; t < last; t++)
+        {
+          misses += update_fifo_cache (indices + t * 3,
+                                       timestamps,
+                                       &timestamp,
+                                       MASH_MESH_OPTIMIZER_CACHE_SIZE);
+          triangles++;
+
+          if (t + 1 < last && misses / (gfloat) triangles <= cluster_threshold)
+            {
+              cluster.last = t + 1;
+              g_array_append_val (clusters, cluster);
+
+              /* Start the next cluster with a cold cache */
+              cluster.first = t + 1;
+              timestamp += MASH_MESH_OPTIMIZER_CACHE_SIZE + 1;
+              misses = triangles = 0;
+            }
+        }
+
+      cluster.last = last;
+      g_array_append_val (clusters, cluster);
+    }
+
+  g_array_free (hard_boundaries, TRUE);
+  g_free (timestamps);
+
+  return clusters;
+}
+
+/**
+ * mash_mesh_optimizer_optimize_overdraw:
+ * @indices: A triangle list, already optimized for the vertex cache with
+ *   mash_mesh_optimizer_optimize_vertex_cache(). Reordered in place.
+ * @n_indices: Number of indices in @indices
+ * @vertices: The interleaved vertex data
+ * @stride: Size in bytes of a vertex
+ * @position_offset: Offset in bytes of the 3 float position in a vertex
+ * @n_vertices: Number of vertices in @vertices
+ * @threshold: How much the ACMR is allowed to degrade, 1.05 allows the
+ *   vertex cache efficiency to get 5% worse
+ *
+ * Splits @indices into clusters of triangles and sorts them so that the
+ * clusters facing away from the center of the mesh are drawn first. This
+ * lets the depth test reject more fragments when the mesh occludes
+ * itself.
+ */
+void
+mash_mesh_optimizer_optimize_overdraw (guint32      *indices,
+                                       guint         n_indices,
+                                       const guint8 *vertices,
+                                       guint         stride,
+                                       guint         position_offset,
+                                       guint         n_vertices,
+                                       gfloat        threshold)
+{
+  guint n_triangles = n_indices / 3;
+  gfloat mesh_centroid[3] = { 0.f, 0.f, 0.f }, mesh_area = 0.f;
+  GArray *clusters;
+  guint32 *output;
+  guint i, t, n_output = 0;
+
+  if (n_triangles < 2 || n_vertices == 0)
+    return;
+
+  clusters = generate_clusters (indices, n_triangles, n_vertices, threshold);
+
+  /* Nothing to sort */
+  if (clusters->len < 2)
+    {
+      g_array_free (clusters, TRUE);
+      return;
+    }
+
+  /* Area weighted centroid of the whole mesh */
+  for (t = 0; t < n_triangles; t++)
+    {
+      gfloat p0[3], p1[3], p2[3], e1[3], e2[3], n[3], area;
+      int k;
+
+      read_position (vertices, stride, position_offset, indices[t * 3], p0);
+      read_position (vertices, stride, position_offset, indices[t * 3 + 1], p1);
+      read_position (vertices, stride, position_offset, indices[t * 3 + 2], p2);
+
+      for (k = 0; k < 3; k++)
+        {
+          e1[k] = p1[k] - p0[k];
+          e2[k] = p2[k] - p0[k];
+        }
+
+      n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+      n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+      n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+      area = sqrtf (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+      for (k = 0; k < 3; k++)
+        mesh_centroid[k] += area * (p0[k] + p1[k] + p2[k]) / 3.f;
+      mesh_area += area;
+    }
+
+  if (mesh_area > 0.f)
+    for (i = 0; i < 3; i++)
+      mesh_centroid[i] /= mesh_area;
+
+  /* The sort key of a cluster is how much its average normal points away
+     from the center of the mesh */
+  for (i = 0; i < clusters->len; i++)
+    {
+      Cluster *cluster = &g_array_index (clusters, Cluster, i);
+      gfloat centroid[3] = { 0.f, 0.f, 0.f }, normal[3] = { 0.f, 0.f, 0.f };
+      gfloat area = 0.f, length;
+      int k;
+
+      for (t = cluster->first; t < cluster->last; t++)
+        {
+          gfloat p0[3], p1[3], p2[3], e1[3], e2[3], n[3], a;
+
+          read_position (vertices, stride, position_offset,
+                         indices[t * 3], p0);
+          read_position (vertices, stride, position_offset,
+                         indices[t * 3 + 1], p1);
+          read_position (vertices, stride, position_offset,
+                         indices[t * 3 + 2], p2);
+
+          for (k = 0; k < 3; k++)
+            {
+              e1[k] = p1[k] - p0[k];
+              e2[k] = p2[k] - p0[k];
+            }
+
+          n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+          n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+          n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+          a = sqrtf (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+          for (k = 0; k < 3; k++)
+            {
+              centroid[k] += a * (p0[k] + p1[k] + p2[k]) / 3.f;
+              normal[k] += n[k];
+            }
+          area += a;
+        }
+
+      length = sqrtf (normal[0] * normal[0] +
+                      normal[1] * normal[1] +
+                      normal[2] * normal[2]);
+
+      if (area <= 0.f || length <= 0.f)
+        {
+          cluster->sort_key = 0.f;
+          continue;
+        }
+
+      cluster->sort_key = 0.f;
+      for (k = 0; k < 3; k++)
+        cluster->sort_key += (centroid[k] / area - mesh_centroid[k]) *
+                             (normal[k] / length);
+    }
+
+  g_array_sort (clusters, compare_clusters);
+
+  output = g_new (guint32, n_triangles * 3);
+  for (i = 0; i < clusters->len; i++)
+    {
+      Cluster *cluster = &g_array_index (clusters, Cluster, i);
+      guint n = (cluster->last - cluster->first) * 3;
+
+      memcpy (output + n_output, indices + cluster->first * 3,
+              n * sizeof (guint32));
+      n_output += n;
+    }
+
+  memcpy (indices, output, n_triangles * 3 * sizeof (guint32));
+
+  g_free (output);
+  g_array_free (clusters, TRUE);
+}
+
+/*
+ * Vertex fetch optimization
+ */
+
+/**
+ * mash_mesh_optimizer_optimize_vertex_fetch:
+ * @indices: A triangle list, remapped in place
+ * @n_indices: Number of indices in @indices
+ * @vertices: The interleaved vertex data, reordered in place
+ * @stride: Size in bytes of a vertex
+ * @n_vertices: Number of vertices in @vertices
+ *
+ * Reorders @vertices in the order they are referenced by @indices so
+ * that the vertex fetches walk through memory linearly. The vertices that
+ * are not referenced by any triangle are dropped.
+ *
+ * Return value: The new number of vertices
+ */
+guint
+mash_mesh_optimizer_optimize_vertex_fetch (guint32 *indices,
+                                           guint    n_indices,
+                                           guint8  *vertices,
+                                           guint    stride,
+                                           guint    n_vertices)
+{
+  guint32 *remap;
+  guint8 *original;
+  guint32 next_vertex = 0;
+  guint i;
+
+  if (n_vertices == 0)
+    return 0;
+
+  remap = g_new (guint32, n_vertices);
+  for (i = 0; i < n_vertices; i++)
+    remap[i] = NO_REMAP;
+
+  for (i = 0; i < n_indices; i++)
+    {
+      guint32 v = indices[i];
+
+      if (remap[v] == NO_REMAP)
+        remap[v] = next_vertex++;
+
+      indices[i] = remap[v];
+    }
+
+  original = g_memdup (vertices, n_vertices * stride);
+
+  for (i = 0; i < n_vertices; i++)
+    if (remap[i] != NO_REMAP)
+      memcpy (vertices + (gsize) remap[i] * stride,
+              original + (gsize) i * stride,
+              stride);
+
+  g_free (original);
+  g_free (remap);
+
+  return next_vertex;
+}
+
+/*
+ * Vertex welding
+ */
+
+typedef struct
+{
+  guint stride;
+  guint n_floats;
+  gdouble inv_epsilon; /* 0 for exact comparisons */
+} WeldContext;
+
+#define FNV_OFFSET_BASIS  2166136261u
+#define FNV_PRIME         16777619u
+
+static guint32
+fnv1a (guint32       hash,
+       const guint8 *data,
+       gsize         size)
+{
+  gsize i;
+
+  for (i = 0; i < size; i++)
+    {
+      hash ^= data[i];
+      hash *= FNV_PRIME;
+    }
+
+  return hash;
+}
+
+static gint64
+weld_quantize (const WeldContext *ctx,
+               const guint8      *vertex,
+               guint              component)
+{
+  gfloat value;
+
+  memcpy (&value, vertex + component * sizeof (gfloat), sizeof (gfloat));
+
+  return (gint64) floor (value * ctx->inv_epsilon + 0.5);
+}
+
+static guint32
+weld_hash (const WeldContext *ctx,
+           const guint8      *vertex)
+{
+  guint32 hash = FNV_OFFSET_BASIS;
+  guint i;
+
+  if (ctx->inv_epsilon == 0.0)
+    return fnv1a (hash, vertex, ctx->stride);
+
+  /* Hash the snapped floats and the remaining bytes as they are */
+  for (i = 0; i < ctx->n_floats; i++)
+    {
+      gint64 q = weld_quantize (ctx, vertex, i);
+
+      hash = fnv1a (hash, (const guint8 *) &q, sizeof (q));
+    }
+
+  return fnv1a (hash,
+                vertex + ctx->n_floats * sizeof (gfloat),
+                ctx->stride - ctx->n_floats * sizeof (gfloat));
+}
+
+static gboolean
+weld_equal (const WeldContext *ctx,
+            const guint8      *a,
+            const guint8      *b)
+{
+  guint i, float_bytes;
+
+  if (ctx->inv_epsilon == 0.0)
+    return memcmp (a, b, ctx->stride) == 0;
+
+  for (i = 0; i < ctx->n_floats; i++)
+    if (weld_quantize (ctx, a, i) != weld_quantize (ctx, b, i))
+      return FALSE;
+
+  float_bytes = ctx->n_floats * sizeof (gfloat);
+
+  return memcmp (a + float_bytes, b + float_bytes,
+                 ctx->stride - float_bytes) == 0;
+}
+
+/**
+ * mash_mesh_optimizer_weld_vertices:
+ * @indices: A triangle list, remapped in place
+ * @n_indices: Number of indices in @indices
+ * @vertices: The interleaved vertex data, compacted in place
+ * @stride: Size in bytes of a vertex
+ * @n_vertices: Number of vertices in @vertices
+ * @n_floats: Number of floats at the start of each vertex. Only used when
+ *   @epsilon is not 0.
+ * @epsilon: 0 to only merge vertices that are bitwise identical.
+ *   Otherwise the first @n_floats floats of the vertices are snapped to a
+ *   grid of @epsilon before being compared and the remaining bytes are
+ *   compared exactly.
+ *
+ * Merges the duplicated vertices of @vertices, keeping the first
+ * occurrence of each, and updates @indices to reference the merged
+ * vertices. The relative order of the vertices is kept.
+ *
+ * Return value: The new number of vertices
+ */
+guint
+mash_mesh_optimizer_weld_vertices (guint32 *indices,
+                                   guint    n_indices,
+                                   guint8  *vertices,
+                                   guint    stride,
+                                   guint    n_vertices,
+                                   guint    n_floats,
+                                   gfloat   epsilon)
+{
+  WeldContext ctx;
+  guint32 *table, *remap;
+  guint capacity = 16, mask, n_unique = 0;
+  guint i;
+
+  if (n_vertices == 0)
+    return 0;
+
+  ctx.stride = stride;
+  ctx.n_floats = MIN (n_floats, stride / sizeof (gfloat));
+  ctx.inv_epsilon = epsilon > 0.f ? 1.0 / epsilon : 0.0;
+
+  /* Open addressing table of the unique vertices, at most half full */
+  while (capacity < n_vertices * 2)
+    capacity *= 2;
+  mask = capacity - 1;
+
+  table = g_new (guint32, capacity);
+  for (i = 0; i < capacity; i++)
+    table[i] = NO_REMAP;
+
+  remap = g_new (guint32, n_vertices);
+
+  for (i = 0; i < n_vertices; i++)
+    {
+      const guint8 *vertex = vertices + (gsize) i * stride;
+      guint32 slot = weld_hash (&ctx, vertex) & mask;
+
+      while (TRUE)
+        {
+          guint32 unique = table[slot];
+
+          if (unique == NO_REMAP)
+            {
+              /* The unique vertices are compacted at the front of the
+                 buffer. n_unique <= i so this never overwrites a vertex
+                 we still have to look at, nor one stored in the table */
+              if (n_unique != i)
+                memcpy (vertices + (gsize) n_unique * stride, vertex, stride);
+
+              table[slot] = n_unique;
+              remap[i] = n_unique++;
+              break;
+            }
+
+          if (weld_equal (&ctx, vertices + (gsize) unique * stride, vertex))
+            {
+              remap[i] = unique;
+              break;
+            }
+
+          slot = (slot + 1) & mask;
+        }
+    }
+
+  for (i = 0; i < n_indices; i++)
+    indices[i] = remap[indices[i]];
+
+  g_free (remap);
+  g_free (table);
+
+  return n_unique;
+}
+
+/*
+ * Normal generation
+ */
+
+/* Below this number of items a pass runs on the calling thread */
+#define PARALLEL_MIN_ITEMS      16384
+#define PARALLEL_CHUNK_SIZE     4096
+
+/* Calls @func over [0, @n_items) in chunks spread over all the cores.
+   The chunks must not write to the same data */
+static void
+parallel_run (MashParallelFunc func,
+              gpointer         user_data,
+              guint            n_items)
+{
+  if (n_items < PARALLEL_MIN_ITEMS)
+    func (user_data, 0, n_items);
+  else
+    mash_parallel_run (n_items, PARALLEL_CHUNK_SIZE, func, user_data);
+}
+
+typedef struct
+{
+  guint32 *indices;
+  guint8 *vertices;
+  guint stride;
+  guint position_offset;
+  guint normal_offset;
+  guint n_vertices;
+  MashNormalWeighting weighting;
+  gfloat cos_crease;
+
+  /* Unit normal of each triangle, padded to 4 floats so that the sums
+     are done 4 wide */
+  gfloat (* face_normals)[4];
+  /* Weight of each corner of each triangle */
+  gfloat *corner_weights;
+
+  /* The corners around each vertex, corners[first[v]] to
+     corners[first[v + 1] - 1] */
+  guint32 *first;
+  guint32 *corners;
+
+  /* For each entry of corners, the normal and the group of corners
+     sharing it */
+  gfloat (* corner_normals)[4];
+  guint32 *corner_groups;
+  guint32 *n_groups;
+  /* Where the vertices split off each vertex start */
+  guint32 *split_base;
+} NormalContext;
+
+static void
+normal_sub (const gfloat a[3],
+            const gfloat b[3],
+            gfloat       r[3])
+{
+  r[0] = a[0] - b[0];
+  r[1] = a[1] - b[1];
+  r[2] = a[2] - b[2];
+}
+
+static gfloat
+normal_dot (const gfloat a[3],
+            const gfloat b[3])
+{
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static gfloat
+normal_corner_angle (const gfloat u[3],
+                     const gfloat v[3])
+{
+  gfloat lengths = sqrtf (normal_dot (u, u) * normal_dot (v, v));
+
+  if (lengths <= 0.0f)
+    return 0.0f;
+
+  return acosf (CLAMP (normal_dot (u, v) / lengths, -1.0f, 1.0f));
+}
+
+static void
+normal_faces_pass (gpointer user_data,
+                   guint    begin,
+                   guint    end)
+{
+  NormalContext *ctx = user_data;
+  guint t, k;
+
+  for (t = begin; t < end; t++)
+    {
+      const guint32 *triangle = ctx->indices + t * 3;
+      gfloat p[3][3], e[3][3], n[3], length;
+
+      for (k = 0; k < 3; k++)
+        read_position (ctx->vertices, ctx->stride, ctx->position_offset,
+                       triangle[k], p[k]);
+
+      /* e[k] goes from corner k to the next one */
+      normal_sub (p[1], p[0], e[0]);
+      normal_sub (p[2], p[1], e[1]);
+      normal_sub (p[0], p[2], e[2]);
+
+      n[0] = e[0][1] * e[1][2] - e[0][2] * e[1][1];
+      n[1] = e[0][2] * e[1][0] - e[0][0] * e[1][2];
+      n[2] = e[0][0] * e[1][1] - e[0][1] * e[1][0];
+      length = sqrtf (normal_dot (n, n));
+
+      /* Degenerate triangles don't contribute */
+      if (length <= 0.0f)
+        {
+          memset (ctx->face_normals[t], 0, sizeof (ctx->face_normals[t]));
+          for (k = 0; k < 3; k++)
+            ctx->corner_weights[t * 3 + k] = 0.0f;
+          continue;
+        }
+
+      for (k = 0; k < 3; k++)
+        ctx->face_normals[t][k] = n[k] / length;
+      ctx->face_normals[t][3] = 0.0f;
+
+      for (k = 0; k < 3; k++)
+        {
+          if (ctx->weighting == MASH_NORMAL_WEIGHTING_AREA)
+            {
+              /* The length of the cross product is twice the area */
+              ctx->corner_weights[t * 3 + k] = length;
+            }
+          else
+            {
+              gfloat in[3];
+
+              /* Angle between the incoming and the outgoing edges */
+              in[0] = -e[(k + 2) % 3][0];
+              in[1] = -e[(k + 2) % 3][1];
+              in[2] = -e[(k + 2) % 3][2];
+              ctx->corner_weights[t * 3 + k] =
+                normal_corner_angle (e[k], in);
+            }
+        }
+    }
+}
+
+static void
+normal_accumulate (gfloat       sum[4],
+                   const gfloat normal[4],
+                   gfloat       weight)
+{
+  gint i;
+
+  for (i = 0; i < 4; i++)
+    sum[i] += normal[i] * weight;
+}
+
+/* Per thread buffers sized for the vertex with the most corners seen
+   so far. Each edge leaving the vertex is stored as the index of its
+   other end in the high 32 bits and the corner it comes from in the
+   low ones */
+typedef struct
+{
+  guint64 *edges;
+  guint32 *parents;
+  guint32 *groups;
+  gfloat (* sums)[4];
+  guint size;
+} NormalScratch;
+
+static gint
+compare_normal_edges (gconstpointer a,
+                      gconstpointer b)
+{
+  guint64 edge_a = *(const guint64 *) a, edge_b = *(const guint64 *) b;
+
+  return edge_a < edge_b ? -1 : edge_a > edge_b;
+}
+
+/* Most vertices only have a handful of faces, for which an insertion
+   sort is much cheaper than calling qsort() */
+static void
+normal_sort_edges (guint64 *edges,
+                   guint    n_edges)
+{
+  guint i, j;
+
+  if (n_edges > 32)
+    {
+      qsort (edges, n_edges, sizeof (guint64), compare_normal_edges);
+      return;
+    }
+
+  for (i = 1; i < n_edges; i++)
+    {
+      guint64 edge = edges[i];
+
+      for (j = i; j > 0 && edges[j - 1] > edge; j--)
+        edges[j] = edges[j - 1];
+
+      edges[j] = edge;
+    }
+}
+
+static void
+normal_scratch_reserve (NormalScratch *scratch,
+                        guint          size)
+{
+  if (size <= scratch->size)
+    return;
+
+  scratch->size = MAX (size, scratch->size * 2);
+  scratch->edges = g_renew (guint64, scratch->edges, scratch->size * 2);
+  scratch->parents = g_renew (guint32, scratch->parents, scratch->size);
+  scratch->groups = g_renew (guint32, scratch->groups, scratch->size);
+  scratch->sums = g_realloc (scratch->sums,
+                             scratch->size * sizeof (scratch->sums[0]));
+}
+
+static guint32
+normal_find (guint32 *parents,
+             guint32  i)
+{
+  while (parents[i] != i)
+    {
+      parents[i] = parents[parents[i]];
+      i = parents[i];
+    }
+
+  return i;
+}
+
+static void
+normal_union (guint32 *parents,
+              guint32  a,
+              guint32  b)
+{
+  a = normal_find (parents, a);
+  b = normal_find (parents, b);
+
+  if (a < b)
+    parents[b] = a;
+  else
+    parents[a] = b;
+}
+
+/* Groups the corners around each vertex into the smooth regions of its
+   fan: two faces are in the same region when they share an edge at the
+   vertex and meet at less than the crease angle. Each face takes part
+   in two edges, which are sorted by their other end, so the cost only
+   grows as k log k with the number of faces k around the vertex. A
+   texture seam splits the vertex itself, so the faces on its two sides
+   are never in the same fan anyway */
+static void
+normal_vertices_pass (gpointer user_data,
+                      guint    begin,
+                      guint    end)
+{
+  NormalContext *ctx = user_data;
+  NormalScratch scratch = { NULL, NULL, NULL, NULL, 0 };
+  guint v, i, c;
+
+  for (v = begin; v < end; v++)
+    {
+      guint first = ctx->first[v], n_corners = ctx->first[v + 1] - first;
+      guint32 smooth_corner = G_MAXUINT32;
+      guint n_groups = 0;
+
+      /* Not referenced by any triangle */
+      if (n_corners == 0)
+        {
+          ctx->n_groups[v] = 1;
+          continue;
+        }
+
+      /* Without a crease angle all the corners get the same normal so
+         it is only summed once */
+      if (ctx->cos_crease < -1.0f)
+        {
+          gfloat *sum = ctx->corner_normals[first];
+
+          memset (sum, 0, 4 * sizeof (gfloat));
+          for (c = 0; c < n_corners; c++)
+            {
+              guint32 corner = ctx->corners[first + c];
+
+              normal_accumulate (sum, ctx->face_normals[corner / 3],
+                                 ctx->corner_weights[corner]);
+            }
+          for (c = 0; c < n_corners; c++)
+            {
+              if (c > 0)
+                memcpy (ctx->corner_normals[first + c], sum,
+                        4 * sizeof (gfloat));
+              ctx->corner_groups[first + c] = 0;
+            }
+
+          ctx->n_groups[v] = 1;
+          continue;
+        }
+
+      normal_scratch_reserve (&scratch, n_corners);
+
+      for (c = 0; c < n_corners; c++)
+        {
+          guint32 corner = ctx->corners[first + c];
+          const guint32 *triangle = ctx->indices + corner - corner % 3;
+
+          for (i = 0; i < 2; i++)
+            scratch.edges[c * 2 + i] =
+              ((guint64) triangle[(corner + 1 + i) % 3] << 32) | c;
+
+          scratch.parents[c] = c;
+          scratch.groups[c] = G_MAXUINT32;
+        }
+
+      normal_sort_edges (scratch.edges, n_corners * 2);
+
+      /* Join the faces on both sides of each smooth edge */
+      for (i = 1; i < n_corners * 2; i++)
+        {
+          guint64 a = scratch.edges[i - 1], b = scratch.edges[i];
+          const gfloat *face_a, *face_b;
+
+          if ((a >> 32) != (b >> 32))
+            continue;
+
+          face_a = ctx->face_normals[ctx->corners[first + (guint32) a] / 3];
+          face_b = ctx->face_normals[ctx->corners[first + (guint32) b] / 3];
+
+          /* Degenerate faces would bridge the creases they lie along */
+          if (normal_dot (face_a, face_a) > 0.0f &&
+              normal_dot (face_b, face_b) > 0.0f &&
+              normal_dot (face_a, face_b) >= ctx->cos_crease)
+            normal_union (scratch.parents, (guint32) a, (guint32) b);
+        }
+
+      /* Degenerate faces have no weight, they just join the first
+         region instead of getting a vertex of their own */
+      for (c = 0; c < n_corners && smooth_corner == G_MAXUINT32; c++)
+        {
+          const gfloat *face =
+            ctx->face_normals[ctx->corners[first + c] / 3];
+
+          if (normal_dot (face, face) > 0.0f)
+            smooth_corner = c;
+        }
+
+      /* The groups are numbered in the order of their first corner */
+      for (c = 0; c < n_corners; c++)
+        {
+          guint32 corner = ctx->corners[first + c];
+          const gfloat *face = ctx->face_normals[corner / 3];
+          guint32 root;
+
+          if (normal_dot (face, face) == 0.0f &&
+              smooth_corner != G_MAXUINT32)
+            root = normal_find (scratch.parents, smooth_corner);
+          else
+            root = normal_find (scratch.parents, c);
+
+          if (scratch.groups[root] == G_MAXUINT32)
+            {
+              scratch.groups[root] = n_groups;
+              memset (scratch.sums[n_groups], 0, 4 * sizeof (gfloat));
+              n_groups++;
+            }
+
+          ctx->corner_groups[first + c] = scratch.groups[root];
+          normal_accumulate (scratch.sums[scratch.groups[root]], face,
+                             ctx->corner_weights[corner]);
+        }
+
+      for (c = 0; c < n_corners; c++)
+        memcpy (ctx->corner_normals[first + c],
+                scratch.sums[ctx->corner_groups[first + c]],
+                4 * sizeof (gfloat));
+
+      ctx->n_groups[v] = MAX (n_groups, 1);
+    }
+
+  g_free (scratch.sums);
+  g_free (scratch.groups);
+  g_free (scratch.parents);
+  g_free (scratch.edges);
+}
+
+static void
+normal_write (guint8       *vertex,
+              guint         normal_offset,
+              const gfloat  sum[4])
+{
+  gfloat length = sqrtf (normal_dot (sum, sum));
+  gfloat normal[3] = { 0.0f, 0.0f, 1.0f };
+
+  if (length > 0.0f)
+    {
+      normal[0] = sum[0] / length;
+      normal[1] = sum[1] / length;
+      normal[2] = sum[2] / length;
+    }
+
+  memcpy (vertex + normal_offset, normal, sizeof (normal));
+}
+
+static const gfloat no_normal[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+static void
+normal_split_pass (gpointer user_data,
+                   guint    begin,
+                   guint    end)
+{
+  NormalContext *ctx = user_data;
+  guint v, i;
+
+  for (v = begin; v < end; v++)
+    {
+      guint8 *vertex = ctx->vertices + (gsize) v * ctx->stride;
+      guint first = ctx->first[v], last = ctx->first[v + 1];
+      guint32 next_group = 0;
+
+      if (first == last)
+        {
+          /* Not referenced by any triangle */
+          normal_write (vertex, ctx->normal_offset, no_normal);
+          continue;
+        }
+
+      /* The first group keeps the vertex, the others get a copy of it
+         with their own normal */
+      for (i = first; i < last; i++)
+        {
+          guint32 group = ctx->corner_groups[i];
+          guint32 index = v;
+
+          if (group > 0)
+            index = ctx->split_base[v] + group - 1;
+
+          ctx->indices[ctx->corners[i]] = index;
+
+          /* The groups are numbered in the order of their first corner,
+             which is where each of them is written */
+          if (group == next_group)
+            {
+              guint8 *dst = ctx->vertices + (gsize) index * ctx->stride;
+
+              if (group > 0)
+                memcpy (dst, vertex, ctx->stride);
+              normal_write (dst, ctx->normal_offset, ctx->corner_normals[i]);
+              next_group++;
+            }
+        }
+    }
+}
+
+/**
+ * mash_mesh_optimizer_generate_normals:
+ * @indices: A triangle list, remapped in place when vertices are split
+ * @n_indices: Number of indices in @indices
+ * @vertices: The interleaved vertex data. Vertices split at creases are
+ *   appended to it.
+ * @stride: Size in bytes of a vertex
+ * @position_offset: Offset in bytes of the 3 float position
+ * @normal_offset: Offset in bytes of the 3 float normal to write
+ * @n_vertices: Number of vertices in @vertices
+ * @weighting: How the triangles around a vertex are weighted
+ * @crease_angle: Vertices where two triangles sharing an edge meet at
+ *   more than this angle, in radians, are split so that each side gets
+ *   its own normal. A negative angle never splits.
+ *
+ * Computes smooth normals for a mesh with counter-clockwise front
+ * faces. The triangles and then the vertices are processed in parallel
+ * for big meshes.
+ *
+ * Return value: The new number of vertices
+ */
+guint
+mash_mesh_optimizer_generate_normals (guint32             *indices,
+                                      guint                n_indices,
+                                      GByteArray          *vertices,
+                                      guint                stride,
+                                      guint                position_offset,
+                                      guint                normal_offset,
+                                      guint                n_vertices,
+                                      MashNormalWeighting  weighting,
+                                      gfloat               crease_angle)
+{
+  NormalContext ctx;
+  guint n_triangles = n_indices / 3;
+  guint i, n_split = 0;
+
+  if (n_vertices == 0 || n_triangles == 0)
+    return n_vertices;
+
+  ctx.indices = indices;
+  ctx.vertices = vertices->data;
+  ctx.stride = stride;
+  ctx.position_offset = position_offset;
+  ctx.normal_offset = normal_offset;
+  ctx.n_vertices = n_vertices;
+  ctx.weighting = weighting;
+  /* Below -1 no pair of faces is ever a crease */
+  ctx.cos_crease = crease_angle < 0.0f ? -2.0f : cosf (crease_angle);
+
+  ctx.face_normals = g_malloc (n_triangles * sizeof (ctx.face_normals[0]));
+  ctx.corner_weights = g_new (gfloat, n_triangles * 3);
+  parallel_run (normal_faces_pass, &ctx, n_triangles);
+
+  /* Bucket the corners by vertex */
+  ctx.first = g_new0 (guint32, n_vertices + 1);
+  ctx.corners = g_new (guint32, n_triangles * 3);
+
+  for (i = 0; i < n_triangles * 3; i++)
+    ctx.first[indices[i] + 1]++;
+  for (i = 0; i < n_vertices; i++)
+    ctx.first[i + 1] += ctx.first[i];
+  for (i = 0; i < n_triangles * 3; i++)
+    ctx.corners[ctx.first[indices[i]]++] = i;
+  /* Filling the buckets moved each start to the next one */
+  for (i = n_vertices; i > 0; i--)
+    ctx.first[i] = ctx.first[i - 1];
+  ctx.first[0] = 0;
+
+  ctx.corner_normals = g_malloc (n_triangles * 3 *
+                                 sizeof (ctx.corner_normals[0]));
+  ctx.corner_groups = g_new (guint32, n_triangles * 3);
+  ctx.n_groups = g_new (guint32, n_vertices);
+  parallel_run (normal_vertices_pass, &ctx, n_vertices);
+
+  ctx.split_base = g_new (guint32, n_vertices);
+  for (i = 0; i < n_vertices; i++)
+    {
+      ctx.split_base[i] = n_vertices + n_split;
+      n_split += ctx.n_groups[i] - 1;
+    }
+
+  /* Make room for the split vertices before they are written */
+  g_byte_array_set_size (vertices, (n_vertices + n_split) * stride);
+  ctx.vertices = vertices->data;
+  parallel_run (normal_split_pass, &ctx, n_vertices);
+
+  g_free (ctx.split_base);
+  g_free (ctx.n_groups);
+  g_free (ctx.corner_groups);
+  g_free (ctx.corner_normals);
+  g_free (ctx.corners);
+  g_free (ctx.first);
+  g_free (ctx.corner_weights);
+  g_free (ctx.face_normals);
+
+  return n_vertices + n_split;
+}
+
+/*
+ * Mesh splitting
+ */
+
+typedef struct
+{
+  guint32 code;
+  guint32 triangle;
+} SplitKey;
+
+/* Spreads the 10 low bits of @x to every third bit */
+static guint32
+morton_spread (guint32 x)
+{
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+
+  return x;
+}
+
+static gint
+compare_split_keys (gconstpointer a,
+                    gconstpointer b)
+{
+  const SplitKey *ka = a, *kb = b;
+
+  if (ka->code != kb->code)
+    return ka->code < kb->code ? -1 : 1;
+
+  /* Keep the original order of the triangles within a cell */
+  return ka->triangle < kb->triangle ? -1 : ka->triangle > kb->triangle;
+}
+
+/**
+ * mash_mesh_optimizer_split:
+ * @indices: A triangle list, reordered and made relative to the
+ *   submeshes in place
+ * @n_indices: Number of indices in @indices
+ * @vertices: The interleaved vertex data, replaced by the vertices of
+ *   the submeshes one after the other
+ * @stride: Size in bytes of a vertex
+ * @position_offset: Offset in bytes of the 3 float position
+ * @n_vertices: Number of vertices in @vertices
+ * @max_vertices: Most vertices a submesh can have
+ * @submeshes: A #GArray of #MashMeshSubmesh the submeshes are appended
+ *   to
+ *
+ * Splits a mesh into submeshes of at most @max_vertices vertices. The
+ * triangles are sorted along a Morton curve through the bounding box
+ * so that each submesh covers a compact region, which keeps the number
+ * of vertices duplicated at the borders low.
+ *
+ * Return value: The new number of vertices
+ */
+guint
+mash_mesh_optimizer_split (guint32    *indices,
+                           guint       n_indices,
+                           GByteArray *vertices,
+                           guint       stride,
+                           guint       position_offset,
+                           guint       n_vertices,
+                           guint       max_vertices,
+                           GArray     *submeshes)
+{
+  guint n_triangles = n_indices / 3;
+  gfloat min[3] = { G_MAXFLOAT, G_MAXFLOAT, G_MAXFLOAT };
+  gfloat max[3] = { -G_MAXFLOAT, -G_MAXFLOAT, -G_MAXFLOAT };
+  gfloat scale[3];
+  GArray *keys;
+  guint32 *owner, *local, *sources, *split_indices;
+  guint n_sources = 0, i, k;
+  MashMeshSubmesh submesh;
+  guint8 *split_vertices;
+
+  g_return_val_if_fail (max_vertices >= 3, n_vertices);
+
+  if (n_triangles == 0)
+    return n_vertices;
+
+  for (i = 0; i < n_vertices; i++)
+    {
+      gfloat position[3];
+
+      read_position (vertices->data, stride, position_offset, i, position);
+      for (k = 0; k < 3; k++)
+        {
+          min[k] = MIN (min[k], position[k]);
+          max[k] = MAX (max[k], position[k]);
+        }
+    }
+
+  for (k = 0; k < 3; k++)
+    scale[k] = max[k] > min[k] ? 1023.0f / (max[k] - min[k]) : 0.0f;
+
+  keys = g_array_sized_new (FALSE, FALSE, sizeof (SplitKey), n_triangles);
+  for (i = 0; i < n_triangles; i++)
+    {
+      gfloat centroid[3] = { 0.0f, 0.0f, 0.0f };
+      guint32 cell[3];
+      SplitKey key;
+
+      for (k = 0; k < 3; k++)
+        {
+          gfloat position[3];
+
+          read_position (vertices->data, stride, position_offset,
+                         indices[i * 3 + k], position);
+          centroid[0] += position[0] / 3.0f;
+          centroid[1] += position[1] / 3.0f;
+          centroid[2] += position[2] / 3.0f;
+        }
+
+      for (k = 0; k < 3; k++)
+        cell[k] = CLAMP ((centroid[k] - min[k]) * scale[k], 0.0f, 1023.0f);
+
+      key.code = (morton_spread (cell[0]) |
+                  morton_spread (cell[1]) << 1 |
+                  morton_spread (cell[2]) << 2);
+      key.triangle = i;
+      g_array_append_val (keys, key);
+    }
+
+  g_array_sort (keys, compare_split_keys);
+
+  /* owner[v] is the number of the submesh, plus one, that last took a
+     copy of vertex v and local[v] is the index of that copy in it */
+  owner = g_new0 (guint32, n_vertices);
+  local = g_new (guint32, n_vertices);
+  /* The original vertex of each vertex of the submeshes */
+  sources = g_new (guint32, n_triangles * 3);
+  split_indices = g_new (guint32, n_triangles * 3);
+
+  memset (&submesh, 0, sizeof (submesh));
+
+  for (i = 0; i < n_triangles; i++)
+    {
+      const guint32 *triangle =
+        indices + g_array_index (keys, SplitKey, i).triangle * 3;
+      guint32 number = submeshes->len + 1;
+      guint n_new = 0;
+
+      for (k = 0; k < 3; k++)
+        if (owner[triangle[k]] != number)
+          n_new++;
+
+      /* Close the submesh when the triangle doesn't fit. The repeated
+         vertices of a degenerate triangle are counted twice, which only
+         closes the submesh a bit early */
+      if (submesh.n_vertices + n_new > max_vertices)
+        {
+          g_array_append_val (submeshes, submesh);
+          submesh.first_vertex = n_sources;
+          submesh.n_vertices = 0;
+          submesh.first_index = i * 3;
+          submesh.n_indices = 0;
+          number++;
+        }
+
+      for (k = 0; k < 3; k++)
+        {
+          guint32 v = triangle[k];
+
+          if (owner[v] != number)
+            {
+              owner[v] = number;
+              local[v] = submesh.n_vertices++;
+              sources[n_sources++] = v;
+            }
+
+          split_indices[submesh.first_index + submesh.n_indices++] = local[v];
+        }
+    }
+
+  g_array_append_val (submeshes, submesh);
+
+  split_vertices = g_malloc ((gsize) n_sources * stride);
+  for (i = 0; i < n_sources; i++)
+    memcpy (split_vertices + (gsize) i * stride,
+            vertices->data + (gsize) sources[i] * stride,
+            stride);
+
+  g_byte_array_set_size (vertices, n_sources * stride);
+  memcpy (vertices->data, split_vertices, (gsize) n_sources * stride);
+  memcpy (indices, split_indices, n_triangles * 3 * sizeof (guint32));
+
+  g_free (split_vertices);
+  g_free (split_indices);
+  g_free (sources);
+  g_free (local);
+  g_free (owner);
+  g_array_free (keys, TRUE);
+
+  return n_sources;
+}
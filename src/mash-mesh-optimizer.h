@@ -0,0 +1,142 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MASH_MESH_OPTIMIZER_H__
+#define __MASH_MESH_OPTIMIZER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Size of the FIFO post-transform cache used when reporting statistics */
+#define MASH_MESH_OPTIMIZER_CACHE_SIZE 16
+
+/**
+ * MashVertexCacheStats:
+ * @n_triangles: Number of triangles in the index buffer
+ * @n_vertices: Number of distinct vertices referenced by the triangles
+ * @n_transformed: Number of vertex shader invocations (cache misses)
+ * @acmr: Average cache miss ratio, transformed vertices per triangle
+ * @atvr: Average transformed vertex ratio, transformed vertices per
+ *   referenced vertex. 1.0 is optimal.
+ *
+ * Result of simulating a FIFO post-transform vertex cache over an
+ * index buffer.
+ */
+typedef struct _MashVertexCacheStats
+{
+  guint n_triangles;
+  guint n_vertices;
+  guint n_transformed;
+
+  gfloat acmr;
+  gfloat atvr;
+} MashVertexCacheStats;
+
+/* Most vertices a submesh can have to be drawn with 16 bits indices */
+#define MASH_MESH_OPTIMIZER_MAX_SUBMESH_VERTICES 0x10000
+
+/**
+ * MashMeshSubmesh:
+ * @first_vertex: Index of the first vertex of the submesh
+ * @n_vertices: Number of vertices of the submesh
+ * @first_index: Position of the first index of the submesh
+ * @n_indices: Number of indices of the submesh
+ *
+ * A part of a mesh drawn on its own. The indices of a submesh are
+ * relative to its first vertex.
+ */
+typedef struct _MashMeshSubmesh
+{
+  guint32 first_vertex;
+  guint32 n_vertices;
+  guint32 first_index;
+  guint32 n_indices;
+} MashMeshSubmesh;
+
+/**
+ * MashNormalWeighting:
+ * @MASH_NORMAL_WEIGHTING_AREA: Each triangle contributes in proportion
+ *   to its area, which favours the big triangles
+ * @MASH_NORMAL_WEIGHTING_ANGLE: Each triangle contributes in proportion
+ *   to its angle at the vertex, which doesn't depend on how the surface
+ *   is tessellated
+ *
+ * How the normals of the triangles around a vertex are weighted when
+ * generating smooth normals.
+ */
+typedef enum
+{
+  MASH_NORMAL_WEIGHTING_AREA,
+  MASH_NORMAL_WEIGHTING_ANGLE
+} MashNormalWeighting;
+
+void  mash_mesh_optimizer_analyze_vertex_cache  (const guint32        *indices,
+                                                 guint                 n_indices,
+                                                 guint                 n_vertices,
+                                                 guint                 cache_size,
+                                                 MashVertexCacheStats *stats);
+
+void  mash_mesh_optimizer_optimize_vertex_cache (guint32 *indices,
+                                                 guint    n_indices,
+                                                 guint    n_vertices);
+
+void  mash_mesh_optimizer_optimize_overdraw     (guint32      *indices,
+                                                 guint         n_indices,
+                                                 const guint8 *vertices,
+                                                 guint         stride,
+                                                 guint         position_offset,
+                                                 guint         n_vertices,
+                                                 gfloat        threshold);
+
+guint mash_mesh_optimizer_optimize_vertex_fetch (guint32 *indices,
+                                                 guint    n_indices,
+                                                 guint8  *vertices,
+                                                 guint    stride,
+                                                 guint    n_vertices);
+
+guint mash_mesh_optimizer_weld_vertices         (guint32 *indices,
+                                                 guint    n_indices,
+                                                 guint8  *vertices,
+                                                 guint    stride,
+                                                 guint    n_vertices,
+                                                 guint    n_floats,
+                                                 gfloat   epsilon);
+
+guint mash_mesh_optimizer_generate_normals      (guint32             *indices,
+                                                 guint                n_indices,
+                                                 GByteArray          *vertices,
+                                                 guint                stride,
+                                                 guint                position_offset,
+                                                 guint                normal_offset,
+                                                 guint                n_vertices,
+                                                 MashNormalWeighting  weighting,
+                                                 gfloat               crease_angle);
+
+guint mash_mesh_optimizer_split                 (guint32             *indices,
+                                                 guint                n_indices,
+                                                 GByteArray          *vertices,
+                                                 guint                stride,
+                                                 guint                position_offset,
+                                                 guint                n_vertices,
+                                                 guint                max_vertices,
+                                                 GArray              *submeshes);
+
+G_END_DECLS
+
+#endif /* __MASH_MESH_OPTIMIZER_H__ */
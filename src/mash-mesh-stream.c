@@ -0,0 +1,622 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A mesh stream uploads a mesh while it is being read instead of once
+ * the whole of it is in memory, so that models bigger than the memory
+ * can be loaded.
+ *
+ * The loader adds the vertices and the indices as it decodes them. They
+ * are copied into chunks of MASH_MESH_STREAM_CHUNK_SIZE bytes which are
+ * handed to the thread owning the Cogl context once full and recycled
+ * once uploaded. When all the chunks are in flight the loader waits, so
+ * no more than MASH_MESH_STREAM_MAX_CHUNKS chunks are ever allocated.
+ *
+ * The number of vertices is known from the start so they all go to a
+ * single attribute buffer, at the offset of each chunk. The number of
+ * indices isn't, as faces can be polygons, so each chunk of indices
+ * gets its own index buffer and is drawn with its own primitive. The
+ * chunks of indices always hold whole triangles.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <string.h>
+#include <cogl/cogl.h>
+
+#include "mash-mesh-stream.h"
+
+typedef struct
+{
+  CoglIndices *indices;
+  gsize n_indices;
+} MashMeshStreamIndices;
+
+typedef struct
+{
+  MashMeshStream *stream;
+
+  gboolean is_indices;
+  guint8 *data;
+  gsize size;
+
+  /* Where the vertices go in the attribute buffer */
+  guint64 offset;
+} MashMeshStreamChunk;
+
+struct _MashMeshStream
+{
+  /* Context the chunks are uploaded from, NULL when the loader runs in
+     the thread owning the Cogl context and uploads them itself */
+  GMainContext *context;
+
+  /* Layout of the mesh */
+  guint64 n_vertices;
+  guint stride;
+  MashMeshCacheAttribute attributes[MASH_MESH_CACHE_MAX_ATTRIBUTES];
+  guint n_attributes;
+  CoglIndicesType indices_type;
+  guint index_size;
+
+  /* Written by the loader only */
+  MashMeshStreamChunk *vertex_chunk, *index_chunk;
+  guint64 n_added_vertices, n_added_indices;
+
+  /* Chunks shared between the loader and the uploads */
+  GMutex mutex;
+  GCond cond;
+  GSList *free_chunks;
+  guint n_chunks;
+  guint n_pending;
+
+  /* Only touched from the thread owning the Cogl context */
+  CoglAttributeBuffer *vertex_buffer;
+  /* MashMeshStreamIndices */
+  GArray *index_buffers;
+};
+
+/*
+ * mash_mesh_stream_new:
+ * @context: The main context to upload the data from, or %NULL to
+ *   upload it directly from the thread adding it
+ * @n_vertices: The number of vertices of the mesh
+ * @stride: The size of a vertex in bytes
+ * @attributes: Layout of a vertex
+ * @n_attributes: The number of attributes
+ * @error: Return location for an error or %NULL
+ *
+ * Creates a stream for a mesh of @n_vertices vertices. When @context is
+ * not %NULL the data is handed to the backend from idle callbacks of
+ * @context, so it has to be iterated by the thread owning
+ * the Cogl context while the data is added.
+ *
+ * Return value: A new #MashMeshStream or %NULL if the mesh can't be
+ *   drawn with the indices supported by the GL driver.
+ */
+MashMeshStream *
+mash_mesh_stream_new (GMainContext *context,
+                      guint64 n_vertices,
+                      guint stride,
+                      const MashMeshCacheAttribute *attributes,
+                      guint n_attributes,
+                      GError **error)
+{
+  MashMeshStream *stream;
+  CoglIndicesType indices_type;
+  guint index_size;
+
+  /* The mesh can't be split as it is never whole in memory so it has to
+     be addressable with a single index type. This only reads the
+     features of the context, which don't change once it is created, so
+     it is fine from a loading thread */
+  if (n_vertices <= 0x100)
+    {
+      indices_type = COGL_INDICES_TYPE_UNSIGNED_BYTE;
+      index_size = sizeof (guint8);
+    }
+  else if (n_vertices <= 0x10000)
+    {
+      indices_type = COGL_INDICES_TYPE_UNSIGNED_SHORT;
+      index_size = sizeof (guint16);
+    }
+  else if (n_vertices <= (guint64) G_MAXUINT32 + 1 &&
+           cogl_has_feature (mash_data_get_backend ()->context,
+                             COGL_FEATURE_ID_UNSIGNED_INT_INDICES))
+    {
+      indices_type = COGL_INDICES_TYPE_UNSIGNED_INT;
+      index_size = sizeof (guint32);
+    }
+  else
+    {
+      g_set_error (error, MASH_DATA_ERROR,
+                   MASH_DATA_ERROR_UNSUPPORTED,
+                   "Streaming %" G_GUINT64_FORMAT " vertices requires "
+                   "unsigned int indices but this is not supported by "
+                   "your GL driver",
+                   n_vertices);
+      return NULL;
+    }
+
+  stream = g_slice_new0 (MashMeshStream);
+
+  if (context)
+    stream->context = g_main_context_ref (context);
+
+  stream->n_vertices = n_vertices;
+  stream->stride = stride;
+  memcpy (stream->attributes, attributes,
+          n_attributes * sizeof (MashMeshCacheAttribute));
+  stream->n_attributes = n_attributes;
+  stream->indices_type = indices_type;
+  stream->index_size = index_size;
+
+  g_mutex_init (&stream->mutex);
+  g_cond_init (&stream->cond);
+
+  stream->index_buffers = g_array_new (FALSE, FALSE,
+                                       sizeof (MashMeshStreamIndices));
+
+  return stream;
+}
+
+/* Gets a chunk to fill, waiting for one to be uploaded if they are all
+   in use */
+static MashMeshStreamChunk *
+mash_mesh_stream_get_chunk (MashMeshStream *stream,
+                            gboolean is_indices)
+{
+  MashMeshStreamChunk *chunk = NULL;
+
+  g_mutex_lock (&stream->mutex);
+
+  while (stream->free_chunks == NULL &&
+         stream->n_chunks >= MASH_MESH_STREAM_MAX_CHUNKS)
+    g_cond_wait (&stream->cond, &stream->mutex);
+
+  if (stream->free_chunks)
+    {
+      chunk = stream->free_chunks->data;
+      stream->free_chunks = g_slist_delete_link (stream->free_chunks,
+                                                 stream->free_chunks);
+    }
+  else
+    stream->n_chunks++;
+
+  g_mutex_unlock (&stream->mutex);
+
+  if (chunk == NULL)
+    {
+      chunk = g_slice_new (MashMeshStreamChunk);
+      chunk->stream = stream;
+      chunk->data = g_malloc (MASH_MESH_STREAM_CHUNK_SIZE);
+    }
+
+  chunk->is_indices = is_indices;
+  chunk->size = 0;
+  chunk->offset = 0;
+
+  return chunk;
+}
+
+static void
+mash_mesh_stream_put_chunk (MashMeshStreamChunk *chunk,
+                            gboolean was_pending)
+{
+  MashMeshStream *stream = chunk->stream;
+
+  g_mutex_lock (&stream->mutex);
+
+  stream->free_chunks = g_slist_prepend (stream->free_chunks, chunk);
+  if (was_pending)
+    stream->n_pending--;
+  g_cond_signal (&stream->cond);
+
+  g_mutex_unlock (&stream->mutex);
+}
+
+static void
+mash_mesh_stream_upload_done (void *user_data)
+{
+  mash_mesh_stream_put_chunk (user_data, TRUE);
+}
+
+/* Creates the buffer of the chunk if needed and uploads it. This runs
+   in the thread owning the Cogl context */
+static void
+mash_mesh_stream_upload_chunk (MashMeshStreamChunk *chunk)
+{
+  MashMeshStream *stream = chunk->stream;
+  CoglContext *context = mash_data_get_backend ()->context;
+  CoglBuffer *buffer;
+  gsize offset;
+
+  if (chunk->is_indices)
+    {
+      MashMeshStreamIndices indices;
+      CoglIndexBuffer *index_buffer;
+
+      index_buffer = cogl_index_buffer_new (context, chunk->size);
+      indices.indices = cogl_indices_new_for_buffer (stream->indices_type,
+                                                     index_buffer, 0);
+      indices.n_indices = chunk->size / stream->index_size;
+      g_array_append_val (stream->index_buffers, indices);
+
+      buffer = COGL_BUFFER (index_buffer);
+      offset = 0;
+    }
+  else
+    {
+      if (stream->vertex_buffer == NULL)
+        stream->vertex_buffer =
+          cogl_attribute_buffer_new (context,
+                                     stream->n_vertices * stream->stride,
+                                     NULL);
+
+      buffer = cogl_object_ref (stream->vertex_buffer);
+      offset = chunk->offset;
+    }
+
+  if (stream->context)
+    mash_mesh_cache_upload_buffer (buffer, offset, chunk->data, chunk->size,
+                                   mash_mesh_stream_upload_done, chunk);
+  else
+    {
+      cogl_buffer_set_data (buffer, offset, chunk->data, chunk->size);
+      mash_mesh_stream_upload_done (chunk);
+    }
+
+  cogl_object_unref (buffer);
+}
+
+static gboolean
+mash_mesh_stream_upload_idle (gpointer user_data)
+{
+  mash_mesh_stream_upload_chunk (user_data);
+
+  return FALSE;
+}
+
+static void
+mash_mesh_stream_submit_chunk (MashMeshStreamChunk *chunk)
+{
+  MashMeshStream *stream = chunk->stream;
+  GSource *source;
+
+  g_mutex_lock (&stream->mutex);
+  stream->n_pending++;
+  g_mutex_unlock (&stream->mutex);
+
+  if (stream->context == NULL)
+    {
+      mash_mesh_stream_upload_chunk (chunk);
+      return;
+    }
+
+  source = g_idle_source_new ();
+  g_source_set_callback (source, mash_mesh_stream_upload_idle, chunk, NULL);
+  g_source_attach (source, stream->context);
+  g_source_unref (source);
+}
+
+/*
+ * mash_mesh_stream_add_vertices:
+ * @stream: A #MashMeshStream
+ * @vertices: Interleaved vertices laid out as described to
+ *   mash_mesh_stream_new()
+ * @n_vertices: The number of vertices to add
+ *
+ * Adds vertices after the ones already added. This can block until
+ * earlier data has been uploaded.
+ */
+void
+mash_mesh_stream_add_vertices (MashMeshStream *stream,
+                               const guint8 *vertices,
+                               gsize n_vertices)
+{
+  gsize capacity = MASH_MESH_STREAM_CHUNK_SIZE / stream->stride;
+
+  g_return_if_fail (n_vertices <=
+                    stream->n_vertices - stream->n_added_vertices);
+
+  while (n_vertices > 0)
+    {
+      MashMeshStreamChunk *chunk;
+      gsize n;
+
+      if (stream->vertex_chunk == NULL)
+        {
+          stream->vertex_chunk = mash_mesh_stream_get_chunk (stream, FALSE);
+          stream->vertex_chunk->offset =
+            stream->n_added_vertices * stream->stride;
+        }
+
+      chunk = stream->vertex_chunk;
+
+      n = MIN (n_vertices, capacity - chunk->size / stream->stride);
+      memcpy (chunk->data + chunk->size, vertices, n * stream->stride);
+      chunk->size += n * stream->stride;
+
+      vertices += n * stream->stride;
+      n_vertices -= n;
+      stream->n_added_vertices += n;
+
+      if (chunk->size == capacity * stream->stride)
+        {
+          mash_mesh_stream_submit_chunk (chunk);
+          stream->vertex_chunk = NULL;
+        }
+    }
+}
+
+/*
+ * mash_mesh_stream_add_indices:
+ * @stream: A #MashMeshStream
+ * @indices: The indices of whole triangles
+ * @n_indices: The number of indices, a multiple of 3
+ *
+ * Adds triangles after the ones already added, converting their indices
+ * to the type used by @stream. This can block until earlier data has
+ * been uploaded.
+ */
+void
+mash_mesh_stream_add_indices (MashMeshStream *stream,
+                              const guint32 *indices,
+                              gsize n_indices)
+{
+  /* Each chunk is drawn on its own so it must not split a triangle */
+  gsize capacity = (MASH_MESH_STREAM_CHUNK_SIZE / stream->index_size /
+                    3 * 3);
+
+  g_return_if_fail (n_indices % 3 == 0);
+
+  while (n_indices > 0)
+    {
+      MashMeshStreamChunk *chunk;
+      gsize n, used, i;
+
+      if (stream->index_chunk == NULL)
+        stream->index_chunk = mash_mesh_stream_get_chunk (stream, TRUE);
+
+      chunk = stream->index_chunk;
+      used = chunk->size / stream->index_size;
+
+      n = MIN (n_indices, capacity - used);
+
+      switch (stream->indices_type)
+        {
+        case COGL_INDICES_TYPE_UNSIGNED_BYTE:
+          for (i = 0; i < n; i++)
+            chunk->data[used + i] = indices[i];
+          break;
+        case COGL_INDICES_TYPE_UNSIGNED_SHORT:
+          {
+            guint16 *dst = (guint16 *) chunk->data + used;
+
+            for (i = 0; i < n; i++)
+              dst[i] = indices[i];
+          }
+          break;
+        case COGL_INDICES_TYPE_UNSIGNED_INT:
+          memcpy ((guint32 *) chunk->data + used, indices,
+                  n * sizeof (guint32));
+          break;
+        }
+
+      chunk->size += n * stream->index_size;
+
+      indices += n;
+      n_indices -= n;
+      stream->n_added_indices += n;
+
+      if (used + n == capacity)
+        {
+          mash_mesh_stream_submit_chunk (chunk);
+          stream->index_chunk = NULL;
+        }
+    }
+}
+
+/* Waits until all the submitted chunks have been uploaded */
+static void
+mash_mesh_stream_wait (MashMeshStream *stream)
+{
+  g_mutex_lock (&stream->mutex);
+
+  while (stream->n_pending > 0)
+    g_cond_wait (&stream->cond, &stream->mutex);
+
+  g_mutex_unlock (&stream->mutex);
+}
+
+/*
+ * mash_mesh_stream_finish:
+ * @stream: A #MashMeshStream
+ *
+ * Submits the data added since the last full chunks and waits until
+ * everything has been uploaded.
+ */
+void
+mash_mesh_stream_finish (MashMeshStream *stream)
+{
+  if (stream->vertex_chunk)
+    {
+      mash_mesh_stream_submit_chunk (stream->vertex_chunk);
+      stream->vertex_chunk = NULL;
+    }
+
+  if (stream->index_chunk)
+    {
+      mash_mesh_stream_submit_chunk (stream->index_chunk);
+      stream->index_chunk = NULL;
+    }
+
+  mash_mesh_stream_wait (stream);
+}
+
+guint64
+mash_mesh_stream_get_n_indices (MashMeshStream *stream)
+{
+  return stream->n_added_indices;
+}
+
+/*
+ * mash_mesh_stream_get_size:
+ * @stream: A #MashMeshStream
+ *
+ * Return value: The size in bytes of the vertices and the indices
+ *   uploaded by @stream
+ */
+gsize
+mash_mesh_stream_get_size (MashMeshStream *stream)
+{
+  return (stream->n_vertices * stream->stride +
+          stream->n_added_indices * stream->index_size);
+}
+
+/*
+ * mash_mesh_stream_create_primitives:
+ * @stream: A finished #MashMeshStream
+ *
+ * Describes the uploaded data in new primitives, one per chunk of
+ * indices. This has to be called from the thread owning the Cogl
+ * context.
+ *
+ * Return value: A new #GPtrArray of #CoglPrimitive
+ */
+GPtrArray *
+mash_mesh_stream_create_primitives (MashMeshStream *stream)
+{
+  CoglAttribute *attributes[MASH_MESH_CACHE_MAX_ATTRIBUTES];
+  GPtrArray *primitives;
+  guint i;
+
+  g_return_val_if_fail (stream->vertex_buffer != NULL, NULL);
+
+  for (i = 0; i < stream->n_attributes; i++)
+    {
+      const MashMeshCacheAttribute *attribute = stream->attributes + i;
+
+      attributes[i] = cogl_attribute_new (stream->vertex_buffer,
+                                          attribute->name,
+                                          stream->stride,
+                                          attribute->offset,
+                                          attribute->n_components,
+                                          attribute->type);
+      if (attribute->normalized)
+        cogl_attribute_set_normalized (attributes[i], TRUE);
+    }
+
+  primitives = g_ptr_array_new_with_free_func (cogl_object_unref);
+
+  for (i = 0; i < stream->index_buffers->len; i++)
+    {
+      MashMeshStreamIndices *indices =
+        &g_array_index (stream->index_buffers, MashMeshStreamIndices, i);
+      CoglPrimitive *primitive;
+
+      /* The number of vertices is replaced by the number of indices */
+      primitive =
+        cogl_primitive_new_with_attributes (COGL_VERTICES_MODE_TRIANGLES,
+                                            MIN (stream->n_vertices,
+                                                 G_MAXINT),
+                                            attributes,
+                                            stream->n_attributes);
+      cogl_primitive_set_indices (primitive, indices->indices,
+                                  indices->n_indices);
+      g_ptr_array_add (primitives, primitive);
+    }
+
+  for (i = 0; i < stream->n_attributes; i++)
+    cogl_object_unref (attributes[i]);
+
+  return primitives;
+}
+
+/* Releases the buffers, from the thread owning the Cogl context */
+static gboolean
+mash_mesh_stream_free_buffers (gpointer user_data)
+{
+  MashMeshStream *stream = user_data;
+  guint i;
+
+  if (stream->vertex_buffer)
+    cogl_object_unref (stream->vertex_buffer);
+
+  for (i = 0; i < stream->index_buffers->len; i++)
+    cogl_object_unref (g_array_index (stream->index_buffers,
+                                      MashMeshStreamIndices, i).indices);
+  g_array_free (stream->index_buffers, TRUE);
+
+  if (stream->context)
+    g_main_context_unref (stream->context);
+
+  g_slice_free (MashMeshStream, stream);
+
+  return FALSE;
+}
+
+/*
+ * mash_mesh_stream_free:
+ * @stream: A #MashMeshStream
+ *
+ * Frees @stream, discarding the data that wasn't submitted yet. This
+ * waits for the data being uploaded so it must not be called from the
+ * thread owning the Cogl context before mash_mesh_stream_finish() when
+ * the stream has a main context. The buffers are released from that
+ * context.
+ */
+void
+mash_mesh_stream_free (MashMeshStream *stream)
+{
+  GSList *l;
+
+  if (stream->vertex_chunk)
+    mash_mesh_stream_put_chunk (stream->vertex_chunk, FALSE);
+  if (stream->index_chunk)
+    mash_mesh_stream_put_chunk (stream->index_chunk, FALSE);
+
+  mash_mesh_stream_wait (stream);
+
+  for (l = stream->free_chunks; l; l = l->next)
+    {
+      MashMeshStreamChunk *chunk = l->data;
+
+      g_free (chunk->data);
+      g_slice_free (MashMeshStreamChunk, chunk);
+    }
+  g_slist_free (stream->free_chunks);
+
+  g_mutex_clear (&stream->mutex);
+  g_cond_clear (&stream->cond);
+
+  if (stream->context &&
+      (stream->vertex_buffer || stream->index_buffers->len > 0))
+    {
+      GSource *source = g_idle_source_new ();
+
+      g_source_set_callback (source, mash_mesh_stream_free_buffers,
+                             stream, NULL);
+      g_source_attach (source, stream->context);
+      g_source_unref (source);
+    }
+  else
+    mash_mesh_stream_free_buffers (stream);
+}
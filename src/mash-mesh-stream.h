@@ -0,0 +1,61 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MASH_MESH_STREAM_H__
+#define __MASH_MESH_STREAM_H__
+
+#include <glib.h>
+#include <cogl/cogl.h>
+
+#include "mash-mesh-cache.h"
+
+G_BEGIN_DECLS
+
+/* Size of the buffers the data goes through on its way to the GPU and
+   number of them that can be alive at once, which bounds the memory
+   used by a stream */
+#define MASH_MESH_STREAM_CHUNK_SIZE (4 * 1024 * 1024)
+#define MASH_MESH_STREAM_MAX_CHUNKS 4
+
+typedef struct _MashMeshStream MashMeshStream;
+
+MashMeshStream *mash_mesh_stream_new               (GMainContext *context,
+                                                    guint64 n_vertices,
+                                                    guint stride,
+                                                    const MashMeshCacheAttribute *attributes,
+                                                    guint n_attributes,
+                                                    GError **error);
+
+void            mash_mesh_stream_add_vertices      (MashMeshStream *stream,
+                                                    const guint8 *vertices,
+                                                    gsize n_vertices);
+void            mash_mesh_stream_add_indices       (MashMeshStream *stream,
+                                                    const guint32 *indices,
+                                                    gsize n_indices);
+void            mash_mesh_stream_finish            (MashMeshStream *stream);
+
+guint64         mash_mesh_stream_get_n_indices     (MashMeshStream *stream);
+gsize           mash_mesh_stream_get_size          (MashMeshStream *stream);
+
+GPtrArray      *mash_mesh_stream_create_primitives (MashMeshStream *stream);
+
+void            mash_mesh_stream_free              (MashMeshStream *stream);
+
+G_END_DECLS
+
+#endif /* __MASH_MESH_STREAM_H__ */
@@ -0,0 +1,1323 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Loader for Wavefront OBJ files. Only the geometry is read: the v, vt,
+ * vn and f lines. Everything else, including the materials, is
+ * skipped.
+ *
+ * The file is mapped and cut in chunks at line boundaries which are
+ * parsed by a few threads in two passes. The first pass counts the
+ * vertices of each chunk so that every chunk knows the index of its
+ * first vertex in the file. The second pass then decodes the vertices
+ * straight into their place in the arrays of the whole file and
+ * resolves the indices of the faces, including the relative ones. A
+ * corner of a face refers to a position, a texture coordinate and a
+ * normal separately so the last step merges the corners into vertices,
+ * each distinct triplet of indices becoming a vertex.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib-object.h>
+#include <string.h>
+#include <math.h>
+#include <cogl/cogl.h>
+
+#include "mash-obj-loader.h"
+#include "mash-mesh-optimizer.h"
+#include "mash-mesh-cache.h"
+#include "mash-parallel.h"
+
+static void mash_obj_loader_finalize (GObject *object);
+static gboolean mash_obj_loader_load (MashDataLoader *data_loader,
+                                      MashDataFlags flags,
+                                      const gchar *filename,
+                                      GError **error);
+static void mash_obj_loader_get_data (MashDataLoader *data_loader,
+                                      MashDataLoaderData *loader_data);
+static const MashMeshCacheData *
+mash_obj_loader_get_mesh (MashDataLoader *data_loader);
+
+G_DEFINE_TYPE (MashObjLoader, mash_obj_loader, MASH_TYPE_DATA_LOADER);
+
+#define MASH_OBJ_LOADER_GET_PRIVATE(obj)                      \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), MASH_TYPE_OBJ_LOADER,  \
+                                MashObjLoaderPrivate))
+
+/* Files are cut in chunks of at least this size, smaller files are
+   parsed by a single thread */
+#define MASH_OBJ_LOADER_MIN_CHUNK_SIZE  (256 * 1024)
+
+/* Same values as the PLY loader */
+#define MASH_OBJ_LOADER_WELD_EPSILON    1e-5f
+#define MASH_OBJ_LOADER_CREASE_ANGLE    (G_PI / 3.0)
+
+/* Marks a corner without a texture coordinate or a normal */
+#define MASH_OBJ_LOADER_NO_INDEX        G_MAXUINT32
+
+#define MASH_OBJ_LOADER_IS_BLANK(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
+#define MASH_OBJ_LOADER_IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+typedef enum
+{
+  MASH_OBJ_LOADER_LINE_OTHER,
+  MASH_OBJ_LOADER_LINE_POSITION,
+  MASH_OBJ_LOADER_LINE_TEX_COORD,
+  MASH_OBJ_LOADER_LINE_NORMAL,
+  MASH_OBJ_LOADER_LINE_FACE
+} MashObjLoaderLineType;
+
+/* Indices of the attributes used by a corner of a face, counted from
+   the start of the file */
+typedef struct
+{
+  guint32 position;
+  guint32 tex_coord;
+  guint32 normal;
+} MashObjLoaderCorner;
+
+typedef struct
+{
+  const gchar *start, *end;
+
+  /* Number of each attribute in the chunk, then index of the first
+     one in the file */
+  guint64 n_positions, n_tex_coords, n_normals, n_faces;
+  guint64 first_position, first_tex_coord, first_normal;
+
+  /* Three corners per triangle, the faces being cut in fans */
+  GArray *corners;
+  gboolean has_tex_coords, has_normals;
+
+  /* Start of the line that couldn't be parsed */
+  const gchar *error_line;
+} MashObjLoaderChunk;
+
+typedef struct _MashObjLoaderData MashObjLoaderData;
+
+typedef void (* MashObjLoaderChunkFunc) (MashObjLoaderData *data,
+                                         MashObjLoaderChunk *chunk);
+
+struct _MashObjLoaderData
+{
+  GError *error;
+  MashDataFlags flags;
+
+  const gchar *text;
+  gsize size;
+
+  MashObjLoaderChunk *chunks;
+  guint n_chunks, n_threads;
+  MashObjLoaderChunkFunc chunk_func;
+
+  /* Attributes of the whole file, indexed by the corners */
+  guint32 n_positions, n_tex_coords, n_normals;
+  gfloat *positions, *tex_coords, *normals;
+  gboolean has_tex_coords, has_normals;
+
+  GByteArray *vertices;
+  guint n_vertices;
+  /* 32 bits indices, packed down to indices_type once fully processed */
+  GArray *faces;
+  /* MashMeshSubmeshes, empty unless the mesh had to be split */
+  GArray *submeshes;
+  CoglIndicesType indices_type;
+
+  /* Layout of the vertices */
+  guint stride;
+  gint normal_offset, tex_coord_offset;
+  MashMeshCacheAttribute attributes[MASH_MESH_CACHE_MAX_ATTRIBUTES];
+  gint n_attributes;
+
+  /* Bounding cuboid of the data */
+  CoglVertexP3 min_vertex, max_vertex;
+
+  /* Set when the file had no normals and they were computed */
+  gboolean generated_normals;
+};
+
+struct _MashObjLoaderPrivate
+{
+  /* One primitive per submesh */
+  GPtrArray *primitives;
+
+  /* Processed data waiting to be uploaded by get_data(). The loading
+     can happen in a thread so it must not use Cogl */
+  GByteArray *vertices;
+  GArray *faces;
+  GArray *submeshes;
+  MashMeshCacheData mesh;
+
+  /* Size of the uploaded data */
+  gsize mesh_size;
+};
+
+static const gdouble
+mash_obj_loader_powers_of_ten[] =
+{
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static void
+mash_obj_loader_class_init (MashObjLoaderClass *klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  MashDataLoaderClass *data_loader_class = (MashDataLoaderClass *) klass;
+
+  gobject_class->finalize = mash_obj_loader_finalize;
+
+  data_loader_class->load = mash_obj_loader_load;
+  data_loader_class->get_data = mash_obj_loader_get_data;
+  data_loader_class->get_mesh = mash_obj_loader_get_mesh;
+
+  g_type_class_add_private (klass, sizeof (MashObjLoaderPrivate));
+}
+
+static void
+mash_obj_loader_init (MashObjLoader *self)
+{
+  self->priv = MASH_OBJ_LOADER_GET_PRIVATE (self);
+}
+
+static void
+mash_obj_loader_free_data (MashObjLoader *self)
+{
+  MashObjLoaderPrivate *priv = self->priv;
+
+  if (priv->vertices)
+    {
+      g_byte_array_free (priv->vertices, TRUE);
+      priv->vertices = NULL;
+    }
+
+  if (priv->faces)
+    {
+      g_array_free (priv->faces, TRUE);
+      priv->faces = NULL;
+    }
+
+  if (priv->submeshes)
+    {
+      g_array_free (priv->submeshes, TRUE);
+      priv->submeshes = NULL;
+    }
+}
+
+static void
+mash_obj_loader_free_primitive (MashObjLoader *self)
+{
+  MashObjLoaderPrivate *priv = self->priv;
+
+  if (priv->primitives)
+    {
+      g_ptr_array_unref (priv->primitives);
+      priv->primitives = NULL;
+    }
+
+  mash_obj_loader_free_data (self);
+}
+
+static void
+mash_obj_loader_finalize (GObject *object)
+{
+  MashObjLoader *self = (MashObjLoader *) object;
+
+  mash_obj_loader_free_primitive (self);
+
+  G_OBJECT_CLASS (mash_obj_loader_parent_class)->finalize (object);
+}
+
+static void
+mash_obj_loader_run_chunks (gpointer user_data,
+                            guint begin,
+                            guint end)
+{
+  MashObjLoaderData *data = user_data;
+  guint i;
+
+  for (i = begin; i < end; i++)
+    data->chunk_func (data, data->chunks + i);
+}
+
+/* Runs @func on all the chunks spread over all the cores */
+static void
+mash_obj_loader_run (MashObjLoaderData *data,
+                     MashObjLoaderChunkFunc func)
+{
+  data->chunk_func = func;
+
+  mash_parallel_run (data->n_chunks, 1, mash_obj_loader_run_chunks, data);
+}
+
+static void
+mash_obj_loader_split_chunks (MashObjLoaderData *data)
+{
+  const gchar *end = data->text + data->size;
+  const gchar *start = data->text;
+  guint i;
+
+  data->n_chunks = data->n_threads > 1 ? 4 * data->n_threads : 1;
+  data->n_chunks = MIN (data->n_chunks,
+                        data->size / MASH_OBJ_LOADER_MIN_CHUNK_SIZE);
+  data->n_chunks = MAX (data->n_chunks, 1);
+  data->chunks = g_new0 (MashObjLoaderChunk, data->n_chunks);
+
+  /* Each chunk ends after the first new line following its share of
+     the file */
+  for (i = 0; i < data->n_chunks; i++)
+    {
+      MashObjLoaderChunk *chunk = data->chunks + i;
+      const gchar *p = data->text + data->size * (i + 1) / data->n_chunks;
+
+      if (p < start)
+        p = start;
+      if (i + 1 < data->n_chunks && p < end)
+        {
+          p = memchr (p, '\n', end - p);
+          p = p ? p + 1 : end;
+        }
+      else
+        p = end;
+
+      chunk->start = start;
+      chunk->end = p;
+      start = p;
+    }
+}
+
+/* Returns the end of the line starting at @p, excluding the new line */
+static const gchar *
+mash_obj_loader_get_line_end (const gchar *p,
+                              const gchar *end)
+{
+  const gchar *line_end = memchr (p, '\n', end - p);
+
+  return line_end ? line_end : end;
+}
+
+/* Skips the keyword at the start of a line */
+static MashObjLoaderLineType
+mash_obj_loader_get_line_type (const gchar **p,
+                               const gchar *line_end)
+{
+  const gchar *s = *p;
+  MashObjLoaderLineType type = MASH_OBJ_LOADER_LINE_OTHER;
+
+  while (s < line_end && MASH_OBJ_LOADER_IS_BLANK (*s))
+    s++;
+
+  if (line_end - s < 2)
+    return MASH_OBJ_LOADER_LINE_OTHER;
+
+  if (s[0] == 'v')
+    {
+      if (MASH_OBJ_LOADER_IS_BLANK (s[1]))
+        {
+          type = MASH_OBJ_LOADER_LINE_POSITION;
+          s += 1;
+        }
+      else if (line_end - s >= 3 && MASH_OBJ_LOADER_IS_BLANK (s[2]))
+        {
+          if (s[1] == 't')
+            type = MASH_OBJ_LOADER_LINE_TEX_COORD;
+          else if (s[1] == 'n')
+            type = MASH_OBJ_LOADER_LINE_NORMAL;
+          s += 2;
+        }
+    }
+  else if (s[0] == 'f' && MASH_OBJ_LOADER_IS_BLANK (s[1]))
+    {
+      type = MASH_OBJ_LOADER_LINE_FACE;
+      s += 1;
+    }
+
+  *p = s;
+
+  return type;
+}
+
+static void
+mash_obj_loader_count_chunk (MashObjLoaderData *data,
+                             MashObjLoaderChunk *chunk)
+{
+  const gchar *p = chunk->start;
+
+  while (p < chunk->end)
+    {
+      const gchar *line_end = mash_obj_loader_get_line_end (p, chunk->end);
+
+      switch (mash_obj_loader_get_line_type (&p, line_end))
+        {
+        case MASH_OBJ_LOADER_LINE_POSITION:
+          chunk->n_positions++;
+          break;
+        case MASH_OBJ_LOADER_LINE_TEX_COORD:
+          chunk->n_tex_coords++;
+          break;
+        case MASH_OBJ_LOADER_LINE_NORMAL:
+          chunk->n_normals++;
+          break;
+        case MASH_OBJ_LOADER_LINE_FACE:
+          chunk->n_faces++;
+          break;
+        default:
+          break;
+        }
+
+      p = line_end + (line_end < chunk->end);
+    }
+}
+
+/* Parses a decimal number, which is the only notation exporters use.
+   The file isn't nul terminated so strtod() can't be used */
+static gboolean
+mash_obj_loader_parse_float (const gchar **p,
+                             const gchar *end,
+                             gfloat *value)
+{
+  const gchar *s = *p;
+  gboolean negative = FALSE;
+  guint64 mantissa = 0;
+  gint exponent = 0, n_digits = 0;
+  gdouble result;
+
+  while (s < end && MASH_OBJ_LOADER_IS_BLANK (*s))
+    s++;
+
+  if (s < end && (*s == '-' || *s == '+'))
+    negative = *s++ == '-';
+
+  /* The digits past the precision of a double only matter for the
+     exponent */
+  for (; s < end && MASH_OBJ_LOADER_IS_DIGIT (*s); s++, n_digits++)
+    {
+      if (mantissa < G_GUINT64_CONSTANT (1000000000000000000))
+        mantissa = mantissa * 10 + (*s - '0');
+      else
+        exponent++;
+    }
+
+  if (s < end && *s == '.')
+    for (s++; s < end && MASH_OBJ_LOADER_IS_DIGIT (*s); s++, n_digits++)
+      if (mantissa < G_GUINT64_CONSTANT (1000000000000000000))
+        {
+          mantissa = mantissa * 10 + (*s - '0');
+          exponent--;
+        }
+
+  if (n_digits == 0)
+    return FALSE;
+
+  if (s < end && (*s == 'e' || *s == 'E'))
+    {
+      gboolean negative_exponent = FALSE;
+      gint value = 0;
+
+      s++;
+      if (s < end && (*s == '-' || *s == '+'))
+        negative_exponent = *s++ == '-';
+      if (s >= end || !MASH_OBJ_LOADER_IS_DIGIT (*s))
+        return FALSE;
+
+      for (; s < end && MASH_OBJ_LOADER_IS_DIGIT (*s); s++)
+        if (value < 10000)
+          value = value * 10 + (*s - '0');
+
+      exponent += negative_exponent ? -value : value;
+    }
+
+  if (s < end && !MASH_OBJ_LOADER_IS_BLANK (*s))
+    return FALSE;
+
+  result = mantissa;
+  if (exponent < 0)
+    result /= ((guint) -exponent < G_N_ELEMENTS (mash_obj_loader_powers_of_ten) ?
+               mash_obj_loader_powers_of_ten[-exponent] :
+               pow (10.0, -exponent));
+  else if (exponent > 0)
+    result *= ((guint) exponent < G_N_ELEMENTS (mash_obj_loader_powers_of_ten) ?
+               mash_obj_loader_powers_of_ten[exponent] :
+               pow (10.0, exponent));
+
+  *value = negative ? -result : result;
+  *p = s;
+
+  return TRUE;
+}
+
+static gboolean
+mash_obj_loader_parse_floats (const gchar **p,
+                              const gchar *end,
+                              gfloat *values,
+                              gint n_values)
+{
+  gint i;
+
+  for (i = 0; i < n_values; i++)
+    if (!mash_obj_loader_parse_float (p, end, values + i))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Parses an index of a face into an index from the start of the file.
+   Negative indices are relative to the @count attributes defined so
+   far, positive ones start from 1 */
+static gboolean
+mash_obj_loader_parse_index (const gchar **p,
+                             const gchar *end,
+                             guint64 count,
+                             guint32 total,
+                             guint32 *index)
+{
+  const gchar *s = *p;
+  gboolean negative = FALSE;
+  guint64 value = 0;
+
+  if (s < end && *s == '-')
+    {
+      negative = TRUE;
+      s++;
+    }
+
+  if (s >= end || !MASH_OBJ_LOADER_IS_DIGIT (*s))
+    return FALSE;
+
+  for (; s < end && MASH_OBJ_LOADER_IS_DIGIT (*s); s++)
+    {
+      value = value * 10 + (*s - '0');
+      if (value > G_MAXUINT32)
+        return FALSE;
+    }
+
+  if (value == 0)
+    return FALSE;
+
+  if (negative)
+    {
+      if (value > count)
+        return FALSE;
+      value = count - value;
+    }
+  else
+    value--;
+
+  if (value >= total)
+    return FALSE;
+
+  *index = value;
+  *p = s;
+
+  return TRUE;
+}
+
+/* Parses a corner of a face, written as v, v/vt, v//vn or v/vt/vn */
+static gboolean
+mash_obj_loader_parse_corner (MashObjLoaderData *data,
+                              MashObjLoaderChunk *chunk,
+                              const gchar **p,
+                              const gchar *end,
+                              const guint64 *counts,
+                              MashObjLoaderCorner *corner)
+{
+  const gchar *s = *p;
+
+  corner->tex_coord = MASH_OBJ_LOADER_NO_INDEX;
+  corner->normal = MASH_OBJ_LOADER_NO_INDEX;
+
+  if (!mash_obj_loader_parse_index (&s, end, counts[0], data->n_positions,
+                                    &corner->position))
+    return FALSE;
+
+  if (s < end && *s == '/')
+    {
+      s++;
+
+      if (s < end && *s != '/')
+        {
+          if (!mash_obj_loader_parse_index (&s, end, counts[1],
+                                            data->n_tex_coords,
+                                            &corner->tex_coord))
+            return FALSE;
+          chunk->has_tex_coords = TRUE;
+        }
+
+      if (s < end && *s == '/')
+        {
+          s++;
+          if (!mash_obj_loader_parse_index (&s, end, counts[2],
+                                            data->n_normals,
+                                            &corner->normal))
+            return FALSE;
+          chunk->has_normals = TRUE;
+        }
+    }
+
+  if (s < end && !MASH_OBJ_LOADER_IS_BLANK (*s))
+    return FALSE;
+
+  *p = s;
+
+  return TRUE;
+}
+
+/* Cuts a face in a fan of triangles */
+static gboolean
+mash_obj_loader_parse_face (MashObjLoaderData *data,
+                            MashObjLoaderChunk *chunk,
+                            const gchar *p,
+                            const gchar *end,
+                            const guint64 *counts)
+{
+  MashObjLoaderCorner first, last, corner;
+  guint n_corners = 0;
+
+  while (TRUE)
+    {
+      while (p < end && MASH_OBJ_LOADER_IS_BLANK (*p))
+        p++;
+      if (p >= end)
+        break;
+
+      if (!mash_obj_loader_parse_corner (data, chunk, &p, end, counts,
+                                         &corner))
+        return FALSE;
+
+      if (n_corners == 0)
+        first = corner;
+      else if (n_corners >= 2)
+        {
+          g_array_append_val (chunk->corners, first);
+          g_array_append_val (chunk->corners, last);
+          g_array_append_val (chunk->corners, corner);
+        }
+
+      last = corner;
+      n_corners++;
+    }
+
+  return n_corners >= 3;
+}
+
+static void
+mash_obj_loader_parse_chunk (MashObjLoaderData *data,
+                             MashObjLoaderChunk *chunk)
+{
+  /* Number of positions, texture coordinates and normals defined
+     before the current line */
+  guint64 counts[3];
+  const gchar *p = chunk->start;
+
+  counts[0] = chunk->first_position;
+  counts[1] = chunk->first_tex_coord;
+  counts[2] = chunk->first_normal;
+
+  /* Guess that the faces are mostly quads */
+  chunk->corners = g_array_sized_new (FALSE, FALSE,
+                                      sizeof (MashObjLoaderCorner),
+                                      chunk->n_faces * 6);
+
+  while (p < chunk->end)
+    {
+      const gchar *line_start = p;
+      const gchar *line_end = mash_obj_loader_get_line_end (p, chunk->end);
+      gboolean ok = TRUE;
+
+      switch (mash_obj_loader_get_line_type (&p, line_end))
+        {
+        case MASH_OBJ_LOADER_LINE_POSITION:
+          /* Anything after the coordinates, such as a color, is
+             ignored */
+          ok = mash_obj_loader_parse_floats (&p, line_end,
+                                             data->positions + counts[0] * 3,
+                                             3);
+          counts[0]++;
+          break;
+
+        case MASH_OBJ_LOADER_LINE_TEX_COORD:
+          {
+            gfloat *tex_coord = data->tex_coords + counts[1] * 2;
+
+            /* The second coordinate is optional */
+            tex_coord[1] = 0.0f;
+            ok = mash_obj_loader_parse_float (&p, line_end, tex_coord);
+            if (ok)
+              mash_obj_loader_parse_float (&p, line_end, tex_coord + 1);
+            counts[1]++;
+          }
+          break;
+
+        case MASH_OBJ_LOADER_LINE_NORMAL:
+          ok = mash_obj_loader_parse_floats (&p, line_end,
+                                             data->normals + counts[2] * 3,
+                                             3);
+          counts[2]++;
+          break;
+
+        case MASH_OBJ_LOADER_LINE_FACE:
+          ok = mash_obj_loader_parse_face (data, chunk, p, line_end, counts);
+          break;
+
+        case MASH_OBJ_LOADER_LINE_OTHER:
+          break;
+        }
+
+      if (!ok)
+        {
+          chunk->error_line = line_start;
+          return;
+        }
+
+      p = line_end + (line_end < chunk->end);
+    }
+}
+
+static void
+mash_obj_loader_set_parse_error (MashObjLoaderData *data,
+                                 const gchar *line,
+                                 const gchar *display_name)
+{
+  const gchar *p = data->text;
+  guint line_number = 1;
+
+  while ((p = memchr (p, '\n', line - p)))
+    {
+      line_number++;
+      p++;
+    }
+
+  g_set_error (&data->error, MASH_DATA_ERROR,
+               MASH_DATA_ERROR_INVALID,
+               "Invalid line %u in OBJ file %s",
+               line_number, display_name);
+}
+
+static gboolean
+mash_obj_loader_parse (MashObjLoaderData *data,
+                       const gchar *display_name)
+{
+  guint64 n_positions = 0, n_tex_coords = 0, n_normals = 0;
+  guint i;
+
+  mash_obj_loader_split_chunks (data);
+
+  mash_obj_loader_run (data, mash_obj_loader_count_chunk);
+
+  for (i = 0; i < data->n_chunks; i++)
+    {
+      MashObjLoaderChunk *chunk = data->chunks + i;
+
+      chunk->first_position = n_positions;
+      chunk->first_tex_coord = n_tex_coords;
+      chunk->first_normal = n_normals;
+      n_positions += chunk->n_positions;
+      n_tex_coords += chunk->n_tex_coords;
+      n_normals += chunk->n_normals;
+    }
+
+  /* The last index marks the missing attributes */
+  if (MAX (n_positions, MAX (n_tex_coords, n_normals)) >=
+      MASH_OBJ_LOADER_NO_INDEX)
+    {
+      g_set_error (&data->error, MASH_DATA_ERROR,
+                   MASH_DATA_ERROR_UNSUPPORTED,
+                   "OBJ file %s has too many vertices",
+                   display_name);
+      return FALSE;
+    }
+
+  data->n_positions = n_positions;
+  data->n_tex_coords = n_tex_coords;
+  data->n_normals = n_normals;
+  data->positions = g_new (gfloat, n_positions * 3);
+  data->tex_coords = g_new (gfloat, n_tex_coords * 2);
+  data->normals = g_new (gfloat, n_normals * 3);
+
+  mash_obj_loader_run (data, mash_obj_loader_parse_chunk);
+
+  for (i = 0; i < data->n_chunks; i++)
+    {
+      MashObjLoaderChunk *chunk = data->chunks + i;
+
+      if (chunk->error_line)
+        {
+          mash_obj_loader_set_parse_error (data, chunk->error_line,
+                                           display_name);
+          return FALSE;
+        }
+
+      data->has_tex_coords |= chunk->has_tex_coords;
+      data->has_normals |= chunk->has_normals;
+    }
+
+  return TRUE;
+}
+
+/* Gives each distinct corner a vertex and fills the index buffer. The
+   corners of the vertices are returned in a new array.
+
+   The corners are looked up in a hash table keyed by their position,
+   each bucket chaining the vertices sharing a position. The corners of
+   neighbouring faces use nearby positions so this has a much better
+   locality than hashing the whole corner */
+static GArray *
+mash_obj_loader_merge_corners (MashObjLoaderData *data)
+{
+  GArray *keys, *chains;
+  guint32 *buckets;
+  guint n_corners = 0, i, j;
+
+  for (i = 0; i < data->n_chunks; i++)
+    n_corners += data->chunks[i].corners->len;
+
+  buckets = g_new (guint32, data->n_positions);
+  memset (buckets, 0xff, data->n_positions * sizeof (guint32));
+
+  keys = g_array_sized_new (FALSE, FALSE, sizeof (MashObjLoaderCorner),
+                            data->n_positions);
+  chains = g_array_sized_new (FALSE, FALSE, sizeof (guint32),
+                              data->n_positions);
+  data->faces = g_array_sized_new (FALSE, FALSE, sizeof (guint32), n_corners);
+
+  for (i = 0; i < data->n_chunks; i++)
+    {
+      GArray *corners = data->chunks[i].corners;
+
+      for (j = 0; j < corners->len; j++)
+        {
+          const MashObjLoaderCorner *corner =
+            &g_array_index (corners, MashObjLoaderCorner, j);
+          guint32 vertex;
+
+          for (vertex = buckets[corner->position];
+               vertex != MASH_OBJ_LOADER_NO_INDEX;
+               vertex = g_array_index (chains, guint32, vertex))
+            {
+              const MashObjLoaderCorner *key =
+                &g_array_index (keys, MashObjLoaderCorner, vertex);
+
+              if (key->tex_coord == corner->tex_coord &&
+                  key->normal == corner->normal)
+                break;
+            }
+
+          if (vertex == MASH_OBJ_LOADER_NO_INDEX)
+            {
+              vertex = keys->len;
+              g_array_append_val (keys, *corner);
+              g_array_append_val (chains, buckets[corner->position]);
+              buckets[corner->position] = vertex;
+            }
+
+          g_array_append_val (data->faces, vertex);
+        }
+
+      /* The corners aren't needed anymore */
+      g_array_free (corners, TRUE);
+      data->chunks[i].corners = NULL;
+    }
+
+  g_free (buckets);
+  g_array_free (chains, TRUE);
+
+  return keys;
+}
+
+static void
+mash_obj_loader_add_attribute (MashObjLoaderData *data,
+                               const gchar *name,
+                               guint offset,
+                               gint n_components)
+{
+  MashMeshCacheAttribute *attribute = data->attributes + data->n_attributes++;
+
+  g_strlcpy (attribute->name, name, sizeof (attribute->name));
+  attribute->offset = offset;
+  attribute->n_components = n_components;
+  attribute->type = COGL_ATTRIBUTE_TYPE_FLOAT;
+  attribute->normalized = FALSE;
+}
+
+/* Interleaves the attributes of the corners in the vertices */
+static void
+mash_obj_loader_build_vertices (MashObjLoaderData *data,
+                                GArray *keys)
+{
+  guint i, j;
+
+  data->stride = 3 * sizeof (gfloat);
+  data->normal_offset = -1;
+  data->tex_coord_offset = -1;
+  data->n_attributes = 0;
+  mash_obj_loader_add_attribute (data, "cogl_position_in", 0, 3);
+
+  /* Make room for the normals that will be generated */
+  if (data->has_normals || (data->flags & MASH_DATA_GENERATE_NORMALS))
+    {
+      data->normal_offset = data->stride;
+      data->stride += 3 * sizeof (gfloat);
+      mash_obj_loader_add_attribute (data, "cogl_normal_in",
+                                     data->normal_offset, 3);
+    }
+
+  if (data->has_tex_coords)
+    {
+      data->tex_coord_offset = data->stride;
+      data->stride += 2 * sizeof (gfloat);
+      mash_obj_loader_add_attribute (data, "cogl_tex_coord0_in",
+                                     data->tex_coord_offset, 2);
+    }
+
+  data->n_vertices = keys->len;
+  data->vertices = g_byte_array_sized_new (data->n_vertices * data->stride);
+  g_byte_array_set_size (data->vertices, data->n_vertices * data->stride);
+  memset (data->vertices->data, 0, data->vertices->len);
+
+  for (i = 0; i < data->n_vertices; i++)
+    {
+      const MashObjLoaderCorner *corner =
+        &g_array_index (keys, MashObjLoaderCorner, i);
+      guint8 *vertex = data->vertices->data + i * data->stride;
+      gfloat *position = (gfloat *) vertex;
+
+      memcpy (position, data->positions + corner->position * 3,
+              3 * sizeof (gfloat));
+
+      if (corner->normal != MASH_OBJ_LOADER_NO_INDEX)
+        memcpy (vertex + data->normal_offset,
+                data->normals + corner->normal * 3,
+                3 * sizeof (gfloat));
+
+      if (corner->tex_coord != MASH_OBJ_LOADER_NO_INDEX)
+        memcpy (vertex + data->tex_coord_offset,
+                data->tex_coords + corner->tex_coord * 2,
+                2 * sizeof (gfloat));
+
+      /* Flip any axes that have been specified in the flags */
+      for (j = 0; j < 3; j++)
+        if ((data->flags & (MASH_DATA_NEGATE_X << j)))
+          {
+            position[j] = -position[j];
+            if (data->normal_offset != -1)
+              ((gfloat *) (vertex + data->normal_offset))[j] *= -1.0f;
+          }
+
+      /* Update the bounding box for the data */
+      for (j = 0; j < 3; j++)
+        {
+          gfloat *min = &data->min_vertex.x + j;
+          gfloat *max = &data->max_vertex.x + j;
+
+          if (position[j] < *min)
+            *min = position[j];
+          if (position[j] > *max)
+            *max = position[j];
+        }
+    }
+}
+
+static void
+mash_obj_loader_generate_normals (MashObjLoaderData *data,
+                                  const gchar *display_name)
+{
+  guint n_generated, n_negated = 0, i, j;
+  gfloat crease_angle = -1.0f;
+
+  if ((data->flags & MASH_DATA_CREASE_NORMALS))
+    crease_angle = MASH_OBJ_LOADER_CREASE_ANGLE;
+
+  n_generated =
+    mash_mesh_optimizer_generate_normals ((guint32 *) data->faces->data,
+                                          data->faces->len,
+                                          data->vertices,
+                                          data->stride,
+                                          0,
+                                          data->normal_offset,
+                                          data->n_vertices,
+                                          (data->flags &
+                                           MASH_DATA_AREA_WEIGHTED_NORMALS) ?
+                                          MASH_NORMAL_WEIGHTING_AREA :
+                                          MASH_NORMAL_WEIGHTING_ANGLE,
+                                          crease_angle);
+
+  /* Mirroring the model along an odd number of axes turns the faces
+     inside out, flip the normals back */
+  for (i = 0; i < 3; i++)
+    if ((data->flags & (MASH_DATA_NEGATE_X << i)))
+      n_negated++;
+  if ((n_negated & 1))
+    for (i = 0; i < n_generated; i++)
+      {
+        gfloat *normal = (gfloat *) (data->vertices->data +
+                                     i * data->stride +
+                                     data->normal_offset);
+
+        for (j = 0; j < 3; j++)
+          normal[j] = -normal[j];
+      }
+
+  data->generated_normals = TRUE;
+
+  if (mash_data_loader_get_debug ())
+    g_debug ("%s: generated normals, %u vertices split at creases",
+             display_name, n_generated - data->n_vertices);
+
+  data->n_vertices = n_generated;
+}
+
+static guint
+mash_obj_loader_optimize_range (MashObjLoaderData *data,
+                                guint32 *indices,
+                                guint n_indices,
+                                guint8 *vertices,
+                                guint n_vertices)
+{
+  mash_mesh_optimizer_optimize_vertex_cache (indices, n_indices, n_vertices);
+  mash_mesh_optimizer_optimize_overdraw (indices, n_indices,
+                                         vertices, data->stride, 0,
+                                         n_vertices, 1.05f);
+
+  return mash_mesh_optimizer_optimize_vertex_fetch (indices, n_indices,
+                                                    vertices, data->stride,
+                                                    n_vertices);
+}
+
+static void
+mash_obj_loader_optimize (MashObjLoaderData *data)
+{
+  guint32 *indices = (guint32 *) data->faces->data;
+  guint i;
+
+  if (data->submeshes->len == 0)
+    {
+      data->n_vertices =
+        mash_obj_loader_optimize_range (data, indices, data->faces->len,
+                                        data->vertices->data,
+                                        data->n_vertices);
+      g_byte_array_set_size (data->vertices,
+                             data->n_vertices * data->stride);
+    }
+  else
+    /* Each submesh only uses its own vertices, all of them, so they
+       are optimized separately */
+    for (i = 0; i < data->submeshes->len; i++)
+      {
+        const MashMeshSubmesh *submesh =
+          &g_array_index (data->submeshes, MashMeshSubmesh, i);
+
+        mash_obj_loader_optimize_range (data,
+                                        indices + submesh->first_index,
+                                        submesh->n_indices,
+                                        data->vertices->data +
+                                        submesh->first_vertex * data->stride,
+                                        submesh->n_vertices);
+      }
+}
+
+static void
+mash_obj_loader_pack_indices (MashObjLoaderData *data)
+{
+  guint32 *indices = (guint32 *) data->faces->data;
+  guint n_vertices = data->n_vertices, i;
+
+  /* The indices of a split mesh are relative to their submesh */
+  if (data->submeshes->len > 0)
+    {
+      n_vertices = 0;
+      for (i = 0; i < data->submeshes->len; i++)
+        n_vertices = MAX (n_vertices,
+                          g_array_index (data->submeshes,
+                                         MashMeshSubmesh, i).n_vertices);
+    }
+
+  if (n_vertices <= 0x100)
+    {
+      guint8 *packed = (guint8 *) indices;
+
+      data->indices_type = COGL_INDICES_TYPE_UNSIGNED_BYTE;
+      for (i = 0; i < data->faces->len; i++)
+        packed[i] = indices[i];
+    }
+  else if (n_vertices <= 0x10000)
+    {
+      guint16 *packed = (guint16 *) indices;
+
+      data->indices_type = COGL_INDICES_TYPE_UNSIGNED_SHORT;
+      for (i = 0; i < data->faces->len; i++)
+        packed[i] = indices[i];
+    }
+  else
+    data->indices_type = COGL_INDICES_TYPE_UNSIGNED_INT;
+}
+
+static void
+mash_obj_loader_process (MashObjLoaderData *data,
+                         const gchar *display_name)
+{
+  if ((data->flags & (MASH_DATA_WELD | MASH_DATA_WELD_EPSILON)))
+    {
+      guint n_welded =
+        mash_mesh_optimizer_weld_vertices ((guint32 *) data->faces->data,
+                                           data->faces->len,
+                                           data->vertices->data,
+                                           data->stride,
+                                           data->n_vertices,
+                                           data->stride / sizeof (gfloat),
+                                           (data->flags &
+                                            MASH_DATA_WELD_EPSILON) ?
+                                           MASH_OBJ_LOADER_WELD_EPSILON :
+                                           0.0f);
+
+      g_byte_array_set_size (data->vertices, n_welded * data->stride);
+
+      if (mash_data_loader_get_debug ())
+        g_debug ("%s: welded %u vertices into %u", display_name,
+                 data->n_vertices, n_welded);
+
+      data->n_vertices = n_welded;
+    }
+
+  if ((data->flags & MASH_DATA_GENERATE_NORMALS) && !data->has_normals)
+    mash_obj_loader_generate_normals (data, display_name);
+
+  /* Split the big meshes so that they can be drawn with 16 bits
+     indices */
+  if (data->n_vertices > MASH_MESH_OPTIMIZER_MAX_SUBMESH_VERTICES)
+    {
+      guint n_split =
+        mash_mesh_optimizer_split ((guint32 *) data->faces->data,
+                                   data->faces->len,
+                                   data->vertices,
+                                   data->stride,
+                                   0,
+                                   data->n_vertices,
+                                   MASH_MESH_OPTIMIZER_MAX_SUBMESH_VERTICES,
+                                   data->submeshes);
+
+      if (mash_data_loader_get_debug ())
+        g_debug ("%s: split %u vertices into %u submeshes of %u vertices",
+                 display_name, data->n_vertices, data->submeshes->len,
+                 n_split);
+
+      data->n_vertices = n_split;
+    }
+
+  if ((data->flags & MASH_DATA_OPTIMIZE))
+    mash_obj_loader_optimize (data);
+
+  mash_obj_loader_pack_indices (data);
+}
+
+static void
+mash_obj_loader_free_parse_data (MashObjLoaderData *data)
+{
+  guint i;
+
+  for (i = 0; i < data->n_chunks; i++)
+    if (data->chunks[i].corners)
+      g_array_free (data->chunks[i].corners, TRUE);
+  g_free (data->chunks);
+  data->chunks = NULL;
+  data->n_chunks = 0;
+
+  g_free (data->positions);
+  g_free (data->tex_coords);
+  g_free (data->normals);
+  data->positions = NULL;
+  data->tex_coords = NULL;
+  data->normals = NULL;
+}
+
+static gboolean
+mash_obj_loader_load (MashDataLoader *data_loader,
+                      MashDataFlags flags,
+                      const gchar *filename,
+                      GError **error)
+{
+  MashObjLoader *self = MASH_OBJ_LOADER (data_loader);
+  MashObjLoaderPrivate *priv = self->priv;
+  MashObjLoaderData data;
+  GMappedFile *file;
+  GError *file_error = NULL;
+  gchar *display_name;
+  gboolean ret;
+
+  memset (&data, 0, sizeof (data));
+  data.flags = flags;
+  data.n_threads = mash_parallel_get_n_threads ();
+  data.submeshes = g_array_new (FALSE, FALSE, sizeof (MashMeshSubmesh));
+  data.min_vertex.x = G_MAXFLOAT;
+  data.min_vertex.y = G_MAXFLOAT;
+  data.min_vertex.z = G_MAXFLOAT;
+  data.max_vertex.x = -G_MAXFLOAT;
+  data.max_vertex.y = -G_MAXFLOAT;
+  data.max_vertex.z = -G_MAXFLOAT;
+
+  display_name = g_filename_display_name (filename);
+
+  if ((file = g_mapped_file_new (filename, FALSE, &file_error)) == NULL)
+    {
+      g_set_error_literal (&data.error, MASH_DATA_ERROR,
+                           MASH_DATA_ERROR_UNKNOWN,
+                           file_error->message);
+      g_clear_error (&file_error);
+    }
+  else
+    {
+      GTimer *timer = g_timer_new ();
+      GArray *keys;
+
+      data.text = g_mapped_file_get_contents (file);
+      data.size = g_mapped_file_get_length (file);
+
+      if (mash_obj_loader_parse (&data, display_name))
+        {
+          keys = mash_obj_loader_merge_corners (&data);
+          mash_obj_loader_build_vertices (&data, keys);
+          g_array_free (keys, TRUE);
+        }
+
+      mash_obj_loader_free_parse_data (&data);
+
+      g_timer_stop (timer);
+      if (mash_data_loader_get_debug () &&
+          data.error == NULL && g_timer_elapsed (timer, NULL) > 0.0)
+        g_debug ("%s: parsed %.2f MB in %.2f ms, %.1f MB/s (%u threads)",
+                 display_name,
+                 data.size / 1e6,
+                 g_timer_elapsed (timer, NULL) * 1e3,
+                 data.size / 1e6 / g_timer_elapsed (timer, NULL),
+                 data.n_threads);
+      g_timer_destroy (timer);
+
+      g_mapped_file_unref (file);
+    }
+
+  if (data.error == NULL && data.faces->len >= 3)
+    mash_obj_loader_process (&data, display_name);
+
+  if (data.error)
+    {
+      g_propagate_error (error, data.error);
+      ret = FALSE;
+    }
+  else if (data.faces->len < 3)
+    {
+      g_set_error (error, MASH_DATA_ERROR,
+                   MASH_DATA_ERROR_INVALID,
+                   "No faces found in %s",
+                   display_name);
+      ret = FALSE;
+    }
+  else
+    {
+      MashMeshCacheData *mesh = &priv->mesh;
+
+      /* Get rid of the old primitive (if any) */
+      mash_obj_loader_free_primitive (self);
+
+      memset (mesh, 0, sizeof (MashMeshCacheData));
+      mesh->vertices = data.vertices->data;
+      mesh->n_vertices = data.n_vertices;
+      mesh->stride = data.stride;
+      mesh->indices = (const guint8 *) data.faces->data;
+      mesh->indices_type = data.indices_type;
+      mesh->n_indices = data.faces->len;
+      mesh->submeshes = (const MashMeshSubmesh *) data.submeshes->data;
+      mesh->n_submeshes = data.submeshes->len;
+      memcpy (mesh->attributes, data.attributes, sizeof (mesh->attributes));
+      mesh->n_attributes = data.n_attributes;
+      mesh->min_vertex = data.min_vertex;
+      mesh->max_vertex = data.max_vertex;
+      mesh->generated_normals = data.generated_normals;
+
+      if ((flags & MASH_DATA_CACHE))
+        {
+          GError *cache_error = NULL;
+
+          if (!mash_mesh_cache_save (filename, flags, mesh, &cache_error))
+            {
+              g_warning ("Could not cache %s: %s",
+                         display_name, cache_error->message);
+              g_clear_error (&cache_error);
+            }
+        }
+
+      /* Keep the data until get_data() uploads it */
+      priv->vertices = data.vertices;
+      priv->faces = data.faces;
+      priv->submeshes = data.submeshes;
+      data.vertices = NULL;
+      data.faces = NULL;
+      data.submeshes = NULL;
+
+      ret = TRUE;
+    }
+
+  g_free (display_name);
+  if (data.vertices)
+    g_byte_array_free (data.vertices, TRUE);
+  if (data.faces)
+    g_array_free (data.faces, TRUE);
+  if (data.submeshes)
+    g_array_free (data.submeshes, TRUE);
+
+  return ret;
+}
+
+static void
+mash_obj_loader_get_data (MashDataLoader *data_loader,
+                          MashDataLoaderData *loader_data)
+{
+  MashObjLoader *self = MASH_OBJ_LOADER (data_loader);
+  MashObjLoaderPrivate *priv = self->priv;
+
+  /* Upload the data on the first call, from the thread owning the
+     Cogl context */
+  if (priv->primitives == NULL)
+    {
+      priv->primitives = mash_mesh_cache_create_primitives (&priv->mesh);
+      priv->mesh_size = mash_mesh_cache_data_get_size (&priv->mesh);
+      mash_obj_loader_free_data (self);
+    }
+
+  loader_data->primitives = g_ptr_array_ref (priv->primitives);
+
+  loader_data->min_vertex = priv->mesh.min_vertex;
+  loader_data->max_vertex = priv->mesh.max_vertex;
+  loader_data->quantization = priv->mesh.quantization;
+  loader_data->n_bytes = priv->mesh_size;
+  loader_data->generated_normals = priv->mesh.generated_normals;
+}
+
+static const MashMeshCacheData *
+mash_obj_loader_get_mesh (MashDataLoader *data_loader)
+{
+  MashObjLoader *self = MASH_OBJ_LOADER (data_loader);
+  MashObjLoaderPrivate *priv = self->priv;
+
+  /* The data is freed once uploaded by get_data() */
+  if (priv->vertices == NULL)
+    return NULL;
+
+  return &priv->mesh;
+}
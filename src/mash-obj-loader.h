@@ -0,0 +1,69 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MASH_OBJ_LOADER_H__
+#define __MASH_OBJ_LOADER_H__
+
+#include "mash-data-loader.h"
+
+G_BEGIN_DECLS
+
+#define MASH_TYPE_OBJ_LOADER                          \
+  (mash_obj_loader_get_type())
+#define MASH_OBJ_LOADER(obj)                          \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj),                 \
+                               MASH_TYPE_OBJ_LOADER,  \
+                               MashObjLoader))
+#define MASH_OBJ_LOADER_CLASS(klass)                  \
+  (G_TYPE_CHECK_CLASS_CAST ((klass),                  \
+                            MASH_TYPE_OBJ_LOADER,     \
+                            MashObjLoaderClass))
+#define MASH_IS_OBJ_LOADER(obj)                       \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj),                 \
+                               MASH_TYPE_OBJ_LOADER))
+#define MASH_IS_OBJ_LOADER_CLASS(klass)                 \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass),                    \
+                            MASH_TYPE_OBJ_LOADER))
+#define MASH_OBJ_LOADER_GET_CLASS(obj)                \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj),                  \
+                              MASH_TYPE_OBJ_LOADER,   \
+                              MashObjLoaderClass))
+
+typedef struct _MashObjLoader        MashObjLoader;
+typedef struct _MashObjLoaderClass   MashObjLoaderClass;
+typedef struct _MashObjLoaderPrivate MashObjLoaderPrivate;
+
+struct _MashObjLoaderClass
+{
+  /*< private >*/
+  MashDataLoaderClass parent_class;
+};
+
+struct _MashObjLoader
+{
+  /*< private >*/
+  GObject parent;
+
+  MashObjLoaderPrivate *priv;
+};
+
+GType mash_obj_loader_get_type (void) G_GNUC_CONST;
+
+G_END_DECLS
+
+#endif /* __MASH_OBJ_LOADER_H__ */
@@ -0,0 +1,129 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Spreads a pass over the items of an array on all the cores. The
+ * items are cut in chunks which the threads take in turn from an
+ * atomic counter, so a thread that got quick chunks just takes more
+ * of them. The calling thread is one of the workers.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+
+#include "mash-parallel.h"
+
+typedef struct
+{
+  MashParallelFunc func;
+  gpointer user_data;
+  guint n_items;
+  guint chunk_size;
+  guint n_chunks;
+  volatile gint next_chunk;
+} MashParallelPass;
+
+/**
+ * mash_parallel_get_n_threads:
+ *
+ * Return value: the number of threads a pass is spread over, which is
+ *   the number of cores up to %MASH_PARALLEL_MAX_THREADS.
+ */
+guint
+mash_parallel_get_n_threads (void)
+{
+  long n_threads = 1;
+
+#if defined(G_OS_UNIX) && defined(_SC_NPROCESSORS_ONLN)
+  n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+
+  return CLAMP (n_threads, 1, MASH_PARALLEL_MAX_THREADS);
+}
+
+static gpointer
+mash_parallel_worker (gpointer data)
+{
+  MashParallelPass *pass = data;
+  guint chunk;
+
+  while ((chunk = g_atomic_int_add (&pass->next_chunk, 1)) < pass->n_chunks)
+    {
+      guint begin = chunk * pass->chunk_size;
+
+      pass->func (pass->user_data, begin,
+                  MIN (begin + pass->chunk_size, pass->n_items));
+    }
+
+  return NULL;
+}
+
+/**
+ * mash_parallel_run:
+ * @n_items: Number of items to process
+ * @chunk_size: Number of items given to @func at a time
+ * @func: Function processing a range of items
+ * @user_data: Data passed to @func
+ *
+ * Calls @func over [0, @n_items) in chunks of @chunk_size items spread
+ * over mash_parallel_get_n_threads() threads, and returns once all the
+ * items are processed. The chunks must not write to the same data.
+ * When there is a single thread @func is called once for all the items.
+ */
+void
+mash_parallel_run (guint n_items,
+                   guint chunk_size,
+                   MashParallelFunc func,
+                   gpointer user_data)
+{
+  GThread *threads[MASH_PARALLEL_MAX_THREADS];
+  MashParallelPass pass;
+  guint n_threads, i;
+
+  g_return_if_fail (chunk_size > 0);
+
+  pass.func = func;
+  pass.user_data = user_data;
+  pass.n_items = n_items;
+  pass.chunk_size = chunk_size;
+  pass.n_chunks = (n_items + chunk_size - 1) / chunk_size;
+  pass.next_chunk = 0;
+
+  n_threads = MIN (mash_parallel_get_n_threads (), pass.n_chunks);
+
+  if (n_threads <= 1)
+    {
+      if (n_items > 0)
+        func (user_data, 0, n_items);
+      return;
+    }
+
+  for (i = 0; i + 1 < n_threads; i++)
+    threads[i] = g_thread_new ("mash", mash_parallel_worker, &pass);
+
+  mash_parallel_worker (&pass);
+
+  for (i = 0; i + 1 < n_threads; i++)
+    g_thread_join (threads[i]);
+}
@@ -0,0 +1,51 @@
+/*
+ * Mash - A library for displaying PLY models in a Clutter scene
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MASH_PARALLEL_H__
+#define __MASH_PARALLEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Most threads a pass is spread over, including the calling thread */
+#define MASH_PARALLEL_MAX_THREADS 64
+
+/**
+ * MashParallelFunc:
+ * @user_data: The data given to mash_parallel_run()
+ * @begin: Index of the first item to process
+ * @end: Index after the last item to process
+ *
+ * Processes the items [@begin, @end) of a pass. It may be called
+ * from several threads at once on different ranges.
+ */
+typedef void (* MashParallelFunc) (gpointer user_data,
+                                   guint    begin,
+                                   guint    end);
+
+guint mash_parallel_get_n_threads (void);
+
+void  mash_parallel_run           (guint            n_items,
+                                   guint            chunk_size,
+                                   MashParallelFunc func,
+                                   gpointer         user_data);
+
+G_END_DECLS
+
+#endif /* __MASH_PARALLEL_H__ */
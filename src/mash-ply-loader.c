@@ -22,14 +22,17 @@
 #endif
 
 #include <glib-object.h>
+#include <glib/gstdio.h>
 #include <string.h>
+#include <math.h>
 #include <cogl/cogl.h>
 
 #include "mash-ply-loader.h"
+#include "mash-mesh-optimizer.h"
+#include "mash-mesh-cache.h"
+#include "mash-mesh-stream.h"
 #include "rply/rply.h"
 
-#include "es-main.h"
-
 static void mash_ply_loader_finalize (GObject *object);
 static gboolean mash_ply_loader_load (MashDataLoader *data_loader,
                                       MashDataFlags flags,
@@ -37,6 +40,8 @@ static gboolean mash_ply_loader_load (MashDataLoader *data_loader,
                                       GError **error);
 static void mash_ply_loader_get_data (MashDataLoader *data_loader,
                                       MashDataLoaderData *loader_data);
+static const MashMeshCacheData *
+mash_ply_loader_get_mesh (MashDataLoader *data_loader);
 
 G_DEFINE_TYPE (MashPlyLoader, mash_ply_loader, MASH_TYPE_DATA_LOADER);
 
@@ -71,35 +76,88 @@ mash_ply_loader_properties[] =
 #define MASH_PLY_LOADER_TEX_COORD_PROPS (3 << 6)
 #define MASH_PLY_LOADER_COLOR_PROPS     (7 << 8)
 
+/* Grid size used to snap the float properties when welding vertices
+   with MASH_DATA_WELD_EPSILON */
+#define MASH_PLY_LOADER_WELD_EPSILON    1e-5f
+
+/* Angle between two faces above which MASH_DATA_CREASE_NORMALS gives
+   them separate normals */
+#define MASH_PLY_LOADER_CREASE_ANGLE    (G_PI / 3.0)
+
+/* Number of indices gathered before they are handed to the stream with
+   MASH_DATA_STREAM */
+#define MASH_PLY_LOADER_STREAM_INDICES  (3 * 4096)
+
+/* GByteArray and GArray can't grow past this size, bigger models have
+   to be streamed */
+#define MASH_PLY_LOADER_MAX_ARRAY_SIZE  G_MAXINT
+
 typedef struct _MashPlyLoaderData MashPlyLoaderData;
 
 struct _MashPlyLoaderData
 {
   p_ply ply;
   GError *error;
-  /* Data for the current vertex */
-  guint8 current_vertex[G_N_ELEMENTS (mash_ply_loader_properties) * 4];
-  /* Map from property number to byte offset in the current_vertex array */
+  /* Map from property number to byte offset in a vertex */
   gint prop_map[G_N_ELEMENTS (mash_ply_loader_properties)];
   /* Number of bytes for a vertex */
   guint n_vertex_bytes;
   gint available_props, got_props;
   guint first_vertex, last_vertex;
+  /* Layout of a vertex record when the vertex element is decoded in
+     blocks instead of property by property */
+  gboolean read_blocks;
+  /* ASCII numbers are parsed with strtod, to compare with the default */
+  gboolean read_strtod;
+  guint record_size;
+  gint record_offsets[G_N_ELEMENTS (mash_ply_loader_properties)];
+  e_ply_type record_types[G_N_ELEMENTS (mash_ply_loader_properties)];
+  /* Set when the properties appear in the records with the same types
+     and in the same order as in a vertex so they can just be copied */
+  gboolean copy_records;
+  guint copy_offset, copy_size;
   GByteArray *vertices;
+  /* 32 bits indices, packed down to indices_type once fully processed */
   GArray *faces;
+  /* MashMeshSubmeshes, empty unless the mesh had to be split */
+  GArray *submeshes;
   CoglIndicesType indices_type;
   MashDataFlags flags;
 
+  /* Layout of the vertices once they are ready to be uploaded */
+  MashMeshCacheAttribute attributes[MASH_MESH_CACHE_MAX_ATTRIBUTES];
+  gint n_attributes;
+  MashDataQuantization quantization;
+
   /* Bounding cuboid of the data */
   CoglVertexP3 min_vertex, max_vertex;
+
+  /* Set when the file had no normals and they were computed */
+  gboolean generated_normals;
+
+  /* With MASH_DATA_STREAM the vertices and the faces only go through
+     the arrays on their way to the stream */
+  MashMeshStream *stream;
+  gint64 n_file_vertices;
 };
 
 struct _MashPlyLoaderPrivate
 {
-  CoglPrimitive *primitive;
+  /* One primitive per submesh */
+  GPtrArray *primitives;
 
-  /* Bounding cuboid of the data */
-  CoglVertexP3 min_vertex, max_vertex;
+  /* Processed data waiting to be uploaded by get_data(). The loading
+     can happen in a thread so it must not use Cogl */
+  GByteArray *vertices;
+  GArray *faces;
+  GArray *submeshes;
+  MashMeshCacheData mesh;
+
+  /* Data already uploaded with MASH_DATA_STREAM */
+  MashMeshStream *stream;
+
+  /* Size of the uploaded data */
+  gsize mesh_size;
 };
 
 static void
@@ -112,6 +170,7 @@ mash_ply_loader_class_init (MashPlyLoaderClass *klass)
 
   data_loader_class->load = mash_ply_loader_load;
   data_loader_class->get_data = mash_ply_loader_get_data;
+  data_loader_class->get_mesh = mash_ply_loader_get_mesh;
 
   g_type_class_add_private (klass, sizeof (MashPlyLoaderPrivate));
 }
@@ -122,16 +181,48 @@ mash_ply_loader_init (MashPlyLoader *self)
   self->priv = MASH_PLY_LOADER_GET_PRIVATE (self);
 }
 
+static void
+mash_ply_loader_free_data (MashPlyLoader *self)
+{
+  MashPlyLoaderPrivate *priv = self->priv;
+
+  if (priv->vertices)
+    {
+      g_byte_array_free (priv->vertices, TRUE);
+      priv->vertices = NULL;
+    }
+
+  if (priv->faces)
+    {
+      g_array_free (priv->faces, TRUE);
+      priv->faces = NULL;
+    }
+
+  if (priv->submeshes)
+    {
+      g_array_free (priv->submeshes, TRUE);
+      priv->submeshes = NULL;
+    }
+
+  if (priv->stream)
+    {
+      mash_mesh_stream_free (priv->stream);
+      priv->stream = NULL;
+    }
+}
+
 static void
 mash_ply_loader_free_primitive (MashPlyLoader *self)
 {
   MashPlyLoaderPrivate *priv = self->priv;
 
-  if (priv->primitive)
+  if (priv->primitives)
     {
-      cogl_object_unref (priv->primitive);
-      priv->primitive = NULL;
+      g_ptr_array_unref (priv->primitives);
+      priv->primitives = NULL;
     }
+
+  mash_ply_loader_free_data (self);
 }
 
 static void
@@ -164,14 +255,54 @@ mash_ply_loader_check_unknown_error (MashPlyLoaderData *data)
                          "Unknown error loading PLY file");
 }
 
+static void
+mash_ply_loader_process_vertex (MashPlyLoaderData *data,
+                                guint8 *vertex)
+{
+  int i;
+
+  /* Flip any axes that have been specified in the MashPlyLoaderFlags */
+  if ((data->available_props & MASH_PLY_LOADER_VERTEX_PROPS)
+      == MASH_PLY_LOADER_VERTEX_PROPS)
+    for (i = 0; i < 3; i++)
+      if ((data->flags & (MASH_DATA_NEGATE_X << i)))
+        {
+          gfloat *pos = (gfloat *) (vertex + data->prop_map[i]);
+          *pos = -*pos;
+        }
+  if ((data->available_props & MASH_PLY_LOADER_NORMAL_PROPS)
+      == MASH_PLY_LOADER_NORMAL_PROPS)
+    for (i = 0; i < 3; i++)
+      if ((data->flags & (MASH_DATA_NEGATE_X << i)))
+        {
+          gfloat *pos = (gfloat *) (vertex + data->prop_map[i + 3]);
+          *pos = -*pos;
+        }
+
+  /* Update the bounding box for the data */
+  for (i = 0; i < 3; i++)
+    {
+      gfloat *min = &data->min_vertex.x + i;
+      gfloat *max = &data->max_vertex.x + i;
+      gfloat value = *(gfloat *) (vertex + data->prop_map[i]);
+
+      if (value < *min)
+        *min = value;
+      if (value > *max)
+        *max = value;
+    }
+}
+
 static int
 mash_ply_loader_vertex_read_cb (p_ply_argument argument)
 {
   long prop_num;
   MashPlyLoaderData *data;
-  gint32 length, index;
+  gint64 length, index;
   double value;
 
+  guint8 *vertex;
+
   ply_get_argument_user_data (argument, (void **) &data, &prop_num);
   ply_get_argument_property (argument, NULL, &length, &index);
 
@@ -185,151 +316,864 @@ mash_ply_loader_vertex_read_cb (p_ply_argument argument)
       return 0;
     }
 
+  /* The vertex is decoded in place at the end of the array, which was
+     sized from the header so this doesn't reallocate */
+  if (data->got_props == 0)
+    {
+      guint old_len = data->vertices->len;
+
+      g_byte_array_set_size (data->vertices, old_len + data->n_vertex_bytes);
+      /* Welding compares whole vertices, including the alignment
+         padding */
+      memset (data->vertices->data + old_len, 0, data->n_vertex_bytes);
+    }
+
+  vertex = data->vertices->data + data->vertices->len - data->n_vertex_bytes;
   value = ply_get_argument_value (argument);
 
   /* Colors are specified as a byte so we need to treat them specially */
   if (((1 << prop_num) & MASH_PLY_LOADER_COLOR_PROPS))
-    data->current_vertex[data->prop_map[prop_num]] = value;
+    vertex[data->prop_map[prop_num]] = value;
   else
-    *(gfloat *) (data->current_vertex + data->prop_map[prop_num]) = value;
+    *(gfloat *) (vertex + data->prop_map[prop_num]) = value;
 
   data->got_props |= 1 << prop_num;
 
-  /* If we've got enough properties for a complete vertex then add it
-     to the array */
+  /* Once all the properties are there the vertex is complete */
   if (data->got_props == data->available_props)
     {
-      int i;
+      mash_ply_loader_process_vertex (data, vertex);
+      if (data->stream)
+        {
+          mash_mesh_stream_add_vertices (data->stream, vertex, 1);
+          g_byte_array_set_size (data->vertices, 0);
+        }
+      data->got_props = 0;
+    }
 
-      /* Flip any axes that have been specified in the MashPlyLoaderFlags */
-      if ((data->available_props & MASH_PLY_LOADER_VERTEX_PROPS)
-          == MASH_PLY_LOADER_VERTEX_PROPS)
-        for (i = 0; i < 3; i++)
-          if ((data->flags & (MASH_DATA_NEGATE_X << i)))
-            {
-              gfloat *pos = (gfloat *) (data->current_vertex
-                                        + data->prop_map[i]);
-              *pos = -*pos;
-            }
-      if ((data->available_props & MASH_PLY_LOADER_NORMAL_PROPS)
-          == MASH_PLY_LOADER_NORMAL_PROPS)
-        for (i = 0; i < 3; i++)
-          if ((data->flags & (MASH_DATA_NEGATE_X << i)))
-            {
-              gfloat *pos = (gfloat *) (data->current_vertex
-                                        + data->prop_map[i + 3]);
-              *pos = -*pos;
-            }
+  return 1;
+}
 
-      g_byte_array_append (data->vertices, data->current_vertex,
-                           data->n_vertex_bytes);
-      data->got_props = 0;
+static double
+mash_ply_loader_read_value (const guint8 *p,
+                            e_ply_type type)
+{
+  /* The records are packed so the values are copied out to avoid
+     unaligned accesses */
+  switch (type)
+    {
+    case PLY_INT8:
+    case PLY_CHAR:
+      return *(const gint8 *) p;
+    case PLY_UINT8:
+    case PLY_UCHAR:
+      return *p;
+    case PLY_INT16:
+    case PLY_SHORT:
+      {
+        gint16 v;
+        memcpy (&v, p, sizeof (v));
+        return v;
+      }
+    case PLY_UINT16:
+    case PLY_USHORT:
+      {
+        guint16 v;
+        memcpy (&v, p, sizeof (v));
+        return v;
+      }
+    case PLY_INT32:
+    case PLY_INT:
+      {
+        gint32 v;
+        memcpy (&v, p, sizeof (v));
+        return v;
+      }
+    case PLY_UIN32:
+    case PLY_UINT:
+      {
+        guint32 v;
+        memcpy (&v, p, sizeof (v));
+        return v;
+      }
+    case PLY_FLOAT32:
+    case PLY_FLOAT:
+      {
+        gfloat v;
+        memcpy (&v, p, sizeof (v));
+        return v;
+      }
+    case PLY_FLOAT64:
+    case PLY_DOUBLE:
+      {
+        double v;
+        memcpy (&v, p, sizeof (v));
+        return v;
+      }
+    case PLY_LIST:
+      break;
+    }
 
-      /* Update the bounding box for the data */
-      for (i = 0; i < 3; i++)
-        {
-          gfloat *min = &data->min_vertex.x + i;
-          gfloat *max = &data->max_vertex.x + i;
-          gfloat value = *(gfloat *) (data->current_vertex + data->prop_map[i]);
-
-          if (value < *min)
-            *min = value;
-          if (value > *max)
-            *max = value;
-        }
+  g_assert_not_reached ();
+
+  return 0.0;
+}
+
+static int
+mash_ply_loader_vertex_block_cb (p_ply_element element,
+                                 const void *records,
+                                 gint64 first_instance,
+                                 gint64 n_records,
+                                 void *user_data)
+{
+  MashPlyLoaderData *data = user_data;
+  const guint8 *src = records;
+  guint8 *dst;
+  guint old_len;
+  gint64 i;
+  int prop_num;
+
+  /* A stream only needs the current block */
+  if (data->stream)
+    g_byte_array_set_size (data->vertices, 0);
+
+  old_len = data->vertices->len;
+  g_byte_array_set_size (data->vertices,
+                         old_len + (gsize) n_records * data->n_vertex_bytes);
+  dst = data->vertices->data + old_len;
+
+  if (data->copy_records &&
+      data->copy_offset == 0 &&
+      data->copy_size == data->record_size &&
+      data->record_size == data->n_vertex_bytes)
+    /* The records are already laid out as vertices */
+    memcpy (dst, src, n_records * data->n_vertex_bytes);
+  else
+    {
+      /* Welding compares whole vertices, including the padding */
+      memset (dst, 0, n_records * data->n_vertex_bytes);
+
+      if (data->copy_records)
+        for (i = 0; i < n_records; i++)
+          memcpy (dst + i * data->n_vertex_bytes,
+                  src + i * data->record_size + data->copy_offset,
+                  data->copy_size);
+      else
+        for (i = 0; i < n_records; i++)
+          {
+            const guint8 *record = src + i * data->record_size;
+            guint8 *vertex = dst + i * data->n_vertex_bytes;
+
+            for (prop_num = 0;
+                 prop_num < G_N_ELEMENTS (mash_ply_loader_properties);
+                 prop_num++)
+              {
+                double value;
+
+                if (!(data->available_props & (1 << prop_num)))
+                  continue;
+
+                value =
+                  mash_ply_loader_read_value (record +
+                                              data->record_offsets[prop_num],
+                                              data->record_types[prop_num]);
+
+                if (((1 << prop_num) & MASH_PLY_LOADER_COLOR_PROPS))
+                  vertex[data->prop_map[prop_num]] = value;
+                else
+                  *(gfloat *) (vertex + data->prop_map[prop_num]) = value;
+              }
+          }
     }
 
+  for (i = 0; i < n_records; i++)
+    mash_ply_loader_process_vertex (data, dst + i * data->n_vertex_bytes);
+
+  if (data->stream)
+    mash_mesh_stream_add_vertices (data->stream, dst, n_records);
+
   return 1;
 }
 
+static void
+mash_ply_loader_setup_blocks (MashPlyLoaderData *data)
+{
+  p_ply_element element = NULL;
+  p_ply_property property = NULL;
+  const char *name;
+  guint offset = 0;
+  int prop_num;
+
+  while ((element = ply_get_next_element (data->ply, element)))
+    {
+      ply_get_element_info (element, &name, NULL);
+      if (!strcmp (name, "vertex"))
+        break;
+    }
+
+  if (element == NULL ||
+      g_getenv ("MASH_PLY_LOADER_DISABLE_BLOCKS") ||
+      !(data->record_size = ply_set_read_block_cb (data->ply, "vertex",
+                                                   mash_ply_loader_vertex_block_cb,
+                                                   data)))
+    return;
+
+  data->read_blocks = TRUE;
+
+  /* Find where our properties are in a record */
+  while ((property = ply_get_next_property (element, property)))
+    {
+      e_ply_type type;
+
+      ply_get_property_info (property, &name, &type, NULL, NULL);
+
+      for (prop_num = 0;
+           prop_num < G_N_ELEMENTS (mash_ply_loader_properties);
+           prop_num++)
+        if (!strcmp (name, mash_ply_loader_properties[prop_num].name))
+          {
+            data->record_offsets[prop_num] = offset;
+            data->record_types[prop_num] = type;
+          }
+
+      offset += ply_get_type_size (type);
+    }
+
+  /* Check whether the vertices can be copied straight out of the
+     records. This covers the usual float32 layouts such as x y z,
+     x y z nx ny nz or x y z nx ny nz s t optionally followed by uchar
+     colors */
+  data->copy_records = TRUE;
+  data->copy_offset = data->record_offsets[0];
+  data->copy_size = 0;
+
+  for (prop_num = 0;
+       prop_num < G_N_ELEMENTS (mash_ply_loader_properties);
+       prop_num++)
+    {
+      e_ply_type type = data->record_types[prop_num];
+      gboolean same_type;
+
+      if (!(data->available_props & (1 << prop_num)))
+        continue;
+
+      if (((1 << prop_num) & MASH_PLY_LOADER_COLOR_PROPS))
+        same_type = type == PLY_UINT8 || type == PLY_UCHAR;
+      else
+        same_type = type == PLY_FLOAT32 || type == PLY_FLOAT;
+
+      if (!same_type ||
+          data->record_offsets[prop_num] - data->copy_offset !=
+          data->prop_map[prop_num])
+        {
+          data->copy_records = FALSE;
+          break;
+        }
+
+      data->copy_size = MAX (data->copy_size,
+                             data->prop_map[prop_num] +
+                             mash_ply_loader_properties[prop_num].size);
+    }
+}
+
 static void
 mash_ply_loader_add_face_index (MashPlyLoaderData *data,
                                 guint index)
 {
+  guint32 value = index;
+
+  g_array_append_val (data->faces, value);
+}
+
+static void
+mash_ply_loader_pack_indices (MashPlyLoaderData *data)
+{
+  guint32 *indices = (guint32 *) data->faces->data;
+  guint i;
+
+  /* The destination type is never bigger than the 32 bits source so the
+     conversion can be done in place, front to back */
   switch (data->indices_type)
     {
     case COGL_INDICES_TYPE_UNSIGNED_BYTE:
       {
-        guint8 value = index;
-        g_array_append_val (data->faces, value);
+        guint8 *packed = (guint8 *) indices;
+
+        for (i = 0; i < data->faces->len; i++)
+          packed[i] = indices[i];
       }
       break;
     case COGL_INDICES_TYPE_UNSIGNED_SHORT:
       {
-        guint16 value = index;
-        g_array_append_val (data->faces, value);
+        guint16 *packed = (guint16 *) indices;
+
+        for (i = 0; i < data->faces->len; i++)
+          packed[i] = indices[i];
       }
       break;
     case COGL_INDICES_TYPE_UNSIGNED_INT:
-      {
-        guint32 value = index;
-        g_array_append_val (data->faces, value);
-      }
       break;
     }
 }
 
 static gboolean
-mash_ply_loader_get_indices_type (MashPlyLoaderData *data,
-                                  GError **error)
+mash_ply_loader_check_indices (MashPlyLoaderData *data,
+                               guint64 n_vertices,
+                               GError **error)
+{
+  guint32 *indices = (guint32 *) data->faces->data;
+  guint i;
+
+  for (i = 0; i < data->faces->len; i++)
+    if (indices[i] >= n_vertices)
+      {
+        g_set_error (error, MASH_DATA_ERROR,
+                     MASH_DATA_ERROR_INVALID,
+                     "Face references vertex %u but there are only "
+                     "%" G_GUINT64_FORMAT " vertices",
+                     indices[i], n_vertices);
+        return FALSE;
+      }
+
+  return TRUE;
+}
+
+static guint
+mash_ply_loader_weld (MashPlyLoaderData *data,
+                      guint n_vertices,
+                      const gchar *display_name)
+{
+  guint n_floats = 0, n_welded, i;
+  gfloat epsilon = 0.f;
+
+  /* The float properties are laid out first in a vertex */
+  for (i = 0; i < G_N_ELEMENTS (mash_ply_loader_properties); i++)
+    if ((data->available_props & (1 << i)) &&
+        mash_ply_loader_properties[i].size == sizeof (gfloat))
+      n_floats++;
+
+  if ((data->flags & MASH_DATA_WELD_EPSILON))
+    epsilon = MASH_PLY_LOADER_WELD_EPSILON;
+
+  n_welded = mash_mesh_optimizer_weld_vertices ((guint32 *) data->faces->data,
+                                                data->faces->len,
+                                                data->vertices->data,
+                                                data->n_vertex_bytes,
+                                                n_vertices,
+                                                n_floats,
+                                                epsilon);
+  g_byte_array_set_size (data->vertices, n_welded * data->n_vertex_bytes);
+
+  if (mash_data_loader_get_debug ())
+    g_debug ("%s: welded %u vertices into %u", display_name,
+             n_vertices, n_welded);
+
+  return n_welded;
+}
+
+static guint
+mash_ply_loader_generate_normals (MashPlyLoaderData *data,
+                                  guint n_vertices,
+                                  const gchar *display_name)
+{
+  gint old_prop_map[G_N_ELEMENTS (mash_ply_loader_properties)];
+  guint old_n_vertex_bytes = data->n_vertex_bytes;
+  GByteArray *vertices;
+  guint n_generated, n_negated = 0, i, j;
+  gfloat crease_angle = -1.0f;
+
+  /* Make room for the normal in the vertices, where it would have been
+     if the file had it */
+  memcpy (old_prop_map, data->prop_map, sizeof (old_prop_map));
+  data->available_props |= MASH_PLY_LOADER_NORMAL_PROPS;
+  data->n_vertex_bytes = 0;
+  for (i = 0; i < G_N_ELEMENTS (mash_ply_loader_properties); i++)
+    if ((data->available_props & (1 << i)))
+      {
+        data->prop_map[i] = data->n_vertex_bytes;
+        data->n_vertex_bytes += mash_ply_loader_properties[i].size;
+      }
+  data->n_vertex_bytes = (data->n_vertex_bytes + 3) & ~(guint) 3;
+
+  vertices = g_byte_array_sized_new (n_vertices * data->n_vertex_bytes);
+  g_byte_array_set_size (vertices, n_vertices * data->n_vertex_bytes);
+  memset (vertices->data, 0, vertices->len);
+
+  for (i = 0; i < n_vertices; i++)
+    {
+      const guint8 *src = data->vertices->data + i * old_n_vertex_bytes;
+      guint8 *dst = vertices->data + i * data->n_vertex_bytes;
+
+      for (j = 0; j < G_N_ELEMENTS (mash_ply_loader_properties); j++)
+        if (((1 << j) & MASH_PLY_LOADER_NORMAL_PROPS) == 0 &&
+            (data->available_props & (1 << j)))
+          memcpy (dst + data->prop_map[j], src + old_prop_map[j],
+                  mash_ply_loader_properties[j].size);
+    }
+
+  g_byte_array_free (data->vertices, TRUE);
+  data->vertices = vertices;
+
+  if ((data->flags & MASH_DATA_CREASE_NORMALS))
+    crease_angle = MASH_PLY_LOADER_CREASE_ANGLE;
+
+  n_generated =
+    mash_mesh_optimizer_generate_normals ((guint32 *) data->faces->data,
+                                          data->faces->len,
+                                          data->vertices,
+                                          data->n_vertex_bytes,
+                                          data->prop_map[0],
+                                          data->prop_map[3],
+                                          n_vertices,
+                                          (data->flags &
+                                           MASH_DATA_AREA_WEIGHTED_NORMALS) ?
+                                          MASH_NORMAL_WEIGHTING_AREA :
+                                          MASH_NORMAL_WEIGHTING_ANGLE,
+                                          crease_angle);
+
+  /* Mirroring the model along an odd number of axes turns the faces
+     inside out, flip the normals back */
+  for (i = 0; i < 3; i++)
+    if ((data->flags & (MASH_DATA_NEGATE_X << i)))
+      n_negated++;
+  if ((n_negated & 1))
+    for (i = 0; i < n_generated; i++)
+      {
+        gfloat *normal = (gfloat *) (data->vertices->data +
+                                     i * data->n_vertex_bytes +
+                                     data->prop_map[3]);
+
+        for (j = 0; j < 3; j++)
+          normal[j] = -normal[j];
+      }
+
+  data->generated_normals = TRUE;
+
+  if (mash_data_loader_get_debug ())
+    g_debug ("%s: generated normals, %u vertices split at creases",
+             display_name, n_generated - n_vertices);
+
+  return n_generated;
+}
+
+static guint
+mash_ply_loader_split (MashPlyLoaderData *data,
+                       guint n_vertices,
+                       const gchar *display_name)
+{
+  guint n_split;
+
+  n_split = mash_mesh_optimizer_split ((guint32 *) data->faces->data,
+                                       data->faces->len,
+                                       data->vertices,
+                                       data->n_vertex_bytes,
+                                       data->prop_map[0],
+                                       n_vertices,
+                                       MASH_MESH_OPTIMIZER_MAX_SUBMESH_VERTICES,
+                                       data->submeshes);
+
+  if (mash_data_loader_get_debug ())
+    g_debug ("%s: split %u vertices into %u submeshes of %u vertices",
+             display_name, n_vertices, data->submeshes->len, n_split);
+
+  return n_split;
+}
+
+static guint
+mash_ply_loader_optimize_range (MashPlyLoaderData *data,
+                                guint32 *indices,
+                                guint n_indices,
+                                guint8 *vertices,
+                                guint n_vertices,
+                                MashVertexCacheStats *before,
+                                MashVertexCacheStats *after)
+{
+  /* The statistics are only computed to be reported */
+  gboolean debug = mash_data_loader_get_debug ();
+
+  memset (before, 0, sizeof (*before));
+  memset (after, 0, sizeof (*after));
+
+  if (debug)
+    mash_mesh_optimizer_analyze_vertex_cache (indices, n_indices, n_vertices,
+                                              MASH_MESH_OPTIMIZER_CACHE_SIZE,
+                                              before);
+
+  mash_mesh_optimizer_optimize_vertex_cache (indices, n_indices, n_vertices);
+  mash_mesh_optimizer_optimize_overdraw (indices, n_indices,
+                                         vertices,
+                                         data->n_vertex_bytes,
+                                         data->prop_map[0],
+                                         n_vertices,
+                                         1.05f);
+  n_vertices =
+    mash_mesh_optimizer_optimize_vertex_fetch (indices, n_indices,
+                                               vertices,
+                                               data->n_vertex_bytes,
+                                               n_vertices);
+
+  if (debug)
+    mash_mesh_optimizer_analyze_vertex_cache (indices, n_indices, n_vertices,
+                                              MASH_MESH_OPTIMIZER_CACHE_SIZE,
+                                              after);
+
+  return n_vertices;
+}
+
+static void
+mash_ply_loader_add_stats (MashVertexCacheStats *total,
+                           const MashVertexCacheStats *stats)
+{
+  total->n_triangles += stats->n_triangles;
+  total->n_vertices += stats->n_vertices;
+  total->n_transformed += stats->n_transformed;
+  total->acmr = (total->n_triangles ?
+                 (gfloat) total->n_transformed / total->n_triangles : 0.0f);
+  total->atvr = (total->n_vertices ?
+                 (gfloat) total->n_transformed / total->n_vertices : 0.0f);
+}
+
+static guint
+mash_ply_loader_optimize (MashPlyLoaderData *data,
+                          guint n_vertices,
+                          const gchar *display_name)
 {
-  CoglContext *context;
-  p_ply_element elem = NULL;
+  guint32 *indices = (guint32 *) data->faces->data;
+  MashVertexCacheStats before, after;
+  guint i;
 
-  context = es_get_cogl_context ();
+  if (data->submeshes->len == 0)
+    {
+      n_vertices =
+        mash_ply_loader_optimize_range (data, indices, data->faces->len,
+                                        data->vertices->data, n_vertices,
+                                        &before, &after);
+      g_byte_array_set_size (data->vertices,
+                             n_vertices * data->n_vertex_bytes);
+    }
+  else
+    {
+      memset (&before, 0, sizeof (before));
+      memset (&after, 0, sizeof (after));
+
+      /* Each submesh only uses its own vertices, all of them, so they
+         are optimized separately */
+      for (i = 0; i < data->submeshes->len; i++)
+        {
+          const MashMeshSubmesh *submesh =
+            &g_array_index (data->submeshes, MashMeshSubmesh, i);
+          MashVertexCacheStats submesh_before, submesh_after;
+
+          mash_ply_loader_optimize_range (data,
+                                          indices + submesh->first_index,
+                                          submesh->n_indices,
+                                          data->vertices->data +
+                                          submesh->first_vertex *
+                                          data->n_vertex_bytes,
+                                          submesh->n_vertices,
+                                          &submesh_before,
+                                          &submesh_after);
+          mash_ply_loader_add_stats (&before, &submesh_before);
+          mash_ply_loader_add_stats (&after, &submesh_after);
+        }
+    }
+
+  if (mash_data_loader_get_debug ())
+    g_debug ("%s: %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+             display_name, after.n_triangles,
+             before.acmr, after.acmr,
+             before.atvr, after.atvr);
+
+  return n_vertices;
+}
+
+static void
+mash_ply_loader_add_attribute (MashPlyLoaderData *data,
+                               const gchar *name,
+                               guint offset,
+                               gint n_components,
+                               CoglAttributeType type,
+                               gboolean normalized)
+{
+  MashMeshCacheAttribute *attribute = data->attributes + data->n_attributes++;
+
+  g_strlcpy (attribute->name, name, sizeof (attribute->name));
+  attribute->offset = offset;
+  attribute->n_components = n_components;
+  attribute->type = type;
+  attribute->normalized = normalized;
+}
+
+static void
+mash_ply_loader_describe_attributes (MashPlyLoaderData *data)
+{
+  data->n_attributes = 0;
+
+  if ((data->available_props & MASH_PLY_LOADER_VERTEX_PROPS) ==
+      MASH_PLY_LOADER_VERTEX_PROPS)
+    mash_ply_loader_add_attribute (data, "cogl_position_in",
+                                   data->prop_map[0], 3,
+                                   COGL_ATTRIBUTE_TYPE_FLOAT, FALSE);
+
+  if ((data->available_props & MASH_PLY_LOADER_NORMAL_PROPS) ==
+      MASH_PLY_LOADER_NORMAL_PROPS)
+    mash_ply_loader_add_attribute (data, "cogl_normal_in",
+                                   data->prop_map[3], 3,
+                                   COGL_ATTRIBUTE_TYPE_FLOAT, FALSE);
+
+  if ((data->available_props & MASH_PLY_LOADER_TEX_COORD_PROPS) ==
+      MASH_PLY_LOADER_TEX_COORD_PROPS)
+    mash_ply_loader_add_attribute (data, "cogl_tex_coord0_in",
+                                   data->prop_map[6], 2,
+                                   COGL_ATTRIBUTE_TYPE_FLOAT, FALSE);
+
+  /* The colors are stored as bytes in the PLY file */
+  if ((data->available_props & MASH_PLY_LOADER_COLOR_PROPS) ==
+      MASH_PLY_LOADER_COLOR_PROPS)
+    mash_ply_loader_add_attribute (data, "cogl_color_in",
+                                   data->prop_map[8], 3,
+                                   COGL_ATTRIBUTE_TYPE_UNSIGNED_BYTE, TRUE);
+}
+
+static guint16
+mash_ply_loader_quantize_unorm (gfloat value,
+                                gfloat scale,
+                                gfloat offset)
+{
+  gfloat normalized = scale > 0.0f ? (value - offset) / scale : 0.0f;
+
+  return CLAMP (normalized, 0.0f, 1.0f) * 65535.0f + 0.5f;
+}
 
-  /* Look for the 'vertices' element */
-  while ((elem = ply_get_next_element (data->ply, elem)))
+static gint16
+mash_ply_loader_quantize_snorm (gfloat value)
+{
+  value = CLAMP (value, -1.0f, 1.0f) * 32767.0f;
+
+  return value >= 0.0f ? (gint) (value + 0.5f) : (gint) (value - 0.5f);
+}
+
+static void
+mash_ply_loader_encode_normal (const gfloat *normal,
+                               gint16 *encoded)
+{
+  gfloat x = normal[0], y = normal[1], z = normal[2];
+  gfloat l1 = fabsf (x) + fabsf (y) + fabsf (z);
+
+  /* Octahedral mapping: project the normal onto the octahedron
+     |x|+|y|+|z|=1 and fold the lower half over the upper half so that
+     it fits in two components */
+  if (l1 > 0.0f)
     {
-      const char *name;
-      gint32 n_instances;
+      x /= l1;
+      y /= l1;
+      z /= l1;
+    }
+  else
+    {
+      x = y = 0.0f;
+      z = 1.0f;
+    }
+
+  if (z < 0.0f)
+    {
+      gfloat ox = x;
 
-      if (ply_get_element_info (elem, &name, &n_instances))
+      x = (1.0f - fabsf (y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+      y = (1.0f - fabsf (ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+  encoded[0] = mash_ply_loader_quantize_snorm (x);
+  encoded[1] = mash_ply_loader_quantize_snorm (y);
+}
+
+static void
+mash_ply_loader_quantize (MashPlyLoaderData *data,
+                          guint n_vertices,
+                          const gchar *display_name)
+{
+  MashDataQuantization *quantization = &data->quantization;
+  gboolean has_normals, has_tex_coords, has_colors;
+  guint position_offset, normal_offset = 0;
+  guint tex_coord_offset = 0, color_offset = 0;
+  guint stride, i, j;
+  GByteArray *vertices;
+
+  has_normals = ((data->available_props & MASH_PLY_LOADER_NORMAL_PROPS) ==
+                 MASH_PLY_LOADER_NORMAL_PROPS);
+  has_tex_coords = ((data->available_props & MASH_PLY_LOADER_TEX_COORD_PROPS) ==
+                    MASH_PLY_LOADER_TEX_COORD_PROPS);
+  has_colors = ((data->available_props & MASH_PLY_LOADER_COLOR_PROPS) ==
+                MASH_PLY_LOADER_COLOR_PROPS);
+
+  /* The position is stored as 4 shorts to keep the next attribute
+     aligned to 32 bits, the last one is unused */
+  position_offset = 0;
+  stride = 4 * sizeof (guint16);
+  if (has_normals)
+    {
+      normal_offset = stride;
+      stride += 2 * sizeof (gint16);
+    }
+  if (has_tex_coords)
+    {
+      tex_coord_offset = stride;
+      stride += 2 * sizeof (guint16);
+    }
+  if (has_colors)
+    {
+      color_offset = stride;
+      stride += 4;
+    }
+
+  /* The positions are normalized to the bounding box */
+  quantization->attributes = MASH_DATA_QUANTIZED_POSITION;
+  for (i = 0; i < 3; i++)
+    {
+      quantization->position_offset[i] = (&data->min_vertex.x)[i];
+      quantization->position_scale[i] = ((&data->max_vertex.x)[i] -
+                                         (&data->min_vertex.x)[i]);
+    }
+
+  if (has_normals)
+    quantization->attributes |= MASH_DATA_QUANTIZED_NORMAL;
+
+  /* Texture coordinates can be outside of [0,1] for repeating textures
+     so they are normalized to their own range */
+  if (has_tex_coords)
+    {
+      gfloat min[2] = { G_MAXFLOAT, G_MAXFLOAT };
+      gfloat max[2] = { -G_MAXFLOAT, -G_MAXFLOAT };
+
+      for (i = 0; i < n_vertices; i++)
         {
-          if (!strcmp (name, "vertex"))
-            {
-              if (n_instances <= 0x100)
-                {
-                  data->indices_type = COGL_INDICES_TYPE_UNSIGNED_BYTE;
-                  data->faces = g_array_new (FALSE, FALSE, sizeof (guint8));
-                }
-              else if (n_instances <= 0x10000)
-                {
-                  data->indices_type = COGL_INDICES_TYPE_UNSIGNED_SHORT;
-                  data->faces = g_array_new (FALSE, FALSE, sizeof (guint16));
-                }
-              else if (cogl_has_feature (context,
-                                         COGL_FEATURE_ID_UNSIGNED_INT_INDICES))
-                {
-                  data->indices_type = COGL_INDICES_TYPE_UNSIGNED_INT;
-                  data->faces = g_array_new (FALSE, FALSE, sizeof (guint32));
-                }
-              else
-                {
-                  g_set_error (error, MASH_DATA_ERROR,
-                               MASH_DATA_ERROR_UNSUPPORTED,
-                               "The PLY file requires unsigned int indices "
-                               "but this is not supported by your GL driver");
-                  return FALSE;
-                }
+          const gfloat *tex_coord =
+            (const gfloat *) (data->vertices->data + i * data->n_vertex_bytes +
+                              data->prop_map[6]);
 
-              return TRUE;
+          for (j = 0; j < 2; j++)
+            {
+              min[j] = MIN (min[j], tex_coord[j]);
+              max[j] = MAX (max[j], tex_coord[j]);
             }
         }
-      else
+
+      quantization->attributes |= MASH_DATA_QUANTIZED_TEX_COORD;
+      for (j = 0; j < 2; j++)
+        {
+          quantization->tex_coord_offset[j] = min[j];
+          quantization->tex_coord_scale[j] = max[j] - min[j];
+        }
+    }
+
+  vertices = g_byte_array_sized_new (n_vertices * stride);
+  g_byte_array_set_size (vertices, n_vertices * stride);
+  memset (vertices->data, 0, vertices->len);
+
+  for (i = 0; i < n_vertices; i++)
+    {
+      const guint8 *src = data->vertices->data + i * data->n_vertex_bytes;
+      guint8 *dst = vertices->data + i * stride;
+      const gfloat *position = (const gfloat *) (src + data->prop_map[0]);
+      guint16 *quantized_position = (guint16 *) (dst + position_offset);
+
+      for (j = 0; j < 3; j++)
+        quantized_position[j] =
+          mash_ply_loader_quantize_unorm (position[j],
+                                          quantization->position_scale[j],
+                                          quantization->position_offset[j]);
+
+      if (has_normals)
+        mash_ply_loader_encode_normal ((const gfloat *)
+                                       (src + data->prop_map[3]),
+                                       (gint16 *) (dst + normal_offset));
+
+      if (has_tex_coords)
         {
-          g_set_error (error, MASH_DATA_ERROR,
-                       MASH_DATA_ERROR_UNKNOWN,
-                       "Error getting element info");
-          return FALSE;
+          const gfloat *tex_coord = (const gfloat *) (src + data->prop_map[6]);
+          guint16 *quantized_tex_coord = (guint16 *) (dst + tex_coord_offset);
+
+          for (j = 0; j < 2; j++)
+            quantized_tex_coord[j] =
+              mash_ply_loader_quantize_unorm (tex_coord[j],
+                                              quantization->tex_coord_scale[j],
+                                              quantization->tex_coord_offset[j]);
         }
+
+      if (has_colors)
+        for (j = 0; j < 3; j++)
+          dst[color_offset + j] = src[data->prop_map[8 + j]];
+    }
+
+  if (mash_data_loader_get_debug ())
+    g_debug ("%s: quantized %u vertices from %u to %u bytes",
+             display_name, n_vertices,
+             data->vertices->len, vertices->len);
+
+  g_byte_array_free (data->vertices, TRUE);
+  data->vertices = vertices;
+  data->n_vertex_bytes = stride;
+
+  data->n_attributes = 0;
+  mash_ply_loader_add_attribute (data, "cogl_position_in",
+                                 position_offset, 3,
+                                 COGL_ATTRIBUTE_TYPE_UNSIGNED_SHORT, TRUE);
+  if (has_normals)
+    mash_ply_loader_add_attribute (data, "cogl_normal_in",
+                                   normal_offset, 2,
+                                   COGL_ATTRIBUTE_TYPE_SHORT, TRUE);
+  if (has_tex_coords)
+    mash_ply_loader_add_attribute (data, "cogl_tex_coord0_in",
+                                   tex_coord_offset, 2,
+                                   COGL_ATTRIBUTE_TYPE_UNSIGNED_SHORT, TRUE);
+  if (has_colors)
+    mash_ply_loader_add_attribute (data, "cogl_color_in",
+                                   color_offset, 3,
+                                   COGL_ATTRIBUTE_TYPE_UNSIGNED_BYTE, TRUE);
+}
+
+static void
+mash_ply_loader_get_indices_type (MashPlyLoaderData *data,
+                                  guint n_vertices)
+{
+  guint i;
+
+  /* The indices of a split mesh are relative to their submesh */
+  if (data->submeshes->len > 0)
+    {
+      n_vertices = 0;
+      for (i = 0; i < data->submeshes->len; i++)
+        n_vertices = MAX (n_vertices,
+                          g_array_index (data->submeshes,
+                                         MashMeshSubmesh, i).n_vertices);
     }
 
-  g_set_error (error, MASH_DATA_ERROR,
-               MASH_DATA_ERROR_MISSING_PROPERTY,
-               "PLY file is missing the vertex element");
+  /* This is done once the vertices have been processed as welding can
+     bring the number of vertices down to a smaller index type. Meshes
+     with more vertices than 16 bits indices can address have been
+     split */
+  if (n_vertices <= 0x100)
+    data->indices_type = COGL_INDICES_TYPE_UNSIGNED_BYTE;
+  else if (n_vertices <= 0x10000)
+    data->indices_type = COGL_INDICES_TYPE_UNSIGNED_SHORT;
+  else
+    data->indices_type = COGL_INDICES_TYPE_UNSIGNED_INT;
+}
 
-  return FALSE;
+/* Hands the gathered indices over to the stream */
+static gboolean
+mash_ply_loader_flush_stream (MashPlyLoaderData *data)
+{
+  if (!mash_ply_loader_check_indices (data, data->n_file_vertices,
+                                      &data->error))
+    return FALSE;
+
+  mash_mesh_stream_add_indices (data->stream,
+                                (const guint32 *) data->faces->data,
+                                data->faces->len);
+  g_array_set_size (data->faces, 0);
+
+  return TRUE;
 }
 
 static int
@@ -337,7 +1181,7 @@ mash_ply_loader_face_read_cb (p_ply_argument argument)
 {
   long prop_num;
   MashPlyLoaderData *data;
-  gint32 length, index;
+  gint64 length, index;
 
   ply_get_argument_user_data (argument, (void **) &data, &prop_num);
   ply_get_argument_property (argument, NULL, &length, &index);
@@ -358,35 +1202,64 @@ mash_ply_loader_face_read_cb (p_ply_argument argument)
 
       /* Use the new vertex as one of the vertices next time around */
       data->last_vertex = new_vertex;
+
+      if (data->stream &&
+          data->faces->len >= MASH_PLY_LOADER_STREAM_INDICES &&
+          !mash_ply_loader_flush_stream (data))
+        return 0;
     }
 
   return 1;
 }
 
+static void
+mash_ply_loader_report_throughput (const gchar *filename,
+                                   const gchar *display_name,
+                                   MashPlyLoaderData *data,
+                                   gdouble elapsed)
+{
+  GStatBuf buf;
+
+  if (!mash_data_loader_get_debug () ||
+      g_stat (filename, &buf) == -1 || elapsed <= 0.0)
+    return;
+
+  g_debug ("%s: parsed %.2f MB in %.2f ms, %.1f MB/s (%s%s)",
+           display_name,
+           buf.st_size / 1e6,
+           elapsed * 1e3,
+           buf.st_size / 1e6 / elapsed,
+           !data->read_blocks ? "per property callbacks" :
+           data->copy_records ? "block copy" : "block decode",
+           data->read_strtod ? ", strtod" : "");
+}
+
 static gboolean
 mash_ply_loader_load (MashDataLoader *data_loader,
                       MashDataFlags flags,
                       const gchar *filename,
                       GError **error)
 {
-  CoglContext *context;
-  CoglIndices *indices;
   MashPlyLoader *self = MASH_PLY_LOADER (data_loader);
   MashPlyLoaderPrivate *priv;
   MashPlyLoaderData data;
   gchar *display_name;
+  guint n_vertices = 0;
+  gint64 n_faces = 0;
   gboolean ret;
 
   priv = self->priv;
 
-  context = es_get_cogl_context ();
-
   data.error = NULL;
+  data.read_blocks = FALSE;
+  data.read_strtod = FALSE;
+  data.copy_records = FALSE;
   data.n_vertex_bytes = 0;
   data.available_props = 0;
   data.got_props = 0;
   data.vertices = g_byte_array_new ();
-  data.faces = NULL;
+  data.faces = g_array_new (FALSE, FALSE, sizeof (guint32));
+  data.submeshes = g_array_new (FALSE, FALSE, sizeof (MashMeshSubmesh));
   data.min_vertex.x = G_MAXFLOAT;
   data.min_vertex.y = G_MAXFLOAT;
   data.min_vertex.z = G_MAXFLOAT;
@@ -394,6 +1267,11 @@ mash_ply_loader_load (MashDataLoader *data_loader,
   data.max_vertex.y = -G_MAXFLOAT;
   data.max_vertex.z = -G_MAXFLOAT;
   data.flags = flags;
+  data.n_attributes = 0;
+  data.generated_normals = FALSE;
+  data.stream = NULL;
+  data.n_file_vertices = 0;
+  memset (&data.quantization, 0, sizeof (data.quantization));
 
   display_name = g_filename_display_name (filename);
 
@@ -407,14 +1285,28 @@ mash_ply_loader_load (MashDataLoader *data_loader,
         mash_ply_loader_check_unknown_error (&data);
       else
         {
+          gint64 n_instances;
           int i;
 
+          /* Parse large ASCII files with all the cores */
+          ply_set_read_threads (data.ply, 0);
+
+          if (g_getenv ("MASH_PLY_LOADER_STRTOD"))
+            {
+              ply_set_read_strtod (data.ply, 1);
+              data.read_strtod = TRUE;
+            }
+
+          /* ply_set_read_cb() returns -1 when the property is missing,
+             otherwise the number of vertices */
           for (i = 0; i < G_N_ELEMENTS (mash_ply_loader_properties); i++)
-            if (ply_set_read_cb (data.ply, "vertex",
-                                 mash_ply_loader_properties[i].name,
-                                 mash_ply_loader_vertex_read_cb,
-                                 &data, i))
+            if ((n_instances =
+                 ply_set_read_cb (data.ply, "vertex",
+                                  mash_ply_loader_properties[i].name,
+                                  mash_ply_loader_vertex_read_cb,
+                                  &data, i)) >= 0)
               {
+                data.n_file_vertices = n_instances;
                 data.prop_map[i] = data.n_vertex_bytes;
                 data.n_vertex_bytes += mash_ply_loader_properties[i].size;
                 data.available_props |= 1 << i;
@@ -429,28 +1321,130 @@ mash_ply_loader_load (MashDataLoader *data_loader,
                          MASH_DATA_ERROR_MISSING_PROPERTY,
                          "PLY file %s is missing the vertex properties",
                          display_name);
-          else if (!ply_set_read_cb (data.ply, "face", "vertex_indices",
+          /* A face element with no instances is a valid empty mesh */
+          else if ((n_faces =
+                    ply_set_read_cb (data.ply, "face", "vertex_indices",
                                      mash_ply_loader_face_read_cb,
-                                     &data, i))
+                                     &data, i)) < 0)
             g_set_error (&data.error, MASH_DATA_ERROR,
                          MASH_DATA_ERROR_MISSING_PROPERTY,
                          "PLY file %s is missing face property "
                          "'vertex_indices'",
                          display_name);
-          else if (mash_ply_loader_get_indices_type (&data, &data.error)
-                   && !ply_read (data.ply))
-            mash_ply_loader_check_unknown_error (&data);
+          /* Faces are assumed to be mostly triangles */
+          else if (!(flags & MASH_DATA_STREAM) &&
+                   (data.n_file_vertices * data.n_vertex_bytes >
+                    MASH_PLY_LOADER_MAX_ARRAY_SIZE ||
+                    n_faces * 3 * sizeof (guint32) >
+                    MASH_PLY_LOADER_MAX_ARRAY_SIZE))
+            g_set_error (&data.error, MASH_DATA_ERROR,
+                         MASH_DATA_ERROR_UNSUPPORTED,
+                         "PLY file %s is too big to be loaded in memory, "
+                         "it can be streamed with MASH_DATA_STREAM",
+                         display_name);
+          else
+            {
+              GTimer *timer;
+              gboolean read_ok;
+
+              mash_ply_loader_setup_blocks (&data);
+
+              /* Decode straight into arrays sized from the counts in
+                 the header. The faces are assumed to be triangles */
+              if (!(flags & MASH_DATA_STREAM))
+                {
+                  g_byte_array_free (data.vertices, TRUE);
+                  data.vertices =
+                    g_byte_array_sized_new (data.n_file_vertices *
+                                            data.n_vertex_bytes);
+                  g_array_free (data.faces, TRUE);
+                  data.faces = g_array_sized_new (FALSE, FALSE,
+                                                  sizeof (guint32),
+                                                  n_faces * 3);
+                }
+
+              /* The layout of the vertices can't change once they are
+                 streamed so it is known before reading them */
+              if ((flags & MASH_DATA_STREAM))
+                {
+                  mash_ply_loader_describe_attributes (&data);
+                  data.stream =
+                    mash_mesh_stream_new (mash_data_loader_get_upload_context
+                                          (data_loader),
+                                          data.n_file_vertices,
+                                          data.n_vertex_bytes,
+                                          data.attributes,
+                                          data.n_attributes,
+                                          &data.error);
+                }
+
+              timer = g_timer_new ();
+              read_ok = data.error == NULL && ply_read (data.ply);
+              g_timer_stop (timer);
+
+              if (read_ok)
+                mash_ply_loader_report_throughput (filename, display_name,
+                                                   &data,
+                                                   g_timer_elapsed (timer,
+                                                                    NULL));
+              g_timer_destroy (timer);
+
+              if (!read_ok)
+                mash_ply_loader_check_unknown_error (&data);
+              else if (data.stream)
+                {
+                  if (mash_ply_loader_flush_stream (&data))
+                    mash_mesh_stream_finish (data.stream);
+                }
+              else
+                {
+                  n_vertices = data.vertices->len / data.n_vertex_bytes;
+                  mash_ply_loader_check_indices (&data, n_vertices,
+                                                 &data.error);
+                }
+            }
         }
 
       ply_close (data.ply);
     }
 
+  /* A streamed mesh is uploaded as it is read */
+  if (data.error == NULL && data.stream == NULL && data.faces->len >= 3)
+    {
+      if ((flags & (MASH_DATA_WELD | MASH_DATA_WELD_EPSILON)))
+        n_vertices = mash_ply_loader_weld (&data, n_vertices, display_name);
+
+      if ((flags & MASH_DATA_GENERATE_NORMALS) &&
+          (data.available_props & MASH_PLY_LOADER_NORMAL_PROPS) !=
+          MASH_PLY_LOADER_NORMAL_PROPS)
+        n_vertices = mash_ply_loader_generate_normals (&data, n_vertices,
+                                                       display_name);
+
+      /* Split the big meshes so that they can be drawn with 16 bits
+         indices, which halves the size of the indices and doesn't
+         need GL_OES_element_index_uint on GLES2 */
+      if (n_vertices > MASH_MESH_OPTIMIZER_MAX_SUBMESH_VERTICES)
+        n_vertices = mash_ply_loader_split (&data, n_vertices, display_name);
+
+      if ((flags & MASH_DATA_OPTIMIZE))
+        n_vertices = mash_ply_loader_optimize (&data, n_vertices, display_name);
+
+      mash_ply_loader_get_indices_type (&data, n_vertices);
+
+      if ((flags & MASH_DATA_QUANTIZE))
+        mash_ply_loader_quantize (&data, n_vertices, display_name);
+      else
+        mash_ply_loader_describe_attributes (&data);
+    }
+
   if (data.error)
     {
       g_propagate_error (error, data.error);
       ret = FALSE;
     }
-  else if (data.faces->len < 3)
+  else if (data.stream ?
+           mash_mesh_stream_get_n_indices (data.stream) < 3 :
+           data.faces->len < 3)
     {
       g_set_error (error, MASH_DATA_ERROR,
                    MASH_DATA_ERROR_INVALID,
@@ -458,95 +1452,77 @@ mash_ply_loader_load (MashDataLoader *data_loader,
                    display_name);
       ret = FALSE;
     }
-  else
+  else if (data.stream)
     {
-      CoglAttributeBuffer *attribute_buffer;
-      CoglAttribute *attributes[4];
-      int n_attributes = 0, i;
-
-      /* Get rid of the old primitive (if any) */
       mash_ply_loader_free_primitive (self);
 
-      /* Create a new attribute buffer for the vertices */
-      attribute_buffer = cogl_attribute_buffer_new (context,
-                                                    data.vertices->len,
-                                                    data.vertices->data);
+      /* Only the bounds are known, the data is already in the buffers
+         of the stream */
+      memset (&priv->mesh, 0, sizeof (priv->mesh));
+      priv->mesh.min_vertex = data.min_vertex;
+      priv->mesh.max_vertex = data.max_vertex;
 
-      /* And describe the attributes */
-      if ((data.available_props & MASH_PLY_LOADER_VERTEX_PROPS) ==
-          MASH_PLY_LOADER_VERTEX_PROPS)
-        {
-          attributes[n_attributes++] =
-            cogl_attribute_new (attribute_buffer,
-                                "cogl_position_in",
-                                data.n_vertex_bytes,
-                                data.prop_map[0],
-                                3,
-                                COGL_ATTRIBUTE_TYPE_FLOAT);
-        }
+      priv->stream = data.stream;
+      data.stream = NULL;
 
-      if ((data.available_props & MASH_PLY_LOADER_NORMAL_PROPS) ==
-          MASH_PLY_LOADER_NORMAL_PROPS)
-        {
-          attributes[n_attributes++] =
-            cogl_attribute_new (attribute_buffer,
-                                "cogl_normal_in",
-                                data.n_vertex_bytes,
-                                data.prop_map[3],
-                                3,
-                                COGL_ATTRIBUTE_TYPE_FLOAT);
-        }
+      ret = TRUE;
+    }
+  else
+    {
+      MashMeshCacheData *mesh = &priv->mesh;
 
-      if ((data.available_props & MASH_PLY_LOADER_TEX_COORD_PROPS) ==
-          MASH_PLY_LOADER_TEX_COORD_PROPS)
-        {
-          attributes[n_attributes++] =
-            cogl_attribute_new (attribute_buffer,
-                                "cogl_tex_coord0_in",
-                                data.n_vertex_bytes,
-                                data.prop_map[6],
-                                2,
-                                COGL_ATTRIBUTE_TYPE_FLOAT);
-        }
+      /* Get rid of the old primitive (if any) */
+      mash_ply_loader_free_primitive (self);
 
-      if ((data.available_props & MASH_PLY_LOADER_COLOR_PROPS) ==
-          MASH_PLY_LOADER_COLOR_PROPS)
+      mash_ply_loader_pack_indices (&data);
+
+      mesh->vertices = data.vertices->data;
+      mesh->n_vertices = n_vertices;
+      mesh->stride = data.n_vertex_bytes;
+      mesh->indices = (const guint8 *) data.faces->data;
+      mesh->indices_type = data.indices_type;
+      mesh->n_indices = data.faces->len;
+      mesh->submeshes = (const MashMeshSubmesh *) data.submeshes->data;
+      mesh->n_submeshes = data.submeshes->len;
+      memcpy (mesh->attributes, data.attributes, sizeof (mesh->attributes));
+      mesh->n_attributes = data.n_attributes;
+      mesh->min_vertex = data.min_vertex;
+      mesh->max_vertex = data.max_vertex;
+      mesh->quantization = data.quantization;
+      mesh->generated_normals = data.generated_normals;
+
+      if ((flags & MASH_DATA_CACHE))
         {
-          attributes[n_attributes++] =
-            cogl_attribute_new (attribute_buffer,
-                                "cogl_color_in",
-                                data.n_vertex_bytes,
-                                data.prop_map[8],
-                                3,
-                                COGL_ATTRIBUTE_TYPE_FLOAT);
+          GError *cache_error = NULL;
+
+          if (!mash_mesh_cache_save (filename, flags, mesh, &cache_error))
+            {
+              g_warning ("Could not cache %s: %s",
+                         display_name, cache_error->message);
+              g_clear_error (&cache_error);
+            }
         }
 
-      priv->primitive =
-        cogl_primitive_new_with_attributes (COGL_VERTICES_MODE_TRIANGLES,
-                                            data.vertices->len,
-                                            attributes, n_attributes);
-      for (i = 0; i < n_attributes; i++)
-        cogl_object_unref (attributes[i]);
-
-      indices = cogl_indices_new (context,
-                                  data.indices_type,
-                                  data.faces->data,
-                                  data.faces->len);
-      cogl_primitive_set_indices (priv->primitive,
-                                  indices,
-                                  data.faces->len);
-      cogl_object_unref (indices);
-
-      priv->min_vertex = data.min_vertex;
-      priv->max_vertex = data.max_vertex;
+      /* Keep the data until get_data() uploads it */
+      priv->vertices = data.vertices;
+      priv->faces = data.faces;
+      priv->submeshes = data.submeshes;
+      data.vertices = NULL;
+      data.faces = NULL;
+      data.submeshes = NULL;
 
       ret = TRUE;
     }
 
   g_free (display_name);
-  g_byte_array_free (data.vertices, TRUE);
+  if (data.stream)
+    mash_mesh_stream_free (data.stream);
+  if (data.vertices)
+    g_byte_array_free (data.vertices, TRUE);
   if (data.faces)
     g_array_free (data.faces, TRUE);
+  if (data.submeshes)
+    g_array_free (data.submeshes, TRUE);
 
   return ret;
 }
@@ -557,8 +1533,42 @@ mash_ply_loader_get_data (MashDataLoader *data_loader, MashDataLoaderData *loade
   MashPlyLoader *self = MASH_PLY_LOADER (data_loader);
   MashPlyLoaderPrivate *priv = self->priv;
 
-  loader_data->primitive = cogl_object_ref (priv->primitive);
+  /* Upload the data on the first call, from the thread owning the
+     Cogl context */
+  if (priv->primitives == NULL)
+    {
+      if (priv->stream)
+        {
+          priv->primitives =
+            mash_mesh_stream_create_primitives (priv->stream);
+          priv->mesh_size = mash_mesh_stream_get_size (priv->stream);
+        }
+      else
+        {
+          priv->primitives = mash_mesh_cache_create_primitives (&priv->mesh);
+          priv->mesh_size = mash_mesh_cache_data_get_size (&priv->mesh);
+        }
+      mash_ply_loader_free_data (self);
+    }
+
+  loader_data->primitives = g_ptr_array_ref (priv->primitives);
+
+  loader_data->min_vertex = priv->mesh.min_vertex;
+  loader_data->max_vertex = priv->mesh.max_vertex;
+  loader_data->quantization = priv->mesh.quantization;
+  loader_data->n_bytes = priv->mesh_size;
+  loader_data->generated_normals = priv->mesh.generated_normals;
+}
+
+static const MashMeshCacheData *
+mash_ply_loader_get_mesh (MashDataLoader *data_loader)
+{
+  MashPlyLoader *self = MASH_PLY_LOADER (data_loader);
+  MashPlyLoaderPrivate *priv = self->priv;
+
+  /* The data is freed once uploaded by get_data() */
+  if (priv->vertices == NULL)
+    return NULL;
 
-  loader_data->min_vertex = priv->min_vertex;
-  loader_data->max_vertex = priv->max_vertex;
+  return &priv->mesh;
 }
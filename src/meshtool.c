@@ -0,0 +1,623 @@
+/*
+ * Eclectic Sheep
+ *
+ * Copyright (C) 2012  Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * meshtool conditions PLY models once at build time so that wonderbar
+ * doesn't have to at every launch. It can rewrite them as binary PLY
+ * files, which load without parsing any text, and it can run the
+ * processing passes of the loader and store the result in the mesh
+ * cache, which later loads map as they are. The files are processed in
+ * parallel and the size and the load time of each model are printed
+ * before and after.
+ *
+ * It can also write large ASCII models and check that the number
+ * parsers of rply give the same values as strtod, timing both, so that
+ * the ASCII loading speed can be measured on any machine. The models
+ * are only written to new files, never over existing ones.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <glib-object.h>
+#include <glib/gstdio.h>
+
+#include "mash-ply-loader.h"
+#include "mash-mesh-cache.h"
+#include "es-mesh-registry.h"
+#include "rply/rply.h"
+
+typedef struct
+{
+  const char *filename;
+
+  GError *error;
+
+  /* Sizes in bytes and load times in micro seconds */
+  gint64 size_before, size_after;
+  gint64 load_before, load_after;
+
+  /* Values compared between the number parsers, and parse times in
+     micro seconds */
+  gint64 n_values, n_different;
+  gint64 parse_default, parse_strtod;
+} Job;
+
+static gboolean binary = FALSE;
+static gboolean cache = FALSE;
+static char *output_dir = NULL;
+static int n_jobs = 0;
+static gboolean weld = FALSE;
+static gboolean optimize = FALSE;
+static gboolean quantize = FALSE;
+static gboolean normals = FALSE;
+static int generate = 0;
+static gboolean compare = FALSE;
+
+static MashDataFlags flags;
+
+static GOptionEntry entries[] =
+{
+  { "binary", 'b', 0, G_OPTION_ARG_NONE, &binary,
+    "Convert the models to binary PLY files", NULL },
+  { "cache", 'c', 0, G_OPTION_ARG_NONE, &cache,
+    "Store the processed models in the mesh cache", NULL },
+  { "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir,
+    "Write the binary files to DIR instead of next to the models", "DIR" },
+  { "jobs", 'j', 0, G_OPTION_ARG_INT, &n_jobs,
+    "Number of models processed at the same time", "N" },
+  { "weld", 'w', 0, G_OPTION_ARG_NONE, &weld,
+    "Merge the identical vertices", NULL },
+  { "optimize", 'O', 0, G_OPTION_ARG_NONE, &optimize,
+    "Reorder the faces and the vertices for the GPU caches", NULL },
+  { "quantize", 'q', 0, G_OPTION_ARG_NONE, &quantize,
+    "Store the attributes with smaller types", NULL },
+  { "normals", 'n', 0, G_OPTION_ARG_NONE, &normals,
+    "Generate the missing normals, keeping the sharp edges", NULL },
+  { "generate", 'g', 0, G_OPTION_ARG_INT, &generate,
+    "Write an ASCII model of N vertices to each new MODEL first", "N" },
+  { "compare-parsers", 'p', 0, G_OPTION_ARG_NONE, &compare,
+    "Check the ASCII numbers parse as with strtod and time both", NULL },
+  { NULL }
+};
+
+static void
+ply_error_cb (const char *message, gpointer user_data)
+{
+  Job *job = user_data;
+
+  if (job->error == NULL)
+    g_set_error_literal (&job->error, MASH_DATA_ERROR,
+                         MASH_DATA_ERROR_UNKNOWN, message);
+}
+
+static int
+ply_copy_cb (p_ply_argument argument)
+{
+  void *output;
+
+  ply_get_argument_user_data (argument, &output, NULL);
+
+  return ply_write (output, ply_get_argument_value (argument));
+}
+
+static gint64
+get_file_size (const char *filename)
+{
+  GStatBuf buf;
+
+  if (g_stat (filename, &buf) == -1)
+    return 0;
+
+  return buf.st_size;
+}
+
+static char *
+get_binary_filename (const char *filename)
+{
+  char *basename, *stem, *binary_filename;
+
+  if (output_dir)
+    {
+      basename = g_path_get_basename (filename);
+      binary_filename = g_build_filename (output_dir, basename, NULL);
+      g_free (basename);
+
+      return binary_filename;
+    }
+
+  /* Keep the extension so that the file is still recognised */
+  if (g_str_has_suffix (filename, ".ply"))
+    stem = g_strndup (filename, strlen (filename) - 4);
+  else
+    stem = g_strdup (filename);
+  binary_filename = g_strconcat (stem, ".binary.ply", NULL);
+  g_free (stem);
+
+  return binary_filename;
+}
+
+/* Declares the elements, the properties and the comments of @input
+   in @output and copies all the values */
+static gboolean
+copy_ply (p_ply input, p_ply output)
+{
+  p_ply_element element = NULL;
+  const char *text = NULL;
+
+  while ((text = ply_get_next_comment (input, text)))
+    ply_add_comment (output, text);
+  while ((text = ply_get_next_obj_info (input, text)))
+    ply_add_obj_info (output, text);
+
+  while ((element = ply_get_next_element (input, element)))
+    {
+      p_ply_property property = NULL;
+      const char *element_name;
+      gint64 n_instances;
+
+      ply_get_element_info (element, &element_name, &n_instances);
+      ply_add_element (output, element_name, n_instances);
+
+      while ((property = ply_get_next_property (element, property)))
+        {
+          const char *property_name;
+          e_ply_type type, length_type, value_type;
+
+          ply_get_property_info (property, &property_name,
+                                 &type, &length_type, &value_type);
+          ply_add_property (output, property_name,
+                            type, length_type, value_type);
+          ply_set_read_cb (input, element_name, property_name,
+                           ply_copy_cb, output, 0);
+        }
+    }
+
+  return ply_write_header (output) && ply_read (input);
+}
+
+static gboolean
+is_same_file (const char *a, const char *b)
+{
+  GStatBuf buf_a, buf_b;
+
+  return (g_stat (a, &buf_a) == 0 && g_stat (b, &buf_b) == 0 &&
+          buf_a.st_dev == buf_b.st_dev && buf_a.st_ino == buf_b.st_ino);
+}
+
+/* Rewrites the model as a binary PLY file in the byte order of the
+   machine */
+static gboolean
+write_binary (Job *job, const char *binary_filename)
+{
+  p_ply input, output;
+  gboolean ret = FALSE;
+
+  /* The model is read while the file is written */
+  if (is_same_file (job->filename, binary_filename))
+    {
+      g_set_error (&job->error, MASH_DATA_ERROR, MASH_DATA_ERROR_UNKNOWN,
+                   "%s would overwrite the model", binary_filename);
+      return FALSE;
+    }
+
+  if ((input = ply_open (job->filename, ply_error_cb, job)))
+    {
+      if (ply_read_header (input) &&
+          (output = ply_create (binary_filename, PLY_DEFAULT,
+                                ply_error_cb, job)))
+        {
+          ret = copy_ply (input, output);
+
+          if (!ply_close (output))
+            ret = FALSE;
+        }
+
+      ply_close (input);
+    }
+
+  if (!ret && job->error == NULL)
+    g_set_error (&job->error, MASH_DATA_ERROR, MASH_DATA_ERROR_UNKNOWN,
+                 "Could not convert %s", job->filename);
+
+  return ret;
+}
+
+/* Loads @filename with the processing flags and returns the loader,
+   timing the load in @load_time */
+static MashDataLoader *
+load_model (Job *job, const char *filename, gint64 *load_time)
+{
+  MashDataLoader *loader = g_object_new (MASH_TYPE_PLY_LOADER, NULL);
+  gint64 start = g_get_monotonic_time ();
+
+  if (!mash_data_loader_load (loader, flags, filename, &job->error))
+    {
+      g_object_unref (loader);
+      return NULL;
+    }
+
+  *load_time = g_get_monotonic_time () - start;
+
+  return loader;
+}
+
+static void
+convert_to_binary (Job *job)
+{
+  MashDataLoader *loader;
+  char *binary_filename = get_binary_filename (job->filename);
+
+  if ((loader = load_model (job, job->filename, &job->load_before)))
+    {
+      g_object_unref (loader);
+
+      if (write_binary (job, binary_filename) &&
+          (loader = load_model (job, binary_filename, &job->load_after)))
+        {
+          job->size_after = get_file_size (binary_filename);
+          g_object_unref (loader);
+        }
+    }
+
+  g_free (binary_filename);
+}
+
+static void
+convert_to_cache (Job *job)
+{
+  MashDataLoader *loader;
+  MashMeshCache *mesh_cache;
+  gint64 start;
+
+  if ((loader = load_model (job, job->filename, &job->load_before)) == NULL)
+    return;
+
+  if (mash_mesh_cache_save (job->filename, flags,
+                            mash_data_loader_get_mesh (loader),
+                            &job->error))
+    {
+      /* This is what mash_data_load() does when the cache is valid */
+      start = g_get_monotonic_time ();
+      mesh_cache = mash_mesh_cache_open (job->filename, flags);
+      job->load_after = g_get_monotonic_time () - start;
+
+      if (mesh_cache == NULL)
+        g_set_error (&job->error, MASH_DATA_ERROR, MASH_DATA_ERROR_UNKNOWN,
+                     "The cache of %s could not be read back",
+                     job->filename);
+      else
+        {
+          job->size_after =
+            mash_mesh_cache_data_get_size (mash_mesh_cache_get_data
+                                           (mesh_cache));
+          mash_mesh_cache_close (mesh_cache);
+        }
+    }
+
+  g_object_unref (loader);
+}
+
+/* Writes a random strip of @n_vertices vertices with normals, printed
+   with the precision of the usual exporters. The model must not exist
+   yet so that a mistyped command can't replace the real ones */
+static void
+generate_model (Job *job, int n_vertices)
+{
+  p_ply output;
+  GRand *rand;
+  gboolean ret = FALSE;
+  int fd, i, j;
+
+  if ((fd = g_open (job->filename, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1)
+    {
+      gint saved_errno = errno;
+
+      g_set_error (&job->error, G_FILE_ERROR,
+                   g_file_error_from_errno (saved_errno),
+                   "Could not create %s: %s", job->filename,
+                   g_strerror (saved_errno));
+      return;
+    }
+  close (fd);
+
+  if ((output = ply_create (job->filename, PLY_ASCII, ply_error_cb, job)))
+    {
+      /* The same models on every run */
+      rand = g_rand_new_with_seed (n_vertices);
+
+      ply_add_comment (output, "generated by meshtool");
+      ply_add_element (output, "vertex", n_vertices);
+      ply_add_scalar_property (output, "x", PLY_FLOAT);
+      ply_add_scalar_property (output, "y", PLY_FLOAT);
+      ply_add_scalar_property (output, "z", PLY_FLOAT);
+      ply_add_scalar_property (output, "nx", PLY_FLOAT);
+      ply_add_scalar_property (output, "ny", PLY_FLOAT);
+      ply_add_scalar_property (output, "nz", PLY_FLOAT);
+      ply_add_element (output, "face", MAX (n_vertices - 2, 0));
+      ply_add_list_property (output, "vertex_indices", PLY_UCHAR, PLY_UINT);
+
+      ret = ply_write_header (output);
+
+      for (i = 0; ret && i < n_vertices; i++)
+        for (j = 0; ret && j < 6; j++)
+          ret = ply_write (output, g_rand_double_range (rand, -100.0, 100.0));
+
+      for (i = 0; ret && i < n_vertices - 2; i++)
+        ret = (ply_write (output, 3) &&
+               ply_write (output, i) &&
+               ply_write (output, i + 1) &&
+               ply_write (output, i + 2));
+
+      g_rand_free (rand);
+
+      if (!ply_close (output))
+        ret = FALSE;
+    }
+
+  if (!ret)
+    {
+      if (job->error == NULL)
+        g_set_error (&job->error, MASH_DATA_ERROR, MASH_DATA_ERROR_UNKNOWN,
+                     "Could not write %s", job->filename);
+      g_unlink (job->filename);
+    }
+}
+
+static int
+ply_collect_cb (p_ply_argument argument)
+{
+  GArray *values;
+  double value;
+
+  ply_get_argument_user_data (argument, (void **) &values, NULL);
+  value = ply_get_argument_value (argument);
+  g_array_append_val (values, value);
+
+  return 1;
+}
+
+/* Reads all the values of the model in order, timing the parsing in
+   @parse_time */
+static GArray *
+read_values (Job *job, gboolean use_strtod, gint64 *parse_time)
+{
+  GArray *values = g_array_new (FALSE, FALSE, sizeof (double));
+  p_ply_element element = NULL;
+  p_ply input;
+  gboolean ret = FALSE;
+  gint64 start;
+
+  if ((input = ply_open (job->filename, ply_error_cb, job)))
+    {
+      if (ply_read_header (input))
+        {
+          /* As the loader reads the models */
+          ply_set_read_threads (input, 0);
+          ply_set_read_strtod (input, use_strtod);
+
+          while ((element = ply_get_next_element (input, element)))
+            {
+              p_ply_property property = NULL;
+              const char *element_name, *property_name;
+
+              ply_get_element_info (element, &element_name, NULL);
+
+              while ((property = ply_get_next_property (element, property)))
+                {
+                  ply_get_property_info (property, &property_name,
+                                         NULL, NULL, NULL);
+                  ply_set_read_cb (input, element_name, property_name,
+                                   ply_collect_cb, values, 0);
+                }
+            }
+
+          start = g_get_monotonic_time ();
+          ret = ply_read (input);
+          *parse_time = g_get_monotonic_time () - start;
+        }
+
+      ply_close (input);
+    }
+
+  if (!ret)
+    {
+      if (job->error == NULL)
+        g_set_error (&job->error, MASH_DATA_ERROR, MASH_DATA_ERROR_UNKNOWN,
+                     "Could not read %s", job->filename);
+      g_array_free (values, TRUE);
+      return NULL;
+    }
+
+  return values;
+}
+
+static void
+compare_parsers (Job *job)
+{
+  GArray *values, *strtod_values;
+  int i;
+
+  if ((values = read_values (job, FALSE, &job->parse_default)) == NULL)
+    return;
+
+  if ((strtod_values = read_values (job, TRUE, &job->parse_strtod)))
+    {
+      if (strtod_values->len != values->len)
+        g_set_error (&job->error, MASH_DATA_ERROR, MASH_DATA_ERROR_UNKNOWN,
+                     "The parsers read a different number of values");
+
+      job->n_values = values->len;
+
+      /* The values have to be the same bit for bit */
+      for (i = 0; i < MIN (values->len, strtod_values->len); i++)
+        if (memcmp (&g_array_index (values, double, i),
+                    &g_array_index (strtod_values, double, i),
+                    sizeof (double)))
+          job->n_different++;
+
+      g_array_free (strtod_values, TRUE);
+    }
+
+  g_array_free (values, TRUE);
+}
+
+static void
+run_job (gpointer data, gpointer user_data)
+{
+  Job *job = data;
+
+  if (generate > 0)
+    generate_model (job, generate);
+
+  job->size_before = get_file_size (job->filename);
+
+  if (compare && job->error == NULL)
+    compare_parsers (job);
+
+  if (binary && job->error == NULL)
+    convert_to_binary (job);
+  if (cache && job->error == NULL)
+    convert_to_cache (job);
+}
+
+static void
+print_job (const Job *job)
+{
+  char *before, *after;
+
+  if (job->error)
+    {
+      g_printerr ("%s: %s\n", job->filename, job->error->message);
+      return;
+    }
+
+  before = g_format_size (job->size_before);
+  after = g_format_size (job->size_after);
+
+  if (generate > 0)
+    g_print ("%s: %d vertices, %s\n", job->filename, generate, before);
+  if (compare)
+    g_print ("%s: %" G_GINT64_FORMAT " values, %" G_GINT64_FORMAT
+             " different, parsed in %.1f ms, %.1f ms with strtod\n",
+             job->filename, job->n_values, job->n_different,
+             job->parse_default / 1000.0, job->parse_strtod / 1000.0);
+  if (binary || cache)
+    g_print ("%s: %s -> %s, loaded in %.1f ms -> %.1f ms\n",
+             job->filename, before, after,
+             job->load_before / 1000.0, job->load_after / 1000.0);
+
+  g_free (after);
+  g_free (before);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *option_context;
+  GThreadPool *pool;
+  GError *error = NULL;
+  Job *jobs;
+  int n_failed = 0, i;
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+  g_type_init ();
+#endif
+
+  option_context = g_option_context_new ("MODEL... - condition PLY models");
+  g_option_context_set_summary (option_context,
+                                "The models are loaded with the flags of "
+                                "wonderbar unless processing options are "
+                                "given.\nThe cache is keyed on the absolute "
+                                "path of the models so they have to be\n"
+                                "given as wonderbar will load them.");
+  g_option_context_add_main_entries (option_context, entries, NULL);
+
+  if (!g_option_context_parse (option_context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_option_context_free (option_context);
+
+  if (argc < 2 || !(binary || cache || generate > 0 || compare))
+    {
+      g_printerr ("Give some models and --binary, --cache, --generate "
+                  "or --compare-parsers\n");
+      return 1;
+    }
+
+  if (weld)
+    flags |= MASH_DATA_WELD;
+  if (optimize)
+    flags |= MASH_DATA_OPTIMIZE;
+  if (quantize)
+    flags |= MASH_DATA_QUANTIZE;
+  if (normals)
+    flags |= MASH_DATA_GENERATE_NORMALS | MASH_DATA_CREASE_NORMALS;
+  if (flags == 0)
+    flags = ES_MESH_REGISTRY_LOAD_FLAGS;
+  /* The cache is written explicitly */
+  flags &= ~MASH_DATA_CACHE;
+
+  /* The parsers use all the cores, so the timings are only meaningful
+     one model at a time */
+  if (n_jobs <= 0 && compare)
+    n_jobs = 1;
+  if (n_jobs <= 0)
+    n_jobs = MAX (sysconf (_SC_NPROCESSORS_ONLN), 1);
+
+  if (output_dir && g_mkdir_with_parents (output_dir, 0755) == -1)
+    {
+      g_printerr ("Could not create %s\n", output_dir);
+      return 1;
+    }
+
+  jobs = g_new0 (Job, argc - 1);
+  pool = g_thread_pool_new (run_job, NULL, n_jobs, TRUE, NULL);
+
+  for (i = 1; i < argc; i++)
+    {
+      jobs[i - 1].filename = argv[i];
+      g_thread_pool_push (pool, jobs + i - 1, NULL);
+    }
+
+  /* Wait for all the jobs */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  for (i = 0; i < argc - 1; i++)
+    {
+      print_job (jobs + i);
+
+      if (jobs[i].error)
+        {
+          g_error_free (jobs[i].error);
+          n_failed++;
+        }
+    }
+
+  g_free (jobs);
+
+  return n_failed ? 1 : 0;
+}
@@ -22,6 +22,14 @@
 #include <stdlib.h>
 #include <stddef.h>
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define PLY_USE_MMAP 1
+#endif
+
 #include "rply.h"
 
 /* ----------------------------------------------------------------------
@@ -30,6 +38,19 @@
 #define WORDSIZE 256
 #define LINESIZE 1024
 #define BUFFERSIZE (8*1024)
+/* minimum number of instances for an element to be parsed in parallel
+ * and of instances per chunk */
+#define PARALLEL_MIN_INSTANCES (16*1024)
+#define PARALLEL_CHUNK_INSTANCES 1024
+#define PARALLEL_MAX_THREADS 64
+/* maximum number of instances transcoded at once */
+#define PARALLEL_WINDOW_INSTANCES (256*1024)
+/* amount of a mapped file read before its pages are given back */
+#define MAP_RELEASE_SIZE (4*1024*1024)
+
+/* matches the blanks skipped by ply_read_word */
+#define PLY_IS_BLANK(c) ((c) == ' ' || (c) == '\n' || (c) == '\r' || \
+        (c) == '\t')
 
 typedef enum e_ply_io_mode_ {
     PLY_READ,
@@ -48,6 +69,13 @@ static const char *const ply_type_list[] = {
     "list", NULL
 };     /* order matches e_ply_type enum */
 
+static const int ply_type_size_list[] = {
+    1, 1, 2, 2,
+    4, 4, 4, 8,
+    1, 1, 2, 2,
+    4, 4, 4, 8
+};     /* order matches e_ply_type enum */
+
 /* ----------------------------------------------------------------------
  * Property reading callback argument
  *
@@ -64,9 +92,9 @@ static const char *const ply_type_list[] = {
  * ---------------------------------------------------------------------- */
 typedef struct t_ply_argument_ {
     p_ply_element element;
-    gint32 instance_index;
+    gint64 instance_index;
     p_ply_property property;
-    gint32 length, value_index;
+    gint64 length, value_index;
     double value;
     void *pdata;
     long idata;
@@ -97,14 +125,20 @@ typedef struct t_ply_property_ {
  * ninstances: number of elements of this type in file
  * property: property descriptions for this element
  * nproperty: number of properties in this element
+ * read_block_cb: function to be called with blocks of raw records
+ * block_pdata: user data passed to read_block_cb
+ * record_size: size of a record when read in blocks
  *
  * Returns 1 if should continue processing file, 0 if should abort.
  * ---------------------------------------------------------------------- */
 typedef struct t_ply_element_ {
     char name[WORDSIZE];
-    gint32 ninstances;
+    gint64 ninstances;
     p_ply_property property;
     gint32 nproperties;
+    p_ply_read_block_cb read_block_cb;
+    void *block_pdata;
+    size_t record_size;
 } t_ply_element;
 
 /* ----------------------------------------------------------------------
@@ -145,8 +179,14 @@ typedef t_ply_odriver *p_ply_odriver;
  * nobj_infos: number of obj_info items in file
  * fp: file pointer associated with ply file
  * c: last character read from ply file
- * buffer: last word/chunck of data read from ply file
+ * buffer: last word/chunck of data read from ply file, or the whole file
+ *     when it is memory mapped
+ * buffer_storage: storage for buffer when the file is not mapped
  * buffer_first, buffer_last: interval of untouched good data in buffer
+ * map, map_size: memory mapping of the file (NULL if not mapped)
+ * map_released: end of the pages of the mapping already given back
+ * nthreads: number of threads used to parse ascii elements
+ * use_strtod: parse ascii numbers with strtol/strtod instead of the fast path
  * buffer_token: start of parsed token (line or word) in buffer
  * idriver, odriver: input driver used to get property fields from file
  * argument: storage space for callback arguments
@@ -167,13 +207,18 @@ typedef struct t_ply_ {
     gint32 nobj_infos;
     FILE *fp;
     int c;
-    char buffer[BUFFERSIZE];
+    char *buffer;
+    char buffer_storage[BUFFERSIZE];
     size_t buffer_first, buffer_token, buffer_last;
+    char *map;
+    size_t map_size, map_released;
+    int nthreads;
+    int use_strtod;
     p_ply_idriver idriver;
     p_ply_odriver odriver;
     t_ply_argument argument;
     gint32 welement, wproperty;
-    gint32 winstance_index, wvalue_index, wlength;
+    gint64 winstance_index, wvalue_index, wlength;
     p_ply_error_cb error_cb;
     gpointer cb_data;
 } t_ply;
@@ -190,8 +235,18 @@ static t_ply_odriver ply_odriver_binary_reverse;
 
 static int ply_read_word(p_ply ply);
 static int ply_check_word(p_ply ply);
+static int ply_read_token(p_ply ply, size_t *length);
+static int ply_parse_integer(const char *token, size_t length,
+        double *value);
+static int ply_parse_double(const char *token, size_t length,
+        double *value);
+static int ply_parse_value(e_ply_type type, const char *token,
+        size_t length, int use_strtod, double *value);
 static int ply_read_line(p_ply ply);
 static int ply_check_line(p_ply ply);
+static int ply_map(p_ply ply);
+static void ply_unmap(p_ply ply);
+static void ply_release_map(p_ply ply);
 static int ply_read_chunk(p_ply ply, void *anybuffer, size_t size);
 static int ply_read_chunk_reverse(p_ply ply, void *anybuffer, size_t size);
 static int ply_write_chunk(p_ply ply, void *anybuffer, size_t size);
@@ -230,7 +285,8 @@ static void ply_property_init(p_ply_property property);
 static p_ply ply_alloc(void);
 static p_ply_element ply_grow_element(p_ply ply);
 static p_ply_property ply_grow_property(p_ply ply, p_ply_element element);
-static void *ply_grow_array(p_ply ply, void **pointer, gint32 *nmemb, gint32 size);
+static void *ply_grow_array(p_ply ply, void **pointer, gint32 *nmemb,
+        size_t size);
 
 /* ----------------------------------------------------------------------
  * Special functions
@@ -243,6 +299,13 @@ static int ply_type_check(void);
  * ---------------------------------------------------------------------- */
 static int ply_read_element(p_ply ply, p_ply_element element,
         p_ply_argument argument);
+static int ply_read_element_blocks(p_ply ply, p_ply_element element);
+static int ply_read_element_parallel(p_ply ply, p_ply_element element,
+        p_ply_argument argument);
+static int ply_read_instances(p_ply ply, p_ply_element element,
+        p_ply_argument argument, gint64 first, gint64 ninstances);
+static void ply_reverse_records(p_ply_element element, char *records,
+        gint64 ninstances);
 static int ply_read_property(p_ply ply, p_ply_element element,
         p_ply_property property, p_ply_argument argument);
 static int ply_read_list_property(p_ply ply, p_ply_element element,
@@ -269,8 +332,11 @@ static int ply_read_scalar_property(p_ply ply, p_ply_element element,
 
 /* refills the buffer */
 static int BREFILL(p_ply ply) {
+    size_t size;
+    /* a mapped file is entirely in the buffer already */
+    if (ply->map) return 0;
     /* move untouched data to beginning of buffer */
-    size_t size = BSIZE(ply);
+    size = BSIZE(ply);
     memmove(ply->buffer, BFIRST(ply), size);
     ply->buffer_last = size;
     ply->buffer_first = ply->buffer_token = 0;
@@ -326,6 +392,9 @@ p_ply ply_open(const char *name, p_ply_error_cb error_cb, gpointer cb_data) {
     ply->io_mode = PLY_READ;
     ply->error_cb = error_cb;
     ply->cb_data = cb_data;
+    /* parse straight from the file when it can be mapped, this falls
+     * back to the buffered reads for pipes and the like */
+    ply_map(ply);
     return ply;
 }
 
@@ -349,20 +418,66 @@ int ply_read_header(p_ply ply) {
     return 1;
 }
 
-long ply_set_read_cb(p_ply ply, const char *element_name,
+gint64 ply_set_read_cb(p_ply ply, const char *element_name,
         const char* property_name, p_ply_read_cb read_cb,
         void *pdata, long idata) {
     p_ply_element element = NULL;
     p_ply_property property = NULL;
     assert(ply && element_name && property_name);
     element = ply_find_element(ply, element_name);
-    if (!element) return 0;
+    if (!element) return -1;
     property = ply_find_property(element, property_name);
-    if (!property) return 0;
+    if (!property) return -1;
     property->read_cb = read_cb;
     property->pdata = pdata;
     property->idata = idata;
-    return (int) element->ninstances;
+    return element->ninstances;
+}
+
+long ply_set_read_block_cb(p_ply ply, const char *element_name,
+        p_ply_read_block_cb read_block_cb, void *pdata) {
+    p_ply_element element = NULL;
+    size_t record_size = 0;
+    gint32 i;
+    assert(ply && element_name);
+    element = ply_find_element(ply, element_name);
+    if (!element) return 0;
+    /* the records of ascii files are transcoded from the whole text of
+     * the element so the file has to be mapped */
+    if (ply->storage_mode == PLY_ASCII && !ply->map) return 0;
+    /* records only have a fixed size without lists */
+    for (i = 0; i < element->nproperties; i++) {
+        if (element->property[i].type == PLY_LIST) return 0;
+        record_size += ply_type_size_list[element->property[i].type];
+    }
+    /* a record has to fit in the buffer */
+    if (record_size == 0 || record_size >= BUFFERSIZE - 1) return 0;
+    element->read_block_cb = read_block_cb;
+    element->block_pdata = pdata;
+    element->record_size = record_size;
+    return (long) record_size;
+}
+
+void ply_set_read_strtod(p_ply ply, int use_strtod) {
+    assert(ply);
+    ply->use_strtod = use_strtod;
+}
+
+void ply_set_read_threads(p_ply ply, int nthreads) {
+    assert(ply);
+    if (nthreads <= 0) {
+#if defined(PLY_USE_MMAP) && defined(_SC_NPROCESSORS_ONLN)
+        nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (nthreads <= 0) nthreads = 1;
+    }
+    if (nthreads > PARALLEL_MAX_THREADS) nthreads = PARALLEL_MAX_THREADS;
+    ply->nthreads = nthreads;
+}
+
+int ply_get_type_size(e_ply_type type) {
+    assert(type < PLY_LIST);
+    return ply_type_size_list[type];
 }
 
 int ply_read(p_ply ply) {
@@ -417,7 +532,7 @@ p_ply ply_create(const char *name, e_ply_storage_mode storage_mode,
     return ply;
 }
 
-int ply_add_element(p_ply ply, const char *name, gint32 ninstances) {
+int ply_add_element(p_ply ply, const char *name, gint64 ninstances) {
     p_ply_element element = NULL;
     assert(ply && ply->fp && ply->io_mode == PLY_WRITE);
     assert(name && strlen(name) < WORDSIZE && ninstances >= 0);
@@ -529,7 +644,7 @@ int ply_write_header(p_ply ply) {
         p_ply_element element = &ply->element[i];
         assert(element->property || element->nproperties == 0);
         assert(!element->property || element->nproperties > 0);
-        if (fprintf(ply->fp, "element %s %" G_GINT32_FORMAT " \n", element->name,
+        if (fprintf(ply->fp, "element %s %" G_GINT64_FORMAT " \n", element->name,
                     element->ninstances) <= 0) goto error;
         for (j = 0; j < element->nproperties; j++) {
             p_ply_property property = &element->property[j];
@@ -563,14 +678,14 @@ int ply_write(p_ply ply, double value) {
     if (property->type == PLY_LIST) {
         if (ply->wvalue_index == 0) {
             type = property->length_type;
-            ply->wlength = (gint32) value;
+            ply->wlength = (gint64) value;
         } else type = property->value_type;
     } else {
         type = property->type;
         ply->wlength = 0;
     }
     if (!ply->odriver->ohandler[type](ply, value)) {
-        ply_error(ply, "Failed writing %s of %s %d (%s: %s)",
+        ply_error(ply, "Failed writing %s of %s %" G_GINT64_FORMAT " (%s: %s)",
                     property->name, element->name,
                     ply->winstance_index,
                     ply->odriver->name, ply_type_list[type]);
@@ -604,6 +719,7 @@ int ply_close(p_ply ply) {
         ply_error(ply, "Error closing up");
         return 0;
     }
+    ply_unmap(ply);
     fclose(ply->fp);
     /* free all memory used by handle */
     if (ply->element) {
@@ -632,10 +748,10 @@ p_ply_element ply_get_next_element(p_ply ply,
 }
 
 int ply_get_element_info(p_ply_element element, const char** name,
-        gint32 *ninstances) {
+        gint64 *ninstances) {
     assert(element);
     if (name) *name = element->name;
-    if (ninstances) *ninstances = (gint32) element->ninstances;
+    if (ninstances) *ninstances = element->ninstances;
     return 1;
 }
 
@@ -679,7 +795,7 @@ const char *ply_get_next_obj_info(p_ply ply, const char *last) {
  * Callback argument support functions
  * ---------------------------------------------------------------------- */
 int ply_get_argument_element(p_ply_argument argument,
-        p_ply_element *element, gint32 *instance_index) {
+        p_ply_element *element, gint64 *instance_index) {
     assert(argument);
     if (!argument) return 0;
     if (element) *element = argument->element;
@@ -688,7 +804,7 @@ int ply_get_argument_element(p_ply_argument argument,
 }
 
 int ply_get_argument_property(p_ply_argument argument,
-        p_ply_property *property, gint32 *length, gint32 *value_index) {
+        p_ply_property *property, gint64 *length, gint64 *value_index) {
     assert(argument);
     if (!argument) return 0;
     if (property) *property = argument->property;
@@ -717,19 +833,19 @@ double ply_get_argument_value(p_ply_argument argument) {
  * ---------------------------------------------------------------------- */
 static int ply_read_list_property(p_ply ply, p_ply_element element,
         p_ply_property property, p_ply_argument argument) {
-    int l;
+    gint64 l;
     p_ply_read_cb read_cb = property->read_cb;
     p_ply_ihandler *driver = ply->idriver->ihandler;
     /* get list length */
     p_ply_ihandler handler = driver[property->length_type];
     double length;
     if (!handler(ply, &length)) {
-        ply_error(ply, "Error reading '%s' of '%s' number %d",
+        ply_error(ply, "Error reading '%s' of '%s' number %" G_GINT64_FORMAT,
                 property->name, element->name, argument->instance_index);
         return 0;
     }
     /* invoke callback to pass length in value field */
-    argument->length = (gint32) length;
+    argument->length = (gint64) length;
     argument->value_index = -1;
     argument->value = length;
     if (read_cb && !read_cb(argument)) {
@@ -739,12 +855,13 @@ static int ply_read_list_property(p_ply ply, p_ply_element element,
     /* read list values */
     handler = driver[property->value_type];
     /* for each value in list */
-    for (l = 0; l < (gint32) length; l++) {
+    for (l = 0; l < argument->length; l++) {
         /* read value from file */
         argument->value_index = l;
         if (!handler(ply, &argument->value)) {
-            ply_error(ply, "Error reading value number %d of '%s' of "
-                    "'%s' number %d", l+1, property->name,
+            ply_error(ply, "Error reading value number %" G_GINT64_FORMAT
+                    " of '%s' of '%s' number %" G_GINT64_FORMAT, l+1,
+                    property->name,
                     element->name, argument->instance_index);
             return 0;
         }
@@ -765,7 +882,7 @@ static int ply_read_scalar_property(p_ply ply, p_ply_element element,
     argument->length = 1;
     argument->value_index = 0;
     if (!handler(ply, &argument->value)) {
-        ply_error(ply, "Error reading '%s' of '%s' number %d",
+        ply_error(ply, "Error reading '%s' of '%s' number %" G_GINT64_FORMAT,
                 property->name, element->name, argument->instance_index);
         return 0;
     }
@@ -784,12 +901,87 @@ static int ply_read_property(p_ply ply, p_ply_element element,
         return ply_read_scalar_property(ply, element, property, argument);
 }
 
-static int ply_read_element(p_ply ply, p_ply_element element,
-        p_ply_argument argument) {
-    gint32 j, k;
+static void ply_reverse_records(p_ply_element element, char *records,
+        gint64 ninstances) {
+    gint64 j;
+    gint32 k;
+    for (j = 0; j < ninstances; j++) {
+        for (k = 0; k < element->nproperties; k++) {
+            size_t size = ply_type_size_list[element->property[k].type];
+            guint16 v16;
+            guint32 v32;
+            guint64 v64;
+            /* memcpy keeps the accesses safe on unaligned records and
+             * compiles down to bswap instructions */
+            switch (size) {
+                case 2:
+                    memcpy(&v16, records, 2);
+                    v16 = GUINT16_SWAP_LE_BE(v16);
+                    memcpy(records, &v16, 2);
+                    break;
+                case 4:
+                    memcpy(&v32, records, 4);
+                    v32 = GUINT32_SWAP_LE_BE(v32);
+                    memcpy(records, &v32, 4);
+                    break;
+                case 8:
+                    memcpy(&v64, records, 8);
+                    v64 = GUINT64_SWAP_LE_BE(v64);
+                    memcpy(records, &v64, 8);
+                    break;
+            }
+            records += size;
+        }
+    }
+}
+
+static int ply_read_element_blocks(p_ply ply, p_ply_element element) {
+    size_t record_size = element->record_size;
+    gint64 j = 0;
+    while (j < element->ninstances) {
+        char *records;
+        gint64 n;
+        /* make sure there is at least one whole record in the buffer */
+        if (BSIZE(ply) < record_size && !BREFILL(ply)) {
+            ply_error(ply, "Error reading '%s' number %" G_GINT64_FORMAT,
+                    element->name, j);
+            return 0;
+        }
+        if (BSIZE(ply) < record_size) continue;
+        records = BFIRST(ply);
+        n = (gint64) (BSIZE(ply) / record_size);
+        if (n > element->ninstances - j) n = element->ninstances - j;
+        if (ply->idriver == &ply_idriver_binary_reverse) {
+            /* swapping in place would copy every page of a private
+             * mapping, going through the buffer storage is cheaper */
+            if (ply->map) {
+                if (n > (gint64) (BUFFERSIZE / record_size))
+                    n = (gint64) (BUFFERSIZE / record_size);
+                memcpy(ply->buffer_storage, records, n * record_size);
+                records = ply->buffer_storage;
+            }
+            ply_reverse_records(element, records, n);
+        }
+        if (!element->read_block_cb(element, records, j, n,
+                    element->block_pdata)) {
+            ply_error(ply, "Aborted by user");
+            return 0;
+        }
+        BSKIP(ply, n * record_size);
+        j += n;
+        ply_release_map(ply);
+    }
+    return 1;
+}
+
+static int ply_read_instances(p_ply ply, p_ply_element element,
+        p_ply_argument argument, gint64 first, gint64 ninstances) {
+    gint64 j;
+    gint32 k;
     /* for each element of this type */
-    for (j = 0; j < element->ninstances; j++) {
+    for (j = first; j < first + ninstances; j++) {
         argument->instance_index = j;
+        if ((j & 0xfff) == 0) ply_release_map(ply);
         /* for each property */
         for (k = 0; k < element->nproperties; k++) {
             p_ply_property property = &element->property[k];
@@ -803,6 +995,298 @@ static int ply_read_element(p_ply ply, p_ply_element element,
     return 1;
 }
 
+static int ply_read_element(p_ply ply, p_ply_element element,
+        p_ply_argument argument) {
+    int ret = ply_read_element_parallel(ply, element, argument);
+    if (ret >= 0) return ret;
+    /* ascii elements that could not be transcoded to records fall back
+     * to the property callbacks */
+    if (element->read_block_cb && ply->storage_mode != PLY_ASCII)
+        return ply_read_element_blocks(ply, element);
+    return ply_read_instances(ply, element, argument, 0,
+            element->ninstances);
+}
+
+/* ----------------------------------------------------------------------
+ * Parallel parsing of ascii elements
+ *
+ * The lines of an element are split in chunks that worker threads
+ * transcode into the records a native binary file would contain. The
+ * records are then read back in order with the binary input driver so
+ * the callbacks are invoked exactly as with the serial parser, from
+ * the thread calling ply_read. This needs the whole element in memory
+ * so it is only done for mapped files, and relies on each instance
+ * being on its own line. When a chunk doesn't parse, the element is
+ * read serially instead, which also reports the error.
+ *
+ * Elements with a block callback always go through the records, on the
+ * calling thread only if threads were not enabled.
+ * ---------------------------------------------------------------------- */
+typedef struct t_ply_chunk_ {
+    const char *text, *text_end;
+    gint64 ninstances;
+    char *records;
+    size_t size, allocated;
+    int use_strtod;
+    int ok;
+} t_ply_chunk;
+
+typedef struct t_ply_parallel_ {
+    p_ply_element element;
+    t_ply_chunk *chunk;
+    gint nchunks;
+    volatile gint next;
+} t_ply_parallel;
+
+static const char *ply_next_word(const char **text, const char *end,
+        size_t *length) {
+    const char *p = *text, *word;
+    while (p < end && PLY_IS_BLANK(*p)) p++;
+    word = p;
+    while (p < end && !PLY_IS_BLANK(*p)) p++;
+    *length = p - word;
+    *text = p;
+    return word;
+}
+
+static void ply_store_value(e_ply_type type, double value, char *record) {
+    switch (type) {
+        case PLY_INT8: case PLY_CHAR:
+            { gint8 v = (gint8) value; memcpy(record, &v, 1); } break;
+        case PLY_UINT8: case PLY_UCHAR:
+            { guint8 v = (guint8) value; memcpy(record, &v, 1); } break;
+        case PLY_INT16: case PLY_SHORT:
+            { gint16 v = (gint16) value; memcpy(record, &v, 2); } break;
+        case PLY_UINT16: case PLY_USHORT:
+            { guint16 v = (guint16) value; memcpy(record, &v, 2); } break;
+        case PLY_INT32: case PLY_INT:
+            { gint32 v = (gint32) value; memcpy(record, &v, 4); } break;
+        case PLY_UIN32: case PLY_UINT:
+            { guint32 v = (guint32) value; memcpy(record, &v, 4); } break;
+        case PLY_FLOAT32: case PLY_FLOAT:
+            { float v = (float) value; memcpy(record, &v, 4); } break;
+        case PLY_FLOAT64: case PLY_DOUBLE:
+            memcpy(record, &value, 8); break;
+        default:
+            assert(0);
+    }
+}
+
+static int ply_parse_chunk_value(t_ply_chunk *chunk, e_ply_type type,
+        const char **text, double *value) {
+    size_t length, size = ply_type_size_list[type];
+    const char *word = ply_next_word(text, chunk->text_end, &length);
+    if (!length || !ply_parse_value(type, word, length, chunk->use_strtod,
+                value))
+        return 0;
+    if (chunk->size + size > chunk->allocated) {
+        char *records;
+        chunk->allocated = 2 * chunk->allocated + size;
+        records = (char *) realloc(chunk->records, chunk->allocated);
+        if (!records) return 0;
+        chunk->records = records;
+    }
+    ply_store_value(type, *value, chunk->records + chunk->size);
+    chunk->size += size;
+    return 1;
+}
+
+static int ply_parse_chunk(p_ply_element element, t_ply_chunk *chunk) {
+    const char *text = chunk->text;
+    size_t length;
+    double value;
+    gint64 j, l;
+    gint32 k;
+    for (j = 0; j < chunk->ninstances; j++) {
+        for (k = 0; k < element->nproperties; k++) {
+            p_ply_property property = &element->property[k];
+            if (property->type == PLY_LIST) {
+                gint64 nvalues;
+                if (!ply_parse_chunk_value(chunk, property->length_type,
+                            &text, &value))
+                    return 0;
+                nvalues = (gint64) value;
+                for (l = 0; l < nvalues; l++)
+                    if (!ply_parse_chunk_value(chunk, property->value_type,
+                                &text, &value))
+                        return 0;
+            } else if (!ply_parse_chunk_value(chunk, property->type,
+                        &text, &value))
+                return 0;
+        }
+    }
+    /* the instances have to end exactly with the chunk */
+    ply_next_word(&text, chunk->text_end, &length);
+    return length == 0;
+}
+
+static gpointer ply_parallel_worker(gpointer data) {
+    t_ply_parallel *parallel = (t_ply_parallel *) data;
+    gint c;
+    while ((c = g_atomic_int_add(&parallel->next, 1)) < parallel->nchunks) {
+        t_ply_chunk *chunk = &parallel->chunk[c];
+        chunk->ok = ply_parse_chunk(parallel->element, chunk);
+    }
+    return NULL;
+}
+
+/* finds where the lines of the next ninstances instances start and
+ * splits them in chunks, skipping blank lines. Returns 0 if the text
+ * ends first. */
+static int ply_split_chunks(t_ply_parallel *parallel, const char **text,
+        const char *end, gint64 ninstances) {
+    const char *p = *text;
+    gint64 j;
+    gint c;
+    for (c = 0; c < parallel->nchunks; c++) {
+        t_ply_chunk *chunk = &parallel->chunk[c];
+        chunk->ninstances = 0;
+        chunk->size = 0;
+        chunk->ok = 0;
+    }
+    c = -1;
+    for (j = 0; j < ninstances; j++) {
+        while (1) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+            if (p < end && *p == '\n') p++;
+            else break;
+        }
+        if (p >= end) return 0;
+        if (c + 1 < parallel->nchunks &&
+                j == ninstances * (c + 1) / parallel->nchunks) {
+            if (c >= 0) parallel->chunk[c].text_end = p;
+            c++;
+            parallel->chunk[c].text = p;
+        }
+        parallel->chunk[c].ninstances++;
+        p = memchr(p, '\n', end - p);
+        p = p ? p + 1 : end;
+    }
+    parallel->chunk[c].text_end = p;
+    *text = p;
+    return 1;
+}
+
+/* transcodes the chunks with nthreads threads, the calling thread being
+ * one of them. Returns 0 if any chunk doesn't parse. */
+static int ply_parse_chunks(t_ply_parallel *parallel, int nthreads,
+        size_t estimate) {
+    GThread *threads[PARALLEL_MAX_THREADS];
+    gint c;
+    /* the buffers are kept from one window to the next */
+    for (c = 0; c < parallel->nchunks; c++) {
+        t_ply_chunk *chunk = &parallel->chunk[c];
+        size_t size = (size_t) chunk->ninstances * estimate;
+        if (chunk->allocated < size) {
+            char *records = (char *) realloc(chunk->records, size);
+            if (!records) return 0;
+            chunk->records = records;
+            chunk->allocated = size;
+        }
+    }
+    parallel->next = 0;
+    nthreads = MIN(nthreads, parallel->nchunks);
+    for (c = 0; c < nthreads - 1; c++)
+        threads[c] = g_thread_new("ply", ply_parallel_worker, parallel);
+    ply_parallel_worker(parallel);
+    for (c = 0; c < nthreads - 1; c++)
+        g_thread_join(threads[c]);
+    for (c = 0; c < parallel->nchunks; c++)
+        if (!parallel->chunk[c].ok) return 0;
+    return 1;
+}
+
+/* reads the transcoded records back in order with the binary driver */
+static int ply_read_chunks(p_ply ply, p_ply_element element,
+        p_ply_argument argument, t_ply_parallel *parallel, gint64 first) {
+    p_ply_idriver idriver = ply->idriver;
+    size_t buffer_first = ply->buffer_first;
+    int ret = 1;
+    gint c;
+    ply->idriver = &ply_idriver_binary;
+    for (c = 0; c < parallel->nchunks && ret; c++) {
+        t_ply_chunk *chunk = &parallel->chunk[c];
+        ply->buffer = chunk->records;
+        ply->buffer_first = ply->buffer_token = 0;
+        ply->buffer_last = chunk->size;
+        if (element->read_block_cb) {
+            ret = element->read_block_cb(element, chunk->records, first,
+                    chunk->ninstances, element->block_pdata);
+            if (!ret) ply_error(ply, "Aborted by user");
+        } else ret = ply_read_instances(ply, element, argument, first,
+                chunk->ninstances);
+        first += chunk->ninstances;
+    }
+    ply->idriver = idriver;
+    ply->buffer = ply->map;
+    ply->buffer_first = ply->buffer_token = buffer_first;
+    ply->buffer_last = ply->map_size;
+    return ret;
+}
+
+/* the element is transcoded in windows of PARALLEL_WINDOW_INSTANCES so
+ * that the records never take more memory than a window, whatever the
+ * size of the file */
+static int ply_read_element_parallel(p_ply ply, p_ply_element element,
+        p_ply_argument argument) {
+    t_ply_parallel parallel;
+    const char *p, *end;
+    gint64 first, nwindow;
+    gint c, nchunks;
+    gint32 k;
+    size_t estimate = 0;
+    int ret = 1;
+    if (!ply->map || ply->storage_mode != PLY_ASCII ||
+            element->ninstances <= 0)
+        return -1;
+    if (!element->read_block_cb && (ply->nthreads <= 1 ||
+                element->ninstances < PARALLEL_MIN_INSTANCES))
+        return -1;
+    parallel.element = element;
+    nchunks = ply->nthreads > 1 ? 4 * ply->nthreads : 1;
+    parallel.chunk = (t_ply_chunk *) calloc(nchunks, sizeof(t_ply_chunk));
+    if (!parallel.chunk) return -1;
+    for (c = 0; c < nchunks; c++)
+        parallel.chunk[c].use_strtod = ply->use_strtod;
+    /* guess the size of the records, lists are assumed to be triangles */
+    for (k = 0; k < element->nproperties; k++) {
+        p_ply_property property = &element->property[k];
+        if (property->type == PLY_LIST)
+            estimate += ply_type_size_list[property->length_type] +
+                3 * ply_type_size_list[property->value_type];
+        else estimate += ply_type_size_list[property->type];
+    }
+    p = BFIRST(ply);
+    end = ply->buffer + ply->buffer_last;
+    for (first = 0; first < element->ninstances; first += nwindow) {
+        const char *window = p;
+        nwindow = MIN(element->ninstances - first,
+                PARALLEL_WINDOW_INSTANCES);
+        parallel.nchunks = nchunks;
+        if (nwindow / parallel.nchunks < PARALLEL_CHUNK_INSTANCES)
+            parallel.nchunks = (gint) (nwindow / PARALLEL_CHUNK_INSTANCES);
+        if (parallel.nchunks < 1) parallel.nchunks = 1;
+        if (!ply_split_chunks(&parallel, &p, end, nwindow) ||
+                !ply_parse_chunks(&parallel, ply->nthreads, estimate)) {
+            /* read the rest serially from the start of the window,
+             * which also reports the error */
+            ply->buffer_first = ply->buffer_token = window - ply->map;
+            ret = ply_read_instances(ply, element, argument, first,
+                    element->ninstances - first);
+            break;
+        }
+        ply->buffer_first = ply->buffer_token = p - ply->map;
+        if (!(ret = ply_read_chunks(ply, element, argument, &parallel,
+                        first)))
+            break;
+        ply_release_map(ply);
+    }
+    for (c = 0; c < nchunks; c++)
+        free(parallel.chunk[c].records);
+    free(parallel.chunk);
+    return ret;
+}
+
 static int ply_find_string(const char *item, const char* const list[]) {
     int i;
     assert(item && list);
@@ -840,7 +1324,7 @@ static p_ply_property ply_find_property(p_ply_element element,
 
 static int ply_check_word(p_ply ply) {
     if (strlen(BLINE(ply)) >= WORDSIZE) {
-        ply_error(ply, "Word too gint32");
+        ply_error(ply, "Word too long");
         return 0;
     }
     return 1;
@@ -891,9 +1375,185 @@ static int ply_read_word(p_ply ply) {
     return ply_check_word(ply);
 }
 
+/* reads the next word without terminating it in the buffer, leaving it
+ * at BWORD(ply). This is used for the values of ascii files so the
+ * pages of a mapped file are never written to. */
+static int ply_read_token(p_ply ply, size_t *length) {
+    size_t t;
+    assert(ply && ply->fp && ply->io_mode == PLY_READ);
+    /* skip leading blanks */
+    while (1) {
+        while (ply->buffer_first < ply->buffer_last &&
+                PLY_IS_BLANK(ply->buffer[ply->buffer_first]))
+            ply->buffer_first++;
+        if (ply->buffer_first < ply->buffer_last) break;
+        if (!BREFILL(ply)) {
+            ply_error(ply, "Unexpected end of file");
+            return 0;
+        }
+    }
+    /* look for a blank after the current word */
+    t = 0;
+    while (1) {
+        const char *word = BFIRST(ply);
+        size_t size = BSIZE(ply);
+        while (t < size && !PLY_IS_BLANK(word[t])) t++;
+        if (t < size) break;
+        /* check if the token is too large for our buffer */
+        if (!ply->map && t >= BUFFERSIZE - 2) {
+            ply_error(ply, "Token too large");
+            return 0;
+        }
+        /* the last word of the file doesn't need a blank after it */
+        if (!BREFILL(ply)) break;
+    }
+    ply->buffer_token = ply->buffer_first;
+    BSKIP(ply, t);
+    *length = t;
+    return 1;
+}
+
+static const double ply_pow10_list[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};     /* powers of ten exactly representable as doubles */
+
+/* parses a whole token as a decimal integer */
+static int ply_parse_integer(const char *token, size_t length,
+        double *value) {
+    const char *p = token, *end = token + length;
+    gint64 n = 0;
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p == end) return 0;
+    for (; p < end; p++) {
+        unsigned digit = (unsigned char) *p - '0';
+        if (digit > 9) return 0;
+        /* way out of range of any integer type anyway */
+        if (n > G_GINT64_CONSTANT(100000000000000000)) return 0;
+        n = n * 10 + digit;
+    }
+    *value = (double) (negative ? -n : n);
+    return 1;
+}
+
+/* parses a whole token as a floating point number. Tokens with at most
+ * 19 significant digits and a decimal exponent small enough to be an
+ * exact double are computed with a single correctly rounded operation
+ * (Clinger's fast path), which covers the values written by all the
+ * usual exporters. Anything else goes to g_ascii_strtod so the result
+ * is always the correctly rounded double, and rounding it to a float
+ * gives back the float that was printed with 9 significant digits. */
+static int ply_parse_double(const char *token, size_t length,
+        double *value) {
+    const char *p = token, *end = token + length;
+    guint64 mantissa = 0;
+    int negative = 0, ndigits = 0, exponent = 0, any = 0;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    /* integer part */
+    for (; p < end && (unsigned) (*p - '0') <= 9; p++) {
+        any = 1;
+        if (mantissa == 0 && *p == '0') continue;
+        if (++ndigits > 19) goto slow;
+        mantissa = mantissa * 10 + (*p - '0');
+    }
+    /* fractional part */
+    if (p < end && *p == '.') {
+        for (p++; p < end && (unsigned) (*p - '0') <= 9; p++) {
+            any = 1;
+            exponent--;
+            if (mantissa == 0 && *p == '0') continue;
+            if (++ndigits > 19) goto slow;
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+    }
+    if (!any) goto slow;
+    /* exponent */
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int e = 0, e_negative = 0;
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) e_negative = *p++ == '-';
+        if (p == end) return 0;
+        for (; p < end && (unsigned) (*p - '0') <= 9; p++) {
+            if (e > 10000) goto slow;
+            e = e * 10 + (*p - '0');
+        }
+        exponent += e_negative ? -e : e;
+    }
+    if (p != end) goto slow;
+    if (mantissa == 0) {
+        *value = negative ? -0.0 : 0.0;
+        return 1;
+    }
+    if (mantissa > (G_GUINT64_CONSTANT(1) << 53) ||
+            exponent < -22 || exponent > 22)
+        goto slow;
+    if (exponent < 0) *value = (double) mantissa / ply_pow10_list[-exponent];
+    else *value = (double) mantissa * ply_pow10_list[exponent];
+    if (negative) *value = -*value;
+    return 1;
+slow:
+    {
+        char word[WORDSIZE];
+        char *word_end;
+        if (length >= WORDSIZE) return 0;
+        memcpy(word, token, length);
+        word[length] = '\0';
+        *value = g_ascii_strtod(word, &word_end);
+        return *word_end == '\0' && length > 0;
+    }
+}
+
+/* parses a whole token with strtol or strtod, as rply did before the
+ * parsers above, to compare them against it */
+static int ply_parse_strtod(const char *token, size_t length, int real,
+        double *value) {
+    char word[WORDSIZE];
+    char *word_end;
+    if (length == 0 || length >= WORDSIZE) return 0;
+    memcpy(word, token, length);
+    word[length] = '\0';
+    if (real) *value = g_ascii_strtod(word, &word_end);
+    else *value = (double) strtol(word, &word_end, 10);
+    return *word_end == '\0';
+}
+
+/* parses a whole token as a value of the given type, checking it is in
+ * the range of the type */
+static int ply_parse_value(e_ply_type type, const char *token,
+        size_t length, int use_strtod, double *value) {
+    double min, max;
+    int real = 0, ok;
+    switch (type) {
+        case PLY_FLOAT32: case PLY_FLOAT:
+            min = -FLT_MAX; max = FLT_MAX; real = 1; break;
+        case PLY_FLOAT64: case PLY_DOUBLE:
+            min = -DBL_MAX; max = DBL_MAX; real = 1; break;
+        case PLY_INT8: case PLY_CHAR:
+            min = CHAR_MIN; max = CHAR_MAX; break;
+        case PLY_UINT8: case PLY_UCHAR:
+            min = 0; max = UCHAR_MAX; break;
+        case PLY_INT16: case PLY_SHORT:
+            min = G_MININT16; max = G_MAXINT16; break;
+        case PLY_UINT16: case PLY_USHORT:
+            min = 0; max = G_MAXUINT16; break;
+        case PLY_INT32: case PLY_INT:
+            min = G_MININT32; max = G_MAXINT32; break;
+        case PLY_UIN32: case PLY_UINT:
+            min = 0; max = G_MAXUINT32; break;
+        default:
+            return 0;
+    }
+    if (use_strtod) ok = ply_parse_strtod(token, length, real, value);
+    else if (real) ok = ply_parse_double(token, length, value);
+    else ok = ply_parse_integer(token, length, value);
+    if (!ok) return 0;
+    return *value >= min && *value <= max;
+}
+
 static int ply_check_line(p_ply ply) {
     if (strlen(BLINE(ply)) >= LINESIZE) {
-        ply_error(ply, "Line too gint32");
+        ply_error(ply, "Line too long");
         return 0;
     }
     return 1;
@@ -941,10 +1601,13 @@ static int ply_read_chunk(p_ply ply, void *anybuffer, size_t size) {
     assert(ply->buffer_first <= ply->buffer_last);
     while (i < size) {
         if (ply->buffer_first < ply->buffer_last) {
-            buffer[i] = ply->buffer[ply->buffer_first];
-            ply->buffer_first++;
-            i++;
+            size_t n = BSIZE(ply);
+            if (n > size - i) n = size - i;
+            memcpy(buffer + i, BFIRST(ply), n);
+            BSKIP(ply, n);
+            i += n;
         } else {
+            if (ply->map) return 0;
             ply->buffer_first = 0;
             ply->buffer_last = fread(ply->buffer, 1, BUFFERSIZE, ply->fp);
             if (ply->buffer_last <= 0) return 0;
@@ -953,6 +1616,75 @@ static int ply_read_chunk(p_ply ply, void *anybuffer, size_t size) {
     return 1;
 }
 
+static int ply_map(p_ply ply) {
+#ifdef PLY_USE_MMAP
+    struct stat st;
+    char *map;
+    size_t size, page;
+    int fd = fileno(ply->fp);
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return 0;
+    size = (size_t) st.st_size;
+    /* reserve one more zeroed byte than the file size to act as the
+     * sentinel the str* functions need, then map the file over it. The
+     * mapping is private and writable as the tokenizer terminates words
+     * in place; only the pages written to end up being copied. */
+    map = mmap(NULL, size + 1, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return 0;
+    if (mmap(map, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                fd, 0) == MAP_FAILED) {
+        munmap(map, size + 1);
+        return 0;
+    }
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+    madvise(map, size, MADV_SEQUENTIAL);
+#endif
+    ply->map = map;
+    ply->map_size = size;
+    ply->buffer = map;
+    /* skip what was already read through the file pointer */
+    ply->buffer_first = ply->buffer_token = (size_t) ftell(ply->fp);
+    ply->buffer_last = size;
+    /* the pages are released from the first one after the header */
+    page = (size_t) sysconf(_SC_PAGESIZE);
+    ply->map_released = (ply->buffer_first + page - 1) / page * page;
+    return 1;
+#else
+    (void) ply;
+    return 0;
+#endif
+}
+
+static void ply_unmap(p_ply ply) {
+#ifdef PLY_USE_MMAP
+    if (!ply->map) return;
+    munmap(ply->map, ply->map_size + 1);
+    ply->map = NULL;
+    ply->buffer = ply->buffer_storage;
+#endif
+}
+
+/* gives back the pages of the mapping that have already been read so
+ * that only a window of a large file is resident at once. The values
+ * are never written to, so the pages are still those of the file and
+ * are read again if they are needed. */
+static void ply_release_map(p_ply ply) {
+#if defined(PLY_USE_MMAP) && defined(HAVE_MADVISE) && defined(MADV_DONTNEED)
+    size_t page, end;
+    if (!ply->map || ply->buffer != ply->map) return;
+    if (ply->buffer_first < ply->map_released + MAP_RELEASE_SIZE) return;
+    /* the page holding the current position is kept */
+    page = (size_t) sysconf(_SC_PAGESIZE);
+    end = ply->buffer_first / page * page;
+    madvise(ply->map + ply->map_released, end - ply->map_released,
+            MADV_DONTNEED);
+    ply->map_released = end;
+#else
+    (void) ply;
+#endif
+}
+
 static int ply_write_chunk(p_ply ply, void *anybuffer, size_t size) {
     char *buffer = (char *) anybuffer;
     size_t i = 0;
@@ -1007,8 +1739,13 @@ static void ply_init(p_ply ply) {
     ply->nobj_infos = 0;
     ply->idriver = NULL;
     ply->odriver = NULL;
+    ply->buffer = ply->buffer_storage;
     ply->buffer[0] = '\0';
     ply->buffer_first = ply->buffer_last = ply->buffer_token = 0;
+    ply->map = NULL;
+    ply->map_size = ply->map_released = 0;
+    ply->nthreads = 1;
+    ply->use_strtod = 0;
     ply->welement = 0;
     ply->wproperty = 0;
     ply->winstance_index = 0;
@@ -1021,6 +1758,9 @@ static void ply_element_init(p_ply_element element) {
     element->ninstances = 0;
     element->property = NULL;
     element->nproperties = 0;
+    element->read_block_cb = NULL;
+    element->block_pdata = NULL;
+    element->record_size = 0;
 }
 
 static void ply_property_init(p_ply_property property) {
@@ -1041,18 +1781,18 @@ static p_ply ply_alloc(void) {
 }
 
 static void *ply_grow_array(p_ply ply, void **pointer,
-        gint32 *nmemb, gint32 size) {
+        gint32 *nmemb, size_t size) {
     void *temp = *pointer;
     gint32 count = *nmemb + 1;
-    if (!temp) temp = malloc(count*size);
-    else temp = realloc(temp, count*size);
+    if (!temp) temp = malloc((size_t) count*size);
+    else temp = realloc(temp, (size_t) count*size);
     if (!temp) {
         ply_error(ply, "Out of memory");
         return NULL;
     }
     *pointer = temp;
     *nmemb = count;
-    return (char *) temp + (count-1) * size;
+    return (char *) temp + (size_t) (count-1) * size;
 }
 
 static p_ply_element ply_grow_element(p_ply ply) {
@@ -1145,7 +1885,7 @@ static int ply_read_header_property(p_ply ply) {
 
 static int ply_read_header_element(p_ply ply) {
     p_ply_element element = NULL;
-    gint32 dummy;
+    gint64 dummy;
     assert(ply && ply->fp && ply->io_mode == PLY_READ);
     if (strcmp(BWORD(ply), "element")) return 0;
     /* allocate room for new element */
@@ -1156,7 +1896,7 @@ static int ply_read_header_element(p_ply ply) {
     strcpy(element->name, BWORD(ply));
     /* get number of elements of this type */
     if (!ply_read_word(ply)) return 0;
-    if (sscanf(BWORD(ply), "%" G_GINT32_FORMAT, &dummy) != 1) {
+    if (sscanf(BWORD(ply), "%" G_GINT64_FORMAT, &dummy) != 1 || dummy < 0) {
         ply_error(ply, "Expected number got '%s'", BWORD(ply));
         return 0;
     }
@@ -1305,68 +2045,42 @@ static int obinary_float64(p_ply ply, double value) {
 /* ----------------------------------------------------------------------
  * Input  handlers
  * ---------------------------------------------------------------------- */
+static int iascii_value(p_ply ply, e_ply_type type, double *value) {
+    size_t length;
+    if (!ply_read_token(ply, &length)) return 0;
+    return ply_parse_value(type, BWORD(ply), length, ply->use_strtod, value);
+}
+
 static int iascii_int8(p_ply ply, double *value) {
-    char *end;
-    if (!ply_read_word(ply)) return 0;
-    *value = strtol(BWORD(ply), &end, 10);
-    if (*end || *value > CHAR_MAX || *value < CHAR_MIN) return 0;
-    return 1;
+    return iascii_value(ply, PLY_INT8, value);
 }
 
 static int iascii_uint8(p_ply ply, double *value) {
-    char *end;
-    if (!ply_read_word(ply)) return 0;
-    *value = strtol(BWORD(ply), &end, 10);
-    if (*end || *value > UCHAR_MAX || *value < 0) return 0;
-    return 1;
+    return iascii_value(ply, PLY_UINT8, value);
 }
 
 static int iascii_int16(p_ply ply, double *value) {
-    char *end;
-    if (!ply_read_word(ply)) return 0;
-    *value = strtol(BWORD(ply), &end, 10);
-    if (*end || *value > G_MAXINT16 || *value < G_MININT16) return 0;
-    return 1;
+    return iascii_value(ply, PLY_INT16, value);
 }
 
 static int iascii_uint16(p_ply ply, double *value) {
-    char *end;
-    if (!ply_read_word(ply)) return 0;
-    *value = strtol(BWORD(ply), &end, 10);
-    if (*end || *value > G_MAXUINT16 || *value < 0) return 0;
-    return 1;
+    return iascii_value(ply, PLY_UINT16, value);
 }
 
 static int iascii_int32(p_ply ply, double *value) {
-    char *end;
-    if (!ply_read_word(ply)) return 0;
-    *value = strtol(BWORD(ply), &end, 10);
-    if (*end || *value > G_MAXINT32 || *value < G_MININT32) return 0;
-    return 1;
+    return iascii_value(ply, PLY_INT32, value);
 }
 
 static int iascii_uint32(p_ply ply, double *value) {
-    char *end;
-    if (!ply_read_word(ply)) return 0;
-    *value = strtol(BWORD(ply), &end, 10);
-    if (*end || *value < 0) return 0;
-    return 1;
+    return iascii_value(ply, PLY_UIN32, value);
 }
 
 static int iascii_float32(p_ply ply, double *value) {
-    char *end;
-    if (!ply_read_word(ply)) return 0;
-    *value = g_ascii_strtod(BWORD(ply), &end);
-    if (*end || *value < -FLT_MAX || *value > FLT_MAX) return 0;
-    return 1;
+    return iascii_value(ply, PLY_FLOAT32, value);
 }
 
 static int iascii_float64(p_ply ply, double *value) {
-    char *end;
-    if (!ply_read_word(ply)) return 0;
-    *value = g_ascii_strtod(BWORD(ply), &end);
-    if (*end || *value < -DBL_MAX || *value > DBL_MAX) return 0;
-    return 1;
+    return iascii_value(ply, PLY_FLOAT64, value);
 }
 
 static int ibinary_int8(p_ply ply, double *value) {
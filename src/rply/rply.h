@@ -89,13 +89,79 @@ typedef int (*p_ply_read_cb)(p_ply_argument argument);
  * read_cb: function to be called for each property value
  * pdata/idata: user data that will be passed to callback
  *
- * Returns 0 if no element or no property in element, returns the
- * number of element instances otherwise.
+ * Returns -1 if no element or no property in element, returns the
+ * number of element instances otherwise, which can be 0.
  * ---------------------------------------------------------------------- */
-long ply_set_read_cb(p_ply ply, const char *element_name,
+gint64 ply_set_read_cb(p_ply ply, const char *element_name,
         const char *property_name, p_ply_read_cb read_cb,
         void *pdata, long idata);
 
+/* ----------------------------------------------------------------------
+ * Element block reading callback prototype
+ *
+ * element: element being processed
+ * records: ninstances consecutive records of the element, in native
+ *     byte order. The records are tightly packed so the values are not
+ *     necessarily aligned.
+ * first_instance: index of the first record in the element
+ * ninstances: number of records
+ * pdata: user data defined with ply_set_read_block_cb
+ *
+ * Returns 1 if should continue processing file, 0 if should abort.
+ * ---------------------------------------------------------------------- */
+typedef int (*p_ply_read_block_cb)(p_ply_element element,
+        const void *records, gint64 first_instance, gint64 ninstances,
+        void *pdata);
+
+/* ----------------------------------------------------------------------
+ * Sets up a callback reading all the instances of an element as raw
+ * records, bypassing the property callbacks. This is only possible for
+ * elements without list properties, in binary files or in mapped ascii
+ * files. The records of ascii files are transcoded from the text; when
+ * an instance isn't on its own line the property callbacks are used
+ * instead so they should be set up as well.
+ *
+ * ply: handle returned by ply_open
+ * element_name: element to read in blocks
+ * read_block_cb: function to be called for each block of records
+ * pdata: user data that will be passed to callback
+ *
+ * Returns the size in bytes of a record if the element can be read in
+ * blocks, 0 otherwise in which case the property callbacks are used.
+ * ---------------------------------------------------------------------- */
+long ply_set_read_block_cb(p_ply ply, const char *element_name,
+        p_ply_read_block_cb read_block_cb, void *pdata);
+
+/* ----------------------------------------------------------------------
+ * Sets the number of threads used to parse the elements of ascii files
+ *
+ * ply: handle returned by ply_open
+ * nthreads: number of threads, 0 to use one per processor
+ *
+ * Large elements of mapped ascii files with one instance per line are
+ * then parsed in parallel. The callbacks are still invoked in order from
+ * the thread calling ply_read. Values of float32 properties are passed
+ * rounded to float as they would be from a binary file. The default is
+ * to parse serially.
+ * ---------------------------------------------------------------------- */
+void ply_set_read_threads(p_ply ply, int nthreads);
+
+/* ----------------------------------------------------------------------
+ * Parses the numbers of ascii files with strtol and strtod
+ *
+ * ply: handle returned by ply_open
+ * use_strtod: 1 to use strtol and strtod, 0 for the default parsers
+ *
+ * This is slower and only meant to check and time the default parsers
+ * against the C library, which gives the same values.
+ * ---------------------------------------------------------------------- */
+void ply_set_read_strtod(p_ply ply, int use_strtod);
+
+/* ----------------------------------------------------------------------
+ * Returns the size in bytes of a scalar type in a binary file
+ * ---------------------------------------------------------------------- */
+int ply_get_type_size(e_ply_type type);
+
 /* ----------------------------------------------------------------------
  * Returns information about the element originating a callback
  *
@@ -107,7 +173,7 @@ long ply_set_read_cb(p_ply ply, const char *element_name,
  * Returns 1 if successfull, 0 otherwise
  * ---------------------------------------------------------------------- */
 int ply_get_argument_element(p_ply_argument argument,
-        p_ply_element *element, gint32 *instance_index);
+        p_ply_element *element, gint64 *instance_index);
 
 /* ----------------------------------------------------------------------
  * Returns information about the property originating a callback
@@ -120,7 +186,7 @@ int ply_get_argument_element(p_ply_argument argument,
  * Returns 1 if successfull, 0 otherwise
  * ---------------------------------------------------------------------- */
 int ply_get_argument_property(p_ply_argument argument,
-        p_ply_property *property, gint32 *length, gint32 *value_index);
+        p_ply_property *property, gint64 *length, gint64 *value_index);
 
 /* ----------------------------------------------------------------------
  * Returns user data associated with callback
@@ -195,7 +261,7 @@ const char *ply_get_next_obj_info(p_ply ply, const char *last);
  * Returns 1 if successfull or 0 otherwise
  * ---------------------------------------------------------------------- */
 int ply_get_element_info(p_ply_element element, const char** name,
-        gint32 *ninstances);
+        gint64 *ninstances);
 
 /* ----------------------------------------------------------------------
  * Iterates over all properties by returning the next property.
@@ -245,7 +311,7 @@ p_ply ply_create(const char *name, e_ply_storage_mode storage_mode,
  *
  * Returns 1 if successfull, 0 otherwise
  * ---------------------------------------------------------------------- */
-int ply_add_element(p_ply ply, const char *name, gint32 ninstances);
+int ply_add_element(p_ply ply, const char *name, gint64 ninstances);
 
 /* ----------------------------------------------------------------------
  * Adds a new property to the last element added by ply_add_element